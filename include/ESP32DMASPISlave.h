@@ -36,6 +36,7 @@ static constexpr int SPI_SLAVE_TASK_PRIORITY = 5;
 static QueueHandle_t s_trans_queue_handle{NULL};
 static constexpr int SEND_TRANS_QUEUE_TIMEOUT_TICKS = pdMS_TO_TICKS(5000);
 static constexpr int RECV_TRANS_QUEUE_TIMEOUT_TICKS = pdMS_TO_TICKS(5000);
+static constexpr int STREAM_REQUEUE_RETRY_TICKS = 1;
 static QueueHandle_t s_trans_result_handle{NULL};
 static constexpr int SEND_TRANS_RESULT_TIMEOUT_TICKS = pdMS_TO_TICKS(5000);
 static constexpr int RECV_TRANS_RESULT_TIMEOUT_TICKS = 0;
@@ -43,8 +44,18 @@ static QueueHandle_t s_trans_error_handle{NULL};
 static constexpr int SEND_TRANS_ERROR_TIMEOUT_TICKS = pdMS_TO_TICKS(5000);
 static constexpr int RECV_TRANS_ERROR_TIMEOUT_TICKS = 0;
 static QueueHandle_t s_in_flight_mailbox_handle{NULL};
-
-using spi_slave_user_cb_t = std::function<void(spi_slave_transaction_t *, void *)>;
+// given by the post transaction interrupt and by requests to the spi task while streaming
+static SemaphoreHandle_t s_stream_wake_handle{NULL};
+
+/// @brief user callback called from the spi interrupt, must be placed in IRAM (IRAM_ATTR)
+///        a plain function pointer keeps the dispatch to a single indirect call with no flash-resident wrapper
+using spi_slave_user_cb_t = void (*)(spi_slave_transaction_t *, void *);
+/// @brief fills in the buffers and length of a transaction to be armed, called from the spi task in streaming mode
+using spi_slave_refill_cb_t = void (*)(spi_slave_transaction_t *, void *);
+/// @brief holds the master off before armed transactions are dropped, or releases it once they are re-armed,
+///        called from the spi task
+/// @return false if the master may be clocking the loaded transaction, nothing is dropped until it completes
+using spi_slave_hold_cb_t = bool (*)(bool, void *);
 
 void spi_slave_post_setup_cb(spi_slave_transaction_t *trans);
 void spi_slave_post_trans_cb(spi_slave_transaction_t *trans);
@@ -80,6 +91,21 @@ struct spi_slave_context_t {
 	spi_host_device_t host{SPI2_HOST};
 	int dma_chan{SPI_DMA_CH_AUTO}; // must be 1, 2 or AUTO
 	TaskHandle_t main_task_handle{NULL};
+	// streaming mode: keep queue_size transactions armed in the driver at all times
+	spi_slave_refill_cb_t refill_cb{nullptr};
+	spi_slave_refill_cb_t drop_cb{nullptr};
+	spi_slave_hold_cb_t hold_cb{nullptr};
+	void *refill_arg{nullptr};
+	void *trans_user{nullptr};
+	spi_slave_transaction_t *stream_trans{nullptr};
+	bool *stream_armed{nullptr}; // stream_trans[i] is queued in the driver and its result not collected
+	volatile bool streaming{false};
+	volatile bool requeue{false};
+	// preallocated in initialize() so that no transfer allocates from the heap:
+	// two batches of queue_size transactions, one being built while the other is executed
+	spi_slave_transaction_t *trans_arena{nullptr};
+	// queue result of each transaction in the batch being executed
+	esp_err_t *queue_errs{nullptr};
 };
 
 struct spi_transaction_context_t {
@@ -114,6 +140,126 @@ void IRAM_ATTR spi_slave_post_trans_cb(spi_slave_transaction_t *trans)
 	if (user_ctx->post_trans.user_cb) {
 		user_ctx->post_trans.user_cb(trans, user_ctx->post_trans.user_arg);
 	}
+	// the result is queued when this returns, the spi task collects it once the interrupt exits
+	if (s_stream_wake_handle != NULL) {
+		BaseType_t higher_priority_task_woken = pdFALSE;
+		xSemaphoreGiveFromISR(s_stream_wake_handle, &higher_priority_task_woken);
+		if (higher_priority_task_woken == pdTRUE) {
+			portYIELD_FROM_ISR();
+		}
+	}
+}
+
+/// @brief arm a streaming transaction, the refill callback supplies its buffers and length
+/// @return true if the transaction was queued in the driver
+bool spi_slave_stream_arm(spi_slave_context_t *ctx, spi_slave_transaction_t *trans)
+{
+	memset(trans, 0, sizeof(spi_slave_transaction_t));
+	ctx->refill_cb(trans, ctx->refill_arg);
+	trans->trans_len = 0;
+	trans->user = ctx->trans_user;
+	esp_err_t err = spi_slave_queue_trans(ctx->host, trans, portMAX_DELAY);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "failed to arm streaming transaction: 0x%X", err);
+		return false;
+	}
+	return true;
+}
+
+/// @brief arm every streaming transaction that is not armed
+/// @return the number of transactions armed
+size_t spi_slave_stream_arm_all(spi_slave_context_t *ctx)
+{
+	size_t num_armed = 0;
+	for (int i = 0; i < ctx->if_cfg.queue_size; ++i) {
+		if (!ctx->stream_armed[i] && spi_slave_stream_arm(ctx, &ctx->stream_trans[i])) {
+			ctx->stream_armed[i] = true;
+			++num_armed;
+		}
+	}
+	return num_armed;
+}
+
+/// @brief collect the results of the completed streaming transactions
+/// @param rearm re-arm each transaction whose result was collected
+/// @return the number of results collected less the transactions re-armed
+size_t spi_slave_stream_collect(spi_slave_context_t *ctx, bool rearm)
+{
+	size_t num_done = 0;
+	spi_slave_transaction_t *rtrans;
+	while (spi_slave_get_trans_result(ctx->host, &rtrans, 0) == ESP_OK) {
+		bool *armed = &ctx->stream_armed[rtrans - ctx->stream_trans];
+		*armed = false;
+		++num_done;
+		// once streaming stops, let the armed transactions drain without replacing them
+		if (rearm && ctx->streaming && spi_slave_stream_arm(ctx, rtrans)) {
+			*armed = true;
+			--num_done;
+		}
+	}
+	return num_done;
+}
+
+/// @brief drop the armed transactions the master has not started and arm them again
+/// @return the number of transactions dropped less the transactions re-armed
+/// @note  the refill callback then sees data that became ready after the dropped
+///        transactions were armed. needs spi_slave_queue_reset(), from ESP-IDF 5.2.
+size_t spi_slave_stream_requeue(spi_slave_context_t *ctx)
+{
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 2, 0)
+	// transactions completed before the master was held off are not dropped
+	size_t num_done = spi_slave_stream_collect(ctx, false);
+	if (!ctx->hold_cb(true, ctx->refill_arg)) {
+		// the master is clocking the loaded transaction and was let go on,
+		// try again once its post-transaction interrupt wakes the spi task
+		ctx->requeue = true;
+		return num_done - spi_slave_stream_arm_all(ctx);
+	}
+	// the master may have just finished the loaded transaction
+	num_done += spi_slave_stream_collect(ctx, false);
+	esp_err_t err = spi_slave_queue_reset(ctx->host);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "failed to reset the transaction queue: 0x%X", err);
+		ctx->hold_cb(false, ctx->refill_arg);
+		return num_done - spi_slave_stream_arm_all(ctx);
+	}
+	for (int i = 0; i < ctx->if_cfg.queue_size; ++i) {
+		if (ctx->stream_armed[i]) {
+			ctx->stream_armed[i] = false;
+			ctx->drop_cb(&ctx->stream_trans[i], ctx->refill_arg);
+			++num_done;
+		}
+	}
+	if (ctx->streaming) {
+		num_done -= spi_slave_stream_arm_all(ctx);
+	}
+	ctx->hold_cb(false, ctx->refill_arg);
+	return num_done;
+#else
+	return 0;
+#endif
+}
+
+/// @brief streaming mode, re-arm each transaction as soon as its result is collected
+/// @return true if termination of the spi task was requested
+bool spi_slave_stream(spi_slave_context_t *ctx)
+{
+	ESP_LOGD(TAG, "streaming started, %d transactions armed", ctx->if_cfg.queue_size);
+	size_t num_armed = spi_slave_stream_arm_all(ctx);
+	while (num_armed > 0) {
+		// a requeue the master put off is tried again soon even if no transaction completes
+		xSemaphoreTake(s_stream_wake_handle, ctx->requeue ? STREAM_REQUEUE_RETRY_TICKS : RECV_TRANS_QUEUE_TIMEOUT_TICKS);
+		num_armed -= spi_slave_stream_collect(ctx, true);
+		if (ctx->requeue) {
+			ctx->requeue = false;
+			num_armed -= spi_slave_stream_requeue(ctx);
+		}
+		if (xTaskNotifyWait(0, 0, NULL, 0) == pdTRUE) {
+			return true;
+		}
+	}
+	ESP_LOGD(TAG, "streaming stopped");
+	return false;
 }
 
 void spi_slave_task(void *arg)
@@ -135,27 +281,38 @@ void spi_slave_task(void *arg)
 	assert(s_trans_error_handle != NULL);
 	s_in_flight_mailbox_handle = xQueueCreate(1, sizeof(size_t));
 	assert(s_in_flight_mailbox_handle != NULL);
+	s_stream_wake_handle = xSemaphoreCreateBinary();
+	assert(s_stream_wake_handle != NULL);
 
 	// spi task
 	while (true) {
 		spi_transaction_context_t trans_ctx;
+		if (ctx->streaming) {
+			if (spi_slave_stream(ctx)) {
+				break;
+			}
+			continue;
+		}
 		if (xQueueReceive(s_trans_queue_handle, &trans_ctx, RECV_TRANS_QUEUE_TIMEOUT_TICKS)) {
+			// an empty request only wakes the task, e.g. to enter streaming mode
+			if (trans_ctx.size == 0) {
+				continue;
+			}
 			// update in-flight count
 			assert(trans_ctx.trans != nullptr);
-			assert(trans_ctx.size <= ctx->if_cfg.queue_size);
+			assert(trans_ctx.size <= (size_t)ctx->if_cfg.queue_size);
 			xQueueOverwrite(s_in_flight_mailbox_handle, &trans_ctx.size);
 
 			// execute new transaction if transaction request received from main task
 			ESP_LOGD(TAG, "new transaction request received (size = %u)", trans_ctx.size);
-			std::vector<esp_err_t> errs;
-			errs.reserve(trans_ctx.size);
+			esp_err_t *errs = ctx->queue_errs;
 			for (size_t i = 0; i < trans_ctx.size; ++i) {
 				spi_slave_transaction_t *trans = &trans_ctx.trans[i];
 				esp_err_t err = spi_slave_queue_trans(ctx->host, trans, trans_ctx.timeout_ticks);
 				if (err != ESP_OK) {
 					ESP_LOGE(TAG, "failed to execute spi_slave_queue_trans(): 0x%X", err);
 				}
-				errs.push_back(err);
+				errs[i] = err;
 			}
 
 			// wait for the completion of all of the queued transactions
@@ -193,8 +350,7 @@ void spi_slave_task(void *arg)
 				xQueueOverwrite(s_in_flight_mailbox_handle, &num_rest_in_flight);
 			}
 
-			// should be deleted because the ownership is moved from main task
-			delete[] trans_ctx.trans;
+			// trans_ctx.trans points into the transaction arena, nothing to free
 
 			ESP_LOGD(TAG, "all requested transactions completed");
 		}
@@ -207,6 +363,8 @@ void spi_slave_task(void *arg)
 
 	ESP_LOGD(TAG, "terminate spi task as requested by the main task");
 
+	vSemaphoreDelete(s_stream_wake_handle);
+	s_stream_wake_handle = NULL;
 	vQueueDelete(s_in_flight_mailbox_handle);
 	vQueueDelete(s_trans_result_handle);
 	vQueueDelete(s_trans_error_handle);
@@ -223,7 +381,9 @@ void spi_slave_task(void *arg)
 class Slave
 {
 	spi_slave_context_t ctx;
-	std::vector<spi_slave_transaction_t> transactions;
+	size_t arena_batch{0};              // batch of the arena used by queue()
+	size_t num_queued{0};               // transactions queued in that batch
+	size_t *results{nullptr};           // received bytes ring used by transfer()
 	spi_slave_cb_user_context_t cb_user_ctx;
 	TaskHandle_t spi_task_handle{NULL};
 
@@ -313,6 +473,9 @@ public:
 			return;
 		}
 		xTaskNotifyGive(this->spi_task_handle);
+		if (this->ctx.streaming) {
+			xSemaphoreGive(s_stream_wake_handle);
+		}
 		if (xTaskNotifyWait(0, 0, NULL, pdMS_TO_TICKS(5000)) != pdTRUE) {
 			ESP_LOGW(TAG, "timeout waiting for the termination of spi_slave_task");
 		}
@@ -356,11 +519,11 @@ public:
 		if (!this->queue(flags, tx_buf, rx_buf, size)) {
 			return 0;
 		}
-		const auto results = this->wait(timeout_ms);
-		if (results.empty()) {
+		const size_t num_results = this->wait(this->results, this->ctx.if_cfg.queue_size, timeout_ms);
+		if (num_results == 0) {
 			return 0;
 		} else {
-			return results[results.size() - 1];
+			return this->results[num_results - 1];
 		}
 	}
 
@@ -373,14 +536,16 @@ public:
 	/// @note   If the size of queued transactions exceeds pre-defined queue_size,
 	///         automatically wait for the completion of transmission and results are stored in the background.
 	///         The results are cleared when the next transaction is queued.
-	bool queue(const uint8_t *tx_buf, uint8_t *rx_buf, size_t size)
+	bool IRAM_ATTR queue(const uint8_t *tx_buf, uint8_t *rx_buf, size_t size)
 	{
 		return this->queue(0, tx_buf, rx_buf, size);
 	}
 
 	void dequeue(void)
 	{
-		this->transactions.pop_back();
+		if (this->num_queued > 0) {
+			--this->num_queued;
+		}
 	}
 
 	/// @brief  queue transaction to internal transaction buffer.
@@ -393,13 +558,13 @@ public:
 	/// @note   If the size of queued transactions exceeds pre-defined queue_size,
 	///         automatically wait for the completion of transmission and results are stored in the background.
 	///         The results are cleared when the next transaction is queued.
-	bool queue(uint32_t flags, const uint8_t *tx_buf, uint8_t *rx_buf, size_t size)
+	bool IRAM_ATTR queue(uint32_t flags, const uint8_t *tx_buf, uint8_t *rx_buf, size_t size)
 	{
 		if (size % 4 != 0) {
 			ESP_LOGW(TAG, "failed to queue transaction: buffer size must be multiples of 4 bytes");
 			return false;
 		}
-		if (this->transactions.size() >= this->ctx.if_cfg.queue_size) {
+		if (this->num_queued >= (size_t)this->ctx.if_cfg.queue_size) {
 			ESP_LOGW(TAG, "failed to queue transaction: queue is full - only %u transactions can be queued at once",
 				this->ctx.if_cfg.queue_size);
 			return false;
@@ -412,13 +577,31 @@ public:
 	///        rx_buf is automatically updated after the completion of each transaction.
 	/// @param timeout_ms timeout in milliseconds
 	/// @return a vector of the received bytes for all transactions
+	/// @note  allocates the returned vector, use wait(results, max, timeout_ms) on hot paths
 	std::vector<size_t> wait(uint32_t timeout_ms = 0)
 	{
-		size_t num_will_be_queued = this->transactions.size();
+		size_t num_will_be_queued = this->num_queued;
 		if (!this->trigger(timeout_ms)) {
 			return std::vector<size_t>();
 		}
-		return this->waitTransaction(num_will_be_queued);
+		this->waitTransaction(num_will_be_queued);
+		return this->numBytesReceivedAll();
+	}
+
+	/// @brief execute queued transactions and wait for the completion without allocating.
+	///        rx_buf is automatically updated after the completion of each transaction.
+	/// @param results buffer that receives the received bytes of each transaction
+	/// @param max_results number of entries in results
+	/// @param timeout_ms timeout in milliseconds
+	/// @return the number of results written
+	size_t wait(size_t *results, size_t max_results, uint32_t timeout_ms = 0)
+	{
+		size_t num_will_be_queued = this->num_queued;
+		if (!this->trigger(timeout_ms)) {
+			return 0;
+		}
+		this->waitTransaction(num_will_be_queued);
+		return this->numBytesReceivedAll(results, max_results);
 	}
 
 	/// @brief execute queued transactions asynchronously in the background (without blocking)
@@ -426,42 +609,125 @@ public:
 	///        rx_buf is automatically updated after the completion of each transaction.
 	/// @param timeout_ms timeout in milliseconds
 	/// @return true if the transaction is queued successfully, false otherwise
-	bool trigger(uint32_t timeout_ms = 0)
+	/// @note  may be called from an interrupt handler, the request is then posted without waiting.
+	///        queue() and trigger() are placed in IRAM for that use.
+	bool IRAM_ATTR trigger(uint32_t timeout_ms = 0)
 	{
-		if (this->transactions.empty()) {
-			ESP_LOGW(TAG, "failed to trigger transaction: no transaction is queued");
+		const bool in_isr = xPortInIsrContext();
+		if (this->num_queued == 0) {
+			if (!in_isr) {
+				ESP_LOGW(TAG, "failed to trigger transaction: no transaction is queued");
+			}
 			return false;
 		}
 		if (this->numTransactionsInFlight() > 0) {
-			ESP_LOGW(TAG, "failed to trigger transaction: there are already in-flight transactions");
+			if (!in_isr) {
+				ESP_LOGW(TAG, "failed to trigger transaction: there are already in-flight transactions");
+			}
 			return false;
 		}
 
+		// the batch is handed to the spi task in place, the next batch is built in the other half of the arena
 		spi_transaction_context_t trans_ctx{
-			.trans = new spi_slave_transaction_t[this->transactions.size()],
-			.size = this->transactions.size(),
+			.trans = this->queuedTransactions(),
+			.size = this->num_queued,
 			.timeout_ticks = timeout_ms == 0 ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms),
 		};
-		for (size_t i = 0; i < this->transactions.size(); i++) {
-			trans_ctx.trans[i] = std::move(this->transactions[i]);
-		}
-		// NOTE: spi_transaction_ext_t should be delete inside of spi task after use
-		int ret = xQueueSend(s_trans_queue_handle, &trans_ctx, SEND_TRANS_QUEUE_TIMEOUT_TICKS);
-		// clearing transactions is safe because data was moved to trans_ctx
-		this->transactions.clear();
-		if (!ret) {
-			ESP_LOGE(TAG, "failed to queue transaction: transaction queue between main and spi task is full");
+		this->arena_batch ^= 1;
+		this->num_queued = 0;
+		BaseType_t ret;
+		if (in_isr) {
+			BaseType_t higher_priority_task_woken = pdFALSE;
+			ret = xQueueSendFromISR(s_trans_queue_handle, &trans_ctx, &higher_priority_task_woken);
+			if (higher_priority_task_woken == pdTRUE) {
+				portYIELD_FROM_ISR();
+			}
+		} else {
+			ret = xQueueSend(s_trans_queue_handle, &trans_ctx, SEND_TRANS_QUEUE_TIMEOUT_TICKS);
+		}
+		if (ret != pdTRUE) {
+			if (!in_isr) {
+				ESP_LOGE(TAG, "failed to queue transaction: transaction queue between main and spi task is full");
+			}
+			return false;
+		}
+		return true;
+	}
+
+	/// @brief keep queue_size transactions armed in the driver so that the master can clock
+	///        data as soon as it asserts SS. refill_cb is called from the spi task to fill in
+	///        the buffers and length of each transaction before it is armed.
+	/// @param refill_cb callback that fills in the next transaction
+	/// @param arg pointer to your own data that you want to pass to the callbacks
+	/// @param drop_cb callback given each armed transaction dropped by requeueStreaming()
+	/// @param hold_cb callback that holds the master off while requeueStreaming() drops transactions
+	/// @return true if streaming mode was started, false otherwise
+	/// @note  trigger() must not be used while streaming, the user callbacks are still called
+	bool startStreaming(spi_slave_refill_cb_t refill_cb, void *arg, spi_slave_refill_cb_t drop_cb = nullptr,
+		spi_slave_hold_cb_t hold_cb = nullptr)
+	{
+		if (this->ctx.streaming) {
+			return true;
+		}
+		this->ctx.refill_cb = refill_cb;
+		this->ctx.drop_cb = drop_cb;
+		this->ctx.hold_cb = hold_cb;
+		this->ctx.refill_arg = arg;
+		this->ctx.trans_user = &this->cb_user_ctx;
+		this->ctx.streaming = true;
+		// wake the spi task if it is waiting for a transaction request, a full queue
+		// means a request is already pending and that wakes it as well
+		spi_transaction_context_t wake_ctx{
+			.trans = nullptr,
+			.size = 0,
+			.timeout_ticks = 0,
+		};
+		xQueueSend(s_trans_queue_handle, &wake_ctx, 0);
+		return true;
+	}
+
+	/// @brief stop re-arming transactions. the transactions already armed stay in the driver
+	///        until the master clocks them.
+	void stopStreaming()
+	{
+		this->ctx.streaming = false;
+	}
+
+	/// @brief drop the armed transactions the master has not started and fill them in again,
+	///        e.g. to send data that became ready while only idle transactions were armed
+	/// @return true if the request was passed to the spi task, the transactions are dropped
+	///         later and only if hold_cb() holds the master off
+	/// @note  needs the drop and hold callbacks of startStreaming() and ESP-IDF 5.2 or later
+	bool requeueStreaming()
+	{
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 2, 0)
+		if (!this->ctx.streaming || this->ctx.drop_cb == nullptr || this->ctx.hold_cb == nullptr) {
 			return false;
 		}
+		this->ctx.requeue = true;
+		xSemaphoreGive(s_stream_wake_handle);
 		return true;
+#else
+		return false;
+#endif
+	}
+
+	/// @brief check if streaming mode is active
+	bool isStreaming() const
+	{
+		return this->ctx.streaming;
 	}
 
 	/// @brief return the number of in-flight transactions
 	/// @return the number of in-flight transactions
-	size_t numTransactionsInFlight()
+	size_t IRAM_ATTR numTransactionsInFlight()
 	{
 		size_t num_in_flight = 0;
-		xQueuePeek(s_in_flight_mailbox_handle, &num_in_flight, 0);
+		if (xPortInIsrContext()) {
+			xQueuePeekFromISR(s_in_flight_mailbox_handle, &num_in_flight);
+		} else {
+			xQueuePeek(s_in_flight_mailbox_handle, &num_in_flight, 0);
+		}
 		return num_in_flight;
 	}
 
@@ -510,6 +776,23 @@ public:
 		return results;
 	}
 
+	/// @brief copy the results of the completed transactions (received bytes) without allocating
+	/// @param results buffer that receives the results
+	/// @param max_results number of entries in results
+	/// @return the number of results written
+	/// @note this method pops front of the result queue, results beyond max_results stay queued
+	size_t numBytesReceivedAll(size_t *results, size_t max_results)
+	{
+		size_t num_results = this->numTransactionsCompleted();
+		if (num_results > max_results) {
+			num_results = max_results;
+		}
+		for (size_t i = 0; i < num_results; ++i) {
+			results[i] = this->numBytesReceived();
+		}
+		return num_results;
+	}
+
 	/// @brief return the oldest error of the completed transaction
 	/// @return the oldest error of the completed transaction
 	/// @note this method pops front of the error queue
@@ -541,6 +824,23 @@ public:
 		return errs;
 	}
 
+	/// @brief copy the errors of the completed transactions without allocating
+	/// @param errs buffer that receives the errors
+	/// @param max_errs number of entries in errs
+	/// @return the number of errors written
+	/// @note this method pops front of the error queue, errors beyond max_errs stay queued
+	size_t errors(esp_err_t *errs, size_t max_errs)
+	{
+		size_t num_errs = this->numTransactionErrors();
+		if (num_errs > max_errs) {
+			num_errs = max_errs;
+		}
+		for (size_t i = 0; i < num_errs; ++i) {
+			errs[i] = this->error();
+		}
+		return num_errs;
+	}
+
 	/// @brief check if the queued transactions are completed and all results are handled
 	/// @return true if the queued transactions are completed and all results are handled, false otherwise
 	bool hasTransactionsCompletedAndAllResultsHandled()
@@ -632,8 +932,8 @@ public:
 	///        see more details about callbacks at https://docs.espressif.com/projects/esp-idf/en/latest/esp32/api-reference/peripherals/spi_master.html#_CPPv4N29spi_device_interface_config_t6pre_cbE
 	/// @param cb  callback that is called when pre callbacks are called
 	/// @param arg pointer to your own data that you want to pass to the callbak
-	/// @note      post_setup callbacks will be called within the interrupt context
-	void setUserPostSetupCbAndArg(const spi_slave_user_cb_t &cb, void *arg)
+	/// @note      post_setup callbacks will be called within the interrupt context, cb must be IRAM_ATTR
+	void setUserPostSetupCbAndArg(spi_slave_user_cb_t cb, void *arg)
 	{
 		this->cb_user_ctx.post_setup.user_cb = cb;
 		this->cb_user_ctx.post_setup.user_arg = arg;
@@ -644,8 +944,8 @@ public:
 	///        see more details about callbacks at https://docs.espressif.com/projects/esp-idf/en/latest/esp32/api-reference/peripherals/spi_master.html#_CPPv4N29spi_device_interface_config_t6pre_cbE
 	/// @param cb  callback that is called when pre/post callbacks are called
 	/// @param arg pointer to your own data that you want to pass to the callbak
-	/// @note      post_trans callbacks will be called within the interrupt context
-	void setUserPostTransCbAndArg(const spi_slave_user_cb_t &cb, void *arg)
+	/// @note      post_trans callbacks will be called within the interrupt context, cb must be IRAM_ATTR
+	void setUserPostTransCbAndArg(spi_slave_user_cb_t cb, void *arg)
 	{
 		this->cb_user_ctx.post_trans.user_cb = cb;
 		this->cb_user_ctx.post_trans.user_arg = arg;
@@ -681,7 +981,18 @@ private:
 		this->ctx.host = this->hostFromBusNumber(spi_bus);
 		this->ctx.bus_cfg.flags |= SPICOMMON_BUSFLAG_SLAVE;
 		this->ctx.main_task_handle = xTaskGetCurrentTaskHandle();
-		this->transactions.reserve(this->ctx.if_cfg.queue_size);
+
+		// everything a transfer needs is allocated once here, sized from the queue size
+		if (this->ctx.trans_arena == nullptr) {
+			const size_t queue_size = this->ctx.if_cfg.queue_size;
+			this->ctx.trans_arena = new spi_slave_transaction_t[2 * queue_size];
+			this->ctx.stream_trans = new spi_slave_transaction_t[queue_size];
+			this->ctx.stream_armed = new bool[queue_size]();
+			this->ctx.queue_errs = new esp_err_t[queue_size];
+			this->results = new size_t[queue_size];
+		}
+		this->arena_batch = 0;
+		this->num_queued = 0;
 
 		// create spi slave task
 		std::string task_name = std::string("spi_slave_task_") + std::to_string(this->ctx.if_cfg.spics_io_num);
@@ -695,7 +1006,8 @@ private:
 		return true;
 	}
 
-	spi_slave_transaction_t generateTransaction(uint32_t flags, size_t size, const uint8_t *tx_buf, uint8_t *rx_buf)
+	spi_slave_transaction_t IRAM_ATTR generateTransaction(
+		uint32_t flags, size_t size, const uint8_t *tx_buf, uint8_t *rx_buf)
 	{
 		spi_slave_transaction_t trans;
 
@@ -709,19 +1021,22 @@ private:
 		return trans;
 	}
 
-	void queueTransaction(uint32_t flags, size_t size, const uint8_t *tx_buf, uint8_t *rx_buf)
+	spi_slave_transaction_t *IRAM_ATTR queuedTransactions()
+	{
+		return &this->ctx.trans_arena[this->arena_batch * this->ctx.if_cfg.queue_size];
+	}
+
+	void IRAM_ATTR queueTransaction(uint32_t flags, size_t size, const uint8_t *tx_buf, uint8_t *rx_buf)
 	{
-		spi_slave_transaction_t trans = generateTransaction(flags, size, tx_buf, rx_buf);
-		this->transactions.push_back(std::move(trans));
+		this->queuedTransactions()[this->num_queued++] = generateTransaction(flags, size, tx_buf, rx_buf);
 	}
 
-	std::vector<size_t> waitTransaction(size_t num_will_be_queued)
+	void waitTransaction(size_t num_will_be_queued)
 	{
 		// transactions inside of spi task will be timeout if failed in the background
 		while (!this->hasTransactionsCompletedAndAllResultsReady(num_will_be_queued)) {
 			vTaskDelay(1);
 		}
-		return this->numBytesReceivedAll();
 	}
 };
 
@@ -16,17 +16,54 @@
 
 constexpr uint8_t ATTN = 9; // GPIO pin for ctxLink ATTN input
 
+constexpr size_t SPI_FRAME_SIZE = 2000; // Largest SPI transaction, should be multiple of 4
+
+/**
+ * @brief Most frames handed to the SPI driver at once, ctxLink clocks them back to back
+ *
+ * Two keep the link busy, one being clocked and the next armed behind it.
+ * More would only take packets out of the output queue before they can be
+ * batched. Without LINK_CAP_CREDIT only one frame is handed over at a time.
+ */
+constexpr size_t SPI_TX_WINDOW_MAX = 2;
+
 // TODO Remove these and any supporting code, not available on PCB v2.1
 constexpr uint8_t PINA = 3; // Test Pin
 constexpr uint8_t PINB = 4; // Test Pin
 constexpr uint8_t PINC = 5; // Test Pin
 
+/**
+ * @brief SPI link statistics
+ *
+ */
+typedef struct {
+	uint32_t transactions;        // SPI transactions completed
+	uint32_t duplex_transactions; // Transactions that carried a packet in both directions
+	uint32_t empty_transactions;  // Transactions that carried no packet either way
+	uint32_t tx_requeues;         // Idle pre-armed transactions dropped to send a frame saved behind them
+	uint32_t tx_frames;           // Frames sent to ctxLink
+	uint32_t tx_notifications;    // Transaction completed packets sent to the SPI task for a full window
+	uint32_t tx_window_max;       // Most frames waiting in the SPI driver at once
+	uint32_t rx_packets;          // Packets received from ctxLink
+	uint32_t rx_dropped;          // Received packets dropped for lack of a buffer or queue space
+	uint32_t rx_truncated;        // Variable-length frames that ended before the advertised length
+	uint32_t ss_setup_samples;    // SS edges seen while the link was running
+	uint32_t ss_setup_prearmed;   // SS edges that found a transaction already armed
+	uint32_t ss_setup_total_us;   // Sum of the SS edge to post-setup callback latencies
+	uint32_t ss_setup_max_us;     // Largest SS edge to post-setup callback latency
+} spi_link_stats_t;
+
 extern bool system_setup_done;
 
 void initCtxLink(void);
 void control_esp32_ready(bool ready);
-void spi_save_tx_transaction_buffer(uint8_t *transaction_buffer);
-void spi_create_pending_transaction(uint8_t *tx_buffer, uint8_t *rx_buffer, bool isTx);
+void spi_save_tx_transaction_buffer(uint8_t *frame, size_t frame_length);
+bool spi_tx_ready(void);
+void spi_set_tx_window(size_t frames);
+void spi_create_pending_transaction(uint8_t *tx_buffer, uint8_t *rx_buffer, size_t length);
+void spi_get_link_stats(spi_link_stats_t *stats);
+void spi_enable_prearmed_transactions(void);
+void spi_disable_prearmed_transactions(void);
 
 void ctxlink_toggle_nReady(void);
 #endif // CTXLINK_H
\ No newline at end of file
@@ -8,9 +8,9 @@ void dumpBuffers(const char *title, const uint8_t *buf, size_t start, size_t len
 {
 	// show title and range
 	if (len == 1)
-		printf("%s [%d]: ", title, start);
+		printf("%s [%u]: ", title, (unsigned)start);
 	else
-		printf("%s [%d-%d]: ", title, start, start + len - 1);
+		printf("%s [%u-%u]: ", title, (unsigned)start, (unsigned)(start + len - 1));
 
 	// show data in the range
 	for (size_t i = 0; i < len; i++) {
@@ -25,7 +25,7 @@ bool verifyAndDumpDifference(
 	bool verified = true;
 
 	if (a_size != b_size) {
-		printf("received data size does not match: expected = %d / actual = %d\n", a_size, b_size);
+		printf("received data size does not match: expected = %u / actual = %u\n", (unsigned)a_size, (unsigned)b_size);
 		return false;
 	}
 
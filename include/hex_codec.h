@@ -0,0 +1,42 @@
+/**
+ * @file hex_codec.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Conversion of GDB memory data between hex and binary
+ * @version 0.1
+ * @date 2025-09-24
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * GDB sends and expects memory contents as two hex digits per byte. Once
+ * LINK_CAP_BINARY_MEMORY has been negotiated the data of M requests and of
+ * the replies to m requests crosses the SPI link in binary, half the size,
+ * and the ESP32 converts it for the TCP side.
+ *
+ * Both directions work in place: the data may share its buffer with the
+ * hex digits, starting at the same address.
+ */
+
+#ifndef HEX_CODEC_H
+#define HEX_CODEC_H
+
+#include <Arduino.h>
+
+/**
+ * @brief Throughput of the codec, measured by hex_codec_benchmark()
+ *
+ * The reference is the digit at a time conversion the codec replaces.
+ */
+typedef struct {
+	size_t length;                   // Bytes of binary data in each conversion
+	uint32_t iterations;             // Conversions timed in each direction
+	uint32_t encode_kib_s;           // Binary bytes encoded per second, in KiB
+	uint32_t decode_kib_s;           // Binary bytes decoded per second, in KiB
+	uint32_t reference_encode_kib_s; // Encoded per second by the reference, in KiB
+	uint32_t reference_decode_kib_s; // Decoded per second by the reference, in KiB
+} hex_codec_benchmark_t;
+
+void hex_encode(uint8_t *hex, const uint8_t *data, size_t length);
+bool hex_decode(uint8_t *data, const uint8_t *hex, size_t length);
+bool hex_codec_benchmark(size_t length, uint32_t iterations, hex_codec_benchmark_t *result);
+
+#endif // HEX_CODEC_H
@@ -0,0 +1,200 @@
+/**
+ * @file link_control.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief ESP32 <-> ctxLink SPI link capability negotiation
+ * @version 0.1
+ * @date 2025-09-04
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * Optional link features are negotiated with a link control packet. The
+ * ESP32 offers the features it supports with a HELLO, ctxLink replies with
+ * a WELCOME listing the subset it accepts. Older ctxLink firmware ignores
+ * the unknown packet type and never replies, so the link stays in the
+ * original fixed-length mode.
+ */
+
+#ifndef LINK_CONTROL_H
+#define LINK_CONTROL_H
+
+#include <Arduino.h>
+
+#include "protocol.h"
+
+/**
+ * @brief Layout of the protocol packet header on the SPI link
+ *
+ * magic1, magic2, packet type, data length (high byte), data length (low byte)
+ */
+constexpr size_t SPI_PACKET_HEADER_SIZE = 5;
+constexpr size_t SPI_PACKET_HEADER_LENGTH_HI = 3;
+constexpr size_t SPI_PACKET_HEADER_LENGTH_LO = 4;
+
+/**
+ * @brief Packet types used for link control packets
+ *
+ * Chosen from the top of the type range to stay clear of protocol.h. As with
+ * the GDB packets, each direction has its own type so the SPI task can tell
+ * packets to be sent from packets received.
+ */
+constexpr uint8_t LINK_PACKET_TYPE_CONTROL_TO_CTXLINK = 0xF0;
+constexpr uint8_t LINK_PACKET_TYPE_CONTROL_FROM_CTXLINK = 0xF1;
+constexpr uint8_t LINK_PACKET_TYPE_FRAGMENT_TO_CTXLINK = 0xF2;
+constexpr uint8_t LINK_PACKET_TYPE_FRAGMENT_FROM_CTXLINK = 0xF3;
+constexpr uint8_t LINK_PACKET_TYPE_GDB_INTERRUPT = 0xF4;    // ESP32 -> ctxLink, GDB interrupt with LINK_CAP_RSP_OFFLOAD
+constexpr uint8_t LINK_PACKET_TYPE_GDB_MEMORY_WRITE = 0xF5; // ESP32 -> ctxLink, M request with binary data
+constexpr uint8_t LINK_PACKET_TYPE_GDB_MEMORY_DATA = 0xF6;  // ctxLink -> ESP32, reply to an m request in binary
+
+/**
+ * @brief Link control commands
+ *
+ */
+typedef enum : uint8_t {
+	LINK_CONTROL_HELLO = 0x01,          // ESP32 -> ctxLink, offer capabilities
+	LINK_CONTROL_WELCOME = 0x02,        // ctxLink -> ESP32, accepted capabilities
+	LINK_CONTROL_RESET = 0x03,          // ctxLink -> ESP32, ctxLink restarted, renegotiate
+	LINK_CONTROL_TARGET_CHANGED = 0x04, // ctxLink -> ESP32, the target changed, empty the RSP cache
+	LINK_CONTROL_CREDIT = 0x05,         // ctxLink -> ESP32, more frames may be sent, with LINK_CAP_CREDIT
+} link_control_command_e;
+
+/**
+ * @brief Link capability flags
+ *
+ * LINK_CAP_VARIABLE_LENGTH - ctxLink reads the packet header first and only clocks the
+ *                            advertised frame length, rounded up to a multiple of 4 bytes.
+ *                            The ESP32 ends the transaction when SS is deasserted.
+ * LINK_CAP_BATCHING        - A frame sent to ctxLink may carry several packets back to back,
+ *                            ctxLink splits them with protocol_split(). The frame ends at the
+ *                            first header without the magic bytes, the ESP32 always sends one.
+ * LINK_CAP_DUPLEX          - Every transaction carries data both ways. The ESP32 sends its
+ *                            pending frame, if any, and receives into a fresh buffer whichever
+ *                            end started the exchange. A side with nothing to send clocks zeros.
+ *                            The ESP32 then keeps transactions armed ahead of SS, nSPI_READY
+ *                            is already asserted when ctxLink pulls SS low.
+ * LINK_CAP_SEGMENTATION    - A packet too large for one frame is split into fragment packets,
+ *                            each sent in its own frame, see link_segment.h. Either end may
+ *                            send fragments, the receiver rebuilds the original packet.
+ * LINK_CAP_RSP_OFFLOAD     - The ESP32 terminates the GDB RSP ack layer, see rsp_framer.h. A GDB
+ *                            packet crosses the link as its payload only, the data between '$'
+ *                            and '#', one RSP packet per protocol packet in both directions.
+ *                            The ESP32 verifies and strips the checksums of GDB's packets and
+ *                            adds them to ctxLink's replies. No acks cross the link, ctxLink
+ *                            never waits for one, and a GDB interrupt is sent as a
+ *                            LINK_PACKET_TYPE_GDB_INTERRUPT packet.
+ * LINK_CAP_BINARY_MEMORY   - Memory contents cross the link in binary rather than as hex digits,
+ *                            only used with LINK_CAP_RSP_OFFLOAD. An M request is sent as a
+ *                            LINK_PACKET_TYPE_GDB_MEMORY_WRITE packet, "Maddr,length:" and then
+ *                            the data. ctxLink answers an m request with the data read in a
+ *                            LINK_PACKET_TYPE_GDB_MEMORY_DATA packet, an error reply is sent as
+ *                            before. The ESP32 converts the data, see hex_codec.h.
+ * LINK_CAP_RSP_CACHE       - The ESP32 answers repeats of the static GDB queries from its cache,
+ *                            only used with LINK_CAP_RSP_OFFLOAD, see rsp_cache.h. ctxLink
+ *                            sends LINK_CONTROL_TARGET_CHANGED whenever it attaches to or
+ *                            detaches from a target, or anything else changes its answers.
+ * LINK_CAP_CREDIT          - ctxLink grants the ESP32 credit for the frames it can accept. The
+ *                            WELCOME carries the initial credit, the frames ctxLink can hold
+ *                            before it has processed any. The ESP32 sends up to that many frames
+ *                            back to back, each uses a credit, and ATTN stays asserted while any
+ *                            wait. ctxLink returns credit for the frames it has processed with
+ *                            LINK_CONTROL_CREDIT packets, in band with its other packets, as
+ *                            often as it likes. Credit never exceeds the initial credit.
+ * LINK_CAP_SWO_STATISTICS  - ctxLink accepts the SWO statistics report, see swo_stream.h. It is
+ *                            sent about once a second while SWO data flows and when the SWO
+ *                            client disconnects. Without it ctxLink only sees the plain SWO
+ *                            client status packets.
+ */
+#define LINK_CAP_VARIABLE_LENGTH (1u << 0)
+#define LINK_CAP_BATCHING        (1u << 1)
+#define LINK_CAP_DUPLEX          (1u << 2)
+#define LINK_CAP_SEGMENTATION    (1u << 3)
+#define LINK_CAP_RSP_OFFLOAD     (1u << 4)
+#define LINK_CAP_BINARY_MEMORY   (1u << 5)
+#define LINK_CAP_RSP_CACHE       (1u << 6)
+#define LINK_CAP_CREDIT          (1u << 7)
+#define LINK_CAP_SWO_STATISTICS  (1u << 8)
+
+/**
+ * @brief The capabilities offered by this firmware
+ *
+ */
+#define LINK_CAP_SUPPORTED                                                                    \
+	(LINK_CAP_VARIABLE_LENGTH | LINK_CAP_BATCHING | LINK_CAP_DUPLEX | LINK_CAP_SEGMENTATION | \
+		LINK_CAP_RSP_OFFLOAD | LINK_CAP_BINARY_MEMORY | LINK_CAP_RSP_CACHE | LINK_CAP_CREDIT |  \
+		LINK_CAP_SWO_STATISTICS)
+
+/**
+ * @brief Version of the link control packet layout
+ *
+ * Version 2 added frame_credits.
+ */
+constexpr uint8_t LINK_CONTROL_VERSION = 2;
+
+/**
+ * @brief Link control packet payload
+ *
+ */
+typedef struct __attribute__((packed)) {
+	uint8_t command;         // link_control_command_e
+	uint8_t version;         // LINK_CONTROL_VERSION of the sender
+	uint32_t capabilities;   // Offered (HELLO) or accepted (WELCOME) capabilities
+	uint16_t max_frame_size; // Largest SPI frame the sender can receive
+	uint16_t frame_credits;  // Initial credit (WELCOME) or credit returned (CREDIT), in frames
+} link_control_packet_s;
+
+/**
+ * @brief Frame credit statistics, with LINK_CAP_CREDIT
+ *
+ */
+typedef struct {
+	uint32_t window;   // Initial credit granted in the WELCOME, 0 without LINK_CAP_CREDIT
+	uint32_t credits;  // Frames that may be sent now
+	uint32_t returned; // Credit returned by ctxLink since start up
+	uint32_t grants;   // LINK_CONTROL_CREDIT packets received
+	uint32_t stalls;   // Times frames waited for credit
+} link_credit_stats_t;
+
+/**
+ * @brief Get the length of the protocol packet at the start of a frame
+ *
+ * @param frame Pointer to the frame
+ * @return size_t Header plus data length, 0 if the frame does not start with a packet
+ *
+ * Usable from the SPI interrupt handlers.
+ */
+static inline size_t IRAM_ATTR link_packet_length(const uint8_t *frame)
+{
+	if (frame[0] != PROTOCOL_MAGIC1 || frame[1] != PROTOCOL_MAGIC2) {
+		return 0;
+	}
+	return SPI_PACKET_HEADER_SIZE +
+		(((size_t)frame[SPI_PACKET_HEADER_LENGTH_HI] << 8) | frame[SPI_PACKET_HEADER_LENGTH_LO]);
+}
+
+/**
+ * @brief The capabilities agreed with ctxLink, 0 until a WELCOME is received
+ *
+ */
+extern volatile uint32_t link_negotiated_capabilities;
+
+void link_control_send_hello(void);
+void link_control_process(const uint8_t *packet_data, size_t data_length);
+uint32_t link_control_capabilities(void);
+uint16_t link_control_peer_max_frame_size(void);
+size_t link_control_frame_limit(void);
+size_t link_control_max_packet_data(void);
+bool link_control_tx_credit_available(void);
+void link_control_tx_credit_used(void);
+void link_control_get_credit_stats(link_credit_stats_t *stats);
+
+/**
+ * @brief Check if a capability has been negotiated with ctxLink
+ *
+ * @param capability One of the LINK_CAP_* flags
+ * @return true if both ends agreed to use the capability
+ */
+static inline bool IRAM_ATTR link_control_has(uint32_t capability)
+{
+	return (link_negotiated_capabilities & capability) != 0;
+}
+
+#endif // LINK_CONTROL_H
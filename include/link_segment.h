@@ -0,0 +1,62 @@
+/**
+ * @file link_segment.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Segmentation and reassembly of packets larger than an SPI frame
+ * @version 0.1
+ * @date 2025-09-15
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * Once LINK_CAP_SEGMENTATION has been negotiated a packet that does not fit
+ * one SPI frame is sent as a series of fragment packets. Each fragment
+ * starts with a link_fragment_header_s followed by the next part of the
+ * original packet's data. The fragments of a message are sent in order
+ * and the receiver rebuilds the original packet in a pool buffer before it
+ * is routed as usual.
+ *
+ * Only the SPI task uses this module.
+ */
+
+#ifndef LINK_SEGMENT_H
+#define LINK_SEGMENT_H
+
+#include <Arduino.h>
+
+/**
+ * @brief Set in the flags of the final fragment of a message
+ *
+ */
+#define LINK_FRAGMENT_LAST (1u << 0)
+
+/**
+ * @brief Fragment header, at the start of a fragment packet's data
+ *
+ */
+typedef struct __attribute__((packed)) {
+	uint8_t type;    // Packet type of the original packet
+	uint8_t message; // Message number, the same in every fragment of a message
+	uint8_t index;   // Fragment number within the message, from 0
+	uint8_t flags;   // LINK_FRAGMENT_LAST on the final fragment
+} link_fragment_header_s;
+
+/**
+ * @brief Segmentation statistics
+ *
+ */
+typedef struct {
+	uint32_t messages_segmented;    // Packets sent as fragments
+	uint32_t fragments_sent;        // Fragment packets sent
+	uint32_t fragment_buffer_waits; // Times the next fragment had to wait for a pool buffer
+	uint32_t messages_reassembled;  // Packets rebuilt from received fragments
+	uint32_t fragments_received;    // Fragment packets received
+	uint32_t reassembly_errors;     // Messages dropped, fragment missing, out of order or too long
+} link_segment_stats_t;
+
+void link_segment_tx_start(uint8_t *packet);
+bool link_segment_tx_pending(void);
+uint8_t *link_segment_tx_next(size_t frame_limit, size_t *fragment_length);
+uint8_t *link_segment_rx_fragment(uint8_t *fragment);
+void link_segment_reset(void);
+void link_segment_get_stats(link_segment_stats_t *stats);
+
+#endif // LINK_SEGMENT_H
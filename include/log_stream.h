@@ -0,0 +1,58 @@
+/**
+ * @file log_stream.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Monitor output streamed to a client of the log port
+ * @version 0.1
+ * @date 2025-10-01
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * Units in the field have no USB host attached. The monitor task writes
+ * everything it outputs to a backlog ring, whether or not a client is
+ * connected, and the network task streams it to the client of the log
+ * port. A client that connects late is first sent the backlog, so it sees
+ * the recent history. When the client falls behind the oldest output is
+ * overwritten and counted, the monitor task never waits for it.
+ *
+ * Lines sent by the client are log commands, see log_command().
+ */
+
+#ifndef LOG_STREAM_H
+#define LOG_STREAM_H
+
+#include <Arduino.h>
+
+#include "tasks/task_server.h"
+
+/**
+ * @brief Size of the backlog ring, in PSRAM when the module has it, otherwise in internal RAM
+ *
+ */
+#define LOG_STREAM_BACKLOG_SIZE_PSRAM    (64 * 1024)
+#define LOG_STREAM_BACKLOG_SIZE_INTERNAL (8 * 1024)
+
+/**
+ * @brief Largest send() to the client
+ *
+ */
+#define LOG_STREAM_SEND_SIZE 1024
+
+/**
+ * @brief Log stream statistics since start up
+ *
+ */
+typedef struct {
+	size_t backlog_size;    // Size of the backlog ring, 0 if none could be allocated
+	uint32_t sessions;      // Clients that connected
+	uint64_t bytes_written; // Output written to the ring
+	uint64_t bytes_sent;    // Output sent to clients
+	uint32_t bytes_lost;    // Output overwritten before the client was sent it
+} log_stream_stats_t;
+
+bool log_stream_init(void);
+void log_stream_write(const char *data, size_t length);
+void log_stream_get_stats(log_stream_stats_t *stats);
+
+extern const server_stream_t log_stream_server;
+
+#endif // LOG_STREAM_H
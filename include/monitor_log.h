@@ -0,0 +1,161 @@
+/**
+ * @file monitor_log.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Binary records for the monitor output, formatted later by the monitor task
+ * @version 0.1
+ * @date 2025-09-29
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * The LOG macros do not format their message where they are called. They
+ * record the address of the format string, which is a literal in flash and
+ * so identifies the message, followed by the raw arguments. The monitor task
+ * formats the record when it is output. Building a record is a few stores
+ * per argument, cheap enough for the SPI callbacks and the hot paths.
+ *
+ * Each argument is one tag byte followed by its value:
+ *
+ *   MONITOR_LOG_ARG_INT32   4 bytes, every integer of up to 32 bits, bool and enums
+ *   MONITOR_LOG_ARG_INT64   8 bytes
+ *   MONITOR_LOG_ARG_DOUBLE  8 bytes, float is promoted as it is for printf
+ *   MONITOR_LOG_ARG_POINTER 8 bytes, pointers other than strings
+ *   MONITOR_LOG_ARG_STRING  1 length byte and the characters, without the terminator
+ *
+ * Strings are copied when the record is built, the caller's buffer may be
+ * gone by the time it is formatted. A string longer than
+ * MONITOR_LOG_STRING_MAX is cut and ends in "...", so a shortened message
+ * can always be recognised.
+ */
+
+#ifndef MONITOR_LOG_H
+#define MONITOR_LOG_H
+
+#include <Arduino.h>
+#include <type_traits>
+
+/**
+ * @brief Longest string argument copied into a record
+ *
+ */
+#define MONITOR_LOG_STRING_MAX 128
+
+/**
+ * @brief Record flags
+ *
+ */
+#define MONITOR_LOG_NEWLINE 0x01 // Follow the message with "\r\n"
+
+/**
+ * @brief Argument tags
+ *
+ */
+typedef enum : uint8_t {
+	MONITOR_LOG_ARG_INT32 = 1,
+	MONITOR_LOG_ARG_INT64,
+	MONITOR_LOG_ARG_DOUBLE,
+	MONITOR_LOG_ARG_POINTER,
+	MONITOR_LOG_ARG_STRING,
+} monitor_log_arg_e;
+
+/**
+ * @brief The start of every record, the arguments follow it
+ *
+ */
+typedef struct {
+	const char *format; // The format string
+	uint16_t length;    // Length of the record including this header
+	uint8_t flags;      // MONITOR_LOG_NEWLINE
+	uint8_t arg_count;  // Arguments following the header
+} monitor_log_header_t;
+
+void monitor_log_submit(const uint8_t *record, size_t length);
+
+/**
+ * @brief Most bytes an argument of type T can take in a record
+ *
+ */
+template <typename T> static constexpr size_t monitor_log_arg_max(void)
+{
+	if constexpr (std::is_pointer<T>::value &&
+		std::is_same<typename std::remove_cv<typename std::remove_pointer<T>::type>::type, char>::value) {
+		return 2 + MONITOR_LOG_STRING_MAX;
+	} else if constexpr (std::is_pointer<T>::value || std::is_floating_point<T>::value || sizeof(T) > 4) {
+		return 1 + 8;
+	} else {
+		return 1 + 4;
+	}
+}
+
+static inline __attribute__((always_inline)) uint8_t *monitor_log_put_value(uint8_t *out, uint8_t tag,
+	const void *value, size_t size)
+{
+	*out++ = tag;
+	memcpy(out, value, size);
+	return out + size;
+}
+
+/**
+ * @brief Append one argument to a record
+ *
+ * @param out   Where to put the argument
+ * @param value The argument
+ * @return uint8_t* The end of the argument
+ */
+template <typename T> static inline __attribute__((always_inline)) uint8_t *monitor_log_put(uint8_t *out, T value)
+{
+	if constexpr (std::is_pointer<T>::value &&
+		std::is_same<typename std::remove_cv<typename std::remove_pointer<T>::type>::type, char>::value) {
+		const char *text = value != NULL ? value : "(null)";
+		uint8_t *characters = out + 2;
+		size_t length = 0;
+		while (length < MONITOR_LOG_STRING_MAX && text[length] != '\0') {
+			characters[length] = (uint8_t)text[length];
+			length++;
+		}
+		if (text[length] != '\0') {
+			memcpy(characters + MONITOR_LOG_STRING_MAX - 3, "...", 3);
+		}
+		out[0] = MONITOR_LOG_ARG_STRING;
+		out[1] = (uint8_t)length;
+		return characters + length;
+	} else if constexpr (std::is_pointer<T>::value) {
+		uint64_t address = (uintptr_t)value;
+		return monitor_log_put_value(out, MONITOR_LOG_ARG_POINTER, &address, 8);
+	} else if constexpr (std::is_floating_point<T>::value) {
+		double number = (double)value;
+		return monitor_log_put_value(out, MONITOR_LOG_ARG_DOUBLE, &number, 8);
+	} else {
+		static_assert(std::is_integral<T>::value || std::is_enum<T>::value, "Log argument type not supported");
+		if constexpr (sizeof(T) > 4) {
+			uint64_t number = (uint64_t)value;
+			return monitor_log_put_value(out, MONITOR_LOG_ARG_INT64, &number, 8);
+		} else {
+			uint32_t number = (uint32_t)value;
+			return monitor_log_put_value(out, MONITOR_LOG_ARG_INT32, &number, 4);
+		}
+	}
+}
+
+/**
+ * @brief Build a record on the stack and pass it to the monitor task
+ *
+ * @param flags  Record flags
+ * @param format The format string, must be a literal
+ * @param args   The arguments of the format
+ */
+template <typename... Args>
+static inline __attribute__((always_inline)) void monitor_log(uint8_t flags, const char *format, Args... args)
+{
+	uint8_t record[sizeof(monitor_log_header_t) + (0 + ... + monitor_log_arg_max<Args>())];
+	uint8_t *out = record + sizeof(monitor_log_header_t);
+	((out = monitor_log_put(out, args)), ...);
+	monitor_log_header_t header;
+	header.format = format;
+	header.length = (uint16_t)(out - record);
+	header.flags = flags;
+	header.arg_count = (uint8_t)sizeof...(Args);
+	memcpy(record, &header, sizeof(header));
+	monitor_log_submit(record, header.length);
+}
+
+#endif // MONITOR_LOG_H
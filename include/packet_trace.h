@@ -0,0 +1,102 @@
+/**
+ * @file packet_trace.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Cycle counter timestamps of the packets at each hop of the data path
+ * @version 0.1
+ * @date 2025-10-03
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * A capture records an event each time a packet passes a hop: the client
+ * read and the forward to the SPI task in the network task, the frame handed
+ * to the SPI driver, the transaction callback for each direction, the route
+ * to a server and the send to the client. An event is the CPU cycle count of
+ * the core it happened on, the hop, the core, the length and the pool buffer
+ * that carries the packet, so a packet can be followed as long as it stays in
+ * the same buffer.
+ *
+ * Recording takes a slot with one atomic add and is safe from any task or
+ * interrupt on either core. The capture stops when the buffer is full. A
+ * client of the trace port stops the capture and is sent it as Chrome
+ * trace-event JSON, to be loaded into Perfetto or chrome://tracing:
+ *
+ *   nc <address> 2163 > trace.json
+ *
+ * The cycle counters of the two cores are not synchronized. Each core
+ * pairs its counter with esp_timer_get_time() at its first event and the
+ * events are placed on that time base. Events on one core more than 2^31
+ * cycles apart, about 9 s at 240 MHz, cannot be placed, keep captures short.
+ */
+
+#ifndef PACKET_TRACE_H
+#define PACKET_TRACE_H
+
+#include <Arduino.h>
+
+#include "tasks/task_server.h"
+
+/**
+ * @brief Events held by a capture, the buffer is allocated by the first capture
+ *
+ */
+#define PACKET_TRACE_EVENTS 2048
+
+/**
+ * @brief Largest send() of the JSON to the client
+ *
+ */
+#define PACKET_TRACE_SEND_SIZE 1024
+
+/**
+ * @brief The hops of the data path
+ *
+ */
+typedef enum : uint8_t {
+	PACKET_TRACE_CLIENT_READ,    // Network task, data read from a client socket
+	PACKET_TRACE_CLIENT_FORWARD, // Network task, a packet queued to the SPI task
+	PACKET_TRACE_SPI_FRAME,      // SPI task, a frame handed to the SPI driver
+	PACKET_TRACE_SPI_SENT,       // Transaction callback, the frame was clocked out to ctxLink
+	PACKET_TRACE_SPI_RECEIVED,   // Transaction callback, a packet was received from ctxLink
+	PACKET_TRACE_SERVER_QUEUED,  // SPI task, a packet queued to a server
+	PACKET_TRACE_CLIENT_SENT,    // Network task, a packet was sent to the client in full
+	PACKET_TRACE_EVENT_COUNT,
+} packet_trace_event_e;
+
+/**
+ * @brief Capture statistics
+ *
+ */
+typedef struct {
+	bool running;      // A capture is being recorded
+	uint32_t recorded; // Events in the capture
+	uint32_t capacity; // Events the buffer holds, 0 before the first capture
+	uint32_t missed;   // Events not recorded because the buffer was full
+	uint32_t exports;  // Captures sent to trace port clients
+} packet_trace_stats_t;
+
+extern volatile bool packet_trace_running;
+
+void packet_trace_record_event(packet_trace_event_e event, const uint8_t *buffer, size_t length);
+
+/**
+ * @brief Record a packet passing a hop while a capture runs
+ *
+ * @param event  The hop
+ * @param buffer The buffer holding the packet
+ * @param length Length of the data
+ */
+static inline __attribute__((always_inline)) void packet_trace(
+	packet_trace_event_e event, const uint8_t *buffer, size_t length)
+{
+	if (packet_trace_running) {
+		packet_trace_record_event(event, buffer, length);
+	}
+}
+
+bool packet_trace_start(void);
+void packet_trace_stop(void);
+void packet_trace_get_stats(packet_trace_stats_t *stats);
+
+extern const server_stream_t packet_trace_server;
+
+#endif // PACKET_TRACE_H
@@ -0,0 +1,36 @@
+/**
+ * @file psram_alloc.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Allocation of large buffers in PSRAM when the module has it
+ * @version 0.1
+ * @date 2025-10-06
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ */
+
+#ifndef PSRAM_ALLOC_H
+#define PSRAM_ALLOC_H
+
+#include <Arduino.h>
+
+/**
+ * @brief Allocate a buffer in PSRAM, or a smaller one in internal RAM
+ *
+ * @param size          Set to the size allocated, 0 if neither could be
+ * @param psram_size    Size of the buffer in PSRAM
+ * @param internal_size Size of the buffer in internal RAM, without PSRAM
+ * @return void* The buffer, NULL if there was no memory
+ */
+static inline void *psram_alloc(size_t *size, size_t psram_size, size_t internal_size)
+{
+	void *buffer = heap_caps_malloc(psram_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	*size = psram_size;
+	if (buffer == NULL) {
+		buffer = heap_caps_malloc(internal_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+		*size = buffer != NULL ? internal_size : 0;
+	}
+	return buffer;
+}
+
+#endif // PSRAM_ALLOC_H
@@ -0,0 +1,67 @@
+/**
+ * @file rsp_cache.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Cache of ctxLink's replies to the static GDB queries
+ * @version 0.1
+ * @date 2025-09-26
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * Every time GDB attaches it asks again for qSupported, the target
+ * description and the memory map, often in many small qXfer chunks. The
+ * answers only change when ctxLink attaches to another target. Once
+ * LINK_CAP_RSP_CACHE has been negotiated the ESP32 keeps ctxLink's replies
+ * to these queries and answers repeats of exactly the same request from
+ * RAM, without crossing the SPI link. ctxLink sends LINK_CONTROL_TARGET_CHANGED
+ * whenever the answers may have changed and the cache is emptied.
+ *
+ * Requests and replies are matched in order, GDB waits for the reply to
+ * each request before it sends the next one.
+ */
+
+#ifndef RSP_CACHE_H
+#define RSP_CACHE_H
+
+#include <Arduino.h>
+
+/**
+ * @brief Size of the store for the cached requests and replies, in PSRAM when the module has it
+ *
+ */
+#define RSP_CACHE_SIZE_PSRAM    (64 * 1024)
+#define RSP_CACHE_SIZE_INTERNAL (16 * 1024)
+
+/**
+ * @brief Most replies cached
+ *
+ */
+#define RSP_CACHE_ENTRIES 48
+
+/**
+ * @brief Longest request cached, room for the feature list GDB sends with qSupported
+ *
+ */
+#define RSP_CACHE_REQUEST_MAX 256
+
+/**
+ * @brief Cache statistics since start up
+ *
+ */
+typedef struct {
+	size_t store_size;      // Size of the store, 0 if none could be allocated
+	size_t store_used;      // Bytes of the store holding requests and replies
+	uint32_t entries;       // Replies cached
+	uint32_t hits;          // Requests answered from the cache
+	uint32_t misses;        // Cacheable requests forwarded to ctxLink
+	uint32_t full;          // Replies not cached because the store was full
+	uint32_t invalidations; // Times the cache was emptied because the target changed
+} rsp_cache_stats_t;
+
+bool rsp_cache_init(void);
+const uint8_t *rsp_cache_request(const uint8_t *request, size_t request_length, size_t *reply_length);
+void rsp_cache_reply(const uint8_t *reply, size_t reply_length);
+void rsp_cache_cancel(void);
+void rsp_cache_invalidate(void);
+void rsp_cache_get_stats(rsp_cache_stats_t *stats);
+
+#endif // RSP_CACHE_H
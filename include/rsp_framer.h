@@ -0,0 +1,135 @@
+/**
+ * @file rsp_framer.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Framing of GDB client input into whole RSP packets
+ * @version 0.1
+ * @date 2025-09-22
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * A read of the GDB client socket returns whatever TCP delivered, often
+ * part of a $...#xx packet. The framer holds back the incomplete packet at
+ * the end of a read until the rest arrives, so every packet forwarded to
+ * ctxLink carries whole RSP packets, acks and NAKs. A Ctrl-C between
+ * packets is taken out of the stream and reported so that it can be sent
+ * ahead of everything else.
+ *
+ * Once LINK_CAP_RSP_OFFLOAD has been negotiated the framer also terminates
+ * the RSP ack layer. Each packet from GDB is unwrapped, its checksum is
+ * verified and only the payload is forwarded. The ESP32 acks the packet
+ * itself, or NAKs it so that GDB sends it again, and drops GDB's acks. The
+ * payloads from ctxLink are wrapped again with '$', '#' and the checksum.
+ * The last packet sent to GDB is kept until GDB switches to no-ack mode,
+ * a NAK from GDB resends it without involving ctxLink.
+ *
+ * Only the network task uses a framer.
+ */
+
+#ifndef RSP_FRAMER_H
+#define RSP_FRAMER_H
+
+#include <Arduino.h>
+
+#include "link_control.h"
+#include "spi_buffer_pool.h"
+
+/**
+ * @brief The GDB interrupt request, sent outside of any packet
+ *
+ */
+constexpr uint8_t RSP_INTERRUPT = 0x03;
+
+/**
+ * @brief Largest incomplete packet held back, the most data one forwarded packet carries
+ *
+ */
+constexpr size_t RSP_FRAMER_HOLD_SIZE = SPI_BUFFER_SIZE - SPI_PACKET_HEADER_SIZE;
+
+/**
+ * @brief Largest payload ctxLink may send with LINK_CAP_RSP_OFFLOAD
+ *
+ * The payload is wrapped in its pool buffer, the '$' replaces the last
+ * header byte and "#xx" follows the payload.
+ */
+constexpr size_t RSP_OFFLOAD_MAX_PAYLOAD = SPI_BUFFER_SIZE - SPI_PACKET_HEADER_SIZE - 3;
+
+/**
+ * @brief Where the framer is within the RSP stream
+ *
+ */
+typedef enum {
+	RSP_FRAMER_BETWEEN_PACKETS = 0, // Expecting '$', an ack or an interrupt
+	RSP_FRAMER_PACKET_DATA,         // Between '$' and '#'
+	RSP_FRAMER_PACKET_ESCAPE,       // After a '}', the next byte is data whatever it is
+	RSP_FRAMER_CHECKSUM_HIGH,       // After the '#'
+	RSP_FRAMER_CHECKSUM_LOW,        // After the first checksum digit
+} rsp_framer_state_e;
+
+/**
+ * @brief A unit of the RSP stream found by rsp_framer_unwrap()
+ *
+ */
+typedef enum {
+	RSP_UNIT_NONE = 0,     // No whole unit left in the data
+	RSP_UNIT_PACKET,       // A packet with a good checksum, its payload is returned
+	RSP_UNIT_BAD_CHECKSUM, // A packet with a bad checksum, to be sent again by GDB
+	RSP_UNIT_OVERSIZE,     // A packet too long to be held, dropped
+	RSP_UNIT_ACK,          // '+' from GDB
+	RSP_UNIT_NAK,          // '-' from GDB, the last packet sent must be sent again
+	RSP_UNIT_INTERRUPT,    // Ctrl-C
+} rsp_unit_e;
+
+/**
+ * @brief Framing statistics
+ *
+ */
+typedef struct {
+	uint32_t reads;           // Socket reads framed
+	uint32_t packets_sent;    // Packets forwarded to ctxLink
+	uint32_t rsp_packets;     // Whole $...#xx packets forwarded
+	uint32_t held_reads;      // Reads that completed nothing and were held back in full
+	uint32_t interrupts;      // Interrupts taken out of the stream to be sent ahead of it
+	uint32_t oversize_passes; // Packets too long to hold, forwarded in parts
+	uint32_t acks_sent;       // Acks sent to GDB by the ESP32 with LINK_CAP_RSP_OFFLOAD
+	uint32_t acks_received;   // Acks from GDB that went no further than the ESP32
+	uint32_t checksum_errors; // Packets from GDB with a bad checksum, NAKed without involving ctxLink
+	uint32_t retransmits;     // Packets sent to GDB again after a NAK
+	uint32_t dropped;         // Packets that could not be unwrapped or wrapped, too long or no buffer
+	uint32_t deferred;        // Times whole units were held back until the SPI path had room for them
+	uint32_t binary_reads;    // Replies to m requests received in binary with LINK_CAP_BINARY_MEMORY
+	uint32_t binary_writes;   // M requests forwarded in binary
+	uint32_t binary_bytes;    // Memory bytes moved in binary, each saved a byte on the link
+} rsp_framer_stats_t;
+
+/**
+ * @brief Framer of one client connection
+ *
+ */
+typedef struct {
+	rsp_framer_state_e state;                        // State at the end of the data framed so far
+	size_t hold_length;                              // Bytes of an incomplete packet held back
+	bool hold_deferred;                              // The held bytes are whole units deferred, not an incomplete packet
+	uint8_t hold[RSP_FRAMER_HOLD_SIZE];              // The incomplete packet, forwarded once its end arrives
+	size_t packet_start;                             // Offset of the '$' of the packet being unwrapped
+	uint8_t checksum;                                // Sum of the data of the packet being unwrapped
+	int checksum_received;                           // Checksum digits received, -1 if not hex
+	bool discarding;                                 // The packet being unwrapped is too long and is dropped
+	bool no_ack;                                     // GDB has switched to no-ack mode
+	bool no_ack_requested;                           // QStartNoAckMode forwarded, an OK reply starts no-ack mode
+	size_t retransmit_length;                        // Length of the last packet sent to GDB, 0 if none is kept
+	uint8_t retransmit[RSP_OFFLOAD_MAX_PAYLOAD + 4]; // The last packet sent to GDB
+	rsp_framer_stats_t stats;                        // Statistics since start up
+} rsp_framer_t;
+
+void rsp_framer_reset(rsp_framer_t *framer);
+size_t rsp_framer_restore(rsp_framer_t *framer, uint8_t *data, size_t max_length);
+size_t rsp_framer_frame(rsp_framer_t *framer, uint8_t *data, size_t *length, size_t max_length, bool *interrupt);
+rsp_unit_e rsp_framer_unwrap(
+	rsp_framer_t *framer, uint8_t *data, size_t length, size_t *offset, uint8_t **payload, size_t *payload_length);
+void rsp_framer_unwrap_done(rsp_framer_t *framer, const uint8_t *data, size_t length, size_t max_length);
+void rsp_framer_unwrap_defer(rsp_framer_t *framer, const uint8_t *data, size_t length, size_t unit_start);
+uint8_t *rsp_framer_wrap(rsp_framer_t *framer, uint8_t *message, size_t *length);
+const uint8_t *rsp_framer_retransmit(rsp_framer_t *framer, size_t *length);
+void rsp_framer_get_stats(const rsp_framer_t *framer, rsp_framer_stats_t *stats);
+
+#endif // RSP_FRAMER_H
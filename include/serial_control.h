@@ -11,14 +11,18 @@
 
 #pragma once
 
-#include "tasks/task_monitor.h"
+#include "monitor_log.h"
 
 /**
   * @brief Macro to control Serialx.print
   * 
   * Comment the following line to turn off all serial output
+  *
+  * The host simulator runs without monitor output, it would distort the timing.
   */
+#ifndef CTXLINK_HOST_SIM
 #define SERIAL_ON
+#endif
 
 /**
   * @brief The following macros enable/disable serial output
@@ -39,53 +43,98 @@
 #endif
 
 /**
-  * @brief Experimental macro to be used for message task and queuing
-  *
-  */
+ * @brief Log levels, a message is kept when its level is at or below the level of its module
+ *
+ */
+#define LOG_LEVEL_NONE    0
+#define LOG_LEVEL_ERROR   1
+#define LOG_LEVEL_WARN    2
+#define LOG_LEVEL_INFO    3
+#define LOG_LEVEL_DEBUG   4
+#define LOG_LEVEL_VERBOSE 5
 
-#ifdef SERIAL_ON
-#define generic_send(msg)                                                             \
-	do {                                                                              \
-		if (xPortInIsrContext()) {                                                    \
-			BaseType_t xHigherPriorityTaskWoken = pdFALSE;                            \
-			xQueueSendFromISR(task_monitor_queue, &(msg), &xHigherPriorityTaskWoken); \
-			if (xHigherPriorityTaskWoken) {                                           \
-				portYIELD_FROM_ISR();                                                 \
-			}                                                                         \
-		} else {                                                                      \
-			xQueueSend(task_monitor_queue, &(msg), portMAX_DELAY);                    \
-		}                                                                             \
-	} while (0)
+/**
+ * @brief Level compiled in for each module, set with -D in build_flags
+ *
+ * Messages above the level of their module are discarded at compile time,
+ * they leave neither code nor their format string in the image. A release
+ * build keeps the warnings with -D LOG_LEVEL_DEFAULT=LOG_LEVEL_WARN.
+ */
+#ifndef LOG_LEVEL_DEFAULT
+#define LOG_LEVEL_DEFAULT LOG_LEVEL_INFO
+#endif
+#ifndef LOG_LEVEL_SPI
+#define LOG_LEVEL_SPI LOG_LEVEL_DEFAULT // SPI link to ctxLink, link control and the SPI task
+#endif
+#ifndef LOG_LEVEL_NET
+#define LOG_LEVEL_NET LOG_LEVEL_DEFAULT // Network task, its servers and clients
+#endif
+#ifndef LOG_LEVEL_WIFI
+#define LOG_LEVEL_WIFI LOG_LEVEL_DEFAULT // Wi-Fi task
+#endif
+#ifndef LOG_LEVEL_PREFS
+#define LOG_LEVEL_PREFS LOG_LEVEL_DEFAULT // Stored preferences
+#endif
 
-#define MON(TEXT)                                                  \
-	do {                                                           \
-		monitor_output_message_t msg = {0};                        \
-		strncpy(msg.message, TEXT, MONITOR_OUTPUT_MAX_LENGTH - 1); \
-		generic_send(msg);                                         \
-	} while (0)
+/**
+ * @brief Level each module starts at, it can be changed at run time up to the level compiled in
+ *
+ * Build with a module at LOG_LEVEL_DEBUG and -D LOG_LEVEL_RUNTIME=LOG_LEVEL_INFO
+ * to have the debug messages available without them running all the time.
+ */
+#ifndef LOG_LEVEL_RUNTIME
+#define LOG_LEVEL_RUNTIME LOG_LEVEL_VERBOSE
+#endif
 
-#define MON_NL(TEXT)                                         \
-	do {                                                     \
-		monitor_output_message_t msg = {0};                  \
-		size_t len = strlen(TEXT);                           \
-		if (len > MONITOR_OUTPUT_MAX_LENGTH - 3) {           \
-			len = MONITOR_OUTPUT_MAX_LENGTH - 3;             \
-		}                                                    \
-		memcpy(msg.message, TEXT, len);                      \
-		msg.message[len] = '\r';                             \
-		msg.message[len + 1] = '\n';                         \
-		/* msg.message[len + 2] is already '\0' from init */ \
-		generic_send(msg);                                   \
-	} while (0)
+typedef enum : uint8_t {
+	LOG_MODULE_SPI,
+	LOG_MODULE_NET,
+	LOG_MODULE_WIFI,
+	LOG_MODULE_PREFS,
+	LOG_MODULE_COUNT,
+} log_module_e;
 
-#define MON_PRINTF(FORMAT, ...)                                          \
-	do {                                                                 \
-		monitor_output_message_t msg = {0};                              \
-		snprintf(msg.message, sizeof(msg.message), FORMAT, __VA_ARGS__); \
-		generic_send(msg);                                               \
+/**
+ * @brief Send a message to the monitor task for output
+ *
+ * @param MODULE One of SPI, NET, WIFI or PREFS
+ * @param FORMAT printf style format, must be a string literal, the line end is added
+ *
+ * The message is not formatted here, the format and the arguments are
+ * recorded and the monitor task formats them, see monitor_log.h. The
+ * arguments are still checked against the format at compile time. Safe to
+ * use in an ISR.
+ */
+#ifdef SERIAL_ON
+extern uint8_t log_levels[LOG_MODULE_COUNT];
+
+/**
+ * @brief Never called, it lets the compiler check the arguments against the format
+ *
+ */
+static inline __attribute__((format(printf, 1, 2))) void log_format_check(const char *format, ...)
+{
+}
+
+#define LOG_AT(MODULE, LEVEL, FORMAT, ...)                                     \
+	do {                                                                       \
+		if constexpr ((LEVEL) <= LOG_LEVEL_##MODULE) {                         \
+			if (false) {                                                       \
+				log_format_check("" FORMAT "", ##__VA_ARGS__);                 \
+			}                                                                  \
+			if ((LEVEL) <= log_levels[LOG_MODULE_##MODULE]) {                  \
+				monitor_log(MONITOR_LOG_NEWLINE, "" FORMAT "", ##__VA_ARGS__); \
+			}                                                                  \
+		}                                                                      \
 	} while (0)
 #else
-#define MON(TEXT)
-#define MON_NL(TEXT)
-#define MON_PRINTF(FORMAT, ...)
-#endif // SERIAL_ON
\ No newline at end of file
+#define LOG_AT(MODULE, LEVEL, FORMAT, ...)
+#endif // SERIAL_ON
+
+#define LOG_ERROR(MODULE, ...)   LOG_AT(MODULE, LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(MODULE, ...)    LOG_AT(MODULE, LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(MODULE, ...)    LOG_AT(MODULE, LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(MODULE, ...)   LOG_AT(MODULE, LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_VERBOSE(MODULE, ...) LOG_AT(MODULE, LOG_LEVEL_VERBOSE, __VA_ARGS__)
+
+#include "tasks/task_monitor.h"
@@ -0,0 +1,92 @@
+/**
+ * @file spi_buffer_pool.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Ownership tracked pool of SPI packet buffers
+ * @version 0.1
+ * @date 2025-09-02
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * Every packet that moves between the network tasks, the SPI task and the
+ * SPI driver lives in one of these buffers. A buffer is acquired by the task
+ * that fills it and released by whichever stage consumes it last, so a slot
+ * can never be handed out again while it is still queued or owned by DMA.
+ */
+
+#ifndef SPI_BUFFER_POOL_H
+#define SPI_BUFFER_POOL_H
+
+#include <Arduino.h>
+
+/**
+ * @brief Define the size of each buffer in the pool
+ *
+ */
+#define SPI_BUFFER_SIZE 2048
+
+/**
+ * @brief Define the number of buffers in the pool
+ *
+ * May be overridden from the build flags, use the high-water mark
+ * reported by spi_buffer_pool_report() to size it.
+ */
+#ifndef SPI_BUFFER_COUNT
+#define SPI_BUFFER_COUNT 16
+#endif
+
+/**
+ * @brief The stage of the data path that currently owns a buffer
+ *
+ */
+typedef enum {
+	SPI_BUFFER_OWNER_NONE = 0,   // Buffer is in the free list
+	SPI_BUFFER_OWNER_CLIENT,     // Client task, network input or client state
+	SPI_BUFFER_OWNER_SERVER,     // Server task, waiting to be sent to the client
+	SPI_BUFFER_OWNER_SPI_COMMS,  // SPI communications task
+	SPI_BUFFER_OWNER_SPI_DRIVER, // SPI driver, queued for or in a DMA transaction
+	SPI_BUFFER_OWNER_WIFI,       // Wi-Fi task
+	SPI_BUFFER_OWNER_COUNT,
+} spi_buffer_owner_e;
+
+/**
+ * @brief The life-cycle state of a buffer
+ *
+ */
+typedef enum {
+	SPI_BUFFER_STATE_FREE = 0,  // In the free list
+	SPI_BUFFER_STATE_FILLING,   // Acquired, the owner is filling it
+	SPI_BUFFER_STATE_QUEUED,    // Waiting in a queue for the owner to process it
+	SPI_BUFFER_STATE_IN_FLIGHT, // Loaded into an SPI DMA transaction
+} spi_buffer_state_e;
+
+/**
+ * @brief Snapshot of the pool usage statistics
+ *
+ */
+typedef struct {
+	size_t free_count;       // Buffers currently in the free list
+	size_t in_use_count;     // Buffers currently owned by a stage
+	size_t high_water_mark;  // Largest in_use_count seen since boot
+	uint32_t acquire_fails;  // Acquire requests that timed out or found the pool empty
+	uint32_t release_errors; // Release of a buffer that was already free
+} spi_buffer_pool_stats_t;
+
+void spi_buffer_pool_init(void);
+
+uint8_t *spi_buffer_acquire(spi_buffer_owner_e owner, TickType_t wait_ticks);
+uint8_t *spi_buffer_acquire_from_isr(spi_buffer_owner_e owner);
+void spi_buffer_release(uint8_t *buffer);
+void spi_buffer_release_from_isr(uint8_t *buffer);
+void spi_buffer_tag(uint8_t *buffer, spi_buffer_owner_e owner, spi_buffer_state_e state);
+
+bool spi_buffer_is_pool_buffer(const uint8_t *buffer);
+spi_buffer_owner_e spi_buffer_owner(const uint8_t *buffer);
+spi_buffer_state_e spi_buffer_state(const uint8_t *buffer);
+
+size_t spi_buffer_free_count(void);
+size_t spi_buffer_in_use_count(void);
+size_t spi_buffer_high_water_mark(void);
+void spi_buffer_pool_get_stats(spi_buffer_pool_stats_t *stats);
+void spi_buffer_pool_report(void);
+
+#endif // SPI_BUFFER_POOL_H
@@ -0,0 +1,86 @@
+/**
+ * @file stream_ring.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Byte ring and client sender shared by the stream servers
+ * @version 0.1
+ * @date 2025-10-06
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * A stream_ring_t holds the data of a stream between the task that writes
+ * it and the network task. It keeps the newest data, the reader's position
+ * is a count of the bytes ever written and is moved on past data that was
+ * overwritten before it was read.
+ *
+ * A stream_sender_t sends a stream to its client for a server_stream_t. It
+ * wakes the server with a static SERVER_PACKET_TYPE_STREAM_READY packet, as
+ * the SPI driver does with the transaction completed packet, one wake-up
+ * queued at a time. The client socket is non-blocking, data the socket did
+ * not take stays in the send buffer until the socket is writable again.
+ */
+
+#ifndef STREAM_RING_H
+#define STREAM_RING_H
+
+#include <Arduino.h>
+
+/**
+ * @brief A byte ring with one writer and one reader
+ *
+ * The lock protects everything else, the writer and the reader hold it
+ * around the ring calls and their own counters, only for a memcpy.
+ */
+typedef struct {
+	uint8_t *data;          // The ring, NULL if none could be allocated
+	size_t size;            // Size of the ring
+	uint64_t written;       // Bytes ever written, the newest is at (written - 1) % size
+	uint64_t read_position; // Next byte to read, never more than size behind written
+	SemaphoreHandle_t lock; // Held around the ring calls
+} stream_ring_t;
+
+bool stream_ring_init(stream_ring_t *ring, size_t psram_size, size_t internal_size);
+size_t stream_ring_write(stream_ring_t *ring, const void *data, size_t length);
+size_t stream_ring_read(stream_ring_t *ring, void *data, size_t max_length);
+
+/**
+ * @brief Bytes written and not yet read, call with the lock held
+ *
+ */
+static inline size_t stream_ring_waiting(const stream_ring_t *ring)
+{
+	return (size_t)(ring->written - ring->read_position);
+}
+
+/**
+ * @brief Sends a stream to the client of its server
+ *
+ * Only the network task calls the sender, apart from stream_sender_signal()
+ * which the writer of the stream calls too.
+ */
+typedef struct {
+	size_t (*fill)(uint8_t *buffer, size_t size); // Take the next data to send, 0 if none is waiting
+	bool (*waiting)(void);                        // More data is waiting once a budget was sent
+	uint8_t *buffer;                              // Data taken from the stream, offset to length is still to be sent
+	size_t buffer_size;                           // Size of the send buffer, the largest send()
+	size_t budget;                                // Bytes sent per call so that the other servers are not starved
+	size_t offset;
+	size_t length;
+	QueueHandle_t queue;                          // The server queue while a client is connected, NULL otherwise
+	volatile bool signalled;                      // A wake-up is queued to the server
+} stream_sender_t;
+
+void stream_sender_start(stream_sender_t *sender, QueueHandle_t server_queue);
+void stream_sender_end(stream_sender_t *sender);
+void stream_sender_signal(stream_sender_t *sender);
+bool stream_sender_send(stream_sender_t *sender, int client_fd, size_t *bytes_sent);
+
+/**
+ * @brief Check if the client socket did not take all of the data of the last send
+ *
+ */
+static inline bool stream_sender_blocked(const stream_sender_t *sender)
+{
+	return sender->offset < sender->length;
+}
+
+#endif // STREAM_RING_H
@@ -0,0 +1,84 @@
+/**
+ * @file swo_stream.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief SWO trace streaming from ctxLink to the SWO server client
+ * @version 0.1
+ * @date 2025-09-18
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * SWO data does not travel through the server queue in pool buffers. The
+ * SPI task copies it into a byte ring and returns the buffer at once, the
+ * network task drains the ring to the SWO client in large send() calls. When the
+ * client falls behind the oldest data is overwritten and counted, neither
+ * the SPI task nor the GDB traffic ever waits for the SWO client.
+ */
+
+#ifndef SWO_STREAM_H
+#define SWO_STREAM_H
+
+#include <Arduino.h>
+
+#include "tasks/task_server.h"
+
+/**
+ * @brief Size of the ring, in PSRAM when the module has it, otherwise in internal RAM
+ *
+ */
+#define SWO_STREAM_RING_SIZE_PSRAM    (256 * 1024)
+#define SWO_STREAM_RING_SIZE_INTERNAL (16 * 1024)
+
+/**
+ * @brief Largest send() to the client
+ *
+ */
+#define SWO_STREAM_SEND_SIZE 4096
+
+/**
+ * @brief Status value of the SWO statistics report
+ *
+ * Sent with the SWO client status type, 0x00 and 0x01 report the client
+ * disconnecting and connecting. Only sent with LINK_CAP_SWO_STATISTICS.
+ */
+constexpr uint8_t SWO_STREAM_STATUS_STATISTICS = 0x02;
+
+/**
+ * @brief SWO statistics report sent to ctxLink
+ *
+ * Starts with the protocol_packet_status_s fields so that ctxLink firmware
+ * which only knows the plain status packet can still parse it.
+ */
+typedef struct __attribute__((packed)) {
+	uint8_t type;              // SERVER_STATUS_TYPE_SWO_CLIENT
+	uint8_t status;            // SWO_STREAM_STATUS_STATISTICS
+	uint32_t bytes_received;   // SWO bytes received from ctxLink this session
+	uint32_t bytes_sent;       // SWO bytes sent to the client this session
+	uint32_t overrun_bytes;    // Oldest bytes overwritten because the client fell behind
+	uint32_t overruns;         // Writes that overwrote data
+	uint32_t bytes_per_second; // Rate sent to the client since the previous report
+} swo_stream_status_s;
+
+/**
+ * @brief SWO stream statistics for the current session
+ *
+ */
+typedef struct {
+	size_t ring_size;        // Size of the ring
+	size_t high_water_mark;  // Most bytes waiting in the ring
+	uint32_t bytes_received; // Bytes written to the ring
+	uint32_t bytes_sent;     // Bytes sent to the client
+	uint32_t overrun_bytes;  // Bytes overwritten before they were sent
+	uint32_t overruns;       // Writes that overwrote data
+} swo_stream_stats_t;
+
+bool swo_stream_init(void);
+void swo_stream_session_start(QueueHandle_t server_queue);
+void swo_stream_session_end(void);
+void swo_stream_write(const uint8_t *data, size_t length);
+bool swo_stream_send(int client_fd);
+bool swo_stream_send_blocked(void);
+void swo_stream_get_stats(swo_stream_stats_t *stats);
+
+extern const server_stream_t swo_stream_server;
+
+#endif // SWO_STREAM_H
@@ -0,0 +1,222 @@
+/**
+ * @file Arduino.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Host simulator stand-in for the Arduino-ESP32 core and FreeRTOS
+ * @version 0.1
+ * @date 2025-09-10
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * Only the parts of the Arduino and FreeRTOS APIs used by the firmware
+ * modules built into the simulator are provided. Tasks run as pthreads,
+ * queues are mutex/condition variable rings and one tick is 1 ms. The
+ * "interrupt" handlers run on the simulator threads that raise them, with
+ * xPortInIsrContext() returning true while they run.
+ */
+
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT        0x01
+#define OUTPUT       0x03
+#define INPUT_PULLUP 0x05
+
+#define RISING  0x01
+#define FALLING 0x02
+#define CHANGE  0x03
+
+#define SPI_MODE0 0
+#define SPI_MODE1 1
+#define SPI_MODE2 2
+#define SPI_MODE3 3
+
+#define FSPI 0
+#define HSPI 1
+
+//
+// FreeRTOS types and constants
+//
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef struct sim_queue_s *QueueHandle_t;
+typedef struct sim_task_s *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdTRUE  ((BaseType_t)1)
+#define pdFALSE ((BaseType_t)0)
+#define pdPASS  pdTRUE
+#define pdFAIL  pdFALSE
+
+#define portMAX_DELAY      ((TickType_t)0xffffffffUL)
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)  ((TickType_t)(((TickType_t)(ms) * (TickType_t)configTICK_RATE_HZ) / (TickType_t)1000U))
+
+#define configASSERT(x) \
+	do {                \
+		if (!(x)) {     \
+			abort();    \
+		}               \
+	} while (0)
+
+//
+// Critical sections are a recursive mutex shared by tasks and "interrupts"
+//
+typedef struct {
+	pthread_mutex_t mutex;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED \
+	{                                \
+		PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP \
+	}
+
+#define portENTER_CRITICAL(mux)      pthread_mutex_lock(&(mux)->mutex)
+#define portEXIT_CRITICAL(mux)       pthread_mutex_unlock(&(mux)->mutex)
+#define portENTER_CRITICAL_ISR(mux)  portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_ISR(mux)   portEXIT_CRITICAL(mux)
+#define portENTER_CRITICAL_SAFE(mux) portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_SAFE(mux)  portEXIT_CRITICAL(mux)
+#define portYIELD_FROM_ISR()         sched_yield()
+
+#define portNUM_PROCESSORS 2
+
+BaseType_t xPortInIsrContext(void);
+BaseType_t xPortGetCoreID(void);
+
+//
+// Queues
+//
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+void vQueueDelete(QueueHandle_t queue);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait_ticks);
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t wait_ticks);
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t wait_ticks);
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *higher_priority_task_woken);
+BaseType_t xQueueOverwrite(QueueHandle_t queue, const void *item);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait_ticks);
+BaseType_t xQueueReceiveFromISR(QueueHandle_t queue, void *item, BaseType_t *higher_priority_task_woken);
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t wait_ticks);
+BaseType_t xQueuePeekFromISR(QueueHandle_t queue, void *item);
+BaseType_t xQueueReset(QueueHandle_t queue);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+UBaseType_t uxQueueMessagesWaitingFromISR(QueueHandle_t queue);
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue);
+
+//
+// Mutexes
+//
+typedef struct sim_semaphore_s *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait_ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+
+//
+// Tasks
+//
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stack_depth, void *parameters,
+	UBaseType_t priority, TaskHandle_t *handle);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stack_depth, void *parameters,
+	UBaseType_t priority, TaskHandle_t *handle, BaseType_t core_id);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+TickType_t xTaskGetTickCountFromISR(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_task_woken);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t wait_ticks);
+BaseType_t xTaskNotifyWait(
+	uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *notification_value, TickType_t wait_ticks);
+
+//
+// Timing and heap
+//
+int64_t esp_timer_get_time(void);
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+#define MALLOC_CAP_8BIT     (1 << 2)
+#define MALLOC_CAP_SPIRAM   (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+void *heap_caps_malloc(size_t size, uint32_t caps);
+uint32_t getCpuFrequencyMhz(void);
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+//
+// GPIO, backed by the simulated pins in sim_hal.h
+//
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t level);
+int digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode);
+void detachInterrupt(uint8_t pin);
+#define digitalPinToInterrupt(pin) (pin)
+
+/**
+ * @brief Serial port stand-in, output goes to stdout
+ *
+ */
+class HardwareSerial
+{
+public:
+	void begin(unsigned long baud)
+	{
+	}
+	size_t print(const char *text)
+	{
+		return (size_t)fputs(text, stdout);
+	}
+	size_t println(const char *text)
+	{
+		return (size_t)puts(text);
+	}
+	int printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+	{
+		va_list args;
+		va_start(args, format);
+		int result = vprintf(format, args);
+		va_end(args);
+		return result;
+	}
+	size_t write(const uint8_t *data, size_t length)
+	{
+		return fwrite(data, 1, length, stdout);
+	}
+	void flush()
+	{
+		fflush(stdout);
+	}
+	int availableForWrite()
+	{
+		return 256;
+	}
+	operator bool() const
+	{
+		return true;
+	}
+};
+
+extern HardwareSerial Serial;
+
+#endif // SIM_ARDUINO_H
@@ -0,0 +1,17 @@
+/**
+ * @file SPI.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Host simulator stand-in for the Arduino SPI library
+ * @version 0.1
+ * @date 2025-09-10
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ */
+
+#ifndef SIM_SPI_H
+#define SIM_SPI_H
+
+#include <Arduino.h>
+
+#endif // SIM_SPI_H
@@ -0,0 +1,19 @@
+/**
+ * @file WiFi.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Host simulator stand-in for the Arduino Wi-Fi library
+ * @version 0.1
+ * @date 2025-09-10
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * The simulator uses the host network stack directly, the servers listen
+ * on the loopback interface.
+ */
+
+#ifndef SIM_WIFI_H
+#define SIM_WIFI_H
+
+#include <Arduino.h>
+
+#endif // SIM_WIFI_H
@@ -0,0 +1,34 @@
+/**
+ * @file spi_slave.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Host simulator stand-in for the ESP-IDF SPI slave driver types
+ * @version 0.1
+ * @date 2025-09-10
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ */
+
+#ifndef SIM_DRIVER_SPI_SLAVE_H
+#define SIM_DRIVER_SPI_SLAVE_H
+
+#include <Arduino.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK   0
+#define ESP_FAIL -1
+
+/**
+ * @brief SPI slave transaction, the fields used by the firmware
+ *
+ */
+typedef struct {
+	size_t length;         // Total data length, in bits
+	size_t trans_len;      // Transaction data length, in bits, written on completion
+	const void *tx_buffer; // Data to send, NULL to send zeros
+	void *rx_buffer;       // Buffer for the received data, NULL to discard
+	void *user;            // User defined variable
+} spi_slave_transaction_t;
+
+#endif // SIM_DRIVER_SPI_SLAVE_H
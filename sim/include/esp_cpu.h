@@ -0,0 +1,21 @@
+/**
+ * @file esp_cpu.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Host simulator stand-in for the ESP-IDF CPU cycle counter
+ * @version 0.1
+ * @date 2025-10-03
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * The cycle count is derived from the host clock, at the frequency
+ * getCpuFrequencyMhz() reports.
+ */
+
+#ifndef SIM_ESP_CPU_H
+#define SIM_ESP_CPU_H
+
+#include <stdint.h>
+
+uint32_t esp_cpu_get_cycle_count(void);
+
+#endif // SIM_ESP_CPU_H
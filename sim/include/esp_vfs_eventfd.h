@@ -0,0 +1,30 @@
+/**
+ * @file esp_vfs_eventfd.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Host simulator stand-in for the ESP-IDF eventfd VFS driver
+ * @version 0.1
+ * @date 2025-09-19
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * The host has eventfd() already, registering the driver does nothing.
+ */
+
+#ifndef SIM_ESP_VFS_EVENTFD_H
+#define SIM_ESP_VFS_EVENTFD_H
+
+#include <sys/eventfd.h>
+
+typedef struct {
+	size_t max_fds;
+} esp_vfs_eventfd_config_t;
+
+#define ESP_VFS_EVENTD_CONFIG_DEFAULT() {5}
+
+static inline int esp_vfs_eventfd_register(const esp_vfs_eventfd_config_t *config)
+{
+	(void)config;
+	return 0;
+}
+
+#endif // SIM_ESP_VFS_EVENTFD_H
@@ -0,0 +1,35 @@
+/**
+ * @file gpio_ll.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Host simulator stand-in for the ESP-IDF GPIO low level driver
+ * @version 0.1
+ * @date 2025-09-10
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ */
+
+#ifndef SIM_HAL_GPIO_LL_H
+#define SIM_HAL_GPIO_LL_H
+
+#include "sim_hal.h"
+
+typedef int gpio_num_t;
+
+typedef struct {
+	int unused;
+} gpio_dev_t;
+
+extern gpio_dev_t GPIO;
+
+static inline void gpio_ll_set_level(gpio_dev_t *hw, gpio_num_t gpio_num, uint32_t level)
+{
+	sim_gpio_write((uint8_t)gpio_num, level ? HIGH : LOW);
+}
+
+static inline int gpio_ll_get_level(gpio_dev_t *hw, gpio_num_t gpio_num)
+{
+	return sim_gpio_read((uint8_t)gpio_num);
+}
+
+#endif // SIM_HAL_GPIO_LL_H
@@ -0,0 +1,25 @@
+/**
+ * @file sockets.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Host simulator stand-in for the lwIP sockets API
+ * @version 0.1
+ * @date 2025-09-10
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * lwIP follows the BSD sockets API, so the host headers are used as-is.
+ */
+
+#ifndef SIM_LWIP_SOCKETS_H
+#define SIM_LWIP_SOCKETS_H
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#endif // SIM_LWIP_SOCKETS_H
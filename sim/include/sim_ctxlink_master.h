@@ -0,0 +1,77 @@
+/**
+ * @file sim_ctxlink_master.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Host simulator of the ctxLink end of the SPI link
+ * @version 0.1
+ * @date 2025-09-10
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * The simulated master plays ctxLink's side of the ATTN/SS/nSPI_READY
+ * handshake against the firmware's ctxlink.cpp. It answers link control
+ * negotiation and passes every GDB packet it receives to a handler, by
+ * default an echo, whose reply is sent back as a TO_GDB packet.
+ */
+
+#ifndef SIM_CTXLINK_MASTER_H
+#define SIM_CTXLINK_MASTER_H
+
+#include <Arduino.h>
+
+/**
+ * @brief Handler for the GDB data ctxLink receives
+ *
+ * @param request      The data received from the GDB client
+ * @param length       Length of the data
+ * @param response     Buffer for the reply
+ * @param max_length   Size of the reply buffer
+ * @return size_t Length of the reply, 0 for none
+ */
+typedef size_t (*sim_master_gdb_handler_t)(const uint8_t *request, size_t length, uint8_t *response, size_t max_length);
+
+/**
+ * @brief Largest reply a GDB handler may return
+ *
+ */
+#define SIM_MASTER_MAX_RESPONSE (64 * 1024)
+
+/**
+ * @brief Simulated master configuration
+ *
+ */
+typedef struct {
+	uint32_t clock_hz;                   // SPI clock rate
+	uint32_t jitter_us;                  // Random extra delay, 0 to jitter_us, before each transaction
+	uint32_t turnaround_us;              // ctxLink processing time between transactions
+	uint32_t ready_timeout_us;           // Longest wait for nSPI_READY after SS falls
+	uint32_t capabilities;               // Link capabilities ctxLink accepts, 0 for firmware without link control
+	uint32_t frame_credits;              // Frames ctxLink can hold with LINK_CAP_CREDIT, its initial credit
+	uint32_t seed;                       // Seed for the jitter generator
+	sim_master_gdb_handler_t gdb_handler; // Handler for GDB data, NULL to echo it
+} sim_master_config_t;
+
+/**
+ * @brief Simulated master statistics
+ *
+ */
+typedef struct {
+	uint32_t transactions;     // SS assertions that completed a transfer
+	uint32_t ready_timeouts;   // SS assertions abandoned waiting for nSPI_READY
+	uint32_t packets_received; // Packets received from the ESP32
+	uint32_t packets_sent;     // Packets sent to the ESP32
+	uint32_t gdb_requests;     // GDB packets passed to the handler
+	uint32_t gdb_interrupts;   // GDB interrupts received with LINK_CAP_RSP_OFFLOAD
+	uint32_t status_packets;   // Status packets received, client state and SWO reports
+	uint32_t credit_packets;   // LINK_CONTROL_CREDIT packets sent with LINK_CAP_CREDIT
+	uint64_t bytes_clocked;    // Bytes clocked over the bus
+	uint64_t bus_time_us;      // Time spent clocking the bus
+} sim_master_stats_t;
+
+void sim_master_start(const sim_master_config_t *config);
+void sim_master_stop(void);
+bool sim_master_send_swo(const uint8_t *data, size_t length);
+uint32_t sim_master_capabilities(void);
+void sim_master_target_changed(void);
+void sim_master_get_stats(sim_master_stats_t *stats);
+
+#endif // SIM_CTXLINK_MASTER_H
@@ -0,0 +1,37 @@
+/**
+ * @file sim_hal.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Host simulator pins and interrupt context
+ * @version 0.1
+ * @date 2025-09-10
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * The simulated pins connect the firmware to the simulated ctxLink master.
+ * A write that produces the edge an interrupt is attached for calls the
+ * handler on the writing thread, in interrupt context.
+ */
+
+#ifndef SIM_HAL_H
+#define SIM_HAL_H
+
+#include <Arduino.h>
+
+/**
+ * @brief Number of simulated GPIO pins
+ *
+ */
+#define SIM_GPIO_COUNT 64
+
+void sim_isr_enter(void);
+void sim_isr_exit(void);
+
+void sim_gpio_write(uint8_t pin, uint8_t level);
+int sim_gpio_read(uint8_t pin);
+void sim_gpio_notify(void);
+bool sim_gpio_wait_level(uint8_t pin, int level, uint32_t timeout_us);
+void sim_gpio_wait_event(uint32_t timeout_us);
+
+void sim_delay_us(uint32_t us);
+
+#endif // SIM_HAL_H
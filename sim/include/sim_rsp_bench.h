@@ -0,0 +1,50 @@
+/**
+ * @file sim_rsp_bench.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief GDB remote serial protocol workloads for the host simulator
+ * @version 0.1
+ * @date 2025-09-12
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * A GDB client on the loopback interface sends RSP packets through the
+ * GDB server and the SPI link to a stand-in target on the simulated
+ * ctxLink, which answers them the way the probe would.
+ */
+
+#ifndef SIM_RSP_BENCH_H
+#define SIM_RSP_BENCH_H
+
+#include <Arduino.h>
+
+/**
+ * @brief RSP benchmark settings
+ *
+ */
+typedef struct {
+	uint16_t port;      // GDB server port
+	uint32_t count;     // Requests per workload
+	uint32_t load_size; // Bytes of binary data in each X packet of the load workload
+} sim_rsp_bench_config_t;
+
+/**
+ * @brief Default and largest load_size
+ *
+ * Large X packets reach the client task in several reads and may need
+ * segmentation to cross the SPI link.
+ */
+#define SIM_RSP_DEFAULT_LOAD_SIZE 1024
+#define SIM_RSP_MAX_LOAD_SIZE     16384
+
+/**
+ * @brief Largest load_size with LINK_CAP_RSP_OFFLOAD
+ *
+ * The ESP32 holds each packet until it is whole, an X packet must fit one
+ * pool buffer with room for the escapes.
+ */
+#define SIM_RSP_MAX_OFFLOAD_LOAD_SIZE 1024
+
+size_t sim_rsp_target(const uint8_t *request, size_t length, uint8_t *response, size_t max_length);
+int sim_rsp_bench_run(const sim_rsp_bench_config_t *config);
+
+#endif // SIM_RSP_BENCH_H
@@ -0,0 +1,57 @@
+/**
+ * @file sim_spi_slave.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Host simulator mock of the ESP32DMASPI slave driver
+ * @version 0.1
+ * @date 2025-09-10
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * Provides the subset of ESP32DMASPI::Slave used by ctxlink.cpp. As with the
+ * real driver, transactions requested with trigger() are armed by a
+ * background "SPI task" thread, the transaction at the head of the driver
+ * queue is loaded and the post-setup callback called. The simulated master
+ * clocks the loaded transaction with sim_spi_slave_exchange(), which calls
+ * the post-transaction callback and loads the next one.
+ *
+ * Only one slave instance is supported.
+ */
+
+#ifndef SIM_SPI_SLAVE_H
+#define SIM_SPI_SLAVE_H
+
+#include <Arduino.h>
+#include <driver/spi_slave.h>
+
+namespace ESP32DMASPI
+{
+
+using spi_slave_user_cb_t = void (*)(spi_slave_transaction_t *, void *);
+using spi_slave_refill_cb_t = void (*)(spi_slave_transaction_t *, void *);
+using spi_slave_hold_cb_t = bool (*)(bool, void *);
+
+class Slave
+{
+public:
+	bool begin(uint8_t spi_bus, int sck, int miso, int mosi, int ss);
+	void setDataMode(uint8_t mode);
+	void setMaxTransferSize(size_t size);
+	void setQueueSize(size_t size);
+	void setUserPostSetupCbAndArg(spi_slave_user_cb_t cb, void *arg);
+	void setUserPostTransCbAndArg(spi_slave_user_cb_t cb, void *arg);
+	bool queue(const uint8_t *tx_buf, uint8_t *rx_buf, size_t size);
+	bool trigger(uint32_t timeout_ms = 0);
+	size_t numTransactionsInFlight();
+	bool startStreaming(spi_slave_refill_cb_t refill_cb, void *arg, spi_slave_refill_cb_t drop_cb = nullptr,
+		spi_slave_hold_cb_t hold_cb = nullptr);
+	void stopStreaming();
+	bool requeueStreaming();
+	bool isStreaming() const;
+};
+
+} // namespace ESP32DMASPI
+
+bool sim_spi_slave_loaded_tx(const uint8_t **tx_buffer, size_t *length);
+size_t sim_spi_slave_exchange(const uint8_t *master_tx, uint8_t *master_rx, size_t length);
+
+#endif // SIM_SPI_SLAVE_H
@@ -0,0 +1,37 @@
+/**
+ * @file sim_support.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Host simulator firmware bring-up, client sockets and reporting
+ * @version 0.1
+ * @date 2025-09-10
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ */
+
+#ifndef SIM_SUPPORT_H
+#define SIM_SUPPORT_H
+
+#include <Arduino.h>
+
+#include <vector>
+
+#include "sim_ctxlink_master.h"
+
+/**
+ * @brief Latency samples in microseconds
+ *
+ */
+typedef std::vector<uint32_t> sim_latency_samples_t;
+
+bool sim_firmware_start(const sim_master_config_t *master_config, uint16_t port);
+int sim_client_connect(uint16_t port, uint32_t timeout_ms);
+bool sim_send_all(int fd, const uint8_t *data, size_t length);
+bool sim_receive_all(int fd, uint8_t *data, size_t length);
+bool sim_trace_save(uint16_t port, const char *path);
+
+uint32_t sim_percentile(const sim_latency_samples_t &sorted_samples, uint32_t percent);
+void sim_report_latency(const char *title, sim_latency_samples_t &samples);
+void sim_report_link(double elapsed_s);
+
+#endif // SIM_SUPPORT_H
@@ -0,0 +1,33 @@
+/**
+ * @file sim_swo_bench.h
+ * @author Sid Price (sid@sidprice.com)
+ * @brief SWO streaming workload for the host simulator
+ * @version 0.1
+ * @date 2025-09-18
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * The simulated ctxLink streams SWO trace data as fast as the link takes
+ * it while a client on the loopback interface reads it from the SWO
+ * server, optionally slowly enough to make the stream ring overrun.
+ */
+
+#ifndef SIM_SWO_BENCH_H
+#define SIM_SWO_BENCH_H
+
+#include <Arduino.h>
+
+/**
+ * @brief SWO benchmark settings
+ *
+ */
+typedef struct {
+	uint16_t port;            // SWO server port
+	uint32_t count;           // SWO packets ctxLink sends
+	size_t size;              // Bytes of trace data in each packet
+	uint32_t reader_delay_us; // Pause of the client after each read, 0 to read as fast as possible
+} sim_swo_bench_config_t;
+
+int sim_swo_bench_run(const sim_swo_bench_config_t *config);
+
+#endif // SIM_SWO_BENCH_H
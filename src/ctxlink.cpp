@@ -20,7 +20,15 @@
 
 #include "debug.h"
 
+#ifdef CTXLINK_HOST_SIM
+#include "sim_spi_slave.h"
+#else
 #include "ESP32DMASPISlave.h"
+#endif
+#include "hal/gpio_ll.h"
+#include "link_control.h"
+#include "packet_trace.h"
+#include "spi_buffer_pool.h"
 #include "tasks/task_spi_comms.h"
 
 static const uint8_t nREADY = 8;     // GPIO pin for ctxLink nReady input
@@ -31,101 +39,323 @@ static const uint8_t SPI_MISO_PIN = 37;
 static const uint8_t SPI_MOSI_PIN = 35;
 static const uint8_t SPI_SCK_PIN = 36;
 
-static bool is_tx = false;
-
 ESP32DMASPI::Slave slave;
 
-static constexpr size_t BUFFER_SIZE = 2000; // should be multiple of 4
-static constexpr size_t QUEUE_SIZE = 1;
+//
+// Depth of the slave transaction queue. In pre-armed mode this many transactions
+// are always loaded in the driver, ready for ctxLink to clock.
+//
+static constexpr size_t QUEUE_SIZE = 2;
+
+//
+// The frames waiting for, or in, TX transactions, sent in order. tx_first is
+// the oldest, the next to complete. The first tx_armed of them have been
+// loaded into transactions, so each is only sent once. No more than
+// tx_window frames wait at a time, one unless LINK_CAP_CREDIT was negotiated.
+//
+static uint8_t *tx_frames[SPI_TX_WINDOW_MAX];
+static size_t tx_lengths[SPI_TX_WINDOW_MAX];
+static volatile size_t tx_first = 0;
+static volatile size_t tx_count = 0;
+static volatile size_t tx_armed = 0;
+static volatile size_t tx_window = 1;
+//
+// Set when the SPI task found the window full, the next frame completed wakes it
+//
+static volatile bool tx_notify = false;
+//
+// Number of transactions loaded in the driver and not yet completed
+//
+static volatile uint32_t spi_armed_count = 0;
+//
+// SS edge to transaction setup latency measurement
+//
+static volatile bool spi_ss_waiting_for_setup = false;
+static volatile int64_t spi_ss_edge_time = 0;
 
-static uint8_t *tx_saved_transaction;
-static uint8_t zero_transaction_buffer[BUFFER_SIZE] = {0}; // Use your max transfer size
+static portMUX_TYPE spi_tx_lock = portMUX_INITIALIZER_UNLOCKED;
+//
+// Set while the slave driver keeps transactions pre-armed, read by the SS interrupt
+//
+static volatile bool spi_prearmed = false;
+//
+// Set while nSPI_READY is held released for the armed transactions to be dropped
+//
+static volatile bool spi_held = false;
+//
+// Set from the post-setup callback until the transaction completes, ctxLink
+// may be clocking the loaded transaction
+//
+static volatile bool spi_ready_offered = false;
+//
+// Shadow of the ATTN output, true while ATTN is asserted (LOW)
+//
+static volatile bool attn_asserted = false;
+static uint8_t zero_transaction_buffer[SPI_FRAME_SIZE] = {0}; // Use your max transfer size
+//
+// Receives the data of an RX transaction when the buffer pool is exhausted, the
+// data is discarded and counted in link_stats.rx_dropped. Also receives the
+// unused RX side of a legacy TX transaction.
+//
+static uint8_t rx_discard_buffer[SPI_FRAME_SIZE] __attribute__((aligned(4)));
+//
+// Link statistics, updated by the SPI ISRs
+//
+static volatile spi_link_stats_t link_stats = {0};
+
+/**
+ * @brief Drive a handshake output from the SPI interrupt handlers
+ *
+ * @param pin   GPIO number
+ * @param level HIGH or LOW
+ *
+ * digitalWrite() is not guaranteed to be in IRAM, the register write is.
+ */
+static inline void IRAM_ATTR spi_pin_write(uint8_t pin, uint32_t level)
+{
+	gpio_ll_set_level(&GPIO, (gpio_num_t)pin, level);
+}
+
+/**
+ * @brief Assert or release ATTN, keeping the shadow state in step
+ *
+ * @param asserted true to drive ATTN LOW, ctxLink then knows a frame is waiting
+ */
+static inline void IRAM_ATTR spi_set_attn(bool asserted)
+{
+	attn_asserted = asserted;
+	spi_pin_write(ATTN, asserted ? LOW : HIGH);
+}
 
 bool system_setup_done = false;
 
 /**
- * @brief Save the passed transaction packet pointer for later transmission
+ * @brief Save the passed frame for transmission to ctxLink
  *
- * @param transaction_buffer  Pointer to the packet to be sent
+ * @param frame         Pointer to the frame to be sent, one or more protocol packets
+ * @param frame_length  Length of the frame in bytes
  *
- * 	If the transaction_buffer is NULL, the call is to check for any
- * transactions queued.
- * 
- *  If the spi comms output queue has a single entry:
- * 		Save the buffer pointer and assert nATTN.
- * 
- * If the spi comms output queue has more than 1 entry:
- * 		Place the buffer into the output queue.
- * 
- * Upon transaction completion the entry must be removed from the queue.
+ * The frame is sent after the frames already waiting, the caller must check
+ * spi_tx_ready() first. The frame buffer is returned to the pool by the SPI
+ * ISR when the transaction completes.
  */
-void spi_save_tx_transaction_buffer(uint8_t *transaction_buffer)
+void spi_save_tx_transaction_buffer(uint8_t *frame, size_t frame_length)
 {
-	UBaseType_t queue_count;
-	queue_count = uxQueueMessagesWaiting(spi_comms_output_queue);
-	MON_PRINTF("Entry - Queue count: %d\r\n", queue_count);
+	spi_buffer_tag(frame, SPI_BUFFER_OWNER_SPI_DRIVER, SPI_BUFFER_STATE_QUEUED);
+	packet_trace(PACKET_TRACE_SPI_FRAME, frame, frame_length);
+	portENTER_CRITICAL(&spi_tx_lock);
+	size_t index = (tx_first + tx_count) % SPI_TX_WINDOW_MAX;
+	tx_frames[index] = frame;
+	tx_lengths[index] = frame_length;
+	tx_count++;
+	if (tx_count > link_stats.tx_window_max) {
+		link_stats.tx_window_max = tx_count;
+	}
+	bool idle_armed = spi_prearmed && spi_armed_count > tx_armed;
+	portEXIT_CRITICAL(&spi_tx_lock);
 	//
-	// If a transcation buffer is received, queue it.
+	// A pre-armed transaction without a frame would be clocked first, have the
+	// armed transactions filled in again. The post-setup callback asserts ATTN
+	// once the frame is loaded.
 	//
-	if (transaction_buffer != NULL) {
-		xQueueSend(spi_comms_output_queue, &transaction_buffer, 0);
-	} else if (queue_count == 0) {
-		//
-		// If there are no queued transactions, do nothing.
-		//
+	if (idle_armed && slave.requeueStreaming()) {
+		link_stats.tx_requeues++;
 		return;
 	}
 	//
-	// If there is more than 1 queued item, we are done.
+	// Signal ctxLink that there is a transaction ready to be sent.
 	//
-	queue_count = uxQueueMessagesWaiting(spi_comms_output_queue);
-	MON_PRINTF("Queue count: %d\r\n", queue_count);
-	if (queue_count > 1) {
-		return;
+	spi_set_attn(true);
+}
+
+/**
+ * @brief Check if the SPI driver can accept another TX frame
+ *
+ * @return true if the window has room for another frame
+ *
+ * When the window is full the SPI ISR sends a transaction completed packet
+ * to the SPI task once the oldest frame has been sent. Otherwise frames
+ * complete without involving the SPI task.
+ */
+bool spi_tx_ready(void)
+{
+	portENTER_CRITICAL(&spi_tx_lock);
+	bool ready = tx_count < tx_window;
+	tx_notify = !ready;
+	portEXIT_CRITICAL(&spi_tx_lock);
+	return ready;
+}
+
+/**
+ * @brief Set the most frames handed to the SPI driver at once
+ *
+ * @param frames The window, from 1 to SPI_TX_WINDOW_MAX. Frames already
+ *               waiting beyond a smaller window are still sent.
+ */
+void spi_set_tx_window(size_t frames)
+{
+	if (frames < 1) {
+		frames = 1;
+	} else if (frames > SPI_TX_WINDOW_MAX) {
+		frames = SPI_TX_WINDOW_MAX;
 	}
+	tx_window = frames;
+}
+
+/**
+ * @brief Get the next frame not yet loaded into a transaction, call with spi_tx_lock held
+ *
+ * @param length Set to the length of the frame
+ * @return uint8_t* The frame, NULL if every waiting frame has been loaded.
+ *                  Increment tx_armed once it is loaded.
+ */
+static uint8_t *IRAM_ATTR spi_tx_next_unarmed(size_t *length)
+{
+	if (tx_armed >= tx_count) {
+		return NULL;
+	}
+	size_t index = (tx_first + tx_armed) % SPI_TX_WINDOW_MAX;
+	*length = tx_lengths[index];
+	return tx_frames[index];
+}
+
+static uint8_t packet_transaction_completed[] = {
+	PROTOCOL_MAGIC1, PROTOCOL_MAGIC2, PROTOCOL_TRANSACTION_COMPLETED, 0x00, 0x01, 0x01}; // 0x01 = transaction completed
+
+/**
+ * @brief Record an SS edge to transaction setup latency sample
+ *
+ * @param latency_us The latency in microseconds, 0 if the transaction was already armed
+ */
+static void IRAM_ATTR spi_record_ss_latency(uint32_t latency_us)
+{
+	link_stats.ss_setup_samples++;
+	link_stats.ss_setup_total_us += latency_us;
+	if (latency_us == 0) {
+		link_stats.ss_setup_prearmed++;
+	}
+	if (latency_us > link_stats.ss_setup_max_us) {
+		link_stats.ss_setup_max_us = latency_us;
+	}
+}
+
+/**
+ * @brief Pass a received packet to the SPI task
+ *
+ * @param message Pointer to the receive buffer
+ * @param received Number of bytes clocked in by ctxLink
+ *
+ * @return true if ctxLink sent a packet, even if it could not be passed on
+ *
+ * Called from the transaction completed ISR. Buffers without a packet are
+ * returned to the pool, this is normal for the RX side of a duplex exchange
+ * when ctxLink had nothing to send.
+ */
+static bool IRAM_ATTR spi_rx_complete(uint8_t *message, size_t received)
+{
 	//
-	// Get the next transaction buffer from the queue and save it for transmission.
-	//
-	// Leave the item in the queue, it is removed on completion of the transaction.
+	// Data received into the discard buffer is lost, the pool was empty
+	// when the transaction was set up.
 	//
-	xQueuePeek(spi_comms_output_queue, &tx_saved_transaction, 0); // Get the next transaction buffer from the queue
+	if (!spi_buffer_is_pool_buffer(message)) {
+		return false;
+	}
+	size_t packet_length = link_packet_length(message);
+	if (packet_length == 0) {
+		spi_buffer_release_from_isr(message);
+		return false;
+	}
 	//
-	// Signal ctxLink that there is a transaction ready to be sent.
+	// In variable-length mode ctxLink stops clocking at the end of the frame,
+	// make sure the whole advertised packet arrived before passing it on.
 	//
-	digitalWrite(ATTN, LOW);
+	if (link_control_has(LINK_CAP_VARIABLE_LENGTH) && packet_length > received) {
+		link_stats.rx_truncated++;
+		spi_buffer_release_from_isr(message);
+		return true;
+	}
+	spi_buffer_tag(message, SPI_BUFFER_OWNER_SPI_COMMS, SPI_BUFFER_STATE_QUEUED);
+	packet_trace(PACKET_TRACE_SPI_RECEIVED, message, packet_length);
+	if (xQueueSendFromISR(spi_comms_input_queue, &message, NULL) != pdTRUE) {
+		spi_buffer_release_from_isr(message);
+		link_stats.rx_dropped++;
+		return true;
+	}
+	link_stats.rx_packets++;
+	return true;
 }
 
-static uint8_t packet_transaction_completed[] = {
-	PROTOCOL_MAGIC1, PROTOCOL_MAGIC2, PROTOCOL_TRANSACTION_COMPLETED, 0x00, 0x01, 0x01}; // 0x01 = transaction completed
+/**
+ * @brief Complete the TX side of a transaction
+ *
+ * Return the oldest frame buffer to the pool and, if the SPI task is
+ * waiting for room in the window, send it a transaction completed message
+ * so it can queue the next frame.
+ */
+static void IRAM_ATTR spi_tx_complete(void)
+{
+	uint8_t *message;
+	uint8_t *frame;
+	portENTER_CRITICAL_ISR(&spi_tx_lock);
+	frame = tx_frames[tx_first];
+	size_t frame_length = tx_lengths[tx_first];
+	tx_first = (tx_first + 1) % SPI_TX_WINDOW_MAX;
+	tx_count--;
+	if (tx_armed > 0) {
+		tx_armed--;
+	}
+	bool notify = tx_notify;
+	tx_notify = false;
+	portEXIT_CRITICAL_ISR(&spi_tx_lock);
+	packet_trace(PACKET_TRACE_SPI_SENT, frame, frame_length);
+	spi_buffer_release_from_isr(frame);
+	link_stats.tx_frames++;
+	if (notify) {
+		//
+		// The transaction completed packet is constant, send the static copy rather
+		// than consuming a pool buffer. The pool ignores its release.
+		//
+		message = packet_transaction_completed;
+		xQueueSendFromISR(spi_comms_input_queue, &message, NULL);
+		link_stats.tx_notifications++;
+	}
+}
 
 /**
  * @brief Callback function on transaction completed
  *
  * @param trans Pointer to the transaction that was completed
  * @param arg   Unused user argument
+ *
+ * The directions are dispatched by buffer rather than by transaction type, a
+ * duplex exchange completes both the saved TX frame and a received packet.
  */
 void IRAM_ATTR userTransactionCallback(spi_slave_transaction_t *trans, void *arg)
 {
-	digitalWrite(nSPI_READY, HIGH); // Transaction is done, SPI not ready
-	digitalWrite(ATTN, HIGH);
+	spi_pin_write(nSPI_READY, HIGH); // Transaction is done, SPI not ready
+	spi_ready_offered = false;
+	spi_set_attn(false);
 	//
-	UBaseType_t queue_count;
-	queue_count = uxQueueMessagesWaiting(spi_comms_output_queue);
-	MON_PRINTF("End Transaction - Queue count: %d\r\n", queue_count);
-	if (is_tx == false) {
-		xQueueSendFromISR(spi_comms_input_queue, (uint8_t *)&trans->rx_buffer, NULL);
-	} else {
-		uint8_t *message;
-		MON_NL("TX transaction completed");
+	if (spi_armed_count > 0) {
+		spi_armed_count--;
+	}
+	bool tx_done = (tx_count != 0) && (trans->tx_buffer == tx_frames[tx_first]);
+	bool rx_done = spi_rx_complete((uint8_t *)trans->rx_buffer, trans->trans_len / 8);
+	link_stats.transactions++;
+	if (tx_done && rx_done) {
+		link_stats.duplex_transactions++;
+	} else if (!tx_done && !rx_done) {
+		link_stats.empty_transactions++;
+	}
+	if (tx_done) {
+		spi_tx_complete();
+	}
+	if (tx_count != 0 && !spi_prearmed) {
 		//
-		// For a TX transcation, remove the completed transaction from the output queue
-		// and send a transaction completed message to the SPI task.
-		xQueueReceiveFromISR(spi_comms_output_queue, &message, NULL); // Remove the completed transaction from the queue
-		queue_count = uxQueueMessagesWaiting(spi_comms_output_queue);
-		MON_PRINTF("Remove - Queue count: %d\r\n", queue_count);
-		message = get_next_spi_buffer(); // Get a buffer for the transaction completed message
-		memcpy(message, packet_transaction_completed, sizeof(packet_transaction_completed));
-		xQueueSendFromISR(spi_comms_input_queue, &message, NULL);
+		// More frames wait, or one was saved after this transaction was set up, keep ATTN asserted for them.
+		// Pre-armed, the post-setup callback of the next transaction decides.
+		//
+		spi_set_attn(true);
 	}
 }
 
@@ -137,31 +367,254 @@ void IRAM_ATTR userTransactionCallback(spi_slave_transaction_t *trans, void *arg
  */
 void IRAM_ATTR userPostSetupCallback(spi_slave_transaction_t *trans, void *arg)
 {
-	digitalWrite(nSPI_READY, LOW); // Tell ctxLink the transaction is ready to go.
+	//
+	// Pre-armed, ATTN is asserted for a transaction that carries a frame. An
+	// idle one is only clocked for a frame behind it, when the armed transactions
+	// could not be dropped in time.
+	//
+	if (spi_prearmed) {
+		spi_set_attn(trans->tx_buffer != zero_transaction_buffer || tx_count != 0);
+	}
+	if (!spi_held) {
+		spi_ready_offered = true;
+		spi_pin_write(nSPI_READY, LOW); // Tell ctxLink the transaction is ready to go.
+	}
+	//
+	// If ctxLink is already waiting, record how long the setup took after SS fell
+	//
+	if (spi_ss_waiting_for_setup) {
+		spi_ss_waiting_for_setup = false;
+		spi_record_ss_latency((uint32_t)(esp_timer_get_time() - spi_ss_edge_time));
+	}
+}
+
+/**
+ * @brief Fill in the next pre-armed transaction
+ *
+ * @param trans Pointer to the transaction to be armed
+ * @param arg Unused user argument
+ *
+ * Called from the SPI slave task in pre-armed mode. Every pre-armed
+ * transaction is a duplex exchange, it carries the next saved frame not yet
+ * loaded and receives into a fresh pool buffer.
+ */
+static void spi_refill_transaction(spi_slave_transaction_t *trans, void *arg)
+{
+	uint8_t *rx_buffer = spi_buffer_acquire(SPI_BUFFER_OWNER_SPI_DRIVER, 0);
+	if (rx_buffer == NULL) {
+		rx_buffer = rx_discard_buffer; // The pool is empty, anything ctxLink sends is lost
+	} else {
+		spi_buffer_tag(rx_buffer, SPI_BUFFER_OWNER_SPI_DRIVER, SPI_BUFFER_STATE_IN_FLIGHT);
+	}
+	size_t tx_length;
+	portENTER_CRITICAL(&spi_tx_lock);
+	uint8_t *tx_frame = spi_tx_next_unarmed(&tx_length);
+	if (tx_frame != NULL) {
+		tx_armed++;
+	}
+	spi_armed_count++;
+	portEXIT_CRITICAL(&spi_tx_lock);
+	if (tx_frame != NULL) {
+		spi_buffer_tag(tx_frame, SPI_BUFFER_OWNER_SPI_DRIVER, SPI_BUFFER_STATE_IN_FLIGHT);
+	}
+	trans->tx_buffer = (tx_frame == NULL) ? zero_transaction_buffer : tx_frame;
+	trans->rx_buffer = rx_buffer;
+	trans->length = 8 * SPI_FRAME_SIZE; // in bit size
+}
+
+/**
+ * @brief Take back a pre-armed transaction that was dropped before ctxLink clocked it
+ *
+ * @param trans Pointer to the dropped transaction
+ * @param arg Unused user argument
+ *
+ * Called from the SPI slave task. The frame it carried, if any, is loaded
+ * again by the refill callback.
+ */
+static void spi_drop_transaction(spi_slave_transaction_t *trans, void *arg)
+{
+	portENTER_CRITICAL(&spi_tx_lock);
+	if (spi_armed_count > 0) {
+		spi_armed_count--;
+	}
+	if (trans->tx_buffer != zero_transaction_buffer && tx_armed > 0) {
+		tx_armed--;
+	}
+	portEXIT_CRITICAL(&spi_tx_lock);
+	if (spi_buffer_is_pool_buffer((uint8_t *)trans->rx_buffer)) {
+		spi_buffer_release((uint8_t *)trans->rx_buffer);
+	}
+}
+
+/**
+ * @brief Hold ctxLink off while the armed transactions are dropped, or release it
+ *
+ * @param hold true to hold ctxLink off, false to release it
+ * @param arg Unused user argument
+ * @return bool false if ctxLink may be clocking the loaded transaction, the
+ *              driver tries again once it completes
+ *
+ * ctxLink lowers SS, then waits for nSPI_READY before it clocks. With
+ * nSPI_READY released first, SS still high means ctxLink has not started
+ * and will wait for the transaction armed next. With SS low ctxLink is
+ * clocking, or waiting for, the loaded transaction, so nSPI_READY is
+ * asserted again and ctxLink is not held off until that exchange completes.
+ * While held, the transactions loaded are not offered to ctxLink. If the
+ * driver could not drop them, ATTN is asserted on release for the frame
+ * that follows the idle transactions.
+ */
+static bool spi_hold_transactions(bool hold, void *arg)
+{
+	if (hold) {
+		spi_held = true;
+		spi_pin_write(nSPI_READY, HIGH);
+		if (spi_ready_offered && gpio_ll_get_level(&GPIO, (gpio_num_t)SPI_SS_PIN) == LOW) {
+			spi_held = false;
+			spi_pin_write(nSPI_READY, LOW); // Let ctxLink finish the exchange it started
+			return false;
+		}
+		spi_ready_offered = false;
+		return true;
+	}
+	spi_held = false;
+	if (spi_armed_count > 0) {
+		spi_ready_offered = true;
+		spi_pin_write(nSPI_READY, LOW); // The loaded transaction stays, ctxLink may clock it
+	}
+	if (tx_count != 0) {
+		spi_set_attn(true);
+	}
+	return true;
+}
+
+/**
+ * @brief Start keeping transactions armed ahead of SS
+ *
+ * Pre-arming needs every transaction to be a duplex exchange, it is started
+ * once ctxLink has accepted LINK_CAP_DUPLEX.
+ */
+void spi_enable_prearmed_transactions(void)
+{
+	if (!slave.isStreaming()) {
+		LOG_INFO(SPI, "SPI pre-armed transactions enabled");
+		spi_prearmed = true;
+		slave.startStreaming(spi_refill_transaction, NULL, spi_drop_transaction, spi_hold_transactions);
+	}
+}
+
+/**
+ * @brief Stop re-arming transactions, e.g. after ctxLink restarts
+ *
+ * The transactions already armed complete normally, after that transactions
+ * are set up on the SS edge again.
+ */
+void spi_disable_prearmed_transactions(void)
+{
+	spi_prearmed = false;
+	slave.stopStreaming();
+}
+
+/**
+ * @brief Get the number of bytes to queue for a TX transaction
+ *
+ * @param frame_length Length of the frame to be sent
+ * @return size_t The transaction length in bytes
+ *
+ * Older ctxLink firmware always clocks a full frame. In variable-length mode
+ * ctxLink reads the header and stops after the packet, so only the packet,
+ * rounded up to the 4 byte DMA granularity, needs to be loaded. A batched
+ * frame also carries the empty header that terminates it.
+ */
+static size_t IRAM_ATTR spi_tx_transaction_length(size_t frame_length)
+{
+	if (!link_control_has(LINK_CAP_VARIABLE_LENGTH)) {
+		return SPI_FRAME_SIZE;
+	}
+	size_t length = frame_length;
+	if (link_control_has(LINK_CAP_BATCHING)) {
+		length += SPI_PACKET_HEADER_SIZE;
+	}
+	if (length == 0 || length > SPI_FRAME_SIZE) {
+		return SPI_FRAME_SIZE;
+	}
+	return (length + 3) & ~(size_t)3;
+}
+
+/**
+ * @brief Get a pool buffer for the RX side of a transaction
+ *
+ * @return uint8_t* The buffer, or the discard buffer if the pool is empty
+ */
+static uint8_t *IRAM_ATTR spi_acquire_rx_buffer(void)
+{
+	uint8_t *rx_buffer = spi_buffer_acquire_from_isr(SPI_BUFFER_OWNER_SPI_DRIVER);
+	if (rx_buffer == NULL) {
+		link_stats.rx_dropped++;
+		return rx_discard_buffer; // ctxLink still clocks the transfer, the data is lost
+	}
+	spi_buffer_tag(rx_buffer, SPI_BUFFER_OWNER_SPI_DRIVER, SPI_BUFFER_STATE_IN_FLIGHT);
+	return rx_buffer;
 }
 
 /**
  * @brief Interrupt handler for the SPI CS input falling transition
  *
- *  If ATTN is asserted, set up a TX transaction using the saved txtransaction
- * packet.
+ *  In duplex mode every transaction sends the saved TX frame, if there is
+ * one, and receives into a fresh pool buffer.
+ *
+ *  Otherwise, if ATTN is asserted, set up a TX transaction using the saved
+ * txtransaction packet, or else set up an RX transaction.
  *
- *  Otherwise, set up an RX transaction
+ *  If a transaction is already armed, either pre-armed or still waiting from
+ * an earlier edge, only the setup latency is recorded.
  *
  *  Do nothing if ESP32 is not ready!
  */
-void spi_ss_activated(void)
+void IRAM_ATTR spi_ss_activated(void)
 {
 	// control_esp32_ready(false); // De-assert ESP32 is ready
 	if (system_setup_done) {
-		if (digitalRead(ATTN) == LOW) { // Is this a TX transaction?
-			// Set up a transaction to send the saved transaction buffer to ctxLink
-			spi_create_pending_transaction(tx_saved_transaction, NULL,
-				true); // This is a pending tx transaction
+		if (spi_armed_count > 0) {
+			spi_record_ss_latency(0);
+			return;
+		}
+		spi_ss_edge_time = esp_timer_get_time();
+		spi_ss_waiting_for_setup = true;
+		if (spi_prearmed) {
+			return; // The SPI slave task is about to re-arm, the post-setup callback records the latency
+		}
+
+		//
+		// Without duplex a frame is only sent while ATTN announces it
+		//
+		size_t tx_length = 0;
+		bool duplex = link_control_has(LINK_CAP_DUPLEX);
+		portENTER_CRITICAL_ISR(&spi_tx_lock);
+		uint8_t *tx_frame = spi_tx_next_unarmed(&tx_length);
+		if (tx_frame != NULL && (duplex || attn_asserted)) {
+			tx_armed++;
+		} else {
+			tx_frame = NULL;
+		}
+		spi_armed_count++;
+		portEXIT_CRITICAL_ISR(&spi_tx_lock);
+		if (tx_frame != NULL) {
+			spi_buffer_tag(tx_frame, SPI_BUFFER_OWNER_SPI_DRIVER, SPI_BUFFER_STATE_IN_FLIGHT);
+		}
+
+		if (duplex) {
+			//
+			// ctxLink clocks the longer of the two frames, so the RX side needs a full frame
+			//
+			spi_create_pending_transaction(tx_frame, spi_acquire_rx_buffer(), SPI_FRAME_SIZE);
+		} else if (tx_frame != NULL) { // Is this a TX transaction?
+			// Set up a transaction to send the next saved frame to ctxLink
+			spi_create_pending_transaction(
+				tx_frame, NULL, spi_tx_transaction_length(tx_length)); // This is a pending tx transaction
 		} else {
 			// Set up a transaction to receive data from ctxLink
-			spi_create_pending_transaction(NULL, get_next_spi_buffer(),
-				false); // This is a pending rx transaction
+			spi_create_pending_transaction(
+				NULL, spi_acquire_rx_buffer(), SPI_FRAME_SIZE); // This is a pending rx transaction
 		}
 	}
 }
@@ -194,7 +647,7 @@ void initCtxLink(void)
 	attachInterrupt(digitalPinToInterrupt(SPI_SS_PIN), spi_ss_activated,
 		FALLING); // Attach interrupt to SPI_SS_PIN
 	slave.setDataMode(SPI_MODE1);
-	slave.setMaxTransferSize(BUFFER_SIZE); // default: 4092 bytes
+	slave.setMaxTransferSize(SPI_FRAME_SIZE); // default: 4092 bytes
 	slave.setQueueSize(QUEUE_SIZE);        // default: 1
 
 	// begin() after setting
@@ -208,31 +661,23 @@ void initCtxLink(void)
  *
  * @param dma_tx_buffer Pointer to the buffer containing data to be sent to ctxLink
  * @param dma_rx_buffer Pointer to the buffer where received data from ctxLink should be stored
- * @param isTx          Boolean indicating whether this is a TX transaction (true) or RX transaction (false)
+ * @param length        Number of bytes to load into the transaction, a multiple of 4
  */
-void spi_create_pending_transaction(uint8_t *dma_tx_buffer, uint8_t *dma_rx_buffer, bool isTx)
+void IRAM_ATTR spi_create_pending_transaction(uint8_t *dma_tx_buffer, uint8_t *dma_rx_buffer, size_t length)
 {
 	//
-	// TODO Move this line to the nCS processing? Seems like ALL transaction are
-	// considered tx?
-	//
-	is_tx = isTx; // Set the transaction type
-
-	slave.setUserPostSetupCbAndArg(userPostSetupCallback, NULL);
-	slave.setUserPostTransCbAndArg(userTransactionCallback, NULL);
+	// The user callbacks are set once in initCtxLink(), nothing is allocated per transaction
 	//
 	// Set up the transaction buffers depending upon the transfer direction
 	//
-	// Replace NULL pointers with pointers to buffers filled with zeroes.
-	//
-	// Note: Only a single zero-filled buffer is provided since one of the RX/TX
-	// buffers must be valid!
+	// Replace a NULL TX pointer with a buffer filled with zeroes and a NULL RX
+	// pointer with the discard buffer, so the zero buffer is never written.
 	//
 	// This keeps the buffers valid, even when not supplied by the caller
 	//
 	const uint8_t *tx_buf_to_use = (dma_tx_buffer == NULL) ? zero_transaction_buffer : dma_tx_buffer;
-	uint8_t *rx_buf_to_use = (dma_rx_buffer == NULL) ? zero_transaction_buffer : dma_rx_buffer;
-	slave.queue(tx_buf_to_use, rx_buf_to_use, BUFFER_SIZE);
+	uint8_t *rx_buf_to_use = (dma_rx_buffer == NULL) ? rx_discard_buffer : dma_rx_buffer;
+	slave.queue(tx_buf_to_use, rx_buf_to_use, length);
 	slave.trigger();
 }
 
@@ -248,6 +693,29 @@ void control_esp32_ready(bool ready)
 	digitalWrite(nREADY, ready ? LOW : HIGH);
 }
 
+/**
+ * @brief Take a snapshot of the SPI link statistics
+ *
+ * @param stats Pointer to the structure to be filled
+ */
+void spi_get_link_stats(spi_link_stats_t *stats)
+{
+	stats->transactions = link_stats.transactions;
+	stats->duplex_transactions = link_stats.duplex_transactions;
+	stats->empty_transactions = link_stats.empty_transactions;
+	stats->tx_requeues = link_stats.tx_requeues;
+	stats->tx_frames = link_stats.tx_frames;
+	stats->tx_notifications = link_stats.tx_notifications;
+	stats->tx_window_max = link_stats.tx_window_max;
+	stats->rx_packets = link_stats.rx_packets;
+	stats->rx_dropped = link_stats.rx_dropped;
+	stats->rx_truncated = link_stats.rx_truncated;
+	stats->ss_setup_samples = link_stats.ss_setup_samples;
+	stats->ss_setup_prearmed = link_stats.ss_setup_prearmed;
+	stats->ss_setup_total_us = link_stats.ss_setup_total_us;
+	stats->ss_setup_max_us = link_stats.ss_setup_max_us;
+}
+
 /**
  * @brief A debug aid, not used as a part of the ctxLink Interface.
  * 
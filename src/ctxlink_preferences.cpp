@@ -74,7 +74,7 @@ size_t preferences_get_wifi_parameters(char *ssid, char *password)
 	}
 	ssid_length = preferences.getBytes(wifi_ssid_key, ssid, MAX_SSID_LENGTH);
 	if (ssid_length == 0) {
-		MON_NL("No SSID found in preferences, using default");
+		LOG_WARN(PREFS, "No SSID found in preferences, using default");
 		strcpy(ssid, "ctxlink_net"); // Default SSID
 		ssid_length = strlen((char *)ssid);
 		save = true; // Need to save the default SSID
@@ -84,7 +84,7 @@ size_t preferences_get_wifi_parameters(char *ssid, char *password)
 	//
 	password_length = preferences.getBytes(wifi_password_key, password, MAX_PASS_PHRASE_LENGTH);
 	if (password_length == 0) {
-		MON_NL("No password found in preferences, using default");
+		LOG_WARN(PREFS, "No password found in preferences, using default");
 		strcpy(password, "pass_phrase"); // Default pass phrase
 		password_length = strlen((char *)password);
 		save = true; // Need to save the default pass phrase
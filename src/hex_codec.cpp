@@ -0,0 +1,261 @@
+/**
+ * @file hex_codec.cpp
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Conversion of GDB memory data between hex and binary
+ * @version 0.1
+ * @date 2025-09-24
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * Both directions are table driven and handle four bytes per loop pass,
+ * with no branches on the data. The encode table holds the two digits of
+ * every byte value ready to store as one 16-bit word, the decode table the
+ * value of every character with the invalid ones marked in the high bits,
+ * so a bad digit is found with one test after the loop.
+ *
+ * The tables are built at compile time and kept in internal RAM, flash
+ * reads through the cache would stall the loop whenever the cache misses.
+ */
+
+#include <Arduino.h>
+
+#include "hex_codec.h"
+
+/**
+ * @brief Value of a character in the decode table that is not a hex digit
+ *
+ */
+static constexpr uint8_t hex_invalid = 0xf0;
+
+typedef struct {
+	uint16_t pairs[256];
+} hex_encode_table_s;
+
+typedef struct {
+	uint8_t values[256];
+} hex_decode_table_s;
+
+static constexpr hex_encode_table_s hex_encode_table_build(void)
+{
+	hex_encode_table_s table = {};
+	const char digits[] = "0123456789abcdef";
+	for (unsigned int value = 0; value < 256; value++) {
+		uint16_t high = (uint8_t)digits[value >> 4];
+		uint16_t low = (uint8_t)digits[value & 0x0f];
+		//
+		// The first digit must land at the lower address when the word is stored
+		//
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		table.pairs[value] = (uint16_t)(high | (low << 8));
+#else
+		table.pairs[value] = (uint16_t)((high << 8) | low);
+#endif
+	}
+	return table;
+}
+
+static constexpr hex_decode_table_s hex_decode_table_build(void)
+{
+	hex_decode_table_s table = {};
+	for (unsigned int character = 0; character < 256; character++) {
+		if (character >= '0' && character <= '9') {
+			table.values[character] = (uint8_t)(character - '0');
+		} else if (character >= 'a' && character <= 'f') {
+			table.values[character] = (uint8_t)(character - 'a' + 10);
+		} else if (character >= 'A' && character <= 'F') {
+			table.values[character] = (uint8_t)(character - 'A' + 10);
+		} else {
+			table.values[character] = hex_invalid;
+		}
+	}
+	return table;
+}
+
+static const hex_encode_table_s DRAM_ATTR hex_encode_table = hex_encode_table_build();
+static const hex_decode_table_s DRAM_ATTR hex_decode_table = hex_decode_table_build();
+
+/**
+ * @brief Convert binary data to hex digits, two per byte, most significant first
+ *
+ * @param hex    Where to put the 2 * length digits, may be the address of data
+ * @param data   The binary data
+ * @param length Bytes of binary data
+ *
+ * The conversion runs from the end, so the digits never overwrite data
+ * that is still to be read.
+ */
+void hex_encode(uint8_t *hex, const uint8_t *data, size_t length)
+{
+	const uint16_t *pairs = hex_encode_table.pairs;
+	size_t index = length;
+	while (index >= 4) {
+		index -= 4;
+		//
+		// Read all four bytes before storing, converting in place the first digits overlap them
+		//
+		uint16_t pair0 = pairs[data[index]];
+		uint16_t pair1 = pairs[data[index + 1]];
+		uint16_t pair2 = pairs[data[index + 2]];
+		uint16_t pair3 = pairs[data[index + 3]];
+		uint8_t *output = hex + 2 * index;
+		memcpy(output, &pair0, 2);
+		memcpy(output + 2, &pair1, 2);
+		memcpy(output + 4, &pair2, 2);
+		memcpy(output + 6, &pair3, 2);
+	}
+	while (index > 0) {
+		index--;
+		uint16_t pair = pairs[data[index]];
+		memcpy(hex + 2 * index, &pair, 2);
+	}
+}
+
+/**
+ * @brief Convert hex digits to binary data, upper or lower case digits are accepted
+ *
+ * @param data   Where to put the binary data, may be the address of hex
+ * @param hex    The 2 * length digits
+ * @param length Bytes of binary data
+ * @return false if a character is not a hex digit, the data is then incomplete
+ */
+bool hex_decode(uint8_t *data, const uint8_t *hex, size_t length)
+{
+	const uint8_t *values = hex_decode_table.values;
+	uint8_t invalid = 0;
+	size_t index = 0;
+	for (; index + 4 <= length; index += 4) {
+		const uint8_t *input = hex + 2 * index;
+		uint8_t high0 = values[input[0]];
+		uint8_t low0 = values[input[1]];
+		uint8_t high1 = values[input[2]];
+		uint8_t low1 = values[input[3]];
+		uint8_t high2 = values[input[4]];
+		uint8_t low2 = values[input[5]];
+		uint8_t high3 = values[input[6]];
+		uint8_t low3 = values[input[7]];
+		invalid |= high0 | low0 | high1 | low1 | high2 | low2 | high3 | low3;
+		data[index] = (uint8_t)((high0 << 4) | low0);
+		data[index + 1] = (uint8_t)((high1 << 4) | low1);
+		data[index + 2] = (uint8_t)((high2 << 4) | low2);
+		data[index + 3] = (uint8_t)((high3 << 4) | low3);
+	}
+	for (; index < length; index++) {
+		uint8_t high = values[hex[2 * index]];
+		uint8_t low = values[hex[2 * index + 1]];
+		invalid |= high | low;
+		data[index] = (uint8_t)((high << 4) | low);
+	}
+	return (invalid & hex_invalid) == 0;
+}
+
+/**
+ * @brief Digit at a time conversions, the reference for hex_codec_benchmark()
+ *
+ */
+static void hex_reference_encode(uint8_t *hex, const uint8_t *data, size_t length)
+{
+	static const char digits[] = "0123456789abcdef";
+	for (size_t index = 0; index < length; index++) {
+		hex[2 * index] = digits[data[index] >> 4];
+		hex[2 * index + 1] = digits[data[index] & 0x0f];
+	}
+}
+
+static int hex_reference_value(uint8_t digit)
+{
+	if (digit >= '0' && digit <= '9') {
+		return digit - '0';
+	} else if (digit >= 'a' && digit <= 'f') {
+		return digit - 'a' + 10;
+	} else if (digit >= 'A' && digit <= 'F') {
+		return digit - 'A' + 10;
+	}
+	return -1;
+}
+
+static bool hex_reference_decode(uint8_t *data, const uint8_t *hex, size_t length)
+{
+	for (size_t index = 0; index < length; index++) {
+		int high = hex_reference_value(hex[2 * index]);
+		int low = hex_reference_value(hex[2 * index + 1]);
+		if (high < 0 || low < 0) {
+			return false;
+		}
+		data[index] = (uint8_t)((high << 4) | low);
+	}
+	return true;
+}
+
+/**
+ * @brief Convert elapsed time to a rate in KiB per second
+ *
+ */
+static uint32_t hex_codec_rate(uint64_t bytes, int64_t elapsed_us)
+{
+	if (elapsed_us <= 0) {
+		elapsed_us = 1;
+	}
+	return (uint32_t)((bytes * 1000000) / ((uint64_t)elapsed_us * 1024));
+}
+
+/**
+ * @brief Time the codec against the digit at a time reference
+ *
+ * @param length     Bytes of binary data in each conversion
+ * @param iterations Conversions timed in each direction
+ * @param result     Pointer to the structure to be filled
+ * @return false if there was no memory for the buffers or a conversion did not round trip
+ *
+ * Runs on the calling task, on the target call it before the other tasks
+ * start so that they do not disturb the timing.
+ */
+bool hex_codec_benchmark(size_t length, uint32_t iterations, hex_codec_benchmark_t *result)
+{
+	*result = {0};
+	result->length = length;
+	result->iterations = iterations;
+	uint8_t *data = (uint8_t *)malloc(length);
+	uint8_t *hex = (uint8_t *)malloc(2 * length);
+	uint8_t *check = (uint8_t *)malloc(length);
+	if (data == NULL || hex == NULL || check == NULL) {
+		free(data);
+		free(hex);
+		free(check);
+		return false;
+	}
+	for (size_t index = 0; index < length; index++) {
+		data[index] = (uint8_t)(index * 13 + (index >> 8));
+	}
+	memset(check, 0, length);
+	uint64_t bytes = (uint64_t)length * iterations;
+	bool passed = true;
+
+	int64_t start = esp_timer_get_time();
+	for (uint32_t iteration = 0; iteration < iterations; iteration++) {
+		hex_encode(hex, data, length);
+	}
+	result->encode_kib_s = hex_codec_rate(bytes, esp_timer_get_time() - start);
+	start = esp_timer_get_time();
+	for (uint32_t iteration = 0; iteration < iterations; iteration++) {
+		passed &= hex_decode(check, hex, length);
+	}
+	result->decode_kib_s = hex_codec_rate(bytes, esp_timer_get_time() - start);
+	passed &= memcmp(check, data, length) == 0;
+
+	start = esp_timer_get_time();
+	for (uint32_t iteration = 0; iteration < iterations; iteration++) {
+		hex_reference_encode(hex, data, length);
+	}
+	result->reference_encode_kib_s = hex_codec_rate(bytes, esp_timer_get_time() - start);
+	start = esp_timer_get_time();
+	for (uint32_t iteration = 0; iteration < iterations; iteration++) {
+		passed &= hex_reference_decode(check, hex, length);
+	}
+	result->reference_decode_kib_s = hex_codec_rate(bytes, esp_timer_get_time() - start);
+	passed &= memcmp(check, data, length) == 0;
+
+	free(data);
+	free(hex);
+	free(check);
+	return passed;
+}
@@ -0,0 +1,242 @@
+/**
+ * @file link_control.cpp
+ * @author Sid Price (sid@sidprice.com)
+ * @brief ESP32 <-> ctxLink SPI link capability negotiation
+ * @version 0.1
+ * @date 2025-09-04
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * This module builds the link control packets sent to ctxLink and processes
+ * the replies. Until ctxLink accepts a capability the link runs exactly as
+ * it did before negotiation was added.
+ */
+
+#include <Arduino.h>
+
+#include "ctxlink.h"
+#include "link_control.h"
+#include "link_segment.h"
+#include "protocol.h"
+#include "rsp_cache.h"
+#include "serial_control.h"
+#include "spi_buffer_pool.h"
+#include "tasks/task_spi_comms.h"
+
+volatile uint32_t link_negotiated_capabilities = 0;
+
+/**
+ * @brief The largest frame ctxLink reported it can receive
+ *
+ */
+static uint16_t link_peer_max_frame_size = SPI_FRAME_SIZE;
+
+/**
+ * @brief Frame credit, with LINK_CAP_CREDIT
+ *
+ * Only the SPI task uses the credit, it sends the frames and processes
+ * the LINK_CONTROL_CREDIT packets.
+ */
+static link_credit_stats_t credit_stats = {0};
+static bool credit_stalled = false;
+
+/**
+ * @brief Offer the supported capabilities to ctxLink
+ *
+ * The packet is queued to the SPI task for transmission, the negotiated
+ * capabilities are cleared until ctxLink replies. Only the SPI task calls
+ * this, at start-up and on LINK_CONTROL_RESET after the link features were
+ * turned off, so the capabilities never change under a frame being built.
+ * ctxLink firmware without support simply ignores the offer.
+ */
+void link_control_send_hello(void)
+{
+	link_control_packet_s hello = {0};
+	hello.command = LINK_CONTROL_HELLO;
+	hello.version = LINK_CONTROL_VERSION;
+	hello.capabilities = LINK_CAP_SUPPORTED;
+	hello.max_frame_size = SPI_FRAME_SIZE;
+
+	uint8_t *message = spi_buffer_acquire(SPI_BUFFER_OWNER_SPI_COMMS, pdMS_TO_TICKS(100));
+	if (message == NULL) {
+		LOG_WARN(SPI, "Link control: no buffer for HELLO");
+		return;
+	}
+	link_negotiated_capabilities = 0;
+	memcpy(message, &hello, sizeof(hello));
+	package_data(message, sizeof(hello), (protocol_packet_type_e)LINK_PACKET_TYPE_CONTROL_TO_CTXLINK);
+	spi_buffer_tag(message, SPI_BUFFER_OWNER_SPI_COMMS, SPI_BUFFER_STATE_QUEUED);
+	if (xQueueSend(spi_comms_input_queue, &message, 0) != pdTRUE) {
+		spi_buffer_release(message);
+	}
+}
+
+/**
+ * @brief Process a link control packet received from ctxLink
+ *
+ * @param packet_data Pointer to the packet payload
+ * @param data_length Length of the payload
+ */
+void link_control_process(const uint8_t *packet_data, size_t data_length)
+{
+	link_control_packet_s control = {0};
+	//
+	// Later versions may append fields, only the known part is used.
+	//
+	memcpy(&control, packet_data, data_length < sizeof(control) ? data_length : sizeof(control));
+
+	switch (control.command) {
+	case LINK_CONTROL_WELCOME: {
+		link_negotiated_capabilities = control.capabilities & LINK_CAP_SUPPORTED;
+		if (!link_control_has(LINK_CAP_RSP_OFFLOAD)) {
+			//
+			// Only whole payloads can be converted or cached
+			//
+			link_negotiated_capabilities &= ~(LINK_CAP_BINARY_MEMORY | LINK_CAP_RSP_CACHE);
+		}
+		if (control.frame_credits == 0) {
+			link_negotiated_capabilities &= ~LINK_CAP_CREDIT; // A version 1 WELCOME, or no credit to give
+		}
+		credit_stats.window = link_control_has(LINK_CAP_CREDIT) ? control.frame_credits : 0;
+		credit_stats.credits = credit_stats.window;
+		credit_stalled = false;
+		spi_set_tx_window(credit_stats.window);
+		if (control.max_frame_size != 0 && control.max_frame_size < SPI_FRAME_SIZE) {
+			link_peer_max_frame_size = control.max_frame_size;
+		} else {
+			link_peer_max_frame_size = SPI_FRAME_SIZE;
+		}
+		LOG_INFO(SPI, "Link control: v%d capabilities 0x%08x, max frame %d, credit %d", control.version,
+			(unsigned)link_negotiated_capabilities, link_peer_max_frame_size, (int)credit_stats.window);
+		//
+		// With every exchange duplex the direction no longer has to be known
+		// at the SS edge, so transactions can be armed ahead of time.
+		//
+		if (link_control_has(LINK_CAP_DUPLEX)) {
+			spi_enable_prearmed_transactions();
+		}
+		break;
+	}
+
+	case LINK_CONTROL_RESET: {
+		LOG_INFO(SPI, "Link control: ctxLink restarted, renegotiating");
+		link_negotiated_capabilities = 0;
+		link_peer_max_frame_size = SPI_FRAME_SIZE;
+		credit_stats.window = 0;
+		spi_set_tx_window(1);
+		spi_disable_prearmed_transactions();
+		link_segment_reset();
+		rsp_cache_invalidate();
+		link_control_send_hello();
+		break;
+	}
+
+	case LINK_CONTROL_TARGET_CHANGED: {
+		LOG_INFO(SPI, "Link control: target changed");
+		rsp_cache_invalidate();
+		break;
+	}
+
+	case LINK_CONTROL_CREDIT: {
+		//
+		// Credit beyond the initial credit can only be a mistake, ctxLink has no room for more
+		//
+		credit_stats.credits += control.frame_credits;
+		if (credit_stats.credits > credit_stats.window) {
+			credit_stats.credits = credit_stats.window;
+		}
+		credit_stats.returned += control.frame_credits;
+		credit_stats.grants++;
+		credit_stalled = false;
+		break;
+	}
+
+	default:
+		LOG_WARN(SPI, "Link control: unknown command %d", control.command);
+		break;
+	}
+}
+
+/**
+ * @brief Get the capabilities negotiated with ctxLink
+ *
+ */
+uint32_t link_control_capabilities(void)
+{
+	return link_negotiated_capabilities;
+}
+
+/**
+ * @brief Get the largest frame ctxLink can receive
+ *
+ */
+uint16_t link_control_peer_max_frame_size(void)
+{
+	return link_peer_max_frame_size;
+}
+
+/**
+ * @brief Get the longest run of packets that may be sent to ctxLink in one frame
+ *
+ * A batched frame must also carry the empty header that terminates it.
+ */
+size_t link_control_frame_limit(void)
+{
+	size_t limit = link_peer_max_frame_size;
+	if (link_control_has(LINK_CAP_BATCHING)) {
+		limit -= SPI_PACKET_HEADER_SIZE;
+	}
+	return limit;
+}
+
+/**
+ * @brief Get the most data a packet to ctxLink may carry
+ *
+ * With segmentation a packet only has to fit a pool buffer, it is split
+ * into frames on the way out. Without it the packet must fit one frame.
+ */
+size_t link_control_max_packet_data(void)
+{
+	if (link_control_has(LINK_CAP_SEGMENTATION)) {
+		return SPI_BUFFER_SIZE - SPI_PACKET_HEADER_SIZE;
+	}
+	return link_control_frame_limit() - SPI_PACKET_HEADER_SIZE;
+}
+
+/**
+ * @brief Check if ctxLink can accept another frame
+ *
+ * @return true if a frame may be sent, always without LINK_CAP_CREDIT
+ */
+bool link_control_tx_credit_available(void)
+{
+	if (!link_control_has(LINK_CAP_CREDIT) || credit_stats.credits != 0) {
+		return true;
+	}
+	if (!credit_stalled) {
+		credit_stalled = true;
+		credit_stats.stalls++;
+	}
+	return false;
+}
+
+/**
+ * @brief Use a credit for a frame handed to the SPI driver
+ *
+ */
+void link_control_tx_credit_used(void)
+{
+	if (link_control_has(LINK_CAP_CREDIT) && credit_stats.credits != 0) {
+		credit_stats.credits--;
+	}
+}
+
+/**
+ * @brief Get a copy of the frame credit statistics
+ *
+ * @param stats Pointer to the structure to be filled
+ */
+void link_control_get_credit_stats(link_credit_stats_t *stats)
+{
+	*stats = credit_stats;
+}
@@ -0,0 +1,214 @@
+/**
+ * @file link_segment.cpp
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Segmentation and reassembly of packets larger than an SPI frame
+ * @version 0.1
+ * @date 2025-09-15
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * The packet being segmented stays in its pool buffer until the last
+ * fragment has been built. Each fragment is copied to a buffer of its own
+ * so the SPI driver can release it as usual when the frame is sent.
+ *
+ * A received message is rebuilt in the buffer of its first fragment, the
+ * buffers of the following fragments are returned to the pool as soon as
+ * their data has been copied.
+ */
+
+#include <Arduino.h>
+
+#include "link_control.h"
+#include "link_segment.h"
+#include "protocol.h"
+#include "serial_control.h"
+#include "spi_buffer_pool.h"
+
+/**
+ * @brief The packet being sent as fragments, NULL when there is none
+ *
+ */
+static uint8_t *tx_packet = NULL;
+static size_t tx_offset = 0; // Data of tx_packet already sent
+static uint8_t tx_message = 0;
+static uint8_t tx_index = 0;
+
+/**
+ * @brief The message being reassembled, NULL when there is none
+ *
+ * The data is kept at the start of the buffer, the protocol header is
+ * added by package_data() once the last fragment arrives.
+ */
+static uint8_t *rx_message_buffer = NULL;
+static size_t rx_length = 0;
+static uint8_t rx_type = 0;
+static uint8_t rx_message = 0;
+static uint8_t rx_next_index = 0;
+
+static link_segment_stats_t segment_stats = {0};
+
+/**
+ * @brief Start sending a packet as fragments
+ *
+ * @param packet The packet, its buffer is released after the last fragment
+ */
+void link_segment_tx_start(uint8_t *packet)
+{
+	tx_packet = packet;
+	tx_offset = 0;
+	tx_index = 0;
+	tx_message++;
+	segment_stats.messages_segmented++;
+}
+
+/**
+ * @brief Check if fragments of a packet remain to be sent
+ *
+ */
+bool link_segment_tx_pending(void)
+{
+	return tx_packet != NULL;
+}
+
+/**
+ * @brief Build the next fragment of the packet being segmented
+ *
+ * @param frame_limit     Largest packet that may be sent in one frame
+ * @param fragment_length Set to the length of the fragment packet
+ * @return uint8_t* The fragment packet, NULL if no pool buffer is free, try again later
+ */
+uint8_t *link_segment_tx_next(size_t frame_limit, size_t *fragment_length)
+{
+	uint8_t *fragment = spi_buffer_acquire(SPI_BUFFER_OWNER_SPI_COMMS, 0);
+	if (fragment == NULL) {
+		segment_stats.fragment_buffer_waits++;
+		return NULL;
+	}
+	size_t data_length;
+	protocol_packet_type_e packet_type;
+	uint8_t *packet_data;
+	protocol_split(tx_packet, &data_length, &packet_type, &packet_data);
+
+	size_t chunk = data_length - tx_offset;
+	size_t max_chunk = frame_limit - SPI_PACKET_HEADER_SIZE - sizeof(link_fragment_header_s);
+	if (chunk > max_chunk) {
+		chunk = max_chunk;
+	}
+	link_fragment_header_s header;
+	header.type = (uint8_t)packet_type;
+	header.message = tx_message;
+	header.index = tx_index++;
+	header.flags = (tx_offset + chunk == data_length) ? LINK_FRAGMENT_LAST : 0;
+	memcpy(fragment, &header, sizeof(header));
+	memcpy(fragment + sizeof(header), packet_data + tx_offset, chunk);
+	*fragment_length = package_data(fragment, sizeof(header) + chunk,
+		(protocol_packet_type_e)LINK_PACKET_TYPE_FRAGMENT_TO_CTXLINK);
+	tx_offset += chunk;
+	segment_stats.fragments_sent++;
+	if (header.flags & LINK_FRAGMENT_LAST) {
+		spi_buffer_release(tx_packet);
+		tx_packet = NULL;
+	}
+	return fragment;
+}
+
+/**
+ * @brief Drop the message being reassembled
+ *
+ */
+static void link_segment_rx_discard(void)
+{
+	if (rx_message_buffer != NULL) {
+		spi_buffer_release(rx_message_buffer);
+		rx_message_buffer = NULL;
+		segment_stats.reassembly_errors++;
+	}
+}
+
+/**
+ * @brief Add a received fragment to the message being reassembled
+ *
+ * @param fragment The fragment packet, the function takes ownership of its buffer
+ * @return uint8_t* The rebuilt packet once its last fragment has arrived, otherwise NULL
+ */
+uint8_t *link_segment_rx_fragment(uint8_t *fragment)
+{
+	size_t data_length;
+	protocol_packet_type_e packet_type;
+	uint8_t *packet_data;
+	protocol_split(fragment, &data_length, &packet_type, &packet_data);
+	segment_stats.fragments_received++;
+
+	link_fragment_header_s header;
+	if (data_length < sizeof(header)) {
+		spi_buffer_release(fragment);
+		link_segment_rx_discard();
+		return NULL;
+	}
+	memcpy(&header, packet_data, sizeof(header));
+	size_t chunk = data_length - sizeof(header);
+	if (header.type == LINK_PACKET_TYPE_FRAGMENT_FROM_CTXLINK) {
+		spi_buffer_release(fragment); // Fragments are never nested
+		link_segment_rx_discard();
+		return NULL;
+	}
+
+	if (header.index == 0) {
+		//
+		// A new message, anything left of the previous one is incomplete.
+		// The first fragment's buffer becomes the message buffer.
+		//
+		link_segment_rx_discard();
+		memmove(fragment, packet_data + sizeof(header), chunk);
+		spi_buffer_tag(fragment, SPI_BUFFER_OWNER_SPI_COMMS, SPI_BUFFER_STATE_FILLING);
+		rx_message_buffer = fragment;
+		rx_length = chunk;
+		rx_type = header.type;
+		rx_message = header.message;
+		rx_next_index = 1;
+	} else {
+		bool in_sequence = rx_message_buffer != NULL && header.message == rx_message &&
+			header.index == rx_next_index && rx_length + chunk <= SPI_BUFFER_SIZE - SPI_PACKET_HEADER_SIZE;
+		if (!in_sequence) {
+			LOG_WARN(SPI, "Segment: fragment %d of message %d out of sequence", header.index, header.message);
+			spi_buffer_release(fragment);
+			link_segment_rx_discard();
+			return NULL;
+		}
+		memcpy(rx_message_buffer + rx_length, packet_data + sizeof(header), chunk);
+		spi_buffer_release(fragment);
+		rx_length += chunk;
+		rx_next_index++;
+	}
+	if (!(header.flags & LINK_FRAGMENT_LAST)) {
+		return NULL;
+	}
+	uint8_t *message = rx_message_buffer;
+	rx_message_buffer = NULL;
+	package_data(message, rx_length, (protocol_packet_type_e)rx_type);
+	segment_stats.messages_reassembled++;
+	return message;
+}
+
+/**
+ * @brief Abandon the messages being segmented and reassembled, e.g. when ctxLink restarts
+ *
+ */
+void link_segment_reset(void)
+{
+	if (tx_packet != NULL) {
+		spi_buffer_release(tx_packet);
+		tx_packet = NULL;
+	}
+	link_segment_rx_discard();
+}
+
+/**
+ * @brief Get a copy of the segmentation statistics
+ *
+ * @param stats Pointer to the structure to be filled
+ */
+void link_segment_get_stats(link_segment_stats_t *stats)
+{
+	*stats = segment_stats;
+}
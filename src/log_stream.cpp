@@ -0,0 +1,231 @@
+/**
+ * @file log_stream.cpp
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Monitor output streamed to a client of the log port
+ * @version 0.1
+ * @date 2025-10-01
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * The monitor task is the only writer and the network task the only
+ * reader, the ring and the sender are those of stream_ring.h. The ring is
+ * written whether or not a client is connected, so a new client is sent
+ * the backlog first.
+ */
+
+#include <Arduino.h>
+#include <lwip/sockets.h>
+
+#include "log_stream.h"
+#include "protocol.h"
+#include "serial_control.h"
+#include "stream_ring.h"
+#include "tasks/task_server.h"
+
+static stream_ring_t ring = {0};
+static bool session_line_start = false; // Output was lost, skip to the start of the next line
+static log_stream_stats_t stream_stats = {0};
+
+/**
+ * @brief Log command being received from the client
+ *
+ */
+static monitor_command_t client_command = {0};
+
+/**
+ * @brief Take the oldest output not yet sent out of the ring
+ *
+ * @return size_t Number of bytes taken
+ *
+ * After output was lost, the client is sent output again from the start of
+ * the next whole line.
+ */
+static size_t log_stream_fill(uint8_t *buffer, size_t size)
+{
+	xSemaphoreTake(ring.lock, portMAX_DELAY);
+	size_t length = stream_ring_read(&ring, buffer, size);
+	while (session_line_start && length != 0) {
+		uint8_t *line_end = (uint8_t *)memchr(buffer, '\n', length);
+		if (line_end == NULL) {
+			length = stream_ring_read(&ring, buffer, size);
+			continue;
+		}
+		session_line_start = false;
+		length -= (size_t)(line_end + 1 - buffer);
+		memmove(buffer, line_end + 1, length);
+	}
+	xSemaphoreGive(ring.lock);
+	return length;
+}
+
+/**
+ * @brief Check if output is still waiting to be sent
+ *
+ */
+static bool log_stream_waiting(void)
+{
+	xSemaphoreTake(ring.lock, portMAX_DELAY);
+	bool waiting = stream_ring_waiting(&ring) != 0;
+	xSemaphoreGive(ring.lock);
+	return waiting;
+}
+
+static uint8_t send_buffer[LOG_STREAM_SEND_SIZE];
+static stream_sender_t sender = {log_stream_fill, log_stream_waiting, send_buffer, sizeof(send_buffer)};
+
+/**
+ * @brief Allocate the backlog ring
+ *
+ * @return true if a ring was allocated
+ *
+ * Call before the monitor task starts, output written before then is not
+ * kept.
+ */
+bool log_stream_init(void)
+{
+	if (!stream_ring_init(&ring, LOG_STREAM_BACKLOG_SIZE_PSRAM, LOG_STREAM_BACKLOG_SIZE_INTERNAL)) {
+		LOG_ERROR(NET, "Log stream: no memory for the backlog");
+		return false;
+	}
+	sender.budget = ring.size;
+	LOG_INFO(NET, "Log stream: %u byte backlog on port %d", (unsigned)ring.size, LOG_SERVER_PORT);
+	return true;
+}
+
+/**
+ * @brief Start a client session, the client is sent the backlog first
+ *
+ * @param server_queue The log server queue, woken when output is waiting
+ */
+static void log_stream_session_start(QueueHandle_t server_queue)
+{
+	if (ring.data == NULL) {
+		return;
+	}
+	xSemaphoreTake(ring.lock, portMAX_DELAY);
+	ring.read_position = ring.written > ring.size ? ring.written - ring.size : 0;
+	session_line_start = ring.read_position != 0; // The oldest line in the ring may have lost its start
+	stream_sender_start(&sender, server_queue);
+	stream_stats.sessions++;
+	bool backlog = ring.written != 0;
+	xSemaphoreGive(ring.lock);
+	client_command.length = 0;
+	if (backlog) {
+		stream_sender_signal(&sender);
+	}
+}
+
+/**
+ * @brief End the client session
+ *
+ */
+static void log_stream_session_end(void)
+{
+	if (ring.data == NULL) {
+		return;
+	}
+	xSemaphoreTake(ring.lock, portMAX_DELAY);
+	stream_sender_end(&sender);
+	xSemaphoreGive(ring.lock);
+}
+
+/**
+ * @brief Add monitor output to the ring
+ *
+ * @param data   The output
+ * @param length Length of the output
+ *
+ * Called by the monitor task. The oldest output is overwritten, a client
+ * that has not been sent it yet loses it.
+ */
+void log_stream_write(const char *data, size_t length)
+{
+	if (ring.data == NULL || length == 0) {
+		return;
+	}
+	xSemaphoreTake(ring.lock, portMAX_DELAY);
+	stream_stats.bytes_written += length;
+	size_t lost = stream_ring_write(&ring, data, length);
+	if (lost != 0 && sender.queue != NULL) {
+		stream_stats.bytes_lost += (uint32_t)lost;
+		session_line_start = true;
+	}
+	xSemaphoreGive(ring.lock);
+	stream_sender_signal(&sender);
+}
+
+/**
+ * @brief Send the waiting output to the client
+ *
+ * @param client_fd The non-blocking client socket
+ * @return false if the client socket failed
+ */
+static bool log_stream_send(int client_fd)
+{
+	if (ring.data == NULL) {
+		return true;
+	}
+	size_t sent;
+	bool sent_ok = stream_sender_send(&sender, client_fd, &sent);
+	stream_stats.bytes_sent += sent;
+	return sent_ok;
+}
+
+/**
+ * @brief Check if the client socket did not take all of the data of the last send
+ *
+ */
+static bool log_stream_send_blocked(void)
+{
+	return stream_sender_blocked(&sender);
+}
+
+/**
+ * @brief Read log commands from the client
+ *
+ * @param client_fd The non-blocking client socket
+ * @return false if the client closed the connection
+ */
+static bool log_stream_receive(int client_fd)
+{
+	char data[64];
+	ssize_t length = recv(client_fd, data, sizeof(data), 0);
+	if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		return true;
+	}
+	if (length <= 0) {
+		LOG_INFO(NET, "Log client disconnected");
+		return false;
+	}
+	monitor_command_input(&client_command, data, (size_t)length);
+	return true;
+}
+
+/**
+ * @brief Get a copy of the log stream statistics
+ *
+ * @param stats Pointer to the structure to be filled
+ */
+void log_stream_get_stats(log_stream_stats_t *stats)
+{
+	if (ring.data == NULL) {
+		*stats = {0};
+		return;
+	}
+	xSemaphoreTake(ring.lock, portMAX_DELAY);
+	*stats = stream_stats;
+	stats->backlog_size = ring.size;
+	xSemaphoreGive(ring.lock);
+}
+
+/**
+ * @brief The log stream as the source of the log server, the client input is handled here
+ *
+ */
+const server_stream_t log_stream_server = {
+	log_stream_session_start,
+	log_stream_session_end,
+	log_stream_send,
+	log_stream_send_blocked,
+	log_stream_receive,
+};
@@ -13,8 +13,13 @@
 
 #include "ctxlink.h"
 #include "ctxlink_preferences.h"
+#include "hex_codec.h"
+#include "log_stream.h"
 #include "ota.h"
+#include "rsp_cache.h"
 #include "serial_control.h"
+#include "spi_buffer_pool.h"
+#include "swo_stream.h"
 
 #include "tasks/task_monitor.h"
 #include "tasks/task_spi_comms.h"
@@ -26,6 +31,28 @@
  */
 TaskHandle_t wifi_task_handle = 0;
 
+#ifdef HEX_CODEC_BENCHMARK
+/**
+ * @brief Time the hex codec on the target, build with -D HEX_CODEC_BENCHMARK
+ *
+ * Runs before the tasks start so that nothing disturbs the timing.
+ */
+static void hex_codec_report(void)
+{
+	static const size_t lengths[] = {4, 64, 256, 1020}; // Up to the largest m reply ctxLink sends in binary
+	for (size_t length : lengths) {
+		hex_codec_benchmark_t result;
+		if (!hex_codec_benchmark(length, 10000, &result)) {
+			MONITOR(printf("Hex codec: %u bytes failed\r\n", (unsigned)length));
+			continue;
+		}
+		MONITOR(printf("Hex codec: %4u bytes, encode %u KiB/s (reference %u), decode %u KiB/s (reference %u)\r\n",
+			(unsigned)length, result.encode_kib_s, result.reference_encode_kib_s, result.decode_kib_s,
+			result.reference_decode_kib_s));
+	}
+}
+#endif
+
 void setup()
 {
 	//   MONITOR(begin(115200));
@@ -36,13 +63,33 @@ void setup()
 	//     opens
 	// #endif
 	Serial.begin(921600);
-
-	while (!Serial)
-		delay(10); // will pause Zero, Leonardo, etc until serial console opens
-
-	delay(1000);
+#if ARDUINO_USB_MODE && ARDUINO_USB_CDC_ON_BOOT
+	//
+	// Never wait for a USB host, units in the field have none
+	//
+	Serial.setTxTimeoutMs(0);
+#endif
 	MONITOR(println("ctxLink ESP32 WiFi adapter"));
 	//
+	// Allocate the log port backlog before the monitor task starts writing to it
+	//
+	log_stream_init();
+#ifdef HEX_CODEC_BENCHMARK
+	hex_codec_report();
+#endif
+	//
+	// Create the SPI buffer pool before any of its users start
+	//
+	spi_buffer_pool_init();
+	//
+	// Allocate the SWO stream ring, in PSRAM when the module has it
+	//
+	swo_stream_init();
+	//
+	// Allocate the store of the RSP reply cache
+	//
+	rsp_cache_init();
+	//
 	// Set up the SPI hardware for ctxLink communication
 	//
 	initCtxLink();
@@ -0,0 +1,461 @@
+/**
+ * @file packet_trace.cpp
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Cycle counter timestamps of the packets at each hop of the data path
+ * @version 0.1
+ * @date 2025-10-03
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * The events are written by any task or interrupt, the JSON is built by the
+ * network task once the capture has stopped. An event's hop is written last,
+ * an event still being written when the capture stopped is left out.
+ *
+ * In the JSON each hop is a zero length slice on the track of the task that
+ * records it. Flow arrows join the hops of a packet that stays in one pool
+ * buffer: a packet forwarded by the network task or received from ctxLink
+ * starts a flow, it ends when the frame is clocked out or the data is sent
+ * to the client. A packet batched into the frame of another, or cut into
+ * fragments, leaves its flow there.
+ */
+
+#include <Arduino.h>
+#include <esp_cpu.h>
+#include <lwip/sockets.h>
+
+#include <atomic>
+
+#include "packet_trace.h"
+#include "protocol.h"
+#include "serial_control.h"
+#include "stream_ring.h"
+#include "tasks/task_server.h"
+
+/**
+ * @brief An event, PACKET_TRACE_EVENT_COUNT in event until it has been written
+ *
+ */
+typedef struct {
+	uint32_t cycles;       // Cycle count of the core the event happened on
+	const uint8_t *buffer; // The buffer holding the packet
+	uint16_t length;       // Length of the data, at most 0xffff
+	uint8_t core;          // The core the event happened on
+	uint8_t event;         // packet_trace_event_e
+} packet_trace_record_t;
+
+/**
+ * @brief The time base of a core, its cycle count at a known esp_timer_get_time() time
+ *
+ */
+typedef struct {
+	volatile bool calibrated; // Set by the first event on the core
+	uint32_t cycles;          // Cycle count
+	int64_t time_us;          // esp_timer_get_time() at the same moment
+} packet_trace_core_t;
+
+volatile bool packet_trace_running = false;
+
+static packet_trace_record_t *trace_records = NULL;
+static std::atomic<uint32_t> trace_next(0);   // Next slot, counts on past the end once the buffer is full
+static std::atomic<uint32_t> trace_missed(0); // Events recorded after the buffer was full
+static packet_trace_core_t trace_cores[portNUM_PROCESSORS];
+static int64_t trace_start_us = 0;
+static uint32_t trace_cpu_mhz = 0;
+static uint32_t trace_exports = 0;
+
+/**
+ * @brief Set while a client of the trace port is being sent the capture
+ *
+ */
+static volatile bool export_active = false;
+
+/**
+ * @brief Track, name and part in the flow of a packet of each hop
+ *
+ */
+typedef enum : uint8_t {
+	PACKET_TRACE_FLOW_NONE,  // The hop is not part of a flow
+	PACKET_TRACE_FLOW_START, // The packet starts a flow
+	PACKET_TRACE_FLOW_STEP,  // A step of the flow of the buffer, if it has one
+	PACKET_TRACE_FLOW_END,   // The end of the flow of the buffer, if it has one
+} packet_trace_flow_e;
+
+typedef struct {
+	const char *name;
+	uint8_t track;
+	packet_trace_flow_e flow;
+} packet_trace_hop_t;
+
+static const packet_trace_hop_t trace_hops[PACKET_TRACE_EVENT_COUNT] = {
+	{"client read", 1, PACKET_TRACE_FLOW_NONE},
+	{"client forward", 1, PACKET_TRACE_FLOW_START},
+	{"spi frame", 2, PACKET_TRACE_FLOW_STEP},
+	{"spi sent", 3, PACKET_TRACE_FLOW_END},
+	{"spi received", 3, PACKET_TRACE_FLOW_START},
+	{"server queued", 2, PACKET_TRACE_FLOW_STEP},
+	{"client sent", 1, PACKET_TRACE_FLOW_END},
+};
+
+static const char *const trace_track_names[] = {"", "Network task", "SPI task", "SPI transactions"};
+
+/**
+ * @brief Record an event, use packet_trace() which does nothing unless a capture runs
+ *
+ * @param event  The hop
+ * @param buffer The buffer holding the packet
+ * @param length Length of the data
+ */
+void IRAM_ATTR packet_trace_record_event(packet_trace_event_e event, const uint8_t *buffer, size_t length)
+{
+	uint32_t cycles = esp_cpu_get_cycle_count();
+	uint8_t core = (uint8_t)xPortGetCoreID();
+	packet_trace_core_t *time_base = &trace_cores[core];
+	if (!time_base->calibrated) {
+		time_base->time_us = esp_timer_get_time();
+		time_base->cycles = esp_cpu_get_cycle_count();
+		time_base->calibrated = true;
+	}
+	uint32_t slot = trace_next.fetch_add(1, std::memory_order_relaxed);
+	if (slot >= PACKET_TRACE_EVENTS) {
+		trace_missed.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	packet_trace_record_t *record = &trace_records[slot];
+	record->cycles = cycles;
+	record->buffer = buffer;
+	record->length = length > 0xffff ? 0xffff : (uint16_t)length;
+	record->core = core;
+	__atomic_store_n(&record->event, (uint8_t)event, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Start a capture, the previous one is discarded
+ *
+ * @return false if there is no memory for the capture or it is being sent to a client
+ */
+bool packet_trace_start(void)
+{
+	if (export_active) {
+		return false;
+	}
+	packet_trace_running = false;
+	if (trace_records == NULL) {
+		//
+		// The transaction callback records events, the buffer must be in internal RAM
+		//
+		trace_records = (packet_trace_record_t *)heap_caps_malloc(
+			PACKET_TRACE_EVENTS * sizeof(packet_trace_record_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+		if (trace_records == NULL) {
+			LOG_ERROR(NET, "Packet trace: no memory for %u events", PACKET_TRACE_EVENTS);
+			return false;
+		}
+	}
+	for (uint32_t slot = 0; slot < PACKET_TRACE_EVENTS; slot++) {
+		trace_records[slot].event = PACKET_TRACE_EVENT_COUNT;
+	}
+	for (size_t core = 0; core < portNUM_PROCESSORS; core++) {
+		trace_cores[core].calibrated = false;
+	}
+	trace_next.store(0);
+	trace_missed.store(0);
+	trace_cpu_mhz = getCpuFrequencyMhz();
+	trace_start_us = esp_timer_get_time();
+	packet_trace_running = true;
+	return true;
+}
+
+/**
+ * @brief Stop the capture, it is kept until the next one starts
+ *
+ */
+void packet_trace_stop(void)
+{
+	packet_trace_running = false;
+}
+
+/**
+ * @brief Get a copy of the capture statistics
+ *
+ * @param stats Pointer to the structure to be filled
+ */
+void packet_trace_get_stats(packet_trace_stats_t *stats)
+{
+	uint32_t next = trace_next.load();
+	stats->running = packet_trace_running;
+	stats->recorded = next < PACKET_TRACE_EVENTS ? next : PACKET_TRACE_EVENTS;
+	stats->capacity = trace_records != NULL ? PACKET_TRACE_EVENTS : 0;
+	stats->missed = trace_missed.load();
+	stats->exports = trace_exports;
+}
+
+//
+// Export of the capture to a client of the trace port, run by the network task
+//
+
+/**
+ * @brief Pool buffers whose flow is followed at once, more than the pool and the static packets
+ *
+ */
+#define PACKET_TRACE_FLOWS 32
+
+/**
+ * @brief Room left in the send buffer before another event is built, an event takes less
+ *
+ */
+#define PACKET_TRACE_JSON_MAX 400
+
+typedef enum : uint8_t {
+	EXPORT_HEADER,
+	EXPORT_EVENTS,
+	EXPORT_FOOTER,
+	EXPORT_DONE,
+} export_stage_e;
+
+typedef struct {
+	const uint8_t *buffer;
+	uint32_t id; // 0 while the buffer has no flow
+} export_flow_t;
+
+static export_stage_e export_stage = EXPORT_DONE;
+static uint32_t export_slot = 0;
+static uint32_t export_count = 0;
+static int64_t export_cycles[portNUM_PROCESSORS]; // Cycles since the core's calibration, extended past 32 bits
+static uint32_t export_last_cycles[portNUM_PROCESSORS];
+static export_flow_t export_flows[PACKET_TRACE_FLOWS];
+static uint32_t export_flow_id = 0;
+static bool export_shut_down = false;
+
+/**
+ * @brief Find the flow of a buffer
+ *
+ * @return export_flow_t* The flow entry of the buffer, or a free one, NULL if there are none
+ */
+static export_flow_t *packet_trace_flow(const uint8_t *buffer)
+{
+	export_flow_t *unused = NULL;
+	for (size_t index = 0; index < PACKET_TRACE_FLOWS; index++) {
+		if (export_flows[index].buffer == buffer) {
+			return &export_flows[index];
+		}
+		if (unused == NULL && export_flows[index].id == 0) {
+			unused = &export_flows[index];
+		}
+	}
+	if (unused != NULL) {
+		unused->buffer = buffer;
+	}
+	return unused;
+}
+
+/**
+ * @brief Append the JSON of an event to the send buffer
+ *
+ * @return size_t Number of characters appended
+ */
+static size_t packet_trace_format_event(char *out, size_t size, const packet_trace_record_t *record)
+{
+	uint8_t core = record->core;
+	if (core >= portNUM_PROCESSORS || !trace_cores[core].calibrated) {
+		return 0;
+	}
+	//
+	// A signed step copes with the counter wrapping and with an interrupt's
+	// event taking an earlier slot than the event it interrupted
+	//
+	export_cycles[core] += (int32_t)(record->cycles - export_last_cycles[core]);
+	export_last_cycles[core] = record->cycles;
+	double time_us = (double)(trace_cores[core].time_us - trace_start_us) + (double)export_cycles[core] / trace_cpu_mhz;
+	const packet_trace_hop_t *hop = &trace_hops[record->event];
+	int length = snprintf(out, size,
+		",\n{\"name\":\"%s\",\"cat\":\"packet\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":0,\"pid\":1,\"tid\":%u,"
+		"\"args\":{\"core\":%u,\"bytes\":%u,\"buffer\":\"%p\"}}",
+		hop->name, time_us, hop->track, core, record->length, record->buffer);
+	if (length < 0 || (size_t)length >= size) {
+		return 0;
+	}
+	//
+	// Join the hops of the packet with a flow
+	//
+	export_flow_t *flow = hop->flow != PACKET_TRACE_FLOW_NONE ? packet_trace_flow(record->buffer) : NULL;
+	if (flow == NULL) {
+		return (size_t)length;
+	}
+	char phase;
+	if (hop->flow == PACKET_TRACE_FLOW_START) {
+		flow->id = ++export_flow_id;
+		phase = 's';
+	} else if (flow->id == 0) {
+		return (size_t)length;
+	} else {
+		phase = hop->flow == PACKET_TRACE_FLOW_END ? 'f' : 't';
+	}
+	int flow_length = snprintf(out + length, size - length,
+		",\n{\"name\":\"packet\",\"cat\":\"packet\",\"ph\":\"%c\",\"id\":%u,\"ts\":%.3f,\"pid\":1,\"tid\":%u%s}", phase,
+		(unsigned)flow->id, time_us, hop->track, phase == 's' ? "" : ",\"bp\":\"e\"");
+	if (phase == 'f') {
+		flow->id = 0;
+	}
+	if (flow_length < 0 || (size_t)flow_length >= size - length) {
+		return (size_t)length;
+	}
+	return (size_t)(length + flow_length);
+}
+
+/**
+ * @brief Build the next part of the JSON
+ *
+ * @return size_t Number of characters built, 0 once the JSON is complete
+ */
+static size_t packet_trace_export(uint8_t *buffer, size_t size)
+{
+	char *out = (char *)buffer;
+	size_t length = 0;
+	switch (export_stage) {
+	case EXPORT_HEADER: {
+		int written = snprintf(out, size,
+			"{\"displayTimeUnit\":\"ns\",\"otherData\":{\"cpu_mhz\":%u,\"events\":%u,\"missed\":%u},\n"
+			"\"traceEvents\":[\n"
+			"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"ctxLink ESP32\"}}",
+			(unsigned)trace_cpu_mhz, (unsigned)export_count, (unsigned)trace_missed.load());
+		length = written > 0 ? (size_t)written : 0;
+		for (uint8_t track = 1; track < sizeof(trace_track_names) / sizeof(trace_track_names[0]); track++) {
+			written = snprintf(out + length, size - length,
+				",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", track,
+				trace_track_names[track]);
+			length += written > 0 ? (size_t)written : 0;
+		}
+		export_stage = EXPORT_EVENTS;
+		break;
+	}
+	case EXPORT_EVENTS: {
+		while (export_slot < export_count && size - length >= PACKET_TRACE_JSON_MAX) {
+			const packet_trace_record_t *record = &trace_records[export_slot++];
+			if (__atomic_load_n(&record->event, __ATOMIC_ACQUIRE) < PACKET_TRACE_EVENT_COUNT) {
+				length += packet_trace_format_event(out + length, size - length, record);
+			}
+		}
+		if (export_slot == export_count) {
+			export_stage = EXPORT_FOOTER;
+		}
+		break;
+	}
+	case EXPORT_FOOTER: {
+		static const char footer[] = "\n]}\n";
+		memcpy(out, footer, sizeof(footer) - 1);
+		length = sizeof(footer) - 1;
+		export_stage = EXPORT_DONE;
+		trace_exports++;
+		break;
+	}
+	default:
+		break;
+	}
+	return length;
+}
+
+/**
+ * @brief Check if more of the JSON is to be built
+ *
+ */
+static bool packet_trace_export_waiting(void)
+{
+	return export_stage != EXPORT_DONE;
+}
+
+static uint8_t send_buffer[PACKET_TRACE_SEND_SIZE];
+static stream_sender_t sender = {
+	packet_trace_export, packet_trace_export_waiting, send_buffer, sizeof(send_buffer), 4 * sizeof(send_buffer)};
+
+/**
+ * @brief A client connected, stop the capture and start sending it
+ *
+ * @param server_queue The trace server queue
+ */
+static void packet_trace_session_start(QueueHandle_t server_queue)
+{
+	packet_trace_stop();
+	export_active = true;
+	export_stage = EXPORT_HEADER;
+	export_slot = 0;
+	uint32_t next = trace_next.load();
+	export_count = trace_records == NULL ? 0 : (next < PACKET_TRACE_EVENTS ? next : PACKET_TRACE_EVENTS);
+	for (size_t core = 0; core < portNUM_PROCESSORS; core++) {
+		export_cycles[core] = 0;
+		export_last_cycles[core] = trace_cores[core].cycles;
+	}
+	memset(export_flows, 0, sizeof(export_flows));
+	export_flow_id = 0;
+	export_shut_down = false;
+	stream_sender_start(&sender, server_queue);
+	stream_sender_signal(&sender);
+}
+
+/**
+ * @brief The client disconnected, a new capture may start
+ *
+ */
+static void packet_trace_session_end(void)
+{
+	stream_sender_end(&sender);
+	export_stage = EXPORT_DONE;
+	export_active = false;
+}
+
+/**
+ * @brief Send the next part of the JSON to the client
+ *
+ * @param client_fd The non-blocking client socket
+ * @return false if the client socket failed
+ *
+ * Once all of the JSON has been sent the socket is shut down for writing,
+ * the client sees the end of the file and closes the connection.
+ */
+static bool packet_trace_send(int client_fd)
+{
+	size_t sent;
+	if (!stream_sender_send(&sender, client_fd, &sent)) {
+		return false;
+	}
+	if (export_stage == EXPORT_DONE && !stream_sender_blocked(&sender) && !export_shut_down) {
+		shutdown(client_fd, SHUT_WR);
+		export_shut_down = true;
+	}
+	return true;
+}
+
+/**
+ * @brief Check if the client socket did not take all of the data of the last send
+ *
+ */
+static bool packet_trace_send_blocked(void)
+{
+	return stream_sender_blocked(&sender);
+}
+
+/**
+ * @brief Discard any input from the client, and see it close
+ *
+ * @param client_fd The non-blocking client socket
+ * @return false if the client closed the connection
+ */
+static bool packet_trace_receive(int client_fd)
+{
+	char data[32];
+	ssize_t length = recv(client_fd, data, sizeof(data), 0);
+	if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		return true;
+	}
+	return length > 0;
+}
+
+/**
+ * @brief The capture as the source of the trace server, the client input is discarded here
+ *
+ */
+const server_stream_t packet_trace_server = {
+	packet_trace_session_start,
+	packet_trace_session_end,
+	packet_trace_send,
+	packet_trace_send_blocked,
+	packet_trace_receive,
+};
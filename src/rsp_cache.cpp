@@ -0,0 +1,220 @@
+/**
+ * @file rsp_cache.cpp
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Cache of ctxLink's replies to the static GDB queries
+ * @version 0.1
+ * @date 2025-09-26
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * Only the network task looks up and stores replies, the SPI task
+ * invalidates the cache when ctxLink reports a target change. It does so
+ * by moving the generation on, the network task empties the store the next
+ * time it uses it. A reply that was requested before the change is not
+ * stored.
+ *
+ * Requests and replies are appended to one store and never removed one at
+ * a time, once the store is full further replies are simply not cached.
+ */
+
+#include <Arduino.h>
+
+#include "link_control.h"
+#include "psram_alloc.h"
+#include "rsp_cache.h"
+#include "serial_control.h"
+
+/**
+ * @brief A cached reply, the request is stored first and the reply straight after it
+ *
+ */
+typedef struct {
+	uint32_t offset;         // Offset of the request in the store
+	uint16_t request_length; // Length of the request
+	uint16_t reply_length;   // Length of the reply
+} rsp_cache_entry_t;
+
+/**
+ * @brief The queries cached, matched at the start of the request
+ *
+ */
+static const char *const rsp_cache_queries[] = {
+	"qSupported",
+	"qXfer:features:read:",
+	"qXfer:memory-map:read:",
+};
+
+static uint8_t *store = NULL;
+static size_t store_size = 0;
+static size_t store_used = 0;
+static rsp_cache_entry_t entries[RSP_CACHE_ENTRIES];
+static uint32_t entry_count = 0;
+
+/**
+ * @brief Moved on by rsp_cache_invalidate(), the store is emptied when it no longer matches
+ *
+ */
+static volatile uint32_t invalidate_generation = 0;
+static uint32_t store_generation = 0;
+
+/**
+ * @brief The request forwarded to ctxLink whose reply is to be cached, none if pending_length is 0
+ *
+ */
+static uint8_t pending_request[RSP_CACHE_REQUEST_MAX];
+static size_t pending_length = 0;
+static uint32_t pending_generation = 0;
+
+static rsp_cache_stats_t cache_stats = {0};
+
+/**
+ * @brief Allocate the store
+ *
+ * @return true if a store was allocated
+ */
+bool rsp_cache_init(void)
+{
+	store = (uint8_t *)psram_alloc(&store_size, RSP_CACHE_SIZE_PSRAM, RSP_CACHE_SIZE_INTERNAL);
+	if (store == NULL) {
+		LOG_ERROR(NET, "RSP cache: no memory for the store");
+		return false;
+	}
+	LOG_INFO(NET, "RSP cache: %u byte store", (unsigned)store_size);
+	return true;
+}
+
+/**
+ * @brief Empty the store if the target changed since it was filled
+ *
+ */
+static void rsp_cache_check_generation(void)
+{
+	uint32_t generation = invalidate_generation;
+	if (generation == store_generation) {
+		return;
+	}
+	store_generation = generation;
+	store_used = 0;
+	entry_count = 0;
+	cache_stats.invalidations++;
+}
+
+/**
+ * @brief Check if a request is one of the static queries
+ *
+ */
+static bool rsp_cache_is_query(const uint8_t *request, size_t request_length)
+{
+	if (request_length > RSP_CACHE_REQUEST_MAX) {
+		return false;
+	}
+	for (const char *query : rsp_cache_queries) {
+		size_t query_length = strlen(query);
+		if (request_length >= query_length && memcmp(request, query, query_length) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Look up a request from GDB on its way to ctxLink, with LINK_CAP_RSP_CACHE
+ *
+ * @param request        The payload of the request
+ * @param request_length Length of the request
+ * @param reply_length   Set to the length of the cached reply
+ * @return const uint8_t* The cached reply payload, NULL to forward the request
+ *
+ * When a static query is not in the cache the reply to it is cached by the
+ * next call of rsp_cache_reply(). The reply returned stays valid until the
+ * next call of rsp_cache_request().
+ */
+const uint8_t *rsp_cache_request(const uint8_t *request, size_t request_length, size_t *reply_length)
+{
+	pending_length = 0;
+	if (store == NULL || !link_control_has(LINK_CAP_RSP_CACHE) || !rsp_cache_is_query(request, request_length)) {
+		return NULL;
+	}
+	rsp_cache_check_generation();
+	for (uint32_t index = 0; index < entry_count; index++) {
+		const rsp_cache_entry_t *entry = &entries[index];
+		if (entry->request_length == request_length && memcmp(store + entry->offset, request, request_length) == 0) {
+			cache_stats.hits++;
+			*reply_length = entry->reply_length;
+			return store + entry->offset + entry->request_length;
+		}
+	}
+	cache_stats.misses++;
+	memcpy(pending_request, request, request_length);
+	pending_length = request_length;
+	pending_generation = store_generation;
+	return NULL;
+}
+
+/**
+ * @brief Cache a reply from ctxLink if it answers a static query
+ *
+ * @param reply        The payload of the reply
+ * @param reply_length Length of the reply
+ *
+ * Errors and empty replies are not cached, ctxLink may answer differently
+ * once a target is attached.
+ */
+void rsp_cache_reply(const uint8_t *reply, size_t reply_length)
+{
+	if (pending_length == 0) {
+		return;
+	}
+	size_t request_length = pending_length;
+	pending_length = 0;
+	rsp_cache_check_generation();
+	if (pending_generation != store_generation || reply_length == 0 || reply[0] == 'E') {
+		return;
+	}
+	if (entry_count == RSP_CACHE_ENTRIES || store_used + request_length + reply_length > store_size) {
+		cache_stats.full++;
+		return;
+	}
+	rsp_cache_entry_t *entry = &entries[entry_count++];
+	entry->offset = (uint32_t)store_used;
+	entry->request_length = (uint16_t)request_length;
+	entry->reply_length = (uint16_t)reply_length;
+	memcpy(store + store_used, pending_request, request_length);
+	memcpy(store + store_used + request_length, reply, reply_length);
+	store_used += request_length + reply_length;
+}
+
+/**
+ * @brief Forget the request waiting for its reply, the GDB client went away
+ *
+ */
+void rsp_cache_cancel(void)
+{
+	pending_length = 0;
+}
+
+/**
+ * @brief Empty the cache, the target changed
+ *
+ * Called by the SPI task when ctxLink sends LINK_CONTROL_TARGET_CHANGED or
+ * restarts.
+ */
+void rsp_cache_invalidate(void)
+{
+	invalidate_generation = invalidate_generation + 1;
+}
+
+/**
+ * @brief Get a copy of the cache statistics
+ *
+ * @param stats Pointer to the structure to be filled
+ *
+ * Called from the other tasks for the reports, the counts may be a moment old.
+ */
+void rsp_cache_get_stats(rsp_cache_stats_t *stats)
+{
+	*stats = cache_stats;
+	stats->store_size = store_size;
+	stats->store_used = store_used;
+	stats->entries = entry_count;
+}
@@ -0,0 +1,354 @@
+/**
+ * @file rsp_framer.cpp
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Framing of GDB client input into whole RSP packets
+ * @version 0.1
+ * @date 2025-09-22
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * The framer follows the RSP stream byte by byte. Between packets every
+ * byte other than '$' is a whole unit on its own, GDB sends '+' and '-'
+ * there and the odd stray byte is passed on rather than held. Inside a
+ * packet a '#' can only be the end, binary data escapes it with '}', so
+ * the packet is whole two checksum digits later. Only the bytes after the
+ * last whole unit are held back.
+ *
+ * The checksum is the modulo 256 sum of the bytes between '$' and '#', as
+ * sent, escapes included.
+ */
+
+#include <Arduino.h>
+
+#include "rsp_framer.h"
+
+/**
+ * @brief The request that switches GDB to no-ack mode
+ *
+ */
+static const char rsp_no_ack_request[] = "QStartNoAckMode";
+
+static const char rsp_hex_digits[] = "0123456789abcdef";
+
+/**
+ * @brief Start framing a new connection, any bytes held back are dropped
+ *
+ */
+void rsp_framer_reset(rsp_framer_t *framer)
+{
+	framer->state = RSP_FRAMER_BETWEEN_PACKETS;
+	framer->hold_length = 0;
+	framer->hold_deferred = false;
+	framer->discarding = false;
+	framer->no_ack = false;
+	framer->no_ack_requested = false;
+	framer->retransmit_length = 0;
+}
+
+/**
+ * @brief Copy the bytes held back by the previous read to the start of the next read
+ *
+ * @param framer The framer
+ * @param data   Start of the data of the packet being built, room for max_length bytes
+ * @param max_length Most data the packet may carry
+ * @return size_t Number of bytes copied, read the client data after them
+ */
+size_t rsp_framer_restore(rsp_framer_t *framer, uint8_t *data, size_t max_length)
+{
+	if (framer->hold_length > max_length || (framer->hold_length == max_length && !framer->hold_deferred)) {
+		//
+		// The link was renegotiated to smaller packets, the held bytes can no longer be forwarded whole. Deferred
+		// units are not added to, they may fill the read.
+		//
+		rsp_framer_reset(framer);
+	}
+	memcpy(data, framer->hold, framer->hold_length);
+	framer->packet_start = 0; // Only an incomplete packet is held when unwrapping
+	return framer->hold_length;
+}
+
+/**
+ * @brief Frame the data of a read, after the bytes returned by rsp_framer_restore()
+ *
+ * @param framer     The framer
+ * @param data       The held bytes followed by the new data
+ * @param length     Length of data, updated when interrupts are taken out
+ * @param max_length Most data the packet may carry
+ * @param interrupt  Set if an interrupt was found between packets
+ * @return size_t Length of the whole units at the start of data to forward now, 0 if none
+ *
+ * The bytes after the whole units are held back for the next read. An
+ * incomplete packet that fills max_length can never be held whole and is
+ * forwarded in parts as before.
+ */
+size_t rsp_framer_frame(rsp_framer_t *framer, uint8_t *data, size_t *length, size_t max_length, bool *interrupt)
+{
+	size_t output = framer->hold_length;
+	size_t complete = 0; // Held bytes are never a whole unit
+	rsp_framer_state_e state = framer->state;
+	for (size_t input = framer->hold_length; input < *length; input++) {
+		uint8_t value = data[input];
+		if (state == RSP_FRAMER_BETWEEN_PACKETS && value == RSP_INTERRUPT) {
+			*interrupt = true;
+			framer->stats.interrupts++;
+			continue;
+		}
+		data[output++] = value;
+		switch (state) {
+		case RSP_FRAMER_BETWEEN_PACKETS:
+			if (value == '$') {
+				state = RSP_FRAMER_PACKET_DATA;
+			} else {
+				complete = output;
+			}
+			break;
+		case RSP_FRAMER_PACKET_DATA:
+			if (value == '}') {
+				state = RSP_FRAMER_PACKET_ESCAPE;
+			} else if (value == '#') {
+				state = RSP_FRAMER_CHECKSUM_HIGH;
+			}
+			break;
+		case RSP_FRAMER_PACKET_ESCAPE:
+			state = RSP_FRAMER_PACKET_DATA;
+			break;
+		case RSP_FRAMER_CHECKSUM_HIGH:
+			state = RSP_FRAMER_CHECKSUM_LOW;
+			break;
+		case RSP_FRAMER_CHECKSUM_LOW:
+			state = RSP_FRAMER_BETWEEN_PACKETS;
+			complete = output;
+			framer->stats.rsp_packets++;
+			break;
+		}
+	}
+	*length = output;
+	framer->state = state;
+	framer->stats.reads++;
+	if (complete == 0 && output >= max_length) {
+		complete = output;
+		framer->stats.oversize_passes++;
+	}
+	framer->hold_length = output - complete;
+	framer->hold_deferred = false;
+	memcpy(framer->hold, data + complete, framer->hold_length);
+	if (complete == 0) {
+		framer->stats.held_reads++;
+	} else {
+		framer->stats.packets_sent++;
+	}
+	return complete;
+}
+
+/**
+ * @brief Get the value of a checksum digit
+ *
+ * @return int The value, -1 if the character is not a hex digit
+ */
+static int rsp_hex_value(uint8_t digit)
+{
+	if (digit >= '0' && digit <= '9') {
+		return digit - '0';
+	} else if (digit >= 'a' && digit <= 'f') {
+		return digit - 'a' + 10;
+	} else if (digit >= 'A' && digit <= 'F') {
+		return digit - 'A' + 10;
+	}
+	return -1;
+}
+
+/**
+ * @brief Find the next unit in the data of a read, with LINK_CAP_RSP_OFFLOAD
+ *
+ * @param framer         The framer
+ * @param data           The held bytes followed by the new data
+ * @param length         Length of data
+ * @param offset         Where to continue, start after the held bytes, updated past the unit found
+ * @param payload        Set to the payload of a packet, within data
+ * @param payload_length Set to the length of the payload
+ * @return rsp_unit_e The unit found, RSP_UNIT_NONE once the data has been used up
+ *
+ * Call until RSP_UNIT_NONE is returned, then call rsp_framer_unwrap_done().
+ * Bytes between packets that are not acks or interrupts are dropped.
+ */
+rsp_unit_e rsp_framer_unwrap(
+	rsp_framer_t *framer, uint8_t *data, size_t length, size_t *offset, uint8_t **payload, size_t *payload_length)
+{
+	while (*offset < length) {
+		uint8_t value = data[(*offset)++];
+		switch (framer->state) {
+		case RSP_FRAMER_BETWEEN_PACKETS:
+			if (value == '$') {
+				framer->state = RSP_FRAMER_PACKET_DATA;
+				framer->packet_start = *offset - 1;
+				framer->checksum = 0;
+			} else if (value == '+') {
+				framer->stats.acks_received++;
+				return RSP_UNIT_ACK;
+			} else if (value == '-') {
+				return RSP_UNIT_NAK;
+			} else if (value == RSP_INTERRUPT) {
+				framer->stats.interrupts++;
+				return RSP_UNIT_INTERRUPT;
+			}
+			break;
+		case RSP_FRAMER_PACKET_DATA:
+			if (value == '#') {
+				framer->state = RSP_FRAMER_CHECKSUM_HIGH;
+				break;
+			}
+			framer->checksum += value;
+			if (value == '}') {
+				framer->state = RSP_FRAMER_PACKET_ESCAPE;
+			}
+			break;
+		case RSP_FRAMER_PACKET_ESCAPE:
+			framer->checksum += value;
+			framer->state = RSP_FRAMER_PACKET_DATA;
+			break;
+		case RSP_FRAMER_CHECKSUM_HIGH:
+			framer->checksum_received = rsp_hex_value(value);
+			framer->state = RSP_FRAMER_CHECKSUM_LOW;
+			break;
+		case RSP_FRAMER_CHECKSUM_LOW: {
+			int low = rsp_hex_value(value);
+			framer->state = RSP_FRAMER_BETWEEN_PACKETS;
+			if (framer->discarding) {
+				framer->discarding = false;
+				framer->stats.dropped++;
+				return RSP_UNIT_OVERSIZE;
+			}
+			if (framer->checksum_received < 0 || low < 0 ||
+				((framer->checksum_received << 4) | low) != framer->checksum) {
+				framer->stats.checksum_errors++;
+				return RSP_UNIT_BAD_CHECKSUM;
+			}
+			*payload = data + framer->packet_start + 1;
+			*payload_length = *offset - 3 - (framer->packet_start + 1);
+			if (*payload_length == sizeof(rsp_no_ack_request) - 1 &&
+				memcmp(*payload, rsp_no_ack_request, *payload_length) == 0) {
+				framer->no_ack_requested = true;
+			}
+			framer->stats.rsp_packets++;
+			return RSP_UNIT_PACKET;
+		}
+		}
+	}
+	return RSP_UNIT_NONE;
+}
+
+/**
+ * @brief Hold back the incomplete packet at the end of the data unwrapped
+ *
+ * @param framer     The framer
+ * @param data       The data passed to rsp_framer_unwrap()
+ * @param length     Length of data
+ * @param max_length Most data a read may hold, an incomplete packet this long can never be held whole
+ */
+void rsp_framer_unwrap_done(rsp_framer_t *framer, const uint8_t *data, size_t length, size_t max_length)
+{
+	framer->stats.reads++;
+	framer->hold_length = 0;
+	framer->hold_deferred = false;
+	if (framer->state == RSP_FRAMER_BETWEEN_PACKETS || framer->discarding) {
+		return;
+	}
+	size_t partial = length - framer->packet_start;
+	if (partial >= max_length) {
+		framer->discarding = true; // Dropped up to its checksum
+		return;
+	}
+	memcpy(framer->hold, data + framer->packet_start, partial);
+	framer->hold_length = partial;
+}
+
+/**
+ * @brief Hold back the units not yet handled, the SPI path has no room for them
+ *
+ * @param framer     The framer
+ * @param data       The data passed to rsp_framer_unwrap()
+ * @param length     Length of data
+ * @param unit_start Offset of the first unit not handled, the framer must be between packets
+ *
+ * Call instead of rsp_framer_unwrap_done(). The held units are unwrapped
+ * again from the start, ahead of any further data from the client.
+ */
+void rsp_framer_unwrap_defer(rsp_framer_t *framer, const uint8_t *data, size_t length, size_t unit_start)
+{
+	framer->stats.reads++;
+	framer->stats.deferred++;
+	framer->hold_length = length - unit_start;
+	framer->hold_deferred = true;
+	memmove(framer->hold, data + unit_start, framer->hold_length);
+}
+
+/**
+ * @brief Wrap a payload from ctxLink into an RSP packet for GDB, with LINK_CAP_RSP_OFFLOAD
+ *
+ * @param framer  The framer
+ * @param message The pool buffer holding the protocol packet with the payload
+ * @param length  Set to the length of the RSP packet
+ * @return uint8_t* The RSP packet, within message, NULL if the payload is too long to wrap
+ *
+ * Until GDB switches to no-ack mode a copy is kept for rsp_framer_retransmit().
+ */
+uint8_t *rsp_framer_wrap(rsp_framer_t *framer, uint8_t *message, size_t *length)
+{
+	size_t payload_length;
+	protocol_packet_type_e packet_type;
+	uint8_t *payload;
+	protocol_split(message, &payload_length, &packet_type, &payload);
+	if (payload_length > RSP_OFFLOAD_MAX_PAYLOAD) {
+		framer->stats.dropped++;
+		return NULL;
+	}
+	if (framer->no_ack_requested) {
+		//
+		// Any reply to QStartNoAckMode ends the request, only OK starts no-ack mode
+		//
+		framer->no_ack_requested = false;
+		framer->no_ack = payload_length == 2 && payload[0] == 'O' && payload[1] == 'K';
+	}
+	uint8_t checksum = 0;
+	for (size_t index = 0; index < payload_length; index++) {
+		checksum += payload[index];
+	}
+	payload[-1] = '$';
+	payload[payload_length] = '#';
+	payload[payload_length + 1] = rsp_hex_digits[checksum >> 4];
+	payload[payload_length + 2] = rsp_hex_digits[checksum & 0x0f];
+	*length = payload_length + 4;
+	framer->retransmit_length = 0;
+	if (!framer->no_ack) {
+		memcpy(framer->retransmit, payload - 1, *length);
+		framer->retransmit_length = *length;
+	}
+	return payload - 1;
+}
+
+/**
+ * @brief Get the last packet sent to GDB, to send it again after a NAK
+ *
+ * @param framer The framer
+ * @param length Set to the length of the packet, 0 if none is kept
+ * @return const uint8_t* The packet
+ */
+const uint8_t *rsp_framer_retransmit(rsp_framer_t *framer, size_t *length)
+{
+	*length = framer->retransmit_length;
+	if (*length != 0) {
+		framer->stats.retransmits++;
+	}
+	return framer->retransmit;
+}
+
+/**
+ * @brief Get a copy of the framing statistics
+ *
+ * @param framer The framer
+ * @param stats  Pointer to the structure to be filled
+ */
+void rsp_framer_get_stats(const rsp_framer_t *framer, rsp_framer_stats_t *stats)
+{
+	*stats = framer->stats;
+}
@@ -0,0 +1,580 @@
+/**
+ * @file sim_ctxlink_master.cpp
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Host simulator of the ctxLink end of the SPI link
+ * @version 0.1
+ * @date 2025-09-10
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * ctxLink starts a transaction when the ESP32 asserts ATTN or when it has a
+ * packet of its own to send. It pulls SS low, waits for nSPI_READY, clocks
+ * the transfer at the configured rate and releases SS. Until duplex has
+ * been negotiated a transaction carries data one way only, a read when
+ * ATTN is asserted, otherwise a write.
+ *
+ * With LINK_CAP_CREDIT the master returns credit for the frames it has
+ * processed once half of its initial credit is owed, ahead of any other
+ * packet waiting for the ESP32.
+ */
+
+#include <Arduino.h>
+
+#include <deque>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#include "ctxlink.h"
+#include "hex_codec.h"
+#include "link_control.h"
+#include "link_segment.h"
+#include "protocol.h"
+#include "sim_ctxlink_master.h"
+#include "sim_hal.h"
+#include "sim_spi_slave.h"
+#include "spi_buffer_pool.h"
+#include "tasks/task_server.h"
+
+/**
+ * @brief Handshake pins, these must match ctxlink.cpp
+ *
+ */
+static constexpr uint8_t SIM_nSPI_READY = 7;
+static constexpr uint8_t SIM_SPI_SS = 34;
+
+/**
+ * @brief Pause while nothing is pending, the master is woken by any pin change
+ *
+ */
+static constexpr uint32_t sim_master_idle_wait_us = 1000;
+
+/**
+ * @brief Most SWO packets queued for the ESP32 at once, ctxLink's trace buffer is not unbounded either
+ *
+ */
+static constexpr size_t sim_master_swo_backlog = 8;
+
+static sim_master_config_t master_config;
+static sim_master_stats_t master_stats;
+static std::mutex master_stats_lock;
+static volatile bool master_running = false;
+static volatile uint32_t master_capabilities = 0;
+static TaskHandle_t master_task_handle = NULL;
+
+/**
+ * @brief Packets waiting to be sent to the ESP32, each holds header and data
+ *
+ */
+static std::deque<std::vector<uint8_t>> master_tx_packets;
+static std::mutex master_tx_lock;
+
+/**
+ * @brief The message being reassembled from fragments sent by the ESP32
+ *
+ */
+static std::vector<uint8_t> master_rx_message;
+static link_fragment_header_s master_rx_fragment;
+static bool master_rx_reassembling = false;
+static uint8_t master_tx_message = 0;
+static uint32_t master_credit_owed = 0;
+
+static uint8_t master_tx_frame[SPI_FRAME_SIZE] __attribute__((aligned(4)));
+static uint8_t master_rx_frame[SPI_FRAME_SIZE] __attribute__((aligned(4)));
+
+/**
+ * @brief Queue a packet for the ESP32
+ *
+ */
+static void sim_master_queue_packet(uint8_t type, const uint8_t *data, size_t length)
+{
+	std::vector<uint8_t> packet(SPI_PACKET_HEADER_SIZE + length);
+	memcpy(packet.data(), data, length);
+	package_data(packet.data(), length, (protocol_packet_type_e)type);
+	{
+		std::lock_guard<std::mutex> lock(master_tx_lock);
+		master_tx_packets.push_back(std::move(packet));
+	}
+	sim_gpio_notify();
+}
+
+static bool sim_master_has_packet(void)
+{
+	std::lock_guard<std::mutex> lock(master_tx_lock);
+	return !master_tx_packets.empty();
+}
+
+/**
+ * @brief Move the next packet to the TX frame
+ *
+ * @return size_t Length of the packet, 0 if none is waiting
+ */
+static size_t sim_master_take_packet(void)
+{
+	std::lock_guard<std::mutex> lock(master_tx_lock);
+	if (master_tx_packets.empty()) {
+		return 0;
+	}
+	std::vector<uint8_t> &packet = master_tx_packets.front();
+	size_t length = packet.size();
+	memcpy(master_tx_frame, packet.data(), length);
+	master_tx_packets.pop_front();
+	return length;
+}
+
+/**
+ * @brief Put back a packet that could not be sent
+ *
+ */
+static void sim_master_return_packet(size_t length)
+{
+	std::lock_guard<std::mutex> lock(master_tx_lock);
+	master_tx_packets.emplace_front(master_tx_frame, master_tx_frame + length);
+}
+
+/**
+ * @brief Return credit for the frames processed, with LINK_CAP_CREDIT
+ *
+ */
+static void sim_master_frame_processed(void)
+{
+	if (!(master_capabilities & LINK_CAP_CREDIT)) {
+		return;
+	}
+	uint32_t threshold = master_config.frame_credits / 2 != 0 ? master_config.frame_credits / 2 : 1;
+	if (++master_credit_owed < threshold) {
+		return;
+	}
+	link_control_packet_s credit = {0};
+	credit.command = LINK_CONTROL_CREDIT;
+	credit.version = LINK_CONTROL_VERSION;
+	credit.frame_credits = (uint16_t)master_credit_owed;
+	master_credit_owed = 0;
+	std::vector<uint8_t> packet(SPI_PACKET_HEADER_SIZE + sizeof(credit));
+	memcpy(packet.data(), &credit, sizeof(credit));
+	package_data(packet.data(), sizeof(credit), (protocol_packet_type_e)LINK_PACKET_TYPE_CONTROL_FROM_CTXLINK);
+	{
+		std::lock_guard<std::mutex> lock(master_tx_lock);
+		master_tx_packets.push_front(std::move(packet));
+	}
+	{
+		std::lock_guard<std::mutex> lock(master_stats_lock);
+		master_stats.credit_packets++;
+	}
+	sim_gpio_notify();
+}
+
+/**
+ * @brief Queue SWO trace data for the ESP32, as ctxLink does while tracing
+ *
+ * @param data   The trace data, no more than fits one frame
+ * @param length Length of the data
+ * @return false if the master already has enough packets waiting, try again later
+ */
+bool sim_master_send_swo(const uint8_t *data, size_t length)
+{
+	{
+		std::lock_guard<std::mutex> lock(master_tx_lock);
+		if (master_tx_packets.size() >= sim_master_swo_backlog) {
+			return false;
+		}
+	}
+	sim_master_queue_packet(SERVER_PACKET_TYPE_TO_SWO, data, length);
+	return true;
+}
+
+/**
+ * @brief Answer a link control HELLO
+ *
+ */
+static void sim_master_link_control(const uint8_t *data, size_t length)
+{
+	link_control_packet_s request = {0};
+	memcpy(&request, data, length < sizeof(request) ? length : sizeof(request));
+	if (request.command != LINK_CONTROL_HELLO || master_config.capabilities == 0) {
+		return; // Firmware without link control ignores the packet
+	}
+	link_control_packet_s welcome = {0};
+	welcome.command = LINK_CONTROL_WELCOME;
+	welcome.version = LINK_CONTROL_VERSION;
+	welcome.capabilities = request.capabilities & master_config.capabilities;
+	welcome.max_frame_size = SPI_FRAME_SIZE;
+	if (master_config.frame_credits == 0) {
+		welcome.capabilities &= ~LINK_CAP_CREDIT;
+	}
+	welcome.frame_credits = (welcome.capabilities & LINK_CAP_CREDIT) ? (uint16_t)master_config.frame_credits : 0;
+	master_credit_owed = 0;
+	sim_master_queue_packet(LINK_PACKET_TYPE_CONTROL_FROM_CTXLINK, (const uint8_t *)&welcome, sizeof(welcome));
+	master_capabilities = welcome.capabilities;
+}
+
+/**
+ * @brief Queue a message for the ESP32, as fragments if it does not fit one frame
+ *
+ */
+static void sim_master_queue_message(uint8_t type, const uint8_t *data, size_t length)
+{
+	if (length <= SPI_FRAME_SIZE - SPI_PACKET_HEADER_SIZE) {
+		sim_master_queue_packet(type, data, length);
+		return;
+	}
+	const size_t max_chunk = SPI_FRAME_SIZE - SPI_PACKET_HEADER_SIZE - sizeof(link_fragment_header_s);
+	uint8_t fragment[SPI_FRAME_SIZE];
+	link_fragment_header_s header = {type, ++master_tx_message, 0, 0};
+	for (size_t offset = 0; offset < length; offset += max_chunk) {
+		size_t chunk = length - offset < max_chunk ? length - offset : max_chunk;
+		header.flags = offset + chunk == length ? LINK_FRAGMENT_LAST : 0;
+		memcpy(fragment, &header, sizeof(header));
+		memcpy(fragment + sizeof(header), data + offset, chunk);
+		sim_master_queue_packet(LINK_PACKET_TYPE_FRAGMENT_FROM_CTXLINK, fragment, sizeof(header) + chunk);
+		header.index++;
+	}
+}
+
+/**
+ * @brief Pass an RSP payload to the handler and queue the payloads of its reply, with LINK_CAP_RSP_OFFLOAD
+ *
+ * The handler speaks RSP with acks and checksums as before, the master
+ * adds and strips them as ctxLink does with the ack layer on the ESP32.
+ * With LINK_CAP_BINARY_MEMORY the data read by an m request is sent in
+ * binary, as ctxLink sends the memory it reads.
+ */
+static void sim_master_gdb_payload(const uint8_t *data, size_t length)
+{
+	static uint8_t response[SIM_MASTER_MAX_RESPONSE];
+	std::vector<uint8_t> request;
+	request.reserve(length + 4);
+	uint8_t checksum = 0;
+	request.push_back('$');
+	for (size_t index = 0; index < length; index++) {
+		request.push_back(data[index]);
+		checksum += data[index];
+	}
+	char trailer[4];
+	snprintf(trailer, sizeof(trailer), "#%02x", checksum);
+	request.insert(request.end(), trailer, trailer + 3);
+	size_t response_length = master_config.gdb_handler(request.data(), request.size(), response, sizeof(response));
+	bool binary_reply = (master_capabilities & LINK_CAP_BINARY_MEMORY) && length != 0 && data[0] == 'm';
+	//
+	// Queue the payload of each packet in the reply, the acks go no further
+	//
+	size_t start = 0;
+	for (size_t index = 0; index < response_length; index++) {
+		if (response[index] == '$') {
+			start = index + 1;
+		} else if (response[index] == '#' && start != 0) {
+			size_t payload_length = index - start;
+			//
+			// An error reply has an odd number of characters and is sent as it is
+			//
+			if (binary_reply && payload_length % 2 == 0 &&
+				hex_decode(response + start, response + start, payload_length / 2)) {
+				sim_master_queue_message(LINK_PACKET_TYPE_GDB_MEMORY_DATA, response + start, payload_length / 2);
+			} else {
+				sim_master_queue_message(PROTOCOL_PACKET_TYPE_TO_GDB, response + start, payload_length);
+			}
+			start = 0;
+			index += 2;
+		}
+	}
+	std::lock_guard<std::mutex> lock(master_stats_lock);
+	master_stats.gdb_requests++;
+}
+
+/**
+ * @brief Convert an M request sent in binary back to hex for the handler, with LINK_CAP_BINARY_MEMORY
+ *
+ */
+static void sim_master_gdb_memory_write(const uint8_t *data, size_t length)
+{
+	const uint8_t *colon = (const uint8_t *)memchr(data, ':', length);
+	if (master_config.gdb_handler == NULL || colon == NULL) {
+		return;
+	}
+	size_t prefix = (size_t)(colon - data) + 1;
+	std::vector<uint8_t> request(prefix + 2 * (length - prefix));
+	memcpy(request.data(), data, prefix);
+	hex_encode(request.data() + prefix, data + prefix, length - prefix);
+	sim_master_gdb_payload(request.data(), request.size());
+}
+
+/**
+ * @brief Pass GDB data to the handler and queue the reply
+ *
+ * The reply is split into packets that fit an SPI frame, or with
+ * segmentation into packets that fit the ESP32's pool buffers.
+ */
+static void sim_master_gdb_request(const uint8_t *data, size_t length)
+{
+	static uint8_t response[SIM_MASTER_MAX_RESPONSE];
+	size_t response_length;
+	if (master_config.gdb_handler != NULL && (master_capabilities & LINK_CAP_RSP_OFFLOAD)) {
+		sim_master_gdb_payload(data, length);
+		return;
+	}
+	if (master_config.gdb_handler != NULL) {
+		response_length = master_config.gdb_handler(data, length, response, sizeof(response));
+	} else {
+		response_length = length < sizeof(response) ? length : sizeof(response);
+		memcpy(response, data, response_length);
+	}
+	size_t max_data = SPI_FRAME_SIZE - SPI_PACKET_HEADER_SIZE;
+	if (master_capabilities & LINK_CAP_SEGMENTATION) {
+		max_data = SPI_BUFFER_SIZE - SPI_PACKET_HEADER_SIZE;
+	}
+	for (size_t offset = 0; offset < response_length; offset += max_data) {
+		size_t chunk = response_length - offset < max_data ? response_length - offset : max_data;
+		sim_master_queue_message(PROTOCOL_PACKET_TYPE_TO_GDB, response + offset, chunk);
+	}
+	std::lock_guard<std::mutex> lock(master_stats_lock);
+	master_stats.gdb_requests++;
+}
+
+/**
+ * @brief Act on a packet received from the ESP32
+ *
+ */
+static void sim_master_process_packet(uint8_t type, const uint8_t *data, size_t length);
+
+/**
+ * @brief Add a fragment to the message being reassembled, process the message when complete
+ *
+ */
+static void sim_master_fragment(const uint8_t *data, size_t length)
+{
+	link_fragment_header_s header;
+	if (length < sizeof(header)) {
+		return;
+	}
+	memcpy(&header, data, sizeof(header));
+	if (header.index == 0) {
+		master_rx_message.clear();
+		master_rx_reassembling = true;
+	} else if (!master_rx_reassembling || header.message != master_rx_fragment.message ||
+		header.index != master_rx_fragment.index + 1) {
+		master_rx_reassembling = false; // Lost a fragment, drop the message
+		return;
+	}
+	master_rx_fragment = header;
+	master_rx_message.insert(master_rx_message.end(), data + sizeof(header), data + length);
+	if (header.flags & LINK_FRAGMENT_LAST) {
+		master_rx_reassembling = false;
+		sim_master_process_packet(header.type, master_rx_message.data(), master_rx_message.size());
+	}
+}
+
+static void sim_master_process_packet(uint8_t type, const uint8_t *data, size_t length)
+{
+	switch (type) {
+	case LINK_PACKET_TYPE_CONTROL_TO_CTXLINK:
+		sim_master_link_control(data, length);
+		break;
+	case LINK_PACKET_TYPE_FRAGMENT_TO_CTXLINK:
+		sim_master_fragment(data, length);
+		break;
+	case PROTOCOL_PACKET_TYPE_FROM_GDB:
+		sim_master_gdb_request(data, length);
+		break;
+	case LINK_PACKET_TYPE_GDB_MEMORY_WRITE:
+		sim_master_gdb_memory_write(data, length);
+		break;
+	case LINK_PACKET_TYPE_GDB_INTERRUPT: {
+		std::lock_guard<std::mutex> lock(master_stats_lock);
+		master_stats.gdb_interrupts++;
+		break;
+	}
+	case PROTOCOL_PACKET_TYPE_STATUS: {
+		std::lock_guard<std::mutex> lock(master_stats_lock);
+		master_stats.status_packets++;
+		break;
+	}
+	default:
+		break; // Status and network packets need no reply
+	}
+}
+
+/**
+ * @brief Process the packets received in a frame
+ *
+ */
+static void sim_master_process_frame(const uint8_t *frame, size_t length)
+{
+	size_t offset = 0;
+	if (length >= SPI_PACKET_HEADER_SIZE && link_packet_length(frame) != 0) {
+		sim_master_frame_processed(); // Counted before its packets, the frame with the HELLO used no credit
+	}
+	while (offset + SPI_PACKET_HEADER_SIZE <= length) {
+		size_t packet_length = link_packet_length(frame + offset);
+		if (packet_length == 0 || offset + packet_length > length) {
+			break;
+		}
+		sim_master_process_packet(frame[offset + PACKET_HEADER_SOURCE_ID], frame + offset + SPI_PACKET_HEADER_SIZE,
+			packet_length - SPI_PACKET_HEADER_SIZE);
+		{
+			std::lock_guard<std::mutex> lock(master_stats_lock);
+			master_stats.packets_received++;
+		}
+		offset += packet_length;
+		if (!(master_capabilities & LINK_CAP_BATCHING)) {
+			break;
+		}
+	}
+}
+
+/**
+ * @brief Length of the frame ctxLink reads from the header(s) in variable-length mode
+ *
+ */
+static size_t sim_master_peer_frame_length(const uint8_t *frame, size_t limit)
+{
+	if (frame == NULL) {
+		return 0;
+	}
+	size_t length = 0;
+	while (length + SPI_PACKET_HEADER_SIZE <= limit) {
+		size_t packet_length = link_packet_length(frame + length);
+		if (packet_length == 0) {
+			break;
+		}
+		length += packet_length;
+		if (!(master_capabilities & LINK_CAP_BATCHING)) {
+			return length;
+		}
+	}
+	return length + SPI_PACKET_HEADER_SIZE; // Batched frames end with an empty header
+}
+
+/**
+ * @brief Run one transaction
+ *
+ * @param read_only true for a legacy read, started by ATTN
+ */
+static void sim_master_transaction(bool read_only)
+{
+	size_t tx_length = read_only ? 0 : sim_master_take_packet();
+	sim_gpio_write(SIM_SPI_SS, LOW);
+	if (!sim_gpio_wait_level(SIM_nSPI_READY, LOW, master_config.ready_timeout_us)) {
+		sim_gpio_write(SIM_SPI_SS, HIGH);
+		if (tx_length != 0) {
+			sim_master_return_packet(tx_length);
+		}
+		std::lock_guard<std::mutex> lock(master_stats_lock);
+		master_stats.ready_timeouts++;
+		return;
+	}
+	//
+	// Without duplex the ESP32 chooses the direction from ATTN when SS falls.
+	// If it asserted ATTN in the meantime it is sending, keep the packet for later.
+	//
+	if (!(master_capabilities & LINK_CAP_DUPLEX) && tx_length != 0 && sim_gpio_read(ATTN) == LOW) {
+		sim_master_return_packet(tx_length);
+		tx_length = 0;
+	}
+	size_t length = SPI_FRAME_SIZE;
+	if (master_capabilities & LINK_CAP_VARIABLE_LENGTH) {
+		const uint8_t *peer_frame = NULL;
+		size_t peer_limit = 0;
+		sim_spi_slave_loaded_tx(&peer_frame, &peer_limit);
+		size_t peer_length = sim_master_peer_frame_length(peer_frame, peer_limit);
+		length = peer_length > tx_length ? peer_length : tx_length;
+		length = (length + 3) & ~(size_t)3;
+		if (length > SPI_FRAME_SIZE) {
+			length = SPI_FRAME_SIZE;
+		}
+	}
+	if (tx_length < length) {
+		memset(master_tx_frame + tx_length, 0, length - tx_length);
+	}
+	uint32_t bus_time_us = (uint32_t)(((uint64_t)length * 8 * 1000000) / master_config.clock_hz);
+	sim_delay_us(bus_time_us);
+	size_t exchanged = sim_spi_slave_exchange(master_tx_frame, master_rx_frame, length);
+	sim_gpio_write(SIM_SPI_SS, HIGH);
+	{
+		std::lock_guard<std::mutex> lock(master_stats_lock);
+		master_stats.transactions++;
+		master_stats.bytes_clocked += length;
+		master_stats.bus_time_us += bus_time_us;
+		if (tx_length != 0) {
+			master_stats.packets_sent++;
+		}
+	}
+	sim_master_process_frame(master_rx_frame, exchanged);
+}
+
+/**
+ * @brief The simulated master
+ *
+ */
+static void sim_master_task(void *parameters)
+{
+	std::mt19937 jitter_generator(master_config.seed);
+	std::uniform_int_distribution<uint32_t> jitter(0, master_config.jitter_us);
+	while (master_running) {
+		bool attn = sim_gpio_read(ATTN) == LOW;
+		if (!attn && !sim_master_has_packet()) {
+			sim_gpio_wait_event(sim_master_idle_wait_us);
+			continue;
+		}
+		sim_delay_us(master_config.turnaround_us + jitter(jitter_generator));
+		bool read_only = attn && !(master_capabilities & LINK_CAP_DUPLEX);
+		sim_master_transaction(read_only);
+	}
+	vTaskDelete(NULL);
+}
+
+/**
+ * @brief Start the simulated master
+ *
+ * @param config The master configuration, copied
+ */
+void sim_master_start(const sim_master_config_t *config)
+{
+	master_config = *config;
+	if (master_config.clock_hz == 0) {
+		master_config.clock_hz = 1;
+	}
+	master_stats = {};
+	master_capabilities = 0;
+	master_rx_reassembling = false;
+	master_running = true;
+	sim_gpio_write(SIM_SPI_SS, HIGH);
+	xTaskCreate(sim_master_task, "ctxLink master", 4096, NULL, 5, &master_task_handle);
+}
+
+void sim_master_stop(void)
+{
+	master_running = false;
+	sim_gpio_notify();
+}
+
+/**
+ * @brief The capabilities the master accepted in its WELCOME
+ *
+ */
+uint32_t sim_master_capabilities(void)
+{
+	return master_capabilities;
+}
+
+/**
+ * @brief Tell the ESP32 the target changed, as ctxLink does with LINK_CAP_RSP_CACHE
+ *
+ * Call from the GDB handler, the packet then reaches the ESP32 ahead of
+ * the reply to the request that changed the target.
+ */
+void sim_master_target_changed(void)
+{
+	if (!(master_capabilities & LINK_CAP_RSP_CACHE)) {
+		return;
+	}
+	link_control_packet_s packet = {0};
+	packet.command = LINK_CONTROL_TARGET_CHANGED;
+	packet.version = LINK_CONTROL_VERSION;
+	sim_master_queue_packet(LINK_PACKET_TYPE_CONTROL_FROM_CTXLINK, (const uint8_t *)&packet, sizeof(packet));
+}
+
+void sim_master_get_stats(sim_master_stats_t *stats)
+{
+	std::lock_guard<std::mutex> lock(master_stats_lock);
+	*stats = master_stats;
+}
@@ -0,0 +1,489 @@
+/**
+ * @file sim_freertos.cpp
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Host simulator FreeRTOS queues and tasks on pthreads
+ * @version 0.1
+ * @date 2025-09-10
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * Task priorities and core affinity are ignored, the host scheduler runs
+ * every task as an ordinary thread.
+ */
+
+#include <Arduino.h>
+
+#include <condition_variable>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "esp_cpu.h"
+#include "sim_hal.h"
+
+HardwareSerial Serial;
+
+/**
+ * @brief Time base for the tick count and esp_timer_get_time()
+ *
+ */
+static const std::chrono::steady_clock::time_point sim_start_time = std::chrono::steady_clock::now();
+
+/**
+ * @brief Nesting depth of simulated interrupt handlers on this thread
+ *
+ */
+static thread_local int sim_isr_depth = 0;
+
+struct sim_queue_s {
+	std::mutex mutex;
+	std::condition_variable not_empty;
+	std::condition_variable not_full;
+	std::vector<uint8_t> storage;
+	size_t item_size;
+	size_t length;
+	size_t head;
+	size_t count;
+};
+
+struct sim_task_s {
+	TaskFunction_t function;
+	void *parameters;
+	pthread_t thread;
+	std::mutex mutex;
+	std::condition_variable notified;
+	uint32_t notify_count;
+};
+
+/**
+ * @brief The task record of the calling thread, created on first use for threads not started by xTaskCreate()
+ *
+ */
+static thread_local sim_task_s *sim_current_task = NULL;
+
+void sim_isr_enter(void)
+{
+	sim_isr_depth++;
+}
+
+void sim_isr_exit(void)
+{
+	sim_isr_depth--;
+}
+
+BaseType_t xPortInIsrContext(void)
+{
+	return sim_isr_depth > 0 ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+	return 1;
+}
+
+/**
+ * @brief Convert a tick timeout to an absolute deadline
+ *
+ */
+static std::chrono::steady_clock::time_point sim_deadline(TickType_t wait_ticks)
+{
+	return std::chrono::steady_clock::now() + std::chrono::milliseconds(wait_ticks);
+}
+
+//
+// Queues
+//
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+	sim_queue_s *queue = new sim_queue_s;
+	queue->storage.resize((size_t)length * item_size);
+	queue->item_size = item_size;
+	queue->length = length;
+	queue->head = 0;
+	queue->count = 0;
+	return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+	delete queue;
+}
+
+/**
+ * @brief Wait until the predicate holds, honouring the FreeRTOS timeout rules
+ *
+ * @return true if the predicate holds
+ */
+template <typename predicate_t>
+static bool sim_wait(std::condition_variable &condition, std::unique_lock<std::mutex> &lock, TickType_t wait_ticks,
+	predicate_t predicate)
+{
+	if (wait_ticks == portMAX_DELAY) {
+		condition.wait(lock, predicate);
+		return true;
+	}
+	if (wait_ticks == 0) {
+		return predicate(); // A timed wait would sleep for the host timer slack, tens of microseconds
+	}
+	return condition.wait_until(lock, sim_deadline(wait_ticks), predicate);
+}
+
+static BaseType_t sim_queue_send(QueueHandle_t queue, const void *item, TickType_t wait_ticks, bool to_front)
+{
+	std::unique_lock<std::mutex> lock(queue->mutex);
+	if (!sim_wait(queue->not_full, lock, wait_ticks, [queue] { return queue->count < queue->length; })) {
+		return pdFALSE;
+	}
+	size_t slot;
+	if (to_front) {
+		queue->head = (queue->head + queue->length - 1) % queue->length;
+		slot = queue->head;
+	} else {
+		slot = (queue->head + queue->count) % queue->length;
+	}
+	memcpy(&queue->storage[slot * queue->item_size], item, queue->item_size);
+	queue->count++;
+	queue->not_empty.notify_one();
+	return pdTRUE;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait_ticks)
+{
+	return sim_queue_send(queue, item, wait_ticks, false);
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t wait_ticks)
+{
+	return sim_queue_send(queue, item, wait_ticks, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t wait_ticks)
+{
+	return sim_queue_send(queue, item, wait_ticks, true);
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *higher_priority_task_woken)
+{
+	if (higher_priority_task_woken != NULL) {
+		*higher_priority_task_woken = pdFALSE;
+	}
+	return sim_queue_send(queue, item, 0, false);
+}
+
+BaseType_t xQueueOverwrite(QueueHandle_t queue, const void *item)
+{
+	std::lock_guard<std::mutex> lock(queue->mutex);
+	queue->head = 0;
+	queue->count = 1;
+	memcpy(&queue->storage[0], item, queue->item_size);
+	queue->not_empty.notify_one();
+	return pdTRUE;
+}
+
+static BaseType_t sim_queue_receive(QueueHandle_t queue, void *item, TickType_t wait_ticks, bool remove)
+{
+	std::unique_lock<std::mutex> lock(queue->mutex);
+	if (!sim_wait(queue->not_empty, lock, wait_ticks, [queue] { return queue->count > 0; })) {
+		return pdFALSE;
+	}
+	memcpy(item, &queue->storage[queue->head * queue->item_size], queue->item_size);
+	if (remove) {
+		queue->head = (queue->head + 1) % queue->length;
+		queue->count--;
+		queue->not_full.notify_one();
+	}
+	return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait_ticks)
+{
+	return sim_queue_receive(queue, item, wait_ticks, true);
+}
+
+BaseType_t xQueueReceiveFromISR(QueueHandle_t queue, void *item, BaseType_t *higher_priority_task_woken)
+{
+	if (higher_priority_task_woken != NULL) {
+		*higher_priority_task_woken = pdFALSE;
+	}
+	return sim_queue_receive(queue, item, 0, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t wait_ticks)
+{
+	return sim_queue_receive(queue, item, wait_ticks, false);
+}
+
+BaseType_t xQueuePeekFromISR(QueueHandle_t queue, void *item)
+{
+	return sim_queue_receive(queue, item, 0, false);
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+	std::lock_guard<std::mutex> lock(queue->mutex);
+	queue->head = 0;
+	queue->count = 0;
+	queue->not_full.notify_all();
+	return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+	std::lock_guard<std::mutex> lock(queue->mutex);
+	return (UBaseType_t)queue->count;
+}
+
+UBaseType_t uxQueueMessagesWaitingFromISR(QueueHandle_t queue)
+{
+	return uxQueueMessagesWaiting(queue);
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+	std::lock_guard<std::mutex> lock(queue->mutex);
+	return (UBaseType_t)(queue->length - queue->count);
+}
+
+//
+// Mutexes, a binary flag so a mutex may be given from another thread as FreeRTOS allows
+//
+
+struct sim_semaphore_s {
+	std::mutex mutex;
+	std::condition_variable released;
+	bool taken;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+	sim_semaphore_s *semaphore = new sim_semaphore_s;
+	semaphore->taken = false;
+	return semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait_ticks)
+{
+	std::unique_lock<std::mutex> lock(semaphore->mutex);
+	if (!sim_wait(semaphore->released, lock, wait_ticks, [semaphore] { return !semaphore->taken; })) {
+		return pdFALSE;
+	}
+	semaphore->taken = true;
+	return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+	std::lock_guard<std::mutex> lock(semaphore->mutex);
+	semaphore->taken = false;
+	semaphore->released.notify_one();
+	return pdTRUE;
+}
+
+//
+// Tasks
+//
+
+static void *sim_task_entry(void *arg)
+{
+	sim_current_task = (sim_task_s *)arg;
+	sim_current_task->function(sim_current_task->parameters);
+	return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name, uint32_t stack_depth, void *parameters,
+	UBaseType_t priority, TaskHandle_t *handle)
+{
+	sim_task_s *record = new sim_task_s;
+	record->function = task;
+	record->parameters = parameters;
+	record->notify_count = 0;
+	if (handle != NULL) {
+		*handle = record;
+	}
+	if (pthread_create(&record->thread, NULL, sim_task_entry, record) != 0) {
+		delete record;
+		return pdFAIL;
+	}
+	pthread_detach(record->thread);
+	return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stack_depth, void *parameters,
+	UBaseType_t priority, TaskHandle_t *handle, BaseType_t core_id)
+{
+	return xTaskCreate(task, name, stack_depth, parameters, priority, handle);
+}
+
+/**
+ * @brief Delete a task, only the calling task can be deleted
+ *
+ * The task record is not freed, a handle may still be held by another task.
+ */
+void vTaskDelete(TaskHandle_t task)
+{
+	if (task == NULL || task == sim_current_task) {
+		pthread_exit(NULL);
+	}
+	fprintf(stderr, "sim: vTaskDelete() of another task is not supported\n");
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	return (TickType_t)(esp_timer_get_time() / 1000);
+}
+
+TickType_t xTaskGetTickCountFromISR(void)
+{
+	return xTaskGetTickCount();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	if (sim_current_task == NULL) {
+		sim_current_task = new sim_task_s;
+		sim_current_task->function = NULL;
+		sim_current_task->parameters = NULL;
+		sim_current_task->thread = pthread_self();
+		sim_current_task->notify_count = 0;
+	}
+	return sim_current_task;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+	std::lock_guard<std::mutex> lock(task->mutex);
+	task->notify_count++;
+	task->notified.notify_one();
+	return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_task_woken)
+{
+	if (higher_priority_task_woken != NULL) {
+		*higher_priority_task_woken = pdFALSE;
+	}
+	xTaskNotifyGive(task);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t wait_ticks)
+{
+	sim_task_s *task = xTaskGetCurrentTaskHandle();
+	std::unique_lock<std::mutex> lock(task->mutex);
+	if (!sim_wait(task->notified, lock, wait_ticks, [task] { return task->notify_count > 0; })) {
+		return 0;
+	}
+	uint32_t count = task->notify_count;
+	task->notify_count = clear_on_exit ? 0 : count - 1;
+	return count;
+}
+
+BaseType_t xTaskNotifyWait(
+	uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *notification_value, TickType_t wait_ticks)
+{
+	sim_task_s *task = xTaskGetCurrentTaskHandle();
+	std::unique_lock<std::mutex> lock(task->mutex);
+	task->notify_count &= ~clear_on_entry;
+	if (!sim_wait(task->notified, lock, wait_ticks, [task] { return task->notify_count > 0; })) {
+		return pdFALSE;
+	}
+	if (notification_value != NULL) {
+		*notification_value = task->notify_count;
+	}
+	task->notify_count &= ~clear_on_exit;
+	return pdTRUE;
+}
+
+//
+// Timing and heap
+//
+
+int64_t esp_timer_get_time(void)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - sim_start_time)
+		.count();
+}
+
+/**
+ * @brief The simulated CPU clock of the cycle counter
+ *
+ */
+uint32_t getCpuFrequencyMhz(void)
+{
+	return 240;
+}
+
+uint32_t esp_cpu_get_cycle_count(void)
+{
+	int64_t ns =
+		std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - sim_start_time).count();
+	return (uint32_t)(ns * getCpuFrequencyMhz() / 1000);
+}
+
+/**
+ * @brief Heap use is not tracked on the host
+ *
+ */
+uint32_t esp_get_free_heap_size(void)
+{
+	return 0;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+	return 0;
+}
+
+/**
+ * @brief There is no PSRAM on the host, every allocation comes from the heap
+ *
+ */
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+	return malloc(size);
+}
+
+unsigned long millis(void)
+{
+	return (unsigned long)(esp_timer_get_time() / 1000);
+}
+
+unsigned long micros(void)
+{
+	return (unsigned long)esp_timer_get_time();
+}
+
+void delay(uint32_t ms)
+{
+	vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+void delayMicroseconds(uint32_t us)
+{
+	sim_delay_us(us);
+}
+
+/**
+ * @brief Wait for a number of microseconds
+ *
+ * Short waits spin, the host scheduler cannot sleep for a few microseconds accurately.
+ */
+void sim_delay_us(uint32_t us)
+{
+	if (us == 0) {
+		return;
+	}
+	const int64_t end = esp_timer_get_time() + us;
+	if (us > 200) {
+		std::this_thread::sleep_for(std::chrono::microseconds(us - 100));
+	}
+	while (esp_timer_get_time() < end) {
+		sched_yield();
+	}
+}
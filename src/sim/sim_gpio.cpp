@@ -0,0 +1,136 @@
+/**
+ * @file sim_gpio.cpp
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Host simulator GPIO pins and edge interrupts
+ * @version 0.1
+ * @date 2025-09-10
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * The firmware and the simulated ctxLink master share the pin levels. A
+ * thread waiting for a pin is woken by every write, and by sim_gpio_notify()
+ * for events that are not pin changes.
+ */
+
+#include <Arduino.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+#include "hal/gpio_ll.h"
+#include "sim_hal.h"
+
+gpio_dev_t GPIO;
+
+static std::mutex sim_gpio_mutex;
+static std::condition_variable sim_gpio_changed;
+static uint32_t sim_gpio_generation = 0;
+
+static uint8_t sim_gpio_levels[SIM_GPIO_COUNT];
+static void (*sim_gpio_handlers[SIM_GPIO_COUNT])(void);
+static int sim_gpio_modes[SIM_GPIO_COUNT];
+
+void sim_gpio_write(uint8_t pin, uint8_t level)
+{
+	void (*handler)(void) = NULL;
+	if (pin >= SIM_GPIO_COUNT) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(sim_gpio_mutex);
+		uint8_t previous = sim_gpio_levels[pin];
+		sim_gpio_levels[pin] = level ? HIGH : LOW;
+		if (previous != sim_gpio_levels[pin] && sim_gpio_handlers[pin] != NULL) {
+			int edge = (level == LOW) ? FALLING : RISING;
+			if (sim_gpio_modes[pin] == CHANGE || sim_gpio_modes[pin] == edge) {
+				handler = sim_gpio_handlers[pin];
+			}
+		}
+		sim_gpio_generation++;
+	}
+	sim_gpio_changed.notify_all();
+	//
+	// The handler runs without the pin lock held, it may drive pins itself
+	//
+	if (handler != NULL) {
+		sim_isr_enter();
+		handler();
+		sim_isr_exit();
+	}
+}
+
+int sim_gpio_read(uint8_t pin)
+{
+	std::lock_guard<std::mutex> lock(sim_gpio_mutex);
+	return pin < SIM_GPIO_COUNT ? sim_gpio_levels[pin] : LOW;
+}
+
+/**
+ * @brief Wake the threads waiting in sim_gpio_wait_event()
+ *
+ */
+void sim_gpio_notify(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(sim_gpio_mutex);
+		sim_gpio_generation++;
+	}
+	sim_gpio_changed.notify_all();
+}
+
+/**
+ * @brief Wait for a pin to reach a level
+ *
+ * @return true if the pin is at the level, false on timeout
+ */
+bool sim_gpio_wait_level(uint8_t pin, int level, uint32_t timeout_us)
+{
+	std::unique_lock<std::mutex> lock(sim_gpio_mutex);
+	return sim_gpio_changed.wait_for(
+		lock, std::chrono::microseconds(timeout_us), [pin, level] { return sim_gpio_levels[pin] == level; });
+}
+
+/**
+ * @brief Wait for any pin write or notification
+ *
+ */
+void sim_gpio_wait_event(uint32_t timeout_us)
+{
+	std::unique_lock<std::mutex> lock(sim_gpio_mutex);
+	uint32_t generation = sim_gpio_generation;
+	sim_gpio_changed.wait_for(
+		lock, std::chrono::microseconds(timeout_us), [generation] { return sim_gpio_generation != generation; });
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+	if (pin < SIM_GPIO_COUNT && mode == INPUT_PULLUP) {
+		sim_gpio_write(pin, HIGH);
+	}
+}
+
+void digitalWrite(uint8_t pin, uint8_t level)
+{
+	sim_gpio_write(pin, level);
+}
+
+int digitalRead(uint8_t pin)
+{
+	return sim_gpio_read(pin);
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode)
+{
+	if (pin >= SIM_GPIO_COUNT) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(sim_gpio_mutex);
+	sim_gpio_handlers[pin] = handler;
+	sim_gpio_modes[pin] = mode;
+}
+
+void detachInterrupt(uint8_t pin)
+{
+	attachInterrupt(pin, NULL, 0);
+}
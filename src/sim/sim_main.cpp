@@ -0,0 +1,348 @@
+/**
+ * @file sim_main.cpp
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Host simulator of the ESP32 <-> ctxLink SPI link
+ * @version 0.1
+ * @date 2025-09-10
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * Runs the firmware's SPI, client and server tasks on Linux against a
+ * simulated ctxLink. A TCP client on the loopback interface drives the GDB
+ * or SWO server with one of three workloads:
+ *
+ *   echo   Fixed size messages that ctxLink echoes, each timed until its
+ *          echo is back. The messages are not RSP, so the GDB server
+ *          forwards them without RSP framing.
+ *   rsp    GDB remote serial protocol requests answered by a stand-in
+ *          target: memory reads and writes, a flash load, single steps,
+ *          register dumps and attaches, see sim_rsp_bench.cpp.
+ *   swo    SWO trace data streamed from ctxLink to a client of the SWO
+ *          server, see sim_swo_bench.cpp.
+ *
+ * The hex workload runs no link, it times the hex codec of the binary
+ * memory transfers on the host, see hex_codec.h.
+ *
+ * Build and run with PlatformIO:
+ *
+ *   pio run -e native_sim
+ *   .pio/build/native_sim/program --count 20000 --size 64 --clock 20000000
+ *   .pio/build/native_sim/program --workload rsp --count 2000
+ *   .pio/build/native_sim/program --workload swo --count 5000 --size 1024 --reader-delay 2000
+ *   .pio/build/native_sim/program --workload hex --count 100000
+ *
+ * Options:
+ *   --workload NAME     echo, rsp, swo or hex (default echo)
+ *   --clock HZ          SPI clock rate (default 20000000)
+ *   --jitter US         Random delay of up to US before each transaction (default 0)
+ *   --turnaround US     ctxLink processing time between transactions (default 5)
+ *   --caps MASK         Link capabilities ctxLink accepts, 0 for firmware
+ *                       without link control (default: all)
+ *   --size BYTES        Echo message or SWO packet size (default 64)
+ *   --count N           Number of messages or SWO packets, requests per RSP workload or
+ *                       conversions per hex codec size (default 10000)
+ *   --credits N         Frames ctxLink can hold with LINK_CAP_CREDIT (default 4)
+ *   --window N          Echo messages in flight (default 1)
+ *   --load-size BYTES   Data in each X packet of the RSP load (default 1024)
+ *   --reader-delay US   Pause of the SWO client after each read (default 0)
+ *   --port PORT         GDB server port, the UART, SWO and trace servers use the next three
+ *                       (default GDB_SERVER_PORT)
+ *   --seed N            Seed for the jitter generator (default 1)
+ *   --trace FILE        Capture the packet trace from the start of the workload and save it
+ *                       from the trace server as Chrome trace-event JSON, see packet_trace.h
+ */
+
+#include <Arduino.h>
+#include <lwip/sockets.h>
+
+#include <deque>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "ctxlink.h"
+#include "hex_codec.h"
+#include "link_control.h"
+#include "packet_trace.h"
+#include "sim_rsp_bench.h"
+#include "sim_support.h"
+#include "sim_swo_bench.h"
+#include "tasks/task_server.h"
+#include "tasks/task_wifi.h"
+
+/**
+ * @brief Echo workload settings
+ *
+ */
+typedef struct {
+	size_t size;
+	uint32_t count;
+	uint32_t window;
+	uint16_t port;
+} sim_echo_config_t;
+
+/**
+ * @brief Fill a message with a pattern unique to its sequence number
+ *
+ */
+static void sim_echo_fill(uint8_t *message, size_t size, uint32_t sequence)
+{
+	for (size_t index = 0; index < size; index++) {
+		message[index] = (uint8_t)(sequence * 7 + index);
+	}
+}
+
+/**
+ * @brief Send the messages and time the echoes
+ *
+ * @return int Process exit code
+ */
+static int sim_echo_run(const sim_echo_config_t *config)
+{
+	int fd = sim_client_connect(config->port, 2000);
+	if (fd < 0) {
+		fprintf(stderr, "sim: cannot connect to the GDB server on port %u\n", config->port);
+		return 1;
+	}
+	std::vector<uint8_t> message(config->size);
+	std::vector<uint8_t> expected(config->size);
+	std::vector<uint8_t> echo(config->size);
+	std::deque<int64_t> send_times;
+	sim_latency_samples_t round_trips;
+	round_trips.reserve(config->count);
+	uint32_t sent = 0;
+	uint32_t received = 0;
+	uint32_t corrupted = 0;
+
+	int64_t start = esp_timer_get_time();
+	while (received < config->count) {
+		while (sent < config->count && sent - received < config->window) {
+			sim_echo_fill(message.data(), config->size, sent);
+			send_times.push_back(esp_timer_get_time());
+			if (!sim_send_all(fd, message.data(), config->size)) {
+				fprintf(stderr, "sim: send failed\n");
+				break;
+			}
+			sent++;
+		}
+		if (!sim_receive_all(fd, echo.data(), config->size)) {
+			fprintf(stderr, "sim: echo %u not received\n", received);
+			break;
+		}
+		round_trips.push_back((uint32_t)(esp_timer_get_time() - send_times.front()));
+		send_times.pop_front();
+		sim_echo_fill(expected.data(), config->size, received);
+		if (echo != expected) {
+			corrupted++;
+		}
+		received++;
+	}
+	double elapsed_s = (esp_timer_get_time() - start) / 1e6;
+	close(fd);
+
+	printf("Results:\n");
+	printf("  %u of %u messages echoed, %u corrupted, in %.3f s\n", received, config->count, corrupted, elapsed_s);
+	if (elapsed_s > 0) {
+		printf("  %.0f packets/s, %.1f KiB/s each way\n", received / elapsed_s,
+			(received * (double)config->size) / (1024.0 * elapsed_s));
+	}
+	sim_report_latency("round trip", round_trips);
+	sim_report_link(elapsed_s);
+	return (received == config->count && corrupted == 0) ? 0 : 1;
+}
+
+/**
+ * @brief Time the hex codec for the sizes of typical memory transfers
+ *
+ * @return int Process exit code
+ */
+static int sim_hex_run(uint32_t iterations)
+{
+	static const size_t lengths[] = {4, 64, 256, RSP_OFFLOAD_MAX_PAYLOAD / 2};
+	bool passed = true;
+	printf("Results:\n");
+	for (size_t length : lengths) {
+		hex_codec_benchmark_t result;
+		if (!hex_codec_benchmark(length, iterations, &result)) {
+			fprintf(stderr, "sim: hex codec failed for %u bytes\n", (unsigned)length);
+			passed = false;
+			continue;
+		}
+		printf("  %4u bytes: encode %u KiB/s (reference %u), decode %u KiB/s (reference %u)\n", (unsigned)length,
+			result.encode_kib_s, result.reference_encode_kib_s, result.decode_kib_s, result.reference_decode_kib_s);
+	}
+	return passed ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+	sim_master_config_t master_config = {
+		20000000,           // clock_hz
+		0,                  // jitter_us
+		5,                  // turnaround_us
+		100000,             // ready_timeout_us
+		LINK_CAP_SUPPORTED, // capabilities
+		4,                  // frame_credits
+		1,                  // seed
+		NULL,               // gdb_handler, echo
+	};
+	sim_echo_config_t echo_config = {64, 10000, 1, GDB_SERVER_PORT};
+	sim_rsp_bench_config_t rsp_config = {GDB_SERVER_PORT, 0, SIM_RSP_DEFAULT_LOAD_SIZE};
+	sim_swo_bench_config_t swo_config = {SWO_SERVER_PORT, 0, 0, 0};
+	bool rsp_workload = false;
+	bool swo_workload = false;
+	bool hex_workload = false;
+	const char *trace_path = NULL;
+
+	static const struct option options[] = {
+		{"clock", required_argument, NULL, 'c'},
+		{"jitter", required_argument, NULL, 'j'},
+		{"turnaround", required_argument, NULL, 't'},
+		{"caps", required_argument, NULL, 'a'},
+		{"size", required_argument, NULL, 's'},
+		{"count", required_argument, NULL, 'n'},
+		{"window", required_argument, NULL, 'w'},
+		{"credits", required_argument, NULL, 'f'},
+		{"port", required_argument, NULL, 'p'},
+		{"seed", required_argument, NULL, 'r'},
+		{"workload", required_argument, NULL, 'k'},
+		{"load-size", required_argument, NULL, 'l'},
+		{"reader-delay", required_argument, NULL, 'd'},
+		{"trace", required_argument, NULL, 'T'},
+		{NULL, 0, NULL, 0},
+	};
+	int option;
+	while ((option = getopt_long(argc, argv, "", options, NULL)) != -1) {
+		switch (option) {
+		case 'c':
+			master_config.clock_hz = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			master_config.jitter_us = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			master_config.turnaround_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			master_config.capabilities = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			echo_config.size = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			echo_config.count = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			echo_config.window = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			master_config.frame_credits = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			echo_config.port = (uint16_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			master_config.seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			if (strcmp(optarg, "rsp") == 0) {
+				rsp_workload = true;
+			} else if (strcmp(optarg, "swo") == 0) {
+				swo_workload = true;
+			} else if (strcmp(optarg, "hex") == 0) {
+				hex_workload = true;
+			} else if (strcmp(optarg, "echo") != 0) {
+				fprintf(stderr, "sim: unknown workload %s\n", optarg);
+				return 2;
+			}
+			break;
+		case 'l':
+			rsp_config.load_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			swo_config.reader_delay_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'T':
+			trace_path = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [--workload echo|rsp|swo|hex] [--clock HZ] [--jitter US] [--turnaround US]\n"
+							"       [--caps MASK] [--credits N] [--size BYTES] [--count N] [--window N]\n"
+							"       [--load-size BYTES] [--reader-delay US] [--port PORT] [--seed N]\n"
+							"       [--trace FILE]\n",
+				argv[0]);
+			return 2;
+		}
+	}
+	if (echo_config.size == 0 || echo_config.window == 0) {
+		fprintf(stderr, "sim: size and window must be at least 1\n");
+		return 2;
+	}
+	if (rsp_config.load_size == 0 || rsp_config.load_size > SIM_RSP_MAX_LOAD_SIZE) {
+		fprintf(stderr, "sim: load size must be between 1 and %u bytes\n", SIM_RSP_MAX_LOAD_SIZE);
+		return 2;
+	}
+	if ((master_config.capabilities & LINK_CAP_RSP_OFFLOAD) && rsp_config.load_size > SIM_RSP_MAX_OFFLOAD_LOAD_SIZE) {
+		fprintf(stderr, "sim: with RSP offload the load size must be at most %u bytes\n",
+			SIM_RSP_MAX_OFFLOAD_LOAD_SIZE);
+		return 2;
+	}
+	if (swo_workload && echo_config.size > SPI_FRAME_SIZE - SPI_PACKET_HEADER_SIZE) {
+		fprintf(stderr, "sim: SWO packets must fit one frame, at most %u bytes\n",
+			(unsigned)(SPI_FRAME_SIZE - SPI_PACKET_HEADER_SIZE));
+		return 2;
+	}
+	rsp_config.port = echo_config.port;
+	rsp_config.count = echo_config.count;
+	swo_config.port = echo_config.port + 2;
+	swo_config.count = echo_config.count;
+	swo_config.size = echo_config.size;
+	if (rsp_workload) {
+		master_config.gdb_handler = sim_rsp_target;
+	} else {
+		gdb_server_params.rsp_framer = NULL; // The echo data is not RSP, forward it as it is read
+	}
+	signal(SIGPIPE, SIG_IGN);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	if (hex_workload) {
+		printf("ctxLink hex codec, %u conversions of each size\n", echo_config.count);
+		return sim_hex_run(echo_config.count);
+	}
+
+	printf("ctxLink SPI link simulator\n");
+	printf("  clock %u Hz, jitter %u us, turnaround %u us, capabilities 0x%x\n", master_config.clock_hz,
+		master_config.jitter_us, master_config.turnaround_us, master_config.capabilities);
+	if (rsp_workload) {
+		printf("  RSP workloads, %u requests each, %u byte loads\n", rsp_config.count, rsp_config.load_size);
+	} else if (swo_workload) {
+		printf("  %u SWO packets of %u bytes, reader delay %u us\n", swo_config.count, (unsigned)swo_config.size,
+			swo_config.reader_delay_us);
+	} else {
+		printf("  %u messages of %u bytes, window %u\n", echo_config.count, (unsigned)echo_config.size,
+			echo_config.window);
+	}
+	if (!sim_firmware_start(&master_config, echo_config.port)) {
+		return 1;
+	}
+	printf("  negotiated capabilities 0x%x\n", link_control_capabilities());
+	if (trace_path != NULL) {
+		packet_trace_start();
+	}
+	int result;
+	if (rsp_workload) {
+		result = sim_rsp_bench_run(&rsp_config);
+	} else if (swo_workload) {
+		result = sim_swo_bench_run(&swo_config);
+	} else {
+		result = sim_echo_run(&echo_config);
+	}
+	if (trace_path != NULL && !sim_trace_save(echo_config.port + 3, trace_path) && result == 0) {
+		result = 1;
+	}
+	sim_master_stop();
+	//
+	// The firmware tasks never end, leave without destroying the objects they are blocked on
+	//
+	fflush(stdout);
+	_exit(result);
+}
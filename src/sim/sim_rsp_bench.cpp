@@ -0,0 +1,639 @@
+/**
+ * @file sim_rsp_bench.cpp
+ * @author Sid Price (sid@sidprice.com)
+ * @brief GDB remote serial protocol workloads for the host simulator
+ * @version 0.1
+ * @date 2025-09-12
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * The workloads are the traffic of a typical debug session: memory reads
+ * of several sizes, memory writes with M packets, a flash load with X
+ * packets, a single-step storm, register dumps and GDB attaching. An
+ * attach asks for qSupported, attaches and reads the target description
+ * and memory map in qXfer chunks. Half way through the attaches GDB
+ * attaches to another target, so the RSP cache must be refilled once. Every request waits for its '+' and reply and is acked
+ * the way GDB does, so the latency includes the full round trip through
+ * the server, client and SPI tasks.
+ */
+
+#include <Arduino.h>
+#include <lwip/sockets.h>
+
+#include <string>
+
+#include "ctxlink.h"
+#include "link_control.h"
+#include "rsp_framer.h"
+#include "sim_rsp_bench.h"
+#include "sim_support.h"
+
+/**
+ * @brief Register file returned for 'g', r0-r15 and xPSR of a Cortex-M
+ *
+ */
+static constexpr size_t rsp_register_bytes = 17 * 4;
+
+/**
+ * @brief Stop reply for a single step
+ *
+ */
+static const char rsp_step_reply[] = "T05thread:01;";
+
+/**
+ * @brief Start of the memory the workloads read and load
+ *
+ */
+static constexpr uint32_t rsp_memory_base = 0x08000000;
+
+/**
+ * @brief The kinds of request a workload sends
+ *
+ */
+typedef enum {
+	RSP_WORKLOAD_MEMORY_READ,
+	RSP_WORKLOAD_MEMORY_WRITE,
+	RSP_WORKLOAD_LOAD,
+	RSP_WORKLOAD_STEP,
+	RSP_WORKLOAD_REGISTERS,
+	RSP_WORKLOAD_ATTACH,
+} sim_rsp_workload_e;
+
+typedef struct {
+	const char *name;
+	sim_rsp_workload_e kind;
+	uint32_t size; // Bytes read or written for memory accesses, 0 to use the configured load size for loads
+} sim_rsp_workload_t;
+
+static const sim_rsp_workload_t rsp_workloads[] = {
+	{"m 4", RSP_WORKLOAD_MEMORY_READ, 4},
+	{"m 64", RSP_WORKLOAD_MEMORY_READ, 64},
+	{"m 256", RSP_WORKLOAD_MEMORY_READ, 256},
+	{"m 1024", RSP_WORKLOAD_MEMORY_READ, 1024},
+	{"M 1024", RSP_WORKLOAD_MEMORY_WRITE, 1024},
+	{"load (X)", RSP_WORKLOAD_LOAD, 0},
+	{"step", RSP_WORKLOAD_STEP, 0},
+	{"g", RSP_WORKLOAD_REGISTERS, 0},
+	{"attach", RSP_WORKLOAD_ATTACH, 0},
+};
+
+/**
+ * @brief Reply to qSupported
+ *
+ */
+static const char rsp_supported_reply[] = "PacketSize=7f8;qXfer:memory-map:read+;qXfer:features:read+";
+
+/**
+ * @brief The qSupported GDB sends
+ *
+ */
+static const char rsp_supported_request[] =
+	"qSupported:multiprocess+;swbreak+;hwbreak+;qRelocInsn+;fork-events+;vfork-events+;exec-events+;"
+	"vContSupported+;QThreadEvents+;no-resumed+;memory-tagging+";
+
+/**
+ * @brief Data GDB asks for in each qXfer request
+ *
+ */
+static constexpr uint32_t rsp_xfer_chunk = 0x3fb;
+
+/**
+ * @brief Target currently attached, attaching to another changes the target
+ *
+ */
+static unsigned long rsp_attached_target = 0;
+
+static const char rsp_hex_digits[] = "0123456789abcdef";
+
+/**
+ * @brief Room left for the "Maddr,length:" of an M request when its data is sized to a packet
+ *
+ */
+static constexpr uint32_t rsp_write_prefix_room = 32;
+
+/**
+ * @brief Contents of the target memory, a pattern of the address
+ *
+ */
+static uint8_t sim_rsp_memory_byte(uint32_t address)
+{
+	return (uint8_t)(address * 13 + (address >> 8));
+}
+
+static uint8_t sim_rsp_checksum(const char *data, size_t length)
+{
+	uint8_t checksum = 0;
+	for (size_t index = 0; index < length; index++) {
+		checksum += (uint8_t)data[index];
+	}
+	return checksum;
+}
+
+/**
+ * @brief Frame a payload as $payload#checksum
+ *
+ */
+static void sim_rsp_frame(std::string &out, const std::string &payload)
+{
+	uint8_t checksum = sim_rsp_checksum(payload.data(), payload.size());
+	out += '$';
+	out += payload;
+	out += '#';
+	out += rsp_hex_digits[checksum >> 4];
+	out += rsp_hex_digits[checksum & 0x0f];
+}
+
+static void sim_rsp_append_hex(std::string &out, uint8_t value)
+{
+	out += rsp_hex_digits[value >> 4];
+	out += rsp_hex_digits[value & 0x0f];
+}
+
+static bool sim_rsp_needs_escape(uint8_t value)
+{
+	return value == '#' || value == '$' || value == '}' || value == '*';
+}
+
+/**
+ * @brief Expected reply to a memory read
+ *
+ */
+static void sim_rsp_memory_reply(std::string &out, uint32_t address, uint32_t length)
+{
+	for (uint32_t index = 0; index < length; index++) {
+		sim_rsp_append_hex(out, sim_rsp_memory_byte(address + index));
+	}
+}
+
+/**
+ * @brief The target description and memory map of a Cortex-M with an FPU
+ *
+ */
+static const std::string &sim_rsp_target_xml(void)
+{
+	static std::string xml;
+	if (xml.empty()) {
+		xml = "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\"><target>"
+			  "<architecture>arm</architecture><feature name=\"org.gnu.gdb.arm.m-profile\">";
+		char reg[96];
+		for (int index = 0; index < 13; index++) {
+			snprintf(reg, sizeof(reg), "<reg name=\"r%d\" bitsize=\"32\" type=\"uint32\"/>", index);
+			xml += reg;
+		}
+		xml += "<reg name=\"sp\" bitsize=\"32\" type=\"data_ptr\"/><reg name=\"lr\" bitsize=\"32\" "
+			   "type=\"code_ptr\"/><reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/><reg name=\"xpsr\" "
+			   "bitsize=\"32\" regnum=\"25\"/></feature><feature name=\"org.gnu.gdb.arm.vfp\">";
+		for (int index = 0; index < 16; index++) {
+			snprintf(reg, sizeof(reg), "<reg name=\"d%d\" bitsize=\"64\" type=\"float\"/>", index);
+			xml += reg;
+		}
+		xml += "<reg name=\"fpscr\" bitsize=\"32\" type=\"int\" group=\"float\"/></feature>"
+			   "<feature name=\"org.gnu.gdb.arm.m-system\">";
+		static const char *const system_registers[] = {"msp", "psp", "primask", "basepri", "faultmask", "control"};
+		for (const char *name : system_registers) {
+			snprintf(reg, sizeof(reg), "<reg name=\"%s\" bitsize=\"32\" save-restore=\"no\" group=\"system\"/>", name);
+			xml += reg;
+		}
+		xml += "</feature></target>";
+	}
+	return xml;
+}
+
+static const std::string &sim_rsp_memory_map(void)
+{
+	static const std::string map =
+		"<?xml version=\"1.0\"?><!DOCTYPE memory-map PUBLIC \"+//IDN gnu.org//DTD GDB Memory Map V1.0//EN\" "
+		"\"http://sourceware.org/gdb/gdb-memory-map.dtd\"><memory-map>"
+		"<memory type=\"flash\" start=\"0x8000000\" length=\"0x4000\"><property name=\"blocksize\">0x4000</property></memory>"
+		"<memory type=\"flash\" start=\"0x8004000\" length=\"0xc000\"><property name=\"blocksize\">0x4000</property></memory>"
+		"<memory type=\"flash\" start=\"0x8010000\" length=\"0x10000\"><property name=\"blocksize\">0x10000</property></memory>"
+		"<memory type=\"flash\" start=\"0x8020000\" length=\"0xe0000\"><property name=\"blocksize\">0x20000</property></memory>"
+		"<memory type=\"ram\" start=\"0x20000000\" length=\"0x20000\"/></memory-map>";
+	return map;
+}
+
+/**
+ * @brief Reply to a qXfer read of a document, 'm' and a chunk while more follows, 'l' with the last
+ *
+ */
+static void sim_rsp_xfer_reply(std::string &out, const std::string &document, uint32_t offset, uint32_t length)
+{
+	if (offset >= document.size()) {
+		out = "l";
+		return;
+	}
+	out = offset + length < document.size() ? "m" : "l";
+	out += document.substr(offset, length);
+}
+
+/**
+ * @brief Answer the queries GDB makes on attaching
+ *
+ */
+static void sim_rsp_query_answer(const std::string &packet, std::string &reply)
+{
+	unsigned long offset = 0;
+	unsigned long length = 0;
+	if (packet.compare(0, 10, "qSupported") == 0) {
+		reply = rsp_supported_reply;
+	} else if (sscanf(packet.c_str(), "qXfer:features:read:target.xml:%lx,%lx", &offset, &length) == 2) {
+		sim_rsp_xfer_reply(reply, sim_rsp_target_xml(), (uint32_t)offset, (uint32_t)length);
+	} else if (sscanf(packet.c_str(), "qXfer:memory-map:read::%lx,%lx", &offset, &length) == 2) {
+		sim_rsp_xfer_reply(reply, sim_rsp_memory_map(), (uint32_t)offset, (uint32_t)length);
+	}
+}
+
+/**
+ * @brief Number of requests in one attach, qSupported, vAttach and the qXfer chunks
+ *
+ */
+static uint32_t sim_rsp_attach_requests(void)
+{
+	//
+	// GDB reads each document until a reply starts with 'l'
+	//
+	uint32_t xml_chunks = (uint32_t)sim_rsp_target_xml().size() / rsp_xfer_chunk + 1;
+	uint32_t map_chunks = (uint32_t)sim_rsp_memory_map().size() / rsp_xfer_chunk + 1;
+	return 2 + xml_chunks + map_chunks;
+}
+
+static void sim_rsp_register_reply(std::string &out)
+{
+	for (size_t index = 0; index < rsp_register_bytes; index++) {
+		sim_rsp_append_hex(out, (uint8_t)(index * 5));
+	}
+}
+
+/**
+ * @brief Answer one packet the way the probe would
+ *
+ */
+static void sim_rsp_target_answer(const std::string &packet, std::string &reply)
+{
+	unsigned long address = 0;
+	unsigned long length = 0;
+	switch (packet.empty() ? 0 : packet[0]) {
+	case 'm':
+		if (sscanf(packet.c_str() + 1, "%lx,%lx", &address, &length) == 2) {
+			sim_rsp_memory_reply(reply, (uint32_t)address, (uint32_t)length);
+		} else {
+			reply = "E01";
+		}
+		break;
+	case 'M': {
+		//
+		// Check the hex data holds the declared length
+		//
+		size_t colon = packet.find(':');
+		if (colon == std::string::npos || sscanf(packet.c_str() + 1, "%lx,%lx", &address, &length) != 2) {
+			reply = "E01";
+			break;
+		}
+		size_t digits = packet.size() - colon - 1;
+		bool valid = packet.find_first_not_of("0123456789abcdefABCDEF", colon + 1) == std::string::npos;
+		reply = valid && digits == 2 * length ? "OK" : "E02";
+		break;
+	}
+	case 'X': {
+		//
+		// Check the escaped binary data decodes to the declared length
+		//
+		size_t colon = packet.find(':');
+		if (colon == std::string::npos || sscanf(packet.c_str() + 1, "%lx,%lx", &address, &length) != 2) {
+			reply = "E01";
+			break;
+		}
+		size_t decoded = 0;
+		for (size_t index = colon + 1; index < packet.size(); index++) {
+			if (packet[index] == '}') {
+				index++;
+			}
+			decoded++;
+		}
+		reply = decoded == length ? "OK" : "E02";
+		break;
+	}
+	case 'g':
+		sim_rsp_register_reply(reply);
+		break;
+	case 's':
+		reply = rsp_step_reply;
+		break;
+	case 'v':
+		if (packet.compare(0, 6, "vCont;") == 0) {
+			reply = rsp_step_reply;
+		} else if (sscanf(packet.c_str(), "vAttach;%lx", &address) == 1) {
+			//
+			// ctxLink reports the change ahead of the reply, the ESP32 empties its cache before GDB asks again
+			//
+			if (address != rsp_attached_target) {
+				rsp_attached_target = address;
+				sim_master_target_changed();
+			}
+			reply = rsp_step_reply;
+		}
+		break;
+	case '?':
+		reply = "S05";
+		break;
+	case 'q':
+		sim_rsp_query_answer(packet, reply);
+		break;
+	default:
+		break; // Unsupported, empty reply
+	}
+}
+
+/**
+ * @brief Stand-in target for the simulated ctxLink
+ *
+ * The GDB data arrives as the client task read it from the socket, packets
+ * may be split or several may arrive together. Each complete packet is
+ * acked and answered, acks from GDB are dropped.
+ */
+size_t sim_rsp_target(const uint8_t *request, size_t length, uint8_t *response, size_t max_length)
+{
+	static std::string input;
+	input.append((const char *)request, length);
+
+	std::string output;
+	size_t start;
+	while ((start = input.find('$')) != std::string::npos) {
+		size_t end = input.find('#', start);
+		if (end == std::string::npos || end + 2 >= input.size()) {
+			break; // Wait for the rest of the packet
+		}
+		std::string packet = input.substr(start + 1, end - start - 1);
+		input.erase(0, end + 3);
+		std::string reply;
+		sim_rsp_target_answer(packet, reply);
+		output += '+';
+		sim_rsp_frame(output, reply);
+	}
+	if (input.find('$') == std::string::npos) {
+		input.clear(); // Only acks left
+	}
+	size_t response_length = output.size() < max_length ? output.size() : max_length;
+	memcpy(response, output.data(), response_length);
+	return response_length;
+}
+
+/**
+ * @brief Buffered reader of the GDB server socket
+ *
+ */
+typedef struct {
+	int fd;
+	uint8_t buffer[4096];
+	size_t head;
+	size_t tail;
+	uint64_t bytes;
+} sim_rsp_reader_t;
+
+static bool sim_rsp_read_byte(sim_rsp_reader_t *reader, char *value)
+{
+	if (reader->head == reader->tail) {
+		ssize_t received = recv(reader->fd, reader->buffer, sizeof(reader->buffer), 0);
+		if (received <= 0) {
+			return false;
+		}
+		reader->head = 0;
+		reader->tail = (size_t)received;
+		reader->bytes += (size_t)received;
+	}
+	*value = (char)reader->buffer[reader->head++];
+	return true;
+}
+
+/**
+ * @brief Read the ack and the reply to a request
+ *
+ * @return true if both arrived with a good checksum
+ */
+static bool sim_rsp_read_reply(sim_rsp_reader_t *reader, std::string &reply)
+{
+	char value;
+	if (!sim_rsp_read_byte(reader, &value) || value != '+') {
+		return false;
+	}
+	do {
+		if (!sim_rsp_read_byte(reader, &value)) {
+			return false;
+		}
+	} while (value != '$');
+	reply.clear();
+	while (sim_rsp_read_byte(reader, &value) && value != '#') {
+		reply += value;
+	}
+	char checksum[3] = {0};
+	if (!sim_rsp_read_byte(reader, &checksum[0]) || !sim_rsp_read_byte(reader, &checksum[1])) {
+		return false;
+	}
+	return strtoul(checksum, NULL, 16) == sim_rsp_checksum(reply.data(), reply.size());
+}
+
+/**
+ * @brief Offset at the end of a request, in bytes for memory accesses and in requests for an attach
+ *
+ */
+static uint32_t sim_rsp_request_end(const sim_rsp_workload_t *workload)
+{
+	return workload->kind == RSP_WORKLOAD_ATTACH ? sim_rsp_attach_requests() : workload->size;
+}
+
+/**
+ * @brief Build a request and its expected reply
+ *
+ * Memory accesses and attaches continue from offset, call again while it is
+ * short of sim_rsp_request_end().
+ * @return size_t Payload bytes the request moves, data read, written or loaded
+ */
+static size_t sim_rsp_build_request(const sim_rsp_workload_t *workload, const sim_rsp_bench_config_t *config,
+	uint32_t sequence, uint32_t max_transfer, uint32_t *offset, std::string &request, std::string &expected)
+{
+	uint32_t load_size = config->load_size;
+	char command[64];
+	request.clear();
+	expected.clear();
+	switch (workload->kind) {
+	case RSP_WORKLOAD_MEMORY_READ: {
+		//
+		// As GDB does, a read with a reply larger than the target's packet size is split
+		//
+		uint32_t length = workload->size - *offset < max_transfer ? workload->size - *offset : max_transfer;
+		uint32_t address = rsp_memory_base + (sequence * workload->size) % 0x10000 + *offset;
+		snprintf(command, sizeof(command), "m%x,%x", address, length);
+		request = command;
+		sim_rsp_memory_reply(expected, address, length);
+		*offset += length;
+		return length;
+	}
+	case RSP_WORKLOAD_MEMORY_WRITE: {
+		uint32_t length = workload->size - *offset < max_transfer ? workload->size - *offset : max_transfer;
+		uint32_t address = rsp_memory_base + (sequence * workload->size) % 0x10000 + *offset;
+		snprintf(command, sizeof(command), "M%x,%x:", address, length);
+		request = command;
+		for (uint32_t index = 0; index < length; index++) {
+			sim_rsp_append_hex(request, (uint8_t)(sequence * 31 + *offset + index));
+		}
+		expected = "OK";
+		*offset += length;
+		return length;
+	}
+	case RSP_WORKLOAD_LOAD: {
+		uint32_t address = rsp_memory_base + sequence * load_size;
+		snprintf(command, sizeof(command), "X%x,%x:", address, load_size);
+		request = command;
+		for (uint32_t index = 0; index < load_size; index++) {
+			uint8_t value = (uint8_t)(sequence * 31 + index);
+			if (sim_rsp_needs_escape(value)) {
+				request += '}';
+				value ^= 0x20;
+			}
+			request += (char)value;
+		}
+		expected = "OK";
+		return load_size;
+	}
+	case RSP_WORKLOAD_STEP:
+		request = "vCont;s:1";
+		expected = rsp_step_reply;
+		return 0;
+	case RSP_WORKLOAD_REGISTERS:
+		request = "g";
+		sim_rsp_register_reply(expected);
+		return rsp_register_bytes;
+	case RSP_WORKLOAD_ATTACH: {
+		//
+		// offset counts the requests of the attach, GDB attaches to a second target half way through
+		//
+		uint32_t step = (*offset)++;
+		uint32_t xml_chunks = (uint32_t)sim_rsp_target_xml().size() / rsp_xfer_chunk + 1;
+		if (step == 0) {
+			request = rsp_supported_request;
+			expected = rsp_supported_reply;
+		} else if (step == 1) {
+			snprintf(command, sizeof(command), "vAttach;%x", sequence < config->count / 2 ? 1 : 2);
+			request = command;
+			expected = rsp_step_reply;
+		} else if (step < 2 + xml_chunks) {
+			uint32_t chunk_offset = (step - 2) * rsp_xfer_chunk;
+			snprintf(command, sizeof(command), "qXfer:features:read:target.xml:%x,%x", chunk_offset, rsp_xfer_chunk);
+			request = command;
+			sim_rsp_xfer_reply(expected, sim_rsp_target_xml(), chunk_offset, rsp_xfer_chunk);
+		} else {
+			uint32_t chunk_offset = (step - 2 - xml_chunks) * rsp_xfer_chunk;
+			snprintf(command, sizeof(command), "qXfer:memory-map:read::%x,%x", chunk_offset, rsp_xfer_chunk);
+			request = command;
+			sim_rsp_xfer_reply(expected, sim_rsp_memory_map(), chunk_offset, rsp_xfer_chunk);
+		}
+		return expected.size();
+	}
+	}
+	return 0;
+}
+
+/**
+ * @brief Run one workload and print its line of the report
+ *
+ * @return true if every request was answered correctly
+ */
+static bool sim_rsp_run_workload(int fd, const sim_rsp_workload_t *workload, const sim_rsp_bench_config_t *config)
+{
+	sim_rsp_reader_t *reader = new sim_rsp_reader_t();
+	reader->fd = fd;
+	sim_latency_samples_t round_trips;
+	round_trips.reserve(config->count);
+	std::string request;
+	std::string expected;
+	std::string framed;
+	std::string reply;
+	uint64_t payload_bytes = 0;
+	uint64_t sent_bytes = 0;
+	uint32_t errors = 0;
+	uint32_t completed = 0;
+
+	//
+	// With the ack layer on the ESP32 a packet must fit one payload, ctxLink advertises that packet size
+	//
+	uint32_t max_transfer = workload->size;
+	if (sim_master_capabilities() & LINK_CAP_RSP_OFFLOAD) {
+		uint32_t max_payload = RSP_OFFLOAD_MAX_PAYLOAD;
+		if (!(sim_master_capabilities() & LINK_CAP_SEGMENTATION)) {
+			max_payload = SPI_FRAME_SIZE - SPI_PACKET_HEADER_SIZE - 4; // A whole $...#xx must fit one read
+		}
+		max_transfer = workload->kind == RSP_WORKLOAD_MEMORY_WRITE ? (max_payload - rsp_write_prefix_room) / 2
+																   : max_payload / 2;
+	}
+
+	uint32_t request_end = sim_rsp_request_end(workload);
+	int64_t start = esp_timer_get_time();
+	for (uint32_t sequence = 0; sequence < config->count; sequence++) {
+		int64_t sent_time = esp_timer_get_time();
+		int64_t reply_time = sent_time;
+		uint32_t offset = 0;
+		bool answered = true;
+		do {
+			payload_bytes +=
+				sim_rsp_build_request(workload, config, sequence, max_transfer, &offset, request, expected);
+			framed.clear();
+			sim_rsp_frame(framed, request);
+			if (!sim_send_all(fd, (const uint8_t *)framed.data(), framed.size()) || !sim_rsp_read_reply(reader, reply)) {
+				answered = false;
+				break;
+			}
+			reply_time = esp_timer_get_time();
+			if (!sim_send_all(fd, (const uint8_t *)"+", 1)) {
+				answered = false;
+				break;
+			}
+			sent_bytes += framed.size() + 1;
+			if (reply != expected) {
+				errors++;
+			}
+		} while (offset < request_end);
+		if (!answered) {
+			fprintf(stderr, "sim: %s request %u not answered\n", workload->name, sequence);
+			break;
+		}
+		round_trips.push_back((uint32_t)(reply_time - sent_time));
+		completed++;
+	}
+	double elapsed_s = (esp_timer_get_time() - start) / 1e6;
+	uint64_t wire_bytes = sent_bytes + reader->bytes;
+	delete reader;
+
+	std::string title = std::string(workload->name) + " round trip";
+	sim_report_latency(title.c_str(), round_trips);
+	if (elapsed_s > 0) {
+		printf("    %u requests, %u errors, %.0f requests/s, %.1f KiB/s payload, %.1f KiB/s on the wire\n", completed,
+			errors, completed / elapsed_s, payload_bytes / (1024.0 * elapsed_s), wire_bytes / (1024.0 * elapsed_s));
+	}
+	return completed == config->count && errors == 0;
+}
+
+/**
+ * @brief Run every workload over one GDB connection
+ *
+ * @return int Process exit code
+ */
+int sim_rsp_bench_run(const sim_rsp_bench_config_t *config)
+{
+	int fd = sim_client_connect(config->port, 2000);
+	if (fd < 0) {
+		fprintf(stderr, "sim: cannot connect to the GDB server on port %u\n", config->port);
+		return 1;
+	}
+	printf("Results:\n");
+	int64_t start = esp_timer_get_time();
+	bool passed = true;
+	for (const sim_rsp_workload_t &workload : rsp_workloads) {
+		if (!sim_rsp_run_workload(fd, &workload, config)) {
+			passed = false;
+		}
+	}
+	double elapsed_s = (esp_timer_get_time() - start) / 1e6;
+	close(fd);
+	sim_report_link(elapsed_s);
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,362 @@
+/**
+ * @file sim_spi_slave.cpp
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Host simulator mock of the ESP32DMASPI slave driver
+ * @version 0.1
+ * @date 2025-09-10
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * The driver queue holds the armed transactions, the head of the queue is
+ * the one loaded into the (simulated) SPI peripheral. A background thread
+ * plays the part of the driver's SPI task: it arms the transactions passed
+ * to trigger() and, in streaming mode, keeps the queue full using the
+ * refill callback. requeueStreaming() drops the whole queue, as
+ * spi_slave_queue_reset() does, and fills it in again.
+ */
+
+#include <Arduino.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "sim_hal.h"
+#include "sim_spi_slave.h"
+
+/**
+ * @brief Driver state, there is only one simulated slave
+ *
+ */
+static struct {
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<spi_slave_transaction_t> armed;     // Driver queue, the head is loaded
+	std::vector<spi_slave_transaction_t> queued;   // Built by queue(), not yet triggered
+	std::vector<spi_slave_transaction_t> requested; // Triggered, waiting for the SPI task
+	bool head_loaded;
+	size_t queue_size;
+	ESP32DMASPI::spi_slave_user_cb_t post_setup_cb;
+	void *post_setup_arg;
+	ESP32DMASPI::spi_slave_user_cb_t post_trans_cb;
+	void *post_trans_arg;
+	ESP32DMASPI::spi_slave_refill_cb_t refill_cb;
+	ESP32DMASPI::spi_slave_refill_cb_t drop_cb;
+	ESP32DMASPI::spi_slave_hold_cb_t hold_cb;
+	void *refill_arg;
+	volatile bool streaming;
+	bool requeue;
+	bool requeue_after_exchange;
+	bool exchanging; // The master is clocking the head, until it is popped
+	bool started;
+} sim_slave = {};
+
+/**
+ * @brief Load the transaction at the head of the driver queue, if it is not loaded yet
+ *
+ * Called with the driver lock held, returns the transaction whose post-setup
+ * callback must be called once the lock is released.
+ */
+static bool sim_slave_load_head(spi_slave_transaction_t *loaded)
+{
+	if (sim_slave.head_loaded || sim_slave.armed.empty()) {
+		return false;
+	}
+	sim_slave.head_loaded = true;
+	*loaded = sim_slave.armed.front();
+	return true;
+}
+
+/**
+ * @brief Call the post-setup callback in interrupt context
+ *
+ */
+static void sim_slave_post_setup(spi_slave_transaction_t *trans)
+{
+	if (sim_slave.post_setup_cb != NULL) {
+		sim_isr_enter();
+		sim_slave.post_setup_cb(trans, sim_slave.post_setup_arg);
+		sim_isr_exit();
+	}
+}
+
+/**
+ * @brief The driver's SPI task, arms the requested and streaming transactions
+ *
+ */
+static void sim_slave_task(void *parameters)
+{
+	while (true) {
+		spi_slave_transaction_t loaded;
+		bool load = false;
+		bool refill = false;
+		bool requeue = false;
+		{
+			std::unique_lock<std::mutex> lock(sim_slave.mutex);
+			sim_slave.wake.wait(lock, [] {
+				return !sim_slave.requested.empty() || sim_slave.requeue ||
+					(sim_slave.streaming && sim_slave.armed.size() < sim_slave.queue_size);
+			});
+			if (sim_slave.requeue) {
+				sim_slave.requeue = false;
+				requeue = true;
+			} else if (!sim_slave.requested.empty()) {
+				for (const spi_slave_transaction_t &trans : sim_slave.requested) {
+					sim_slave.armed.push_back(trans);
+				}
+				sim_slave.requested.clear();
+				load = sim_slave_load_head(&loaded);
+			} else {
+				refill = true;
+			}
+		}
+		if (requeue) {
+			//
+			// Like spi_slave_queue_reset(), every armed transaction is dropped,
+			// the loaded one included, once the master is held off
+			//
+			if (!sim_slave.hold_cb(true, sim_slave.refill_arg)) {
+				std::lock_guard<std::mutex> lock(sim_slave.mutex);
+				sim_slave.requeue_after_exchange = true; // The master was let go on, tried again once it is done
+				continue;
+			}
+			std::deque<spi_slave_transaction_t> dropped;
+			{
+				//
+				// The post-transaction interrupt is atomic on the ESP32, let an
+				// exchange that already called it finish
+				//
+				std::unique_lock<std::mutex> lock(sim_slave.mutex);
+				sim_slave.wake.wait(lock, [] { return !sim_slave.exchanging; });
+				dropped.swap(sim_slave.armed);
+				sim_slave.head_loaded = false;
+			}
+			for (spi_slave_transaction_t &trans : dropped) {
+				sim_slave.drop_cb(&trans, sim_slave.refill_arg);
+			}
+			while (sim_slave.streaming && sim_slave.armed.size() < sim_slave.queue_size) {
+				spi_slave_transaction_t trans = {};
+				sim_slave.refill_cb(&trans, sim_slave.refill_arg);
+				spi_slave_transaction_t loaded;
+				bool load;
+				{
+					std::lock_guard<std::mutex> lock(sim_slave.mutex);
+					sim_slave.armed.push_back(trans);
+					load = sim_slave_load_head(&loaded);
+				}
+				if (load) {
+					sim_slave_post_setup(&loaded);
+				}
+			}
+			sim_slave.hold_cb(false, sim_slave.refill_arg);
+			sim_gpio_notify();
+			continue;
+		}
+		if (refill) {
+			//
+			// The refill callback runs in task context, without the driver lock
+			//
+			spi_slave_transaction_t trans = {};
+			sim_slave.refill_cb(&trans, sim_slave.refill_arg);
+			trans.trans_len = 0;
+			std::lock_guard<std::mutex> lock(sim_slave.mutex);
+			sim_slave.armed.push_back(trans);
+			load = sim_slave_load_head(&loaded);
+		}
+		if (load) {
+			sim_slave_post_setup(&loaded);
+			sim_gpio_notify();
+		}
+	}
+}
+
+namespace ESP32DMASPI
+{
+
+bool Slave::begin(uint8_t spi_bus, int sck, int miso, int mosi, int ss)
+{
+	std::lock_guard<std::mutex> lock(sim_slave.mutex);
+	if (!sim_slave.started) {
+		sim_slave.started = true;
+		xTaskCreate(sim_slave_task, "spi_slave_task", 4096, NULL, 5, NULL);
+	}
+	return true;
+}
+
+void Slave::setDataMode(uint8_t mode)
+{
+}
+
+void Slave::setMaxTransferSize(size_t size)
+{
+}
+
+void Slave::setQueueSize(size_t size)
+{
+	sim_slave.queue_size = size;
+}
+
+void Slave::setUserPostSetupCbAndArg(spi_slave_user_cb_t cb, void *arg)
+{
+	sim_slave.post_setup_cb = cb;
+	sim_slave.post_setup_arg = arg;
+}
+
+void Slave::setUserPostTransCbAndArg(spi_slave_user_cb_t cb, void *arg)
+{
+	sim_slave.post_trans_cb = cb;
+	sim_slave.post_trans_arg = arg;
+}
+
+bool Slave::queue(const uint8_t *tx_buf, uint8_t *rx_buf, size_t size)
+{
+	std::lock_guard<std::mutex> lock(sim_slave.mutex);
+	if (size % 4 != 0 || sim_slave.queued.size() >= sim_slave.queue_size) {
+		return false;
+	}
+	spi_slave_transaction_t trans = {};
+	trans.length = 8 * size;
+	trans.tx_buffer = tx_buf;
+	trans.rx_buffer = rx_buf;
+	sim_slave.queued.push_back(trans);
+	return true;
+}
+
+bool Slave::trigger(uint32_t timeout_ms)
+{
+	{
+		std::lock_guard<std::mutex> lock(sim_slave.mutex);
+		if (sim_slave.queued.empty() || !sim_slave.armed.empty() || !sim_slave.requested.empty()) {
+			sim_slave.queued.clear();
+			return false;
+		}
+		sim_slave.requested.swap(sim_slave.queued);
+	}
+	sim_slave.wake.notify_one();
+	return true;
+}
+
+size_t Slave::numTransactionsInFlight()
+{
+	std::lock_guard<std::mutex> lock(sim_slave.mutex);
+	return sim_slave.armed.size() + sim_slave.requested.size();
+}
+
+bool Slave::startStreaming(
+	spi_slave_refill_cb_t refill_cb, void *arg, spi_slave_refill_cb_t drop_cb, spi_slave_hold_cb_t hold_cb)
+{
+	{
+		std::lock_guard<std::mutex> lock(sim_slave.mutex);
+		sim_slave.refill_cb = refill_cb;
+		sim_slave.drop_cb = drop_cb;
+		sim_slave.hold_cb = hold_cb;
+		sim_slave.refill_arg = arg;
+		sim_slave.streaming = true;
+	}
+	sim_slave.wake.notify_one();
+	return true;
+}
+
+void Slave::stopStreaming()
+{
+	sim_slave.streaming = false;
+}
+
+bool Slave::requeueStreaming()
+{
+	{
+		std::lock_guard<std::mutex> lock(sim_slave.mutex);
+		if (!sim_slave.streaming || sim_slave.drop_cb == nullptr || sim_slave.hold_cb == nullptr) {
+			return false;
+		}
+		sim_slave.requeue = true;
+	}
+	sim_slave.wake.notify_one();
+	return true;
+}
+
+bool Slave::isStreaming() const
+{
+	return sim_slave.streaming;
+}
+
+} // namespace ESP32DMASPI
+
+/**
+ * @brief Get the TX buffer of the loaded transaction, as the master would see it
+ *
+ * @param tx_buffer Set to the TX buffer, NULL if the transaction sends zeros
+ * @param length    Set to the transaction length in bytes
+ * @return true if a transaction is loaded
+ */
+bool sim_spi_slave_loaded_tx(const uint8_t **tx_buffer, size_t *length)
+{
+	std::lock_guard<std::mutex> lock(sim_slave.mutex);
+	if (!sim_slave.head_loaded) {
+		return false;
+	}
+	*tx_buffer = (const uint8_t *)sim_slave.armed.front().tx_buffer;
+	*length = sim_slave.armed.front().length / 8;
+	return true;
+}
+
+/**
+ * @brief Clock the loaded transaction
+ *
+ * @param master_tx Data sent by the master, NULL to send zeros
+ * @param master_rx Buffer for the data received by the master
+ * @param length    Number of bytes clocked by the master
+ * @return size_t Number of bytes exchanged, 0 if no transaction was loaded
+ *
+ * The transaction ends at the shorter of the master and slave lengths. The
+ * post-transaction callback is called in interrupt context, then the next
+ * armed transaction is loaded.
+ */
+size_t sim_spi_slave_exchange(const uint8_t *master_tx, uint8_t *master_rx, size_t length)
+{
+	spi_slave_transaction_t trans;
+	{
+		std::lock_guard<std::mutex> lock(sim_slave.mutex);
+		if (!sim_slave.head_loaded) {
+			return 0;
+		}
+		trans = sim_slave.armed.front();
+		sim_slave.exchanging = true;
+	}
+	size_t exchanged = length < trans.length / 8 ? length : trans.length / 8;
+	if (trans.tx_buffer != NULL) {
+		memcpy(master_rx, trans.tx_buffer, exchanged);
+	} else {
+		memset(master_rx, 0, exchanged);
+	}
+	if (trans.rx_buffer != NULL) {
+		if (master_tx != NULL) {
+			memcpy(trans.rx_buffer, master_tx, exchanged);
+		} else {
+			memset(trans.rx_buffer, 0, exchanged);
+		}
+	}
+	trans.trans_len = exchanged * 8;
+	if (sim_slave.post_trans_cb != NULL) {
+		sim_isr_enter();
+		sim_slave.post_trans_cb(&trans, sim_slave.post_trans_arg);
+		sim_isr_exit();
+	}
+	spi_slave_transaction_t loaded;
+	bool load;
+	{
+		std::lock_guard<std::mutex> lock(sim_slave.mutex);
+		sim_slave.armed.pop_front();
+		sim_slave.exchanging = false;
+		sim_slave.head_loaded = false;
+		load = sim_slave_load_head(&loaded);
+		sim_slave.requeue |= sim_slave.requeue_after_exchange;
+		sim_slave.requeue_after_exchange = false;
+	}
+	sim_slave.wake.notify_one();
+	if (load) {
+		sim_slave_post_setup(&loaded);
+	}
+	return exchanged;
+}
@@ -0,0 +1,342 @@
+/**
+ * @file sim_support.cpp
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Host simulator firmware bring-up, client sockets and reporting
+ * @version 0.1
+ * @date 2025-09-10
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * Starts the firmware modules in the order setup() and the Wi-Fi task do on
+ * the target, with the GDB server listening on the loopback interface.
+ */
+
+#include <Arduino.h>
+#include <lwip/sockets.h>
+
+#include <algorithm>
+
+#include "ctxlink.h"
+#include "link_control.h"
+#include "link_segment.h"
+#include "packet_trace.h"
+#include "protocol.h"
+#include "rsp_cache.h"
+#include "sim_support.h"
+#include "spi_buffer_pool.h"
+#include "swo_stream.h"
+#include "tasks/task_server.h"
+#include "tasks/task_spi_comms.h"
+#include "tasks/task_wifi.h"
+
+/**
+ * @brief Definitions normally provided by task_wifi.cpp and main.cpp
+ *
+ */
+static rsp_framer_t gdb_rsp_framer;
+server_task_params_t gdb_server_params = {
+	PROTOCOL_PACKET_STATUS_TYPE_GDB_CLIENT,
+	"GDB",
+	GDB_SERVER_PORT,
+	0,
+	NULL, // Server queue
+	PROTOCOL_PACKET_TYPE_FROM_GDB,
+	false,           // Client connected
+	&gdb_rsp_framer, // Whole RSP packets to ctxLink
+};
+server_task_params_t uart_server_params = {
+	(protocol_packet_status_type_e)SERVER_STATUS_TYPE_UART_CLIENT,
+	"UART",
+	UART_SERVER_PORT,
+	0,
+	NULL, // Server queue
+	(protocol_packet_type_e)SERVER_PACKET_TYPE_FROM_UART,
+	false, // Client connected
+	NULL,  // No RSP framing
+};
+server_task_params_t swo_server_params = {
+	(protocol_packet_status_type_e)SERVER_STATUS_TYPE_SWO_CLIENT,
+	"SWO",
+	SWO_SERVER_PORT,
+	0,
+	NULL, // Server queue
+	(protocol_packet_type_e)SERVER_PACKET_TYPE_FROM_SWO,
+	false,              // Client connected
+	NULL,               // No RSP framing
+	&swo_stream_server, // SWO data from the SWO stream
+};
+server_task_params_t trace_server_params = {
+	(protocol_packet_status_type_e)SERVER_STATUS_TYPE_TRACE_CLIENT,
+	"Trace",
+	TRACE_SERVER_PORT,
+	0,
+	NULL,                      // Server queue
+	(protocol_packet_type_e)0, // The client input stays on the ESP32
+	false,                     // Client connected
+	NULL,                      // No RSP framing
+	&packet_trace_server,      // The packet trace capture as JSON
+};
+QueueHandle_t wifi_comms_queue = NULL;
+TaskHandle_t wifi_task_handle = NULL;
+
+/**
+ * @brief How long to wait for ctxLink to answer the HELLO
+ *
+ */
+static constexpr uint32_t sim_negotiation_timeout_ms = 500;
+
+/**
+ * @brief Start the firmware and the simulated ctxLink
+ *
+ * @param master_config Configuration of the simulated ctxLink
+ * @param port          TCP port for the GDB server
+ * @return true if the link is up
+ */
+bool sim_firmware_start(const sim_master_config_t *master_config, uint16_t port)
+{
+	spi_buffer_pool_init();
+	swo_stream_init();
+	rsp_cache_init();
+	initCtxLink();
+	xTaskCreate(task_spi_comms, "SPI Comms", 4096, NULL, 2, NULL);
+	while (spi_comms_input_queue == NULL || !system_setup_done) {
+		vTaskDelay(1);
+	}
+	sim_master_start(master_config);
+	control_esp32_ready(true);
+	if (master_config->capabilities != 0) {
+		uint32_t start = millis();
+		while (link_control_capabilities() == 0 && millis() - start < sim_negotiation_timeout_ms) {
+			vTaskDelay(1);
+		}
+		if (link_control_capabilities() == 0) {
+			fprintf(stderr, "sim: link negotiation timed out\n");
+			return false;
+		}
+	}
+	//
+	// The servers run, as on the target, on consecutive ports from the GDB port
+	//
+	static server_task_params_t *const servers[] = {
+		&gdb_server_params, &uart_server_params, &swo_server_params, &trace_server_params};
+	static network_task_params_t network_params = {servers, sizeof(servers) / sizeof(servers[0])};
+	for (size_t index = 0; index < network_params.server_count; index++) {
+		servers[index]->port = port + index;
+	}
+	xTaskCreate(task_network, "Network", 4096, (void *)&network_params, 5, NULL);
+	return true;
+}
+
+/**
+ * @brief Connect to the GDB server, retrying while it starts
+ *
+ * @return int The socket, -1 on failure
+ */
+int sim_client_connect(uint16_t port, uint32_t timeout_ms)
+{
+	struct sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	uint32_t start = millis();
+	while (millis() - start < timeout_ms) {
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0) {
+			int no_delay = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+			//
+			// A lost reply must not hang the run
+			//
+			struct timeval receive_timeout = {2, 0};
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &receive_timeout, sizeof(receive_timeout));
+			//
+			// Wait for the server to send the client state to ctxLink
+			//
+			vTaskDelay(pdMS_TO_TICKS(20));
+			return fd;
+		}
+		close(fd);
+		vTaskDelay(pdMS_TO_TICKS(10));
+	}
+	return -1;
+}
+
+bool sim_send_all(int fd, const uint8_t *data, size_t length)
+{
+	while (length > 0) {
+		ssize_t sent = send(fd, data, length, 0);
+		if (sent <= 0) {
+			return false;
+		}
+		data += sent;
+		length -= (size_t)sent;
+	}
+	return true;
+}
+
+bool sim_receive_all(int fd, uint8_t *data, size_t length)
+{
+	while (length > 0) {
+		ssize_t received = recv(fd, data, length, 0);
+		if (received <= 0) {
+			return false;
+		}
+		data += received;
+		length -= (size_t)received;
+	}
+	return true;
+}
+
+/**
+ * @brief Save the packet trace capture, read from the trace server as a client of the target would
+ *
+ * @param port The trace server port
+ * @param path The file for the JSON
+ * @return true if the whole capture was saved
+ */
+bool sim_trace_save(uint16_t port, const char *path)
+{
+	int fd = sim_client_connect(port, 1000);
+	if (fd < 0) {
+		fprintf(stderr, "sim: cannot connect to the trace server\n");
+		return false;
+	}
+	FILE *file = fopen(path, "w");
+	if (file == NULL) {
+		fprintf(stderr, "sim: cannot create %s\n", path);
+		close(fd);
+		return false;
+	}
+	//
+	// The server shuts the connection down once the whole capture is sent
+	//
+	uint8_t data[4096];
+	ssize_t received;
+	size_t total = 0;
+	while ((received = recv(fd, data, sizeof(data), 0)) > 0) {
+		fwrite(data, 1, (size_t)received, file);
+		total += (size_t)received;
+	}
+	fclose(file);
+	close(fd);
+	packet_trace_stats_t stats;
+	packet_trace_get_stats(&stats);
+	printf("Packet trace: %u events, %u missed, %u bytes of JSON in %s\n", stats.recorded, stats.missed,
+		(unsigned)total, path);
+	return received == 0;
+}
+
+/**
+ * @brief Get a percentile from sorted samples
+ *
+ */
+uint32_t sim_percentile(const sim_latency_samples_t &sorted_samples, uint32_t percent)
+{
+	if (sorted_samples.empty()) {
+		return 0;
+	}
+	size_t index = (sorted_samples.size() * percent) / 100;
+	if (index >= sorted_samples.size()) {
+		index = sorted_samples.size() - 1;
+	}
+	return sorted_samples[index];
+}
+
+/**
+ * @brief Print the latency distribution, the samples are sorted
+ *
+ */
+void sim_report_latency(const char *title, sim_latency_samples_t &samples)
+{
+	std::sort(samples.begin(), samples.end());
+	if (samples.empty()) {
+		printf("  %s: no samples\n", title);
+		return;
+	}
+	printf("  %s us: min %u, p50 %u, p90 %u, p99 %u, max %u\n", title, samples.front(), sim_percentile(samples, 50),
+		sim_percentile(samples, 90), sim_percentile(samples, 99), samples.back());
+}
+
+/**
+ * @brief Print the SPI link statistics of both ends
+ *
+ * @param elapsed_s The measurement period, for the bus utilisation
+ */
+void sim_report_link(double elapsed_s)
+{
+	sim_master_stats_t master;
+	sim_master_get_stats(&master);
+	printf("ctxLink (simulated):\n");
+	printf("  %u transactions, %u nSPI_READY timeouts, %llu bytes clocked\n", master.transactions,
+		master.ready_timeouts, (unsigned long long)master.bytes_clocked);
+	printf("  %u packets received, %u sent, bus busy %.1f%%\n", master.packets_received, master.packets_sent,
+		elapsed_s > 0 ? (100.0 * master.bus_time_us) / (elapsed_s * 1e6) : 0.0);
+
+	spi_link_stats_t link;
+	spi_get_link_stats(&link);
+	printf("ESP32 SPI link:\n");
+	printf("  %u transactions, %u duplex, %u frames sent, %u packets received\n", link.transactions,
+		link.duplex_transactions, link.tx_frames, link.rx_packets);
+	printf("  %u dropped, %u truncated, %u empty, %u re-armed for a frame\n", link.rx_dropped, link.rx_truncated,
+		link.empty_transactions, link.tx_requeues);
+	printf("  TX window: %u task wake-ups, max %u frames waiting\n", link.tx_notifications, link.tx_window_max);
+	if (link_control_has(LINK_CAP_CREDIT)) {
+		link_credit_stats_t credit;
+		link_control_get_credit_stats(&credit);
+		printf("  credit: %u of %u, %u returned in %u grants (%u sent), %u stalls\n", credit.credits, credit.window,
+			credit.returned, credit.grants, master.credit_packets, credit.stalls);
+	}
+	if (link.ss_setup_samples != 0) {
+		printf("  SS to setup: %u pre-armed of %u, avg %u us, max %u us\n", link.ss_setup_prearmed,
+			link.ss_setup_samples, link.ss_setup_total_us / link.ss_setup_samples, link.ss_setup_max_us);
+	}
+
+	spi_comms_batch_stats_t batch;
+	spi_comms_get_batch_stats(&batch);
+	printf("  %u packets in %u frames, max %u per frame\n", batch.packets, batch.frames, batch.max_packets_per_frame);
+
+	link_segment_stats_t segment;
+	link_segment_get_stats(&segment);
+	if (segment.fragments_sent != 0 || segment.fragments_received != 0) {
+		printf("  %u packets in %u fragments sent, %u packets from %u fragments received, %u dropped\n",
+			segment.messages_segmented, segment.fragments_sent, segment.messages_reassembled,
+			segment.fragments_received, segment.reassembly_errors);
+	}
+
+	network_send_stats_t send;
+	network_get_send_stats(&send);
+	printf("ESP32 network:\n");
+	printf("  %u packets to clients in %u sends, %u segments saved, max %u per send\n", send.packets, send.batches,
+		send.segments_saved, send.max_batch);
+	network_input_stats_t input;
+	network_get_input_stats(&input);
+	printf("  client input: %u stalls waiting for the SPI path, %.1f ms in total, max %u us\n", input.stalls,
+		input.stall_us / 1000.0, input.max_stall_us);
+	if (gdb_server_params.rsp_framer != NULL) {
+		rsp_framer_stats_t framer;
+		rsp_framer_get_stats(gdb_server_params.rsp_framer, &framer);
+		printf("  GDB input: %u reads forwarded in %u packets, %u RSP packets, %u held back, %u interrupts\n",
+			framer.reads, framer.packets_sent, framer.rsp_packets, framer.held_reads, framer.interrupts);
+		if (link_control_has(LINK_CAP_RSP_OFFLOAD)) {
+			printf("  RSP offload: %u acks sent, %u received, %u bad checksums, %u resent, %u dropped, %u deferred\n",
+				framer.acks_sent, framer.acks_received, framer.checksum_errors, framer.retransmits, framer.dropped,
+				framer.deferred);
+		}
+		if (link_control_has(LINK_CAP_BINARY_MEMORY)) {
+			printf("  Binary memory: %u reads, %u writes, %u link bytes saved\n", framer.binary_reads,
+				framer.binary_writes, framer.binary_bytes);
+		}
+		if (link_control_has(LINK_CAP_RSP_CACHE)) {
+			rsp_cache_stats_t cache;
+			rsp_cache_get_stats(&cache);
+			printf("  RSP cache: %u hits, %u misses, %u replies in %u of %u bytes, %u full, %u invalidated\n",
+				cache.hits, cache.misses, cache.entries, (unsigned)cache.store_used, (unsigned)cache.store_size,
+				cache.full, cache.invalidations);
+		}
+	}
+
+	spi_buffer_pool_stats_t pool;
+	spi_buffer_pool_get_stats(&pool);
+	printf("SPI buffer pool: %u in use, high water %u of %u, %u acquire failures\n", (unsigned)pool.in_use_count,
+		(unsigned)pool.high_water_mark, SPI_BUFFER_COUNT, pool.acquire_fails);
+}
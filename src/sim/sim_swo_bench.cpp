@@ -0,0 +1,169 @@
+/**
+ * @file sim_swo_bench.cpp
+ * @author Sid Price (sid@sidprice.com)
+ * @brief SWO streaming workload for the host simulator
+ * @version 0.1
+ * @date 2025-09-18
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * Byte n of the trace stream is n % 251, so the client can tell where the
+ * stream ring dropped data. Each drop shows as one break in the sequence,
+ * a client that keeps up must see none.
+ */
+
+#include <Arduino.h>
+#include <lwip/sockets.h>
+
+#include <poll.h>
+#include <unistd.h>
+#include <vector>
+
+#include "sim_support.h"
+#include "sim_swo_bench.h"
+#include "swo_stream.h"
+
+/**
+ * @brief Length of the trace byte pattern, a prime so packet sizes do not line up with it
+ *
+ */
+static constexpr uint32_t swo_pattern_length = 251;
+
+/**
+ * @brief Longest time without data before the run is abandoned
+ *
+ */
+static constexpr uint32_t swo_stall_timeout_ms = 5000;
+
+/**
+ * @brief Client receive buffer while the client reads slowly, small so the stream ring fills
+ *
+ */
+static constexpr int swo_slow_reader_buffer = 16 * 1024;
+
+static const sim_swo_bench_config_t *producer_config = NULL;
+static volatile bool producer_done = false;
+
+/**
+ * @brief Stream the trace data from the simulated ctxLink
+ *
+ */
+static void sim_swo_producer(void *parameters)
+{
+	(void)parameters;
+	std::vector<uint8_t> packet(producer_config->size);
+	uint64_t offset = 0;
+	for (uint32_t sequence = 0; sequence < producer_config->count; sequence++) {
+		for (uint8_t &value : packet) {
+			value = (uint8_t)(offset++ % swo_pattern_length);
+		}
+		while (!sim_master_send_swo(packet.data(), packet.size())) {
+			vTaskDelay(1);
+		}
+	}
+	producer_done = true;
+	vTaskDelete(NULL);
+}
+
+/**
+ * @brief Check if every byte ctxLink sent has been sent on or dropped and has reached the client
+ *
+ */
+static bool sim_swo_complete(uint64_t total_bytes, uint64_t client_bytes)
+{
+	swo_stream_stats_t stats;
+	swo_stream_get_stats(&stats);
+	return producer_done && stats.bytes_received == total_bytes &&
+		(uint64_t)stats.bytes_sent + stats.overrun_bytes == stats.bytes_received && client_bytes == stats.bytes_sent;
+}
+
+/**
+ * @brief Stream the trace data and report the throughput and drops
+ *
+ * @return int Process exit code
+ */
+int sim_swo_bench_run(const sim_swo_bench_config_t *config)
+{
+	int fd = sim_client_connect(config->port, 2000);
+	if (fd < 0) {
+		fprintf(stderr, "sim: cannot connect to the SWO server on port %u\n", config->port);
+		return 1;
+	}
+	if (config->reader_delay_us != 0) {
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &swo_slow_reader_buffer, sizeof(swo_slow_reader_buffer));
+	}
+	swo_stream_stats_t stats;
+	swo_stream_get_stats(&stats);
+	if (stats.ring_size == 0) {
+		fprintf(stderr, "sim: SWO stream session not started\n");
+		close(fd);
+		return 1;
+	}
+	uint64_t total_bytes = (uint64_t)config->count * config->size;
+	uint64_t client_bytes = 0;
+	uint32_t breaks = 0;
+	int expected = -1;
+	std::vector<uint8_t> buffer(64 * 1024);
+
+	producer_config = config;
+	producer_done = false;
+	int64_t start = esp_timer_get_time();
+	xTaskCreate(sim_swo_producer, "SWO producer", 4096, NULL, 3, NULL);
+	uint32_t last_data = millis();
+	bool stalled = false;
+	while (!sim_swo_complete(total_bytes, client_bytes)) {
+		struct pollfd poll_fd = {fd, POLLIN, 0};
+		if (poll(&poll_fd, 1, 100) <= 0) {
+			if (millis() - last_data >= swo_stall_timeout_ms) {
+				stalled = true;
+				break;
+			}
+			continue;
+		}
+		ssize_t length = recv(fd, buffer.data(), buffer.size(), 0);
+		if (length <= 0) {
+			stalled = true;
+			break;
+		}
+		last_data = millis();
+		for (ssize_t index = 0; index < length; index++) {
+			if (expected >= 0 && buffer[index] != expected) {
+				breaks++;
+			}
+			expected = (buffer[index] + 1) % swo_pattern_length;
+		}
+		client_bytes += (uint64_t)length;
+		if (config->reader_delay_us != 0) {
+			usleep(config->reader_delay_us);
+		}
+	}
+	double elapsed_s = (esp_timer_get_time() - start) / 1e6;
+	swo_stream_get_stats(&stats);
+	close(fd);
+	//
+	// Let the server end the session and send its final report
+	//
+	vTaskDelay(pdMS_TO_TICKS(50));
+	sim_master_stats_t master_stats;
+	sim_master_get_stats(&master_stats);
+
+	printf("Results:\n");
+	printf("  %llu of %llu trace bytes reached the client in %.3f s", (unsigned long long)client_bytes,
+		(unsigned long long)total_bytes, elapsed_s);
+	if (elapsed_s > 0) {
+		printf(", %.1f KiB/s", client_bytes / (1024.0 * elapsed_s));
+	}
+	printf("\n");
+	printf("  %u bytes dropped in %u overruns, %u breaks seen by the client, ring %u of %u bytes used\n",
+		stats.overrun_bytes, stats.overruns, breaks, (unsigned)stats.high_water_mark, (unsigned)stats.ring_size);
+	printf("  %u status packets received by ctxLink\n", master_stats.status_packets);
+	sim_report_link(elapsed_s);
+	if (stalled) {
+		fprintf(stderr, "sim: SWO stream stalled\n");
+		return 1;
+	}
+	//
+	// Every break must be explained by an overrun
+	//
+	return breaks <= stats.overruns ? 0 : 1;
+}
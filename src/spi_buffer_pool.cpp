@@ -0,0 +1,360 @@
+/**
+ * @file spi_buffer_pool.cpp
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Ownership tracked pool of SPI packet buffers
+ * @version 0.1
+ * @date 2025-09-02
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * The free buffers are held as indices in a FreeRTOS queue, this gives a
+ * blocking acquire for the tasks and a non-blocking acquire for the SPI
+ * driver interrupt handlers. Each buffer carries an owner and state tag
+ * so that leaks and double releases can be traced back to a stage of the
+ * data path.
+ */
+
+#include <Arduino.h>
+
+#include "serial_control.h"
+#include "spi_buffer_pool.h"
+
+/**
+ * @brief Pool of buffers for use by the SPI interface
+ *
+ * Note: The buffers are aligned to 4 bytes to ensure that they are suitable for use with the SPI interface. This
+ *          is noted in the ESP32 SPI documentation
+ */
+static uint8_t spi_buffers[SPI_BUFFER_COUNT][SPI_BUFFER_SIZE] __attribute__((aligned(4)));
+
+/**
+ * @brief Owner and state tags for each buffer in the pool
+ *
+ */
+static spi_buffer_owner_e spi_buffer_owners[SPI_BUFFER_COUNT];
+static spi_buffer_state_e spi_buffer_states[SPI_BUFFER_COUNT];
+
+/**
+ * @brief Queue holding the indices of the free buffers
+ *
+ */
+static QueueHandle_t spi_buffer_free_queue;
+
+/**
+ * @brief Pool usage counters, protected by spi_buffer_lock
+ *
+ */
+static size_t spi_buffer_in_use = 0;
+static size_t spi_buffer_hwm = 0;
+static uint32_t spi_buffer_acquire_fails = 0;
+static uint32_t spi_buffer_release_errors = 0;
+
+static portMUX_TYPE spi_buffer_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief Names of the buffer owners, used for reporting
+ *
+ */
+static const char *const spi_buffer_owner_names[SPI_BUFFER_OWNER_COUNT] = {
+	"none",
+	"client",
+	"server",
+	"spi comms",
+	"spi driver",
+	"wi-fi",
+};
+
+/**
+ * @brief Convert a buffer pointer to its index in the pool
+ *
+ * @param buffer Pointer to the buffer
+ * @return int The index of the buffer, or -1 if the pointer is not the start of a pool buffer
+ */
+static int IRAM_ATTR spi_buffer_index(const uint8_t *buffer)
+{
+	const uint8_t *pool_start = &spi_buffers[0][0];
+	if (buffer < pool_start || buffer >= pool_start + sizeof(spi_buffers)) {
+		return -1;
+	}
+	size_t offset = buffer - pool_start;
+	if (offset % SPI_BUFFER_SIZE != 0) {
+		return -1;
+	}
+	return (int)(offset / SPI_BUFFER_SIZE);
+}
+
+/**
+ * @brief Mark a buffer taken from the free list as in use
+ *
+ * @param index The index of the buffer
+ * @param owner The stage taking ownership of the buffer
+ *
+ * Must be called with spi_buffer_lock held.
+ */
+static void IRAM_ATTR spi_buffer_mark_acquired(uint8_t index, spi_buffer_owner_e owner)
+{
+	spi_buffer_owners[index] = owner;
+	spi_buffer_states[index] = SPI_BUFFER_STATE_FILLING;
+	spi_buffer_in_use++;
+	if (spi_buffer_in_use > spi_buffer_hwm) {
+		spi_buffer_hwm = spi_buffer_in_use;
+	}
+}
+
+/**
+ * @brief Mark a buffer as free prior to returning it to the free list
+ *
+ * @param index The index of the buffer
+ * @return true if the buffer was in use, false if it was already free
+ *
+ * Must be called with spi_buffer_lock held.
+ */
+static bool IRAM_ATTR spi_buffer_mark_released(uint8_t index)
+{
+	if (spi_buffer_states[index] == SPI_BUFFER_STATE_FREE) {
+		spi_buffer_release_errors++;
+		return false;
+	}
+	spi_buffer_owners[index] = SPI_BUFFER_OWNER_NONE;
+	spi_buffer_states[index] = SPI_BUFFER_STATE_FREE;
+	spi_buffer_in_use--;
+	return true;
+}
+
+/**
+ * @brief Initialize the buffer pool
+ *
+ * Must be called before any of the tasks or the SPI interface are started.
+ */
+void spi_buffer_pool_init(void)
+{
+	spi_buffer_free_queue = xQueueCreate(SPI_BUFFER_COUNT, sizeof(uint8_t));
+	for (uint8_t index = 0; index < SPI_BUFFER_COUNT; index++) {
+		spi_buffer_owners[index] = SPI_BUFFER_OWNER_NONE;
+		spi_buffer_states[index] = SPI_BUFFER_STATE_FREE;
+		xQueueSend(spi_buffer_free_queue, &index, 0);
+	}
+}
+
+/**
+ * @brief Acquire a buffer from the pool
+ *
+ * @param owner The stage taking ownership of the buffer
+ * @param wait_ticks How long to wait for a buffer to become free, 0 to fail immediately
+ * @return uint8_t* Pointer to the buffer, or NULL if no buffer became free in time
+ */
+uint8_t *spi_buffer_acquire(spi_buffer_owner_e owner, TickType_t wait_ticks)
+{
+	uint8_t index;
+	if (xQueueReceive(spi_buffer_free_queue, &index, wait_ticks) != pdTRUE) {
+		portENTER_CRITICAL(&spi_buffer_lock);
+		spi_buffer_acquire_fails++;
+		portEXIT_CRITICAL(&spi_buffer_lock);
+		return NULL;
+	}
+	portENTER_CRITICAL(&spi_buffer_lock);
+	spi_buffer_mark_acquired(index, owner);
+	portEXIT_CRITICAL(&spi_buffer_lock);
+	return spi_buffers[index];
+}
+
+/**
+ * @brief Acquire a buffer from the pool in interrupt context
+ *
+ * @param owner The stage taking ownership of the buffer
+ * @return uint8_t* Pointer to the buffer, or NULL if the pool is empty
+ */
+uint8_t *IRAM_ATTR spi_buffer_acquire_from_isr(spi_buffer_owner_e owner)
+{
+	uint8_t index;
+	if (xQueueReceiveFromISR(spi_buffer_free_queue, &index, NULL) != pdTRUE) {
+		portENTER_CRITICAL_ISR(&spi_buffer_lock);
+		spi_buffer_acquire_fails++;
+		portEXIT_CRITICAL_ISR(&spi_buffer_lock);
+		return NULL;
+	}
+	portENTER_CRITICAL_ISR(&spi_buffer_lock);
+	spi_buffer_mark_acquired(index, owner);
+	portEXIT_CRITICAL_ISR(&spi_buffer_lock);
+	return spi_buffers[index];
+}
+
+/**
+ * @brief Return a buffer to the pool
+ *
+ * @param buffer Pointer to the buffer
+ *
+ * Pointers that are not pool buffers, for example the static transaction
+ * completed packet, are ignored so that consumers can release every packet
+ * they finish with.
+ */
+void spi_buffer_release(uint8_t *buffer)
+{
+	int index = spi_buffer_index(buffer);
+	if (index < 0) {
+		return;
+	}
+	portENTER_CRITICAL(&spi_buffer_lock);
+	bool released = spi_buffer_mark_released(index);
+	portEXIT_CRITICAL(&spi_buffer_lock);
+	if (released) {
+		uint8_t free_index = (uint8_t)index;
+		xQueueSend(spi_buffer_free_queue, &free_index, 0);
+	} else {
+		LOG_ERROR(SPI, "SPI buffer %d released twice", index);
+	}
+}
+
+/**
+ * @brief Return a buffer to the pool in interrupt context
+ *
+ * @param buffer Pointer to the buffer
+ */
+void IRAM_ATTR spi_buffer_release_from_isr(uint8_t *buffer)
+{
+	int index = spi_buffer_index(buffer);
+	if (index < 0) {
+		return;
+	}
+	portENTER_CRITICAL_ISR(&spi_buffer_lock);
+	bool released = spi_buffer_mark_released(index);
+	portEXIT_CRITICAL_ISR(&spi_buffer_lock);
+	if (released) {
+		uint8_t free_index = (uint8_t)index;
+		BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+		xQueueSendFromISR(spi_buffer_free_queue, &free_index, &xHigherPriorityTaskWoken);
+		if (xHigherPriorityTaskWoken) {
+			portYIELD_FROM_ISR();
+		}
+	}
+}
+
+/**
+ * @brief Record a hand-over of a buffer between stages of the data path
+ *
+ * @param buffer Pointer to the buffer
+ * @param owner The stage taking ownership of the buffer
+ * @param state The new state of the buffer
+ *
+ * Safe to call from both task and interrupt context.
+ */
+void IRAM_ATTR spi_buffer_tag(uint8_t *buffer, spi_buffer_owner_e owner, spi_buffer_state_e state)
+{
+	int index = spi_buffer_index(buffer);
+	if (index < 0) {
+		return;
+	}
+	portENTER_CRITICAL_SAFE(&spi_buffer_lock);
+	spi_buffer_owners[index] = owner;
+	spi_buffer_states[index] = state;
+	portEXIT_CRITICAL_SAFE(&spi_buffer_lock);
+}
+
+/**
+ * @brief Check whether a pointer is the start of a pool buffer
+ *
+ * @param buffer Pointer to check
+ * @return true if the pointer is a pool buffer
+ */
+bool IRAM_ATTR spi_buffer_is_pool_buffer(const uint8_t *buffer)
+{
+	return spi_buffer_index(buffer) >= 0;
+}
+
+/**
+ * @brief Get the current owner of a buffer
+ *
+ * @param buffer Pointer to the buffer
+ * @return spi_buffer_owner_e The owner, SPI_BUFFER_OWNER_NONE for free or foreign buffers
+ */
+spi_buffer_owner_e spi_buffer_owner(const uint8_t *buffer)
+{
+	int index = spi_buffer_index(buffer);
+	return (index < 0) ? SPI_BUFFER_OWNER_NONE : spi_buffer_owners[index];
+}
+
+/**
+ * @brief Get the current state of a buffer
+ *
+ * @param buffer Pointer to the buffer
+ * @return spi_buffer_state_e The state, SPI_BUFFER_STATE_FREE for free or foreign buffers
+ */
+spi_buffer_state_e spi_buffer_state(const uint8_t *buffer)
+{
+	int index = spi_buffer_index(buffer);
+	return (index < 0) ? SPI_BUFFER_STATE_FREE : spi_buffer_states[index];
+}
+
+/**
+ * @brief Get the number of free buffers
+ *
+ */
+size_t spi_buffer_free_count(void)
+{
+	return uxQueueMessagesWaiting(spi_buffer_free_queue);
+}
+
+/**
+ * @brief Get the number of buffers owned by a stage of the data path
+ *
+ */
+size_t spi_buffer_in_use_count(void)
+{
+	portENTER_CRITICAL(&spi_buffer_lock);
+	size_t in_use = spi_buffer_in_use;
+	portEXIT_CRITICAL(&spi_buffer_lock);
+	return in_use;
+}
+
+/**
+ * @brief Get the largest number of buffers in use at once since boot
+ *
+ */
+size_t spi_buffer_high_water_mark(void)
+{
+	portENTER_CRITICAL(&spi_buffer_lock);
+	size_t hwm = spi_buffer_hwm;
+	portEXIT_CRITICAL(&spi_buffer_lock);
+	return hwm;
+}
+
+/**
+ * @brief Take a snapshot of the pool statistics
+ *
+ * @param stats Pointer to the structure to be filled
+ */
+void spi_buffer_pool_get_stats(spi_buffer_pool_stats_t *stats)
+{
+	stats->free_count = spi_buffer_free_count();
+	portENTER_CRITICAL(&spi_buffer_lock);
+	stats->in_use_count = spi_buffer_in_use;
+	stats->high_water_mark = spi_buffer_hwm;
+	stats->acquire_fails = spi_buffer_acquire_fails;
+	stats->release_errors = spi_buffer_release_errors;
+	portEXIT_CRITICAL(&spi_buffer_lock);
+}
+
+/**
+ * @brief Output the pool statistics and current buffer owners to the monitor
+ *
+ */
+void spi_buffer_pool_report(void)
+{
+	spi_buffer_pool_stats_t stats;
+	size_t owner_counts[SPI_BUFFER_OWNER_COUNT] = {0};
+
+	spi_buffer_pool_get_stats(&stats);
+	portENTER_CRITICAL(&spi_buffer_lock);
+	for (size_t index = 0; index < SPI_BUFFER_COUNT; index++) {
+		owner_counts[spi_buffer_owners[index]]++;
+	}
+	portEXIT_CRITICAL(&spi_buffer_lock);
+
+	LOG_INFO(SPI, "SPI pool: %u free, %u in use, HWM %u/%u, fails %u", (unsigned)stats.free_count,
+		(unsigned)stats.in_use_count, (unsigned)stats.high_water_mark, SPI_BUFFER_COUNT, (unsigned)stats.acquire_fails);
+	for (size_t owner = SPI_BUFFER_OWNER_CLIENT; owner < SPI_BUFFER_OWNER_COUNT; owner++) {
+		if (owner_counts[owner] != 0) {
+			LOG_INFO(SPI, "  %s: %u", spi_buffer_owner_names[owner], (unsigned)owner_counts[owner]);
+		}
+	}
+}
@@ -0,0 +1,190 @@
+/**
+ * @file stream_ring.cpp
+ * @author Sid Price (sid@sidprice.com)
+ * @brief Byte ring and client sender shared by the stream servers
+ * @version 0.1
+ * @date 2025-10-06
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ */
+
+#include <Arduino.h>
+#include <lwip/sockets.h>
+
+#include "protocol.h"
+#include "psram_alloc.h"
+#include "stream_ring.h"
+#include "tasks/task_server.h"
+
+/**
+ * @brief Packet queued to a stream server when data is waiting
+ *
+ */
+static uint8_t packet_stream_ready[] = {PROTOCOL_MAGIC1, PROTOCOL_MAGIC2, SERVER_PACKET_TYPE_STREAM_READY, 0x00, 0x00};
+
+/**
+ * @brief Allocate the ring
+ *
+ * @param ring          The ring
+ * @param psram_size    Size of the ring in PSRAM
+ * @param internal_size Size of the ring in internal RAM, without PSRAM
+ * @return true if a ring was allocated
+ */
+bool stream_ring_init(stream_ring_t *ring, size_t psram_size, size_t internal_size)
+{
+	ring->data = (uint8_t *)psram_alloc(&ring->size, psram_size, internal_size);
+	ring->written = 0;
+	ring->read_position = 0;
+	if (ring->data == NULL) {
+		return false;
+	}
+	ring->lock = xSemaphoreCreateMutex();
+	return true;
+}
+
+/**
+ * @brief Add data to the ring, call with the lock held
+ *
+ * @param ring   The ring
+ * @param data   The data
+ * @param length Length of the data
+ * @return size_t Number of bytes overwritten before they were read
+ *
+ * The oldest data is overwritten when the ring is full, only the newest
+ * ring full of a long write is kept.
+ */
+size_t stream_ring_write(stream_ring_t *ring, const void *data, size_t length)
+{
+	const uint8_t *bytes = (const uint8_t *)data;
+	ring->written += length;
+	if (length > ring->size) {
+		bytes += length - ring->size;
+		length = ring->size;
+	}
+	size_t head = (size_t)((ring->written - length) % ring->size);
+	size_t first = ring->size - head;
+	if (first > length) {
+		first = length;
+	}
+	memcpy(ring->data + head, bytes, first);
+	memcpy(ring->data, bytes + first, length - first);
+	if (ring->written - ring->read_position <= ring->size) {
+		return 0;
+	}
+	size_t lost = (size_t)(ring->written - ring->size - ring->read_position);
+	ring->read_position = ring->written - ring->size;
+	return lost;
+}
+
+/**
+ * @brief Copy the oldest data not yet read out of the ring, call with the lock held
+ *
+ * @return size_t Number of bytes copied
+ */
+size_t stream_ring_read(stream_ring_t *ring, void *data, size_t max_length)
+{
+	uint8_t *bytes = (uint8_t *)data;
+	size_t waiting = stream_ring_waiting(ring);
+	size_t length = waiting < max_length ? waiting : max_length;
+	size_t tail = (size_t)(ring->read_position % ring->size);
+	size_t first = ring->size - tail;
+	if (first > length) {
+		first = length;
+	}
+	memcpy(bytes, ring->data + tail, first);
+	memcpy(bytes + first, ring->data, length - first);
+	ring->read_position += length;
+	return length;
+}
+
+/**
+ * @brief Start a client session
+ *
+ * @param sender       The sender
+ * @param server_queue The server queue, woken when data is waiting
+ */
+void stream_sender_start(stream_sender_t *sender, QueueHandle_t server_queue)
+{
+	sender->offset = 0;
+	sender->length = 0;
+	sender->signalled = false;
+	sender->queue = server_queue;
+}
+
+/**
+ * @brief End the client session, data not yet sent is discarded
+ *
+ */
+void stream_sender_end(stream_sender_t *sender)
+{
+	sender->queue = NULL;
+	sender->offset = 0;
+	sender->length = 0;
+}
+
+/**
+ * @brief Wake the server if a client is connected and it has not been woken already
+ *
+ */
+void stream_sender_signal(stream_sender_t *sender)
+{
+	QueueHandle_t server_queue = sender->queue;
+	if (server_queue == NULL || sender->signalled) {
+		return;
+	}
+	sender->signalled = true;
+	uint8_t *message = packet_stream_ready;
+	if (xQueueSend(server_queue, &message, 0) != pdTRUE) {
+		sender->signalled = false; // Retried on the next write
+		return;
+	}
+	network_wake();
+}
+
+/**
+ * @brief Send the waiting data to the client
+ *
+ * @param sender     The sender
+ * @param client_fd  The non-blocking client socket
+ * @param bytes_sent Set to the number of bytes the socket took
+ * @return false if the client socket failed
+ *
+ * Called by the network task when the server is woken or its blocked
+ * socket becomes writable. At most the budget is taken from the stream per
+ * call, if more is waiting the server is woken again.
+ */
+bool stream_sender_send(stream_sender_t *sender, int client_fd, size_t *bytes_sent)
+{
+	sender->signalled = false;
+	*bytes_sent = 0;
+	size_t taken = 0;
+	while (true) {
+		if (sender->offset == sender->length) {
+			if (taken >= sender->budget) {
+				break;
+			}
+			sender->offset = 0;
+			sender->length = sender->fill(sender->buffer, sender->buffer_size);
+			if (sender->length == 0) {
+				break;
+			}
+			taken += sender->length;
+		}
+		ssize_t sent = send(client_fd, sender->buffer + sender->offset, sender->length - sender->offset, 0);
+		if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break; // The network task waits for the socket to be writable
+		}
+		if (sent <= 0) {
+			sender->offset = 0;
+			sender->length = 0;
+			return false;
+		}
+		sender->offset += (size_t)sent;
+		*bytes_sent += (size_t)sent;
+	}
+	if (!stream_sender_blocked(sender) && sender->waiting()) {
+		stream_sender_signal(sender);
+	}
+	return true;
+}
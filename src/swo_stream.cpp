@@ -0,0 +1,251 @@
+/**
+ * @file swo_stream.cpp
+ * @author Sid Price (sid@sidprice.com)
+ * @brief SWO trace streaming from ctxLink to the SWO server client
+ * @version 0.1
+ * @date 2025-09-18
+ *
+ * @copyright Copyright Sid Price (c) 2025
+ *
+ * The SPI task is the only writer and the network task the only reader,
+ * the ring and the sender are those of stream_ring.h. Starting a session
+ * empties the ring, the data is only kept while a client is connected.
+ */
+
+#include <Arduino.h>
+#include <lwip/sockets.h>
+
+#include "link_control.h"
+#include "protocol.h"
+#include "serial_control.h"
+#include "spi_buffer_pool.h"
+#include "stream_ring.h"
+#include "swo_stream.h"
+#include "tasks/task_server.h"
+#include "tasks/task_spi_comms.h"
+
+/**
+ * @brief Period of the statistics report to ctxLink while data flows
+ *
+ */
+static constexpr uint32_t swo_stream_report_period_ms = 1000;
+
+static stream_ring_t ring = {0};
+static swo_stream_stats_t session_stats = {0};
+static uint32_t report_time_ms = 0;
+static uint32_t report_bytes_sent = 0;
+
+/**
+ * @brief Take the oldest waiting data out of the ring
+ *
+ * @return size_t Number of bytes taken
+ */
+static size_t swo_stream_fill(uint8_t *buffer, size_t size)
+{
+	xSemaphoreTake(ring.lock, portMAX_DELAY);
+	size_t length = stream_ring_read(&ring, buffer, size);
+	xSemaphoreGive(ring.lock);
+	return length;
+}
+
+/**
+ * @brief Check if data is still waiting in the ring
+ *
+ */
+static bool swo_stream_waiting(void)
+{
+	xSemaphoreTake(ring.lock, portMAX_DELAY);
+	bool waiting = stream_ring_waiting(&ring) != 0;
+	xSemaphoreGive(ring.lock);
+	return waiting;
+}
+
+static uint8_t send_buffer[SWO_STREAM_SEND_SIZE];
+static stream_sender_t sender = {swo_stream_fill, swo_stream_waiting, send_buffer, sizeof(send_buffer)};
+
+/**
+ * @brief Allocate the ring
+ *
+ * @return true if a ring was allocated
+ */
+bool swo_stream_init(void)
+{
+	if (!stream_ring_init(&ring, SWO_STREAM_RING_SIZE_PSRAM, SWO_STREAM_RING_SIZE_INTERNAL)) {
+		LOG_ERROR(NET, "SWO stream: no memory for the ring");
+		return false;
+	}
+	sender.budget = ring.size; // At most one ring full per send so that the other servers are not starved
+	LOG_INFO(NET, "SWO stream: %u byte ring", (unsigned)ring.size);
+	return true;
+}
+
+/**
+ * @brief Start a client session, the ring is emptied and the counters cleared
+ *
+ * @param server_queue The SWO server queue, woken when data is waiting
+ */
+void swo_stream_session_start(QueueHandle_t server_queue)
+{
+	if (ring.data == NULL) {
+		return;
+	}
+	xSemaphoreTake(ring.lock, portMAX_DELAY);
+	ring.read_position = ring.written;
+	session_stats = {0};
+	session_stats.ring_size = ring.size;
+	stream_sender_start(&sender, server_queue);
+	xSemaphoreGive(ring.lock);
+	report_time_ms = millis();
+	report_bytes_sent = 0;
+}
+
+/**
+ * @brief Send the session statistics to ctxLink, if it accepted them
+ *
+ */
+static void swo_stream_report(void)
+{
+	if (!link_control_has(LINK_CAP_SWO_STATISTICS)) {
+		return;
+	}
+	uint32_t now = millis();
+	uint32_t elapsed_ms = now - report_time_ms;
+	swo_stream_status_s status_packet = {0};
+	status_packet.type = SERVER_STATUS_TYPE_SWO_CLIENT;
+	status_packet.status = SWO_STREAM_STATUS_STATISTICS;
+	status_packet.bytes_received = session_stats.bytes_received;
+	status_packet.bytes_sent = session_stats.bytes_sent;
+	status_packet.overrun_bytes = session_stats.overrun_bytes;
+	status_packet.overruns = session_stats.overruns;
+	if (elapsed_ms != 0) {
+		status_packet.bytes_per_second =
+			(uint32_t)(((uint64_t)(session_stats.bytes_sent - report_bytes_sent) * 1000) / elapsed_ms);
+	}
+	report_time_ms = now;
+	report_bytes_sent = session_stats.bytes_sent;
+	//
+	// The report is not worth waiting for, skip it if the pool is empty
+	//
+	uint8_t *message = spi_buffer_acquire(SPI_BUFFER_OWNER_SERVER, 0);
+	if (message == NULL) {
+		return;
+	}
+	memcpy(message, &status_packet, sizeof(status_packet));
+	package_data(message, sizeof(status_packet), PROTOCOL_PACKET_TYPE_STATUS);
+	spi_buffer_tag(message, SPI_BUFFER_OWNER_SPI_COMMS, SPI_BUFFER_STATE_QUEUED);
+	if (xQueueSend(spi_comms_input_queue, &message, 0) != pdTRUE) {
+		spi_buffer_release(message);
+	}
+}
+
+/**
+ * @brief End the client session, the final statistics are sent to ctxLink
+ *
+ */
+void swo_stream_session_end(void)
+{
+	if (ring.data == NULL) {
+		return;
+	}
+	xSemaphoreTake(ring.lock, portMAX_DELAY);
+	stream_sender_end(&sender);
+	ring.read_position = ring.written;
+	xSemaphoreGive(ring.lock);
+	swo_stream_report();
+	LOG_INFO(NET, "SWO session: %u bytes sent, %u overwritten in %u overruns", (unsigned)session_stats.bytes_sent,
+		(unsigned)session_stats.overrun_bytes, (unsigned)session_stats.overruns);
+}
+
+/**
+ * @brief Add SWO data from ctxLink to the ring
+ *
+ * @param data   The SWO data
+ * @param length Length of the data
+ *
+ * Called by the SPI task. Without a client the data is dropped, when the
+ * ring is full the oldest data is overwritten.
+ */
+void swo_stream_write(const uint8_t *data, size_t length)
+{
+	if (ring.data == NULL || sender.queue == NULL || length == 0) {
+		return;
+	}
+	xSemaphoreTake(ring.lock, portMAX_DELAY);
+	if (sender.queue == NULL) {
+		xSemaphoreGive(ring.lock);
+		return;
+	}
+	session_stats.bytes_received += length;
+	size_t lost = stream_ring_write(&ring, data, length);
+	if (lost != 0) {
+		session_stats.overrun_bytes += lost;
+		session_stats.overruns++;
+	}
+	size_t waiting = stream_ring_waiting(&ring);
+	if (waiting > session_stats.high_water_mark) {
+		session_stats.high_water_mark = waiting;
+	}
+	xSemaphoreGive(ring.lock);
+	stream_sender_signal(&sender);
+}
+
+/**
+ * @brief Send the waiting SWO data to the client
+ *
+ * @param client_fd The non-blocking client socket
+ * @return false if the client socket failed
+ */
+bool swo_stream_send(int client_fd)
+{
+	if (ring.data == NULL) {
+		return true;
+	}
+	size_t sent;
+	bool sent_ok = stream_sender_send(&sender, client_fd, &sent);
+	session_stats.bytes_sent += (uint32_t)sent;
+	if (!sent_ok) {
+		LOG_WARN(NET, "SWO stream: send failed -> %d", errno);
+		return false;
+	}
+	if (millis() - report_time_ms >= swo_stream_report_period_ms) {
+		swo_stream_report();
+	}
+	return true;
+}
+
+/**
+ * @brief Check if the client socket did not take all of the data of the last send
+ *
+ */
+bool swo_stream_send_blocked(void)
+{
+	return stream_sender_blocked(&sender);
+}
+
+/**
+ * @brief Get a copy of the session statistics
+ *
+ * @param stats Pointer to the structure to be filled
+ */
+void swo_stream_get_stats(swo_stream_stats_t *stats)
+{
+	if (ring.data == NULL) {
+		*stats = {0};
+		return;
+	}
+	xSemaphoreTake(ring.lock, portMAX_DELAY);
+	*stats = session_stats;
+	xSemaphoreGive(ring.lock);
+}
+
+/**
+ * @brief The SWO stream as the source of the SWO server, the client input goes to ctxLink
+ *
+ */
+const server_stream_t swo_stream_server = {
+	swo_stream_session_start,
+	swo_stream_session_end,
+	swo_stream_send,
+	swo_stream_send_blocked,
+	NULL,
+};
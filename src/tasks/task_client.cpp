@@ -7,7 +7,7 @@
  * 
  * @copyright Copyright (c) 2025
  * 
- * The task to manage the inflow of client data and forward it
+ * The inflow of client data, read by the network task and forwarded
  * to ctxLink via the SPI task
  */
 
@@ -15,106 +15,355 @@
 #include "serial_control.h"
 #include "task_client.h"
 #include "ctxlink.h"
+#include "hex_codec.h"
+#include "link_control.h"
+#include "packet_trace.h"
 #include "protocol.h"
+#include "rsp_cache.h"
 #include "tasks/task_server.h"
 #include "tasks/task_spi_comms.h"
+#include "spi_buffer_pool.h"
 #include "debug.h"
 
+/**
+ * @brief Pool buffers client input leaves free
+ *
+ * With an empty pool the SPI driver has nowhere to put what ctxLink sends
+ * and the data is lost. Client input stops short of that, leaving buffers
+ * for the next received frame, a message being reassembled, the fragment
+ * being built and the status and control packets.
+ */
+constexpr size_t client_buffer_reserve = 4;
+
+/**
+ * @brief Entries client input leaves free in the SPI input queue
+ *
+ * A full queue would drop the packet, client input stops short of that
+ * so that the status and link control packets always find room.
+ */
+constexpr UBaseType_t client_queue_reserve = 2;
+
+/**
+ * @brief Packets the network task queues to the GDB server with LINK_CAP_RSP_OFFLOAD
+ *
+ * Static packets, as the SWO wake-up, returning them to the pool does nothing.
+ */
+static uint8_t packet_rsp_ack[] = {PROTOCOL_MAGIC1, PROTOCOL_MAGIC2, SERVER_PACKET_TYPE_TO_CLIENT_RAW, 0x00, 0x01, '+'};
+static uint8_t packet_rsp_nak[] = {PROTOCOL_MAGIC1, PROTOCOL_MAGIC2, SERVER_PACKET_TYPE_TO_CLIENT_RAW, 0x00, 0x01, '-'};
+static uint8_t packet_rsp_retransmit[] = {
+	PROTOCOL_MAGIC1, PROTOCOL_MAGIC2, SERVER_PACKET_TYPE_RSP_RETRANSMIT, 0x00, 0x00};
+
 /**
  * @brief Send the client state to the ctxLink
  *
  * @param server_params The server task parameters
  * @param state The state of the client (0x01 = connected, 0x00 = disconnected)
+ * @return false if there was no buffer or no room in the SPI input queue, send it again later
+ *
+ * Called by the network task, which must never wait for a buffer: only it
+ * frees the buffers queued to its slow clients.
  */
-void send_client_state_to_ctxlink(server_task_params_t *server_params, uint8_t state)
+bool send_client_state_to_ctxlink(server_task_params_t *server_params, uint8_t state)
 {
 	protocol_packet_status_s status_packet = {0};
-	protocol_packet_command_s command_packet = {0};
-	//
-	// If the state is 0x00, then the client has disconnected, so we need to inform the server
-	//
-	if (state == 0x00) {
-		command_packet.type = PROTOCOL_PACKET_TYPE_COMMAND;
-		command_packet.command = PROTOCOL_PACKET_TYPE_CMD_CLIENT_CLOSED;
-		uint8_t *message = get_next_spi_buffer();
-		memcpy(message, &command_packet, sizeof(protocol_packet_command_s));
-		package_data(message, sizeof(protocol_packet_command_s), PROTOCOL_PACKET_TYPE_COMMAND);
-		xQueueSend(server_params->server_queue, &message, 0);
-	}
 	//
 	// Inform ctxLink of the client state
 	//
 	status_packet.type = server_params->server_type; // Indicate the server type
 	status_packet.status = state;                    // 0x01 = connected, 0x00 = disconnected
-	uint8_t *message = get_next_spi_buffer();
+	uint8_t *message = spi_buffer_acquire(SPI_BUFFER_OWNER_CLIENT, 0);
+	if (message == NULL) {
+		return false;
+	}
 	memcpy(message, &status_packet, sizeof(protocol_packet_status_s));
 	package_data(message, sizeof(protocol_packet_status_s), PROTOCOL_PACKET_TYPE_STATUS);
-	xQueueSend(spi_comms_input_queue, &message, 0);
+	spi_buffer_tag(message, SPI_BUFFER_OWNER_SPI_COMMS, SPI_BUFFER_STATE_QUEUED);
+	if (xQueueSend(spi_comms_input_queue, &message, 0) != pdTRUE) {
+		spi_buffer_release(message);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Check if the SPI path has room for another packet of client input
+ *
+ * @param buffers_held Pool buffers the caller holds and returns once done, counted as free
+ * @return true if a pool buffer and an SPI input queue entry are available above the reserves
+ */
+static bool client_has_credit(size_t buffers_held)
+{
+	return spi_buffer_free_count() + buffers_held > client_buffer_reserve &&
+		uxQueueSpacesAvailable(spi_comms_input_queue) > client_queue_reserve;
+}
+
+/**
+ * @brief Send a GDB interrupt to ctxLink ahead of the input already queued
+ *
+ */
+static void client_send_interrupt(server_task_params_t *server_params)
+{
+	uint8_t *message = spi_buffer_acquire(SPI_BUFFER_OWNER_CLIENT, 0);
+	if (message == NULL) {
+		LOG_WARN(NET, "No buffer for the client interrupt, dropped");
+		return;
+	}
+	message[0] = RSP_INTERRUPT;
+	package_data(message, 1,
+		link_control_has(LINK_CAP_RSP_OFFLOAD) ? (protocol_packet_type_e)LINK_PACKET_TYPE_GDB_INTERRUPT
+											   : server_params->source_type);
+	spi_buffer_tag(message, SPI_BUFFER_OWNER_SPI_COMMS, SPI_BUFFER_STATE_QUEUED);
+	packet_trace(PACKET_TRACE_CLIENT_FORWARD, message, link_packet_length(message));
+	if (xQueueSendToFront(spi_comms_input_queue, &message, 0) != pdTRUE) {
+		LOG_WARN(NET, "SPI input queue full, client interrupt dropped");
+		spi_buffer_release(message);
+	}
+}
+
+/**
+ * @brief Find the hex data of an M request
+ *
+ * @return size_t Length of the "Maddr,length:" before the data, 0 if the
+ *                payload is not an M request or the digits are not whole bytes
+ */
+static size_t client_memory_write_prefix(const uint8_t *payload, size_t payload_length)
+{
+	if (payload_length == 0 || payload[0] != 'M') {
+		return 0;
+	}
+	const uint8_t *colon = (const uint8_t *)memchr(payload, ':', payload_length);
+	if (colon == NULL) {
+		return 0;
+	}
+	size_t prefix = (size_t)(colon - payload) + 1;
+	return (payload_length - prefix) % 2 == 0 ? prefix : 0;
+}
+
+/**
+ * @brief Forward the payload of an RSP packet to ctxLink, with LINK_CAP_RSP_OFFLOAD
+ *
+ * @return false if there was no buffer for it
+ *
+ * With LINK_CAP_BINARY_MEMORY the data of an M request is converted to
+ * binary. A request with bad digits is forwarded as it is, for ctxLink to
+ * reject.
+ */
+static bool client_send_payload(server_task_params_t *server_params, const uint8_t *payload, size_t payload_length)
+{
+	uint8_t *message = spi_buffer_acquire(SPI_BUFFER_OWNER_CLIENT, 0);
+	if (message == NULL) {
+		return false;
+	}
+	size_t prefix = link_control_has(LINK_CAP_BINARY_MEMORY) ? client_memory_write_prefix(payload, payload_length) : 0;
+	size_t data_length = (payload_length - prefix) / 2;
+	if (prefix != 0 && hex_decode(message + prefix, payload + prefix, data_length)) {
+		memcpy(message, payload, prefix);
+		package_data(message, prefix + data_length, (protocol_packet_type_e)LINK_PACKET_TYPE_GDB_MEMORY_WRITE);
+		server_params->rsp_framer->stats.binary_writes++;
+		server_params->rsp_framer->stats.binary_bytes += data_length;
+	} else {
+		memcpy(message, payload, payload_length);
+		package_data(message, payload_length, server_params->source_type);
+	}
+	spi_buffer_tag(message, SPI_BUFFER_OWNER_SPI_COMMS, SPI_BUFFER_STATE_QUEUED);
+	packet_trace(PACKET_TRACE_CLIENT_FORWARD, message, link_packet_length(message));
+	if (xQueueSend(spi_comms_input_queue, &message, 0) != pdTRUE) {
+		LOG_WARN(NET, "SPI input queue full, client data dropped");
+		spi_buffer_release(message);
+	}
+	return true;
+}
+
+/**
+ * @brief Build the packet answering a request from the RSP cache, with LINK_CAP_RSP_CACHE
+ *
+ * @return uint8_t* The packet for the GDB server, NULL if there was no buffer for it
+ */
+static uint8_t *client_cached_answer(const uint8_t *reply, size_t reply_length)
+{
+	uint8_t *message = spi_buffer_acquire(SPI_BUFFER_OWNER_CLIENT, 0);
+	if (message == NULL) {
+		return NULL;
+	}
+	memcpy(message, reply, reply_length);
+	package_data(message, reply_length, PROTOCOL_PACKET_TYPE_TO_CLIENT);
+	spi_buffer_tag(message, SPI_BUFFER_OWNER_SERVER, SPI_BUFFER_STATE_QUEUED);
+	return message;
 }
 
 /**
- * @brief Task to manage the inflow of client data and forward it to ctxLink via the SPI task
+ * @brief Terminate the RSP ack layer for the data of a read, with LINK_CAP_RSP_OFFLOAD
  *
- * @param pvParameters Not used
+ * @param server_params The GDB server parameters
+ * @param data          The held bytes followed by the new data, in a pool buffer
+ * @param held          Number of held bytes
+ * @param length        Length of data
+ * @param max_length    Most data a read may hold
  *
- * This task is responsible for managing the inflow of client data and forwarding it to ctxLink via the SPI task.
+ * Packets with a good checksum are acked and their payload forwarded in a
+ * packet of its own. A bad packet is NAKed so that GDB sends it again, a
+ * NAK from GDB resends the last packet sent to it, ctxLink sees neither.
+ * The acks are queued to the GDB server ahead of any reply from ctxLink.
+ * A static query found in the RSP cache is answered here and never
+ * reaches ctxLink.
+ *
+ * Once the SPI path has no room for another packet the units left are
+ * held back by the framer, GDB's stream simply waits for them.
+ *
+ * @return false if units were held back for lack of room
  */
-void task_client(void *pvParameters)
+static bool client_unwrap_rsp(
+	server_task_params_t *server_params, uint8_t *data, size_t held, size_t length, size_t max_length)
 {
-	server_task_params_t *server_params = (server_task_params_t *)pvParameters;
-	int client_fd = server_params->client_fd; // Get the client file descriptor from the parameters
+	rsp_framer_t *framer = server_params->rsp_framer;
+	size_t offset = framer->hold_deferred ? 0 : held;
+	uint8_t *payload;
+	size_t payload_length;
+	rsp_unit_e unit;
+	while ((unit = rsp_framer_unwrap(framer, data, length, &offset, &payload, &payload_length)) != RSP_UNIT_NONE) {
+		if ((unit == RSP_UNIT_PACKET || unit == RSP_UNIT_INTERRUPT) && !client_has_credit(1)) {
+			size_t unit_start = unit == RSP_UNIT_PACKET ? (size_t)(payload - 1 - data) : offset - 1;
+			rsp_framer_unwrap_defer(framer, data, length, unit_start);
+			return false;
+		}
+		uint8_t *reply = NULL;
+		uint8_t *answer = NULL;
+		switch (unit) {
+		case RSP_UNIT_PACKET: {
+			size_t cached_length;
+			const uint8_t *cached = rsp_cache_request(payload, payload_length, &cached_length);
+			if (cached != NULL) {
+				answer = client_cached_answer(cached, cached_length);
+				reply = answer != NULL ? packet_rsp_ack : packet_rsp_nak;
+			} else if (client_send_payload(server_params, payload, payload_length)) {
+				framer->stats.packets_sent++;
+				reply = packet_rsp_ack;
+			} else {
+				rsp_cache_cancel();
+				reply = packet_rsp_nak;
+			}
+			if (reply == packet_rsp_nak) {
+				framer->stats.dropped++; // GDB sends it again once buffers are free
+			}
+			break;
+		}
+		case RSP_UNIT_BAD_CHECKSUM:
+		case RSP_UNIT_OVERSIZE:
+			reply = packet_rsp_nak;
+			break;
+		case RSP_UNIT_NAK:
+			reply = packet_rsp_retransmit;
+			break;
+		case RSP_UNIT_INTERRUPT:
+			client_send_interrupt(server_params);
+			break;
+		default:
+			break; // GDB's acks end here
+		}
+		if (reply != NULL && !framer->no_ack) {
+			if (reply == packet_rsp_ack) {
+				framer->stats.acks_sent++;
+			}
+			if (!server_queue_send(server_params, reply, 0)) {
+				LOG_WARN(NET, "GDB server queue full, RSP ack dropped");
+			}
+		}
+		if (answer != NULL && !server_queue_send(server_params, answer, 0)) {
+			LOG_WARN(NET, "GDB server queue full, cached reply dropped");
+			spi_buffer_release(answer);
+		}
+	}
+	rsp_framer_unwrap_done(framer, data, length, max_length);
+	return true;
+}
+
+/**
+ * @brief Read the data waiting on a client socket and forward it to ctxLink via the SPI task
+ *
+ * @param server_params The server parameters, client_fd is the non-blocking client socket
+ * @return client_receive_e The result of the read
+ *
+ * Called by the network task when the client socket is readable. Nothing
+ * is read while the buffer pool or the SPI input queue is down to its
+ * reserve, this stops the socket being read while the rest of the data
+ * path catches up and TCP flow control holds the client back. Units held
+ * back for lack of room are forwarded before the socket is read again.
+ *
+ * With an RSP framer the data is forwarded up to the end of the last whole
+ * RSP packet or ack, the rest is held back and forwarded with the next read.
+ * With LINK_CAP_RSP_OFFLOAD only the payloads of the packets are forwarded.
+ */
+client_receive_e client_receive(server_task_params_t *server_params)
+{
+	if (!client_has_credit(0)) {
+		return CLIENT_RECEIVE_NO_BUFFER;
+	}
+	uint8_t *net_input_buffer = spi_buffer_acquire(SPI_BUFFER_OWNER_CLIENT, 0);
+	if (net_input_buffer == NULL) {
+		return CLIENT_RECEIVE_NO_BUFFER;
+	}
 	//
-	// Inform ctxLink GDB client connected
+	// Leave room for the protocol header. Unless ctxLink accepts segmented
+	// packets the read is also limited to what fits one SPI frame.
 	//
-	send_client_state_to_ctxlink(server_params, 0x01);
-	while (true) {
-		uint8_t *net_input_buffer = get_next_spi_buffer();
-		int bytes_received = read(client_fd, net_input_buffer, SPI_BUFFER_SIZE);
-		if (bytes_received > 0) {
-			size_t packed_size;
-			//
-			// Send input to the SPI task for forwarding to ctxLink
-			//
-			packed_size = package_data(net_input_buffer, bytes_received, server_params->source_type);
-			// MONITOR(print("Bytes received: "));
-			// MONITOR(println(bytes_received));
-			// for (int i = 0; i < packed_size; i++)
-			// {
-			//     MONITOR(printf("%02x ", net_input_buffer[i]));
-			// }
-			// MONITOR(println());
-			ctxlink_toggle_nReady();
-			xQueueSend(spi_comms_input_queue, &net_input_buffer, 0);
-		} else if (bytes_received == 0) {
-			MON_NL("Client disconnected");
-			close(client_fd);
-			client_fd = -1;
+	size_t max_length = link_control_max_packet_data();
+	rsp_framer_t *framer = server_params->rsp_framer;
+	size_t held = framer != NULL ? rsp_framer_restore(framer, net_input_buffer, max_length) : 0;
+	bool deferred = held != 0 && framer->hold_deferred && link_control_has(LINK_CAP_RSP_OFFLOAD);
+	int bytes_received = deferred ? 0 : read(server_params->client_fd, net_input_buffer + held, max_length - held);
+	if (bytes_received > 0) {
+		packet_trace(PACKET_TRACE_CLIENT_READ, net_input_buffer, bytes_received);
+	}
+	if (bytes_received > 0 || deferred) {
+		size_t length = held + bytes_received;
+		if (framer != NULL && link_control_has(LINK_CAP_RSP_OFFLOAD)) {
+			bool forwarded = client_unwrap_rsp(server_params, net_input_buffer, held, length, max_length);
+			spi_buffer_release(net_input_buffer);
+			return forwarded ? CLIENT_RECEIVE_DATA : CLIENT_RECEIVE_NO_BUFFER;
+		}
+		if (framer != NULL) {
+			bool interrupt = false;
+			size_t complete = rsp_framer_frame(framer, net_input_buffer, &length, max_length, &interrupt);
+			if (interrupt) {
+				client_send_interrupt(server_params);
+			}
+			length = complete;
+		}
+		if (length == 0) {
 			//
-			// Inform ctxLink the client disconnected
+			// Nothing whole yet, the framer holds the data until the rest arrives
 			//
-			send_client_state_to_ctxlink(server_params, 0x00);
-			break;
-		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
-			// No data available, continue the loop
-			MON_NL("Would block socket state");
-			// vTaskDelay(10 / portTICK_PERIOD_MS); // Yield to other tasks
-		} else if (errno == ECONNRESET) {
-			MON_NL("Client disconnected abruptly (ECONNRESET)");
-			close(client_fd);
-			client_fd = -1;
-			send_client_state_to_ctxlink(server_params, 0x00);
-			break;
-		} else {
-			MON_PRINTF("Socket read failed: %d\r\n", errno);
-			close(client_fd);
-			client_fd = -1;
-			send_client_state_to_ctxlink(server_params, 0x00);
-			break;
+			spi_buffer_release(net_input_buffer);
+			return CLIENT_RECEIVE_DATA;
+		}
+		//
+		// Send input to the SPI task for forwarding to ctxLink
+		//
+		package_data(net_input_buffer, length, server_params->source_type);
+		ctxlink_toggle_nReady();
+		spi_buffer_tag(net_input_buffer, SPI_BUFFER_OWNER_SPI_COMMS, SPI_BUFFER_STATE_QUEUED);
+		packet_trace(PACKET_TRACE_CLIENT_FORWARD, net_input_buffer, link_packet_length(net_input_buffer));
+		if (xQueueSend(spi_comms_input_queue, &net_input_buffer, 0) != pdTRUE) {
+			LOG_WARN(NET, "SPI input queue full, client data dropped");
+			spi_buffer_release(net_input_buffer);
 		}
+		return CLIENT_RECEIVE_DATA;
 	}
 	//
-	// Kill this thread, client has disconnected
+	// Nothing was received, return the buffer to the pool
 	//
-	MON_NL("Client task deleted");
-	vTaskDelete(NULL);
-}
\ No newline at end of file
+	int read_errno = errno;
+	spi_buffer_release(net_input_buffer);
+	if (bytes_received == 0) {
+		LOG_INFO(NET, "Client disconnected");
+		return CLIENT_RECEIVE_CLOSED;
+	} else if (read_errno == EAGAIN || read_errno == EWOULDBLOCK) {
+		return CLIENT_RECEIVE_DATA; // Nothing waiting after all
+	} else if (read_errno == ECONNRESET) {
+		LOG_INFO(NET, "Client disconnected abruptly (ECONNRESET)");
+		return CLIENT_RECEIVE_CLOSED;
+	} else {
+		LOG_WARN(NET, "Socket read failed: %d", read_errno);
+		return CLIENT_RECEIVE_CLOSED;
+	}
+}
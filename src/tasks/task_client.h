@@ -7,13 +7,26 @@
  * 
  * @copyright Copyright (c) 2025
  * 
- * Header file for the task handling client connections
+ * Header file for the handling of client input
  */
 #ifndef TASK_CLIENT_H
 #define TASK_CLIENT_H
 
 #include <stdint.h>
 
-void task_client(void *pvParameters);
+#include "task_server.h"
+
+/**
+ * @brief Result of reading a client socket
+ *
+ */
+typedef enum {
+	CLIENT_RECEIVE_DATA,      // Data was forwarded, or there was none after all
+	CLIENT_RECEIVE_NO_BUFFER, // The buffer pool is empty, try again later
+	CLIENT_RECEIVE_CLOSED,    // The client has gone, its socket must be closed
+} client_receive_e;
+
+bool send_client_state_to_ctxlink(server_task_params_t *server_params, uint8_t state);
+client_receive_e client_receive(server_task_params_t *server_params);
 
 #endif // TASK_CLIENT_H
\ No newline at end of file
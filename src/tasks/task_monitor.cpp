@@ -7,35 +7,641 @@
  *
  * @copyright Copyright Sid Price (c) 2025
  *
+ * The LOG macros leave binary records, see monitor_log.h, in a ring per
+ * core. This task takes them out, formats them and writes them to the log
+ * port backlog and the serial port, so none of the formatting is done by
+ * the task or ISR that logged.
+ *
+ * Logging never waits. A producer reserves room in the ring of the core it
+ * runs on with a compare and swap of the head, copies its record in and
+ * then commits it by storing its length word. Tasks and ISRs on one core
+ * interrupt each other and a task may move to the other core, the compare
+ * and swap keeps every reservation its own. When the ring is full the
+ * record is dropped and counted. The monitor task is the only consumer, it
+ * polls the rings, stops at the first record not yet committed and zeroes
+ * what it has read before it hands the room back, so a length word is only
+ * ever non-zero once its record has been written.
+ *
+ * Each record carries a sequence number taken when it is reserved, the
+ * rings are merged in that order.
  */
 
 #include <Arduino.h>
+#include <atomic>
+#include "log_stream.h"
+#include "packet_trace.h"
 #include "serial_control.h"
 #include "task_monitor.h"
 
 /**
- * @brief The queue handle for the monitor output task  
- * 
+ * @brief Bits of a record's length word
+ *
+ */
+static constexpr uint32_t monitor_ring_skip = 0x80000000;     // Padding to the end of the ring, no record
+static constexpr uint32_t monitor_ring_length_mask = 0x0000ffff; // Bytes taken in the ring, this word included
+
+/**
+ * @brief A record in a ring, the monitor_log.h record follows
+ *
+ */
+typedef struct {
+	uint32_t length;   // Length word, 0 until the record is committed
+	uint32_t sequence; // Order of the reservation over both rings
+} monitor_ring_entry_t;
+
+typedef struct {
+	std::atomic<uint32_t> head; // Next byte reserved, free running
+	std::atomic<uint32_t> tail; // Next byte read, free running
+	std::atomic<uint32_t> dropped;
+	uint8_t storage[MONITOR_RING_SIZE] __attribute__((aligned(4)));
+} monitor_ring_t;
+
+static monitor_ring_t monitor_rings[portNUM_PROCESSORS];
+static std::atomic<uint32_t> monitor_sequence(0);
+
+static monitor_stats_t monitor_stats = {0};
+
+/**
+ * @brief Levels compiled in, the run time levels cannot go above them
+ *
+ */
+static const uint8_t log_compiled_levels[LOG_MODULE_COUNT] = {
+	LOG_LEVEL_SPI,
+	LOG_LEVEL_NET,
+	LOG_LEVEL_WIFI,
+	LOG_LEVEL_PREFS,
+};
+
+static const char *const log_module_names[LOG_MODULE_COUNT] = {"spi", "net", "wifi", "prefs"};
+static const char *const log_level_names[] = {"none", "error", "warn", "info", "debug", "verbose"};
+
+#define LOG_LEVEL_START(COMPILED) ((COMPILED) < LOG_LEVEL_RUNTIME ? (COMPILED) : LOG_LEVEL_RUNTIME)
+
+/**
+ * @brief Run time level of each module, read by the LOG macros
+ *
+ */
+uint8_t log_levels[LOG_MODULE_COUNT] = {
+	LOG_LEVEL_START(LOG_LEVEL_SPI),
+	LOG_LEVEL_START(LOG_LEVEL_NET),
+	LOG_LEVEL_START(LOG_LEVEL_WIFI),
+	LOG_LEVEL_START(LOG_LEVEL_PREFS),
+};
+
+/**
+ * @brief Command being received on the serial console
+ *
+ */
+static monitor_command_t console_command = {0};
+
+/**
+ * @brief Formatted output of a batch is collected here and written to the port in one go
+ *
+ */
+static char output[MONITOR_OUTPUT_BATCH_SIZE];
+static size_t output_length = 0;
+
+static inline uint32_t *monitor_ring_word(monitor_ring_t *ring, uint32_t position)
+{
+	return (uint32_t *)(ring->storage + position % MONITOR_RING_SIZE);
+}
+
+/**
+ * @brief Pass a record to the monitor task, called by monitor_log()
+ *
+ * @param record The record, copied into the ring
+ * @param length Length of the record
+ *
+ * Wait-free for the caller and safe in an ISR, the record is dropped and
+ * counted when the ring of the current core is full.
+ */
+void IRAM_ATTR monitor_log_submit(const uint8_t *record, size_t length)
+{
+	monitor_ring_t *ring = &monitor_rings[xPortGetCoreID()];
+	uint32_t size = (uint32_t)((sizeof(monitor_ring_entry_t) + length + 3) & ~(size_t)3);
+	if (size > MONITOR_RING_SIZE / 2) {
+		ring->dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	uint32_t head = ring->head.load(std::memory_order_relaxed);
+	uint32_t padding;
+	do {
+		uint32_t offset = head % MONITOR_RING_SIZE;
+		padding = offset + size > MONITOR_RING_SIZE ? MONITOR_RING_SIZE - offset : 0;
+		if (head + padding + size - ring->tail.load(std::memory_order_acquire) > MONITOR_RING_SIZE) {
+			ring->dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+	} while (!ring->head.compare_exchange_weak(head, head + padding + size, std::memory_order_relaxed));
+	uint32_t sequence = monitor_sequence.fetch_add(1, std::memory_order_relaxed);
+	if (padding != 0) {
+		__atomic_store_n(monitor_ring_word(ring, head), monitor_ring_skip | padding, __ATOMIC_RELEASE);
+	}
+	uint8_t *entry = (uint8_t *)monitor_ring_word(ring, head + padding);
+	memcpy(entry + offsetof(monitor_ring_entry_t, sequence), &sequence, sizeof(sequence));
+	memcpy(entry + sizeof(monitor_ring_entry_t), record, length);
+	__atomic_store_n((uint32_t *)entry, size, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Get a copy of the monitor statistics
+ *
+ * @param stats Pointer to the structure to be filled
+ */
+void task_monitor_get_stats(monitor_stats_t *stats)
+{
+	*stats = monitor_stats;
+	stats->dropped = 0;
+	for (monitor_ring_t &ring : monitor_rings) {
+		stats->dropped += ring.dropped.load(std::memory_order_relaxed);
+	}
+}
+
+/**
+ * @brief Set the run time level of a module
+ *
+ * @param module The module
+ * @param level  The level, limited to the level compiled in for the module
+ * @return uint8_t The level set
+ */
+uint8_t log_set_level(log_module_e module, uint8_t level)
+{
+	if (level > log_compiled_levels[module]) {
+		level = log_compiled_levels[module];
+	}
+	log_levels[module] = level;
+	return level;
+}
+
+static bool log_parse_level(const char *text, uint8_t *level)
+{
+	for (uint8_t index = 0; index < sizeof(log_level_names) / sizeof(log_level_names[0]); index++) {
+		if (strcmp(text, log_level_names[index]) == 0) {
+			*level = index;
+			return true;
+		}
+	}
+	if (text[0] >= '0' && text[0] <= '0' + LOG_LEVEL_VERBOSE && text[1] == '\0') {
+		*level = (uint8_t)(text[0] - '0');
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Carry out a log command, "log <module|all> <level>"
+ *
+ * @param line The command, NUL terminated without the line end
+ * @return false if the line is not a valid log command
+ *
+ * The module is one of spi, net, wifi, prefs, the level a name from none
+ * to verbose or its number. "log" alone reports the levels.
+ */
+bool log_command(const char *line)
+{
+	char module_name[8];
+	char level_name[8];
+	if (strncmp(line, "log", 3) != 0 || (line[3] != '\0' && line[3] != ' ')) {
+		return false;
+	}
+	int fields = sscanf(line + 3, "%7s %7s", module_name, level_name);
+	if (fields <= 0) {
+		for (uint8_t module = 0; module < LOG_MODULE_COUNT; module++) {
+			monitor_log(MONITOR_LOG_NEWLINE, "Log %s: %s, compiled %s", log_module_names[module],
+				log_level_names[log_levels[module]], log_level_names[log_compiled_levels[module]]);
+		}
+		return true;
+	}
+	uint8_t level;
+	if (fields != 2 || !log_parse_level(level_name, &level)) {
+		return false;
+	}
+	bool found = false;
+	for (uint8_t module = 0; module < LOG_MODULE_COUNT; module++) {
+		if (strcmp(module_name, "all") == 0 || strcmp(module_name, log_module_names[module]) == 0) {
+			uint8_t set = log_set_level((log_module_e)module, level);
+			monitor_log(MONITOR_LOG_NEWLINE, "Log %s: %s", log_module_names[module], log_level_names[set]);
+			found = true;
+		}
+	}
+	return found;
+}
+
+/**
+ * @brief Carry out a packet trace command, "trace [start|stop]"
+ *
+ * @param line The command, NUL terminated without the line end
+ * @return false if the line is not a valid trace command
+ *
+ * "trace" alone reports the capture. A client of the trace port is sent
+ * the capture, see packet_trace.h.
+ */
+bool trace_command(const char *line)
+{
+	if (strncmp(line, "trace", 5) != 0 || (line[5] != '\0' && line[5] != ' ')) {
+		return false;
+	}
+	const char *action = line + 5;
+	while (*action == ' ') {
+		action++;
+	}
+	if (strcmp(action, "start") == 0) {
+		if (!packet_trace_start()) {
+			monitor_log(MONITOR_LOG_NEWLINE, "Trace: cannot start, no memory or the capture is being sent");
+			return true;
+		}
+	} else if (strcmp(action, "stop") == 0) {
+		packet_trace_stop();
+	} else if (*action != '\0') {
+		return false;
+	}
+	packet_trace_stats_t stats;
+	packet_trace_get_stats(&stats);
+	monitor_log(MONITOR_LOG_NEWLINE, "Trace: %s, %u of %u events, %u missed, read it from port %d",
+		stats.running ? "running" : "stopped", stats.recorded, stats.capacity, stats.missed, TRACE_SERVER_PORT);
+	return true;
+}
+
+/**
+ * @brief Collect command input and carry out each complete line
+ *
+ * @param command The command being received from this source
+ * @param data    The input
+ * @param length  Length of the input
+ */
+void monitor_command_input(monitor_command_t *command, const char *data, size_t length)
+{
+	for (size_t index = 0; index < length; index++) {
+		char character = data[index];
+		if (character != '\r' && character != '\n') {
+			if (command->length < sizeof(command->line) - 1) {
+				command->line[command->length++] = character;
+			}
+			continue;
+		}
+		if (command->length == 0) {
+			continue;
+		}
+		command->line[command->length] = '\0';
+		command->length = 0;
+		if (!log_command(command->line) && !trace_command(command->line)) {
+			monitor_log(MONITOR_LOG_NEWLINE,
+				"Unknown command, log <spi|net|wifi|prefs|all> <none..verbose> or trace [start|stop]");
+		}
+	}
+}
+
+/**
+ * @brief Take the serial console input
+ *
+ */
+static void monitor_console(void)
+{
+	uint8_t data[32];
+	while (Serial.available() > 0) {
+		size_t length = Serial.read(data, sizeof(data));
+		if (length == 0) {
+			break;
+		}
+		monitor_command_input(&console_command, (const char *)data, length);
+	}
+}
+
+/**
+ * @brief Write out the output collected, to the log port backlog and to the serial port
+ *
+ * Serial output is only written while a USB host is attached, without one
+ * the log port is the only way to see it.
+ */
+static void monitor_flush(void)
+{
+	if (output_length == 0) {
+		return;
+	}
+	log_stream_write(output, output_length);
+	if (Serial) {
+		Serial.write((const uint8_t *)output, output_length);
+	}
+	output_length = 0;
+}
+
+static void monitor_write(const char *text, size_t length)
+{
+	while (length != 0) {
+		size_t chunk = sizeof(output) - output_length;
+		if (chunk > length) {
+			chunk = length;
+		}
+		memcpy(output + output_length, text, chunk);
+		output_length += chunk;
+		text += chunk;
+		length -= chunk;
+		if (output_length == sizeof(output)) {
+			monitor_flush();
+		}
+	}
+}
+
+/**
+ * @brief An argument taken from a record
+ *
+ */
+typedef struct {
+	uint8_t tag;         // The argument tag, 0 if the record had no more arguments
+	uint64_t value;      // The integer or pointer, the bits of the double
+	const char *text;    // The characters of a string, not terminated
+	uint8_t text_length; // Length of the string
+} monitor_arg_t;
+
+static bool monitor_next_arg(const uint8_t **args, const uint8_t *end, monitor_arg_t *arg)
+{
+	*arg = {0};
+	const uint8_t *next = *args;
+	if (next >= end) {
+		return false;
+	}
+	arg->tag = *next++;
+	size_t size;
+	switch (arg->tag) {
+	case MONITOR_LOG_ARG_INT32:
+		size = 4;
+		break;
+	case MONITOR_LOG_ARG_INT64:
+	case MONITOR_LOG_ARG_DOUBLE:
+	case MONITOR_LOG_ARG_POINTER:
+		size = 8;
+		break;
+	case MONITOR_LOG_ARG_STRING:
+		if (next >= end) {
+			return false;
+		}
+		arg->text_length = *next++;
+		arg->text = (const char *)next;
+		size = arg->text_length;
+		break;
+	default:
+		return false;
+	}
+	if ((size_t)(end - next) < size) {
+		return false;
+	}
+	if (arg->tag != MONITOR_LOG_ARG_STRING) {
+		memcpy(&arg->value, next, size);
+	}
+	*args = next + size;
+	return true;
+}
+
+/**
+ * @brief Format one conversion of the format string
+ *
+ * @param spec        The conversion without its length modifier, '%' first and the conversion character last
+ * @param spec_length Length of spec
+ * @param arg         The argument for the conversion
+ *
+ * The record holds every integer as 32 or 64 bits whatever its type was,
+ * the conversion is redone with the ll modifier and the value widened to
+ * match: sign extended for d and i, zero extended for the rest.
+ */
+static void monitor_format_arg(const char *spec, size_t spec_length, const monitor_arg_t *arg)
+{
+	char conversion = spec[spec_length - 1];
+	char format[24];
+	char text[MONITOR_LOG_STRING_MAX + 1];
+	char formatted[MONITOR_LOG_STRING_MAX + 64];
+	int length;
+	double number;
+	memcpy(format, spec, spec_length - 1);
+	size_t format_length = spec_length - 1;
+	switch (conversion) {
+	case 'd':
+	case 'i':
+	case 'u':
+	case 'o':
+	case 'x':
+	case 'X': {
+		int64_t value = (int64_t)arg->value;
+		if (arg->tag == MONITOR_LOG_ARG_INT32) {
+			value = (conversion == 'd' || conversion == 'i') ? (int64_t)(int32_t)arg->value
+															 : (int64_t)(uint32_t)arg->value;
+		} else if (arg->tag == MONITOR_LOG_ARG_DOUBLE) {
+			memcpy(&number, &arg->value, sizeof(number));
+			value = (int64_t)number;
+		}
+		format[format_length++] = 'l';
+		format[format_length++] = 'l';
+		format[format_length++] = conversion;
+		format[format_length] = '\0';
+		length = snprintf(formatted, sizeof(formatted), format, (long long)value);
+		break;
+	}
+	case 'c':
+		format[format_length++] = 'c';
+		format[format_length] = '\0';
+		length = snprintf(formatted, sizeof(formatted), format, (int)(uint8_t)arg->value);
+		break;
+	case 's':
+		if (arg->tag != MONITOR_LOG_ARG_STRING) {
+			monitor_stats.bad_records++;
+			monitor_write("<?>", 3);
+			return;
+		}
+		if (spec_length == 2) {
+			monitor_write(arg->text, arg->text_length);
+			return;
+		}
+		memcpy(text, arg->text, arg->text_length);
+		text[arg->text_length] = '\0';
+		format[format_length++] = 's';
+		format[format_length] = '\0';
+		length = snprintf(formatted, sizeof(formatted), format, text);
+		break;
+	case 'p':
+		format[format_length++] = 'p';
+		format[format_length] = '\0';
+		length = snprintf(formatted, sizeof(formatted), format, (void *)(uintptr_t)arg->value);
+		break;
+	case 'f':
+	case 'F':
+	case 'e':
+	case 'E':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		if (arg->tag == MONITOR_LOG_ARG_DOUBLE) {
+			memcpy(&number, &arg->value, sizeof(number));
+		} else {
+			number = (double)(int64_t)arg->value;
+		}
+		format[format_length++] = conversion;
+		format[format_length] = '\0';
+		length = snprintf(formatted, sizeof(formatted), format, number);
+		break;
+	default:
+		monitor_stats.bad_records++;
+		monitor_write(spec, spec_length);
+		return;
+	}
+	if (length > (int)sizeof(formatted) - 1) {
+		length = sizeof(formatted) - 1;
+	}
+	if (length > 0) {
+		monitor_write(formatted, length);
+	}
+}
+
+/**
+ * @brief Format a record and write it to the output
+ *
+ * @param header The record header
+ * @param args   The arguments following the header
+ * @param end    The end of the record
+ */
+static void monitor_format(const monitor_log_header_t *header, const uint8_t *args, const uint8_t *end)
+{
+	const char *format = header->format;
+	while (*format != '\0') {
+		const char *percent = strchr(format, '%');
+		if (percent == NULL) {
+			monitor_write(format, strlen(format));
+			break;
+		}
+		monitor_write(format, percent - format);
+		if (percent[1] == '%') {
+			monitor_write("%", 1);
+			format = percent + 2;
+			continue;
+		}
+		//
+		// Copy the flags, width and precision, drop the length modifiers
+		//
+		char spec[16];
+		size_t spec_length = 0;
+		const char *next = percent;
+		spec[spec_length++] = *next++;
+		while (*next != '\0' && strchr("-+ #0123456789.", *next) != NULL) {
+			if (spec_length < sizeof(spec) - 4) {
+				spec[spec_length++] = *next;
+			}
+			next++;
+		}
+		while (*next != '\0' && strchr("hlLqjzt", *next) != NULL) {
+			next++;
+		}
+		if (*next == '\0') {
+			monitor_stats.bad_records++;
+			break;
+		}
+		spec[spec_length++] = *next++;
+		format = next;
+		monitor_arg_t arg;
+		if (!monitor_next_arg(&args, end, &arg)) {
+			monitor_stats.bad_records++;
+			monitor_write("<?>", 3);
+			continue;
+		}
+		monitor_format_arg(spec, spec_length, &arg);
+	}
+	if (header->flags & MONITOR_LOG_NEWLINE) {
+		monitor_write("\r\n", 2);
+	}
+}
+
+/**
+ * @brief Find the next committed record of a ring, passing over padding
+ *
+ * @param ring The ring
+ * @return monitor_ring_entry_t* The record, NULL if the ring is empty or the next record is not committed yet
  */
-QueueHandle_t task_monitor_queue;
+static monitor_ring_entry_t *monitor_ring_next(monitor_ring_t *ring)
+{
+	uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+	while (tail != ring->head.load(std::memory_order_acquire)) {
+		uint32_t *word = monitor_ring_word(ring, tail);
+		uint32_t length = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+		if (length == 0) {
+			return NULL;
+		}
+		if ((length & monitor_ring_skip) == 0) {
+			return (monitor_ring_entry_t *)word;
+		}
+		length &= monitor_ring_length_mask;
+		memset(word, 0, length);
+		tail += length;
+		ring->tail.store(tail, std::memory_order_release);
+	}
+	return NULL;
+}
+
+/**
+ * @brief Hand the room of a record back to the producers
+ *
+ */
+static void monitor_ring_release(monitor_ring_t *ring, monitor_ring_entry_t *entry)
+{
+	uint32_t length = entry->length & monitor_ring_length_mask;
+	memset(entry, 0, length);
+	ring->tail.store(ring->tail.load(std::memory_order_relaxed) + length, std::memory_order_release);
+}
+
+/**
+ * @brief Format the records waiting in the rings, oldest first
+ *
+ * @return uint32_t The records formatted
+ */
+static uint32_t monitor_drain(void)
+{
+	uint32_t count = 0;
+	while (1) {
+		monitor_ring_t *oldest_ring = NULL;
+		monitor_ring_entry_t *oldest = NULL;
+		for (monitor_ring_t &ring : monitor_rings) {
+			monitor_ring_entry_t *entry = monitor_ring_next(&ring);
+			if (entry != NULL && (oldest == NULL || (int32_t)(entry->sequence - oldest->sequence) < 0)) {
+				oldest_ring = &ring;
+				oldest = entry;
+			}
+		}
+		if (oldest == NULL) {
+			return count;
+		}
+		uint32_t length = (oldest->length & monitor_ring_length_mask) - sizeof(monitor_ring_entry_t);
+		const uint8_t *record = (const uint8_t *)(oldest + 1);
+		monitor_log_header_t header;
+		memcpy(&header, record, sizeof(header));
+		if (header.length >= sizeof(header) && header.length <= length) {
+			monitor_format(&header, record + sizeof(header), record + header.length);
+			monitor_stats.records++;
+		} else {
+			monitor_stats.bad_records++;
+		}
+		monitor_ring_release(oldest_ring, oldest);
+		count++;
+	}
+}
 
 /**
  * @brief Task to output system monitor messages
  *
  * @param pvParameters Unused parameter
+ *
+ * The rings are polled, producers never signal the task, and everything
+ * formatted in a pass is written to the port with one call.
  */
 void task_monitor(void *pvParameters)
 {
 	(void)pvParameters;
-	//
-	// Create the input queue for the task
-	//
-	task_monitor_queue = xQueueCreate(MONITOR_OUTPUT_QUEUE_DEPTH, sizeof(monitor_output_message_t));
 	while (1) {
-		monitor_output_message_t message;
-		if (xQueueReceive(task_monitor_queue, &message, portMAX_DELAY) == pdTRUE) {
-			Serial.print(message.message);
-			Serial.flush();
+		monitor_console();
+		uint32_t count = monitor_drain();
+		if (count != 0) {
+			monitor_flush();
+			monitor_stats.batches++;
+			if (count > monitor_stats.max_batch) {
+				monitor_stats.max_batch = count;
+			}
 		}
+		vTaskDelay(pdMS_TO_TICKS(MONITOR_POLL_MS));
 	}
-}
\ No newline at end of file
+}
@@ -16,29 +16,49 @@
 #include "serial_control.h"
 
 /**
- * @brief Define the queue handle for the monitor output task
- * 
+ * @brief Size of the record ring of each core
+ *
  */
-extern QueueHandle_t task_monitor_queue;
+#define MONITOR_RING_SIZE 4096
 
 /**
- * @brief Define the maximum length of a monitor output message
- * 
+ * @brief Size of the output collected before it is written to the serial port
+ *
  */
-#define MONITOR_OUTPUT_MAX_LENGTH 80
+#define MONITOR_OUTPUT_BATCH_SIZE 2048
+
 /**
- * @brief Define the depth of the monitor output task message queue
- * 
+ * @brief Period the monitor task polls the rings at
+ *
  */
-#define MONITOR_OUTPUT_QUEUE_DEPTH 10
+#define MONITOR_POLL_MS 10
 
 /**
- * @brief Define the message structure for the monitor output task
- * 
+ * @brief Monitor output statistics since start up
+ *
  */
 typedef struct {
-	char message[MONITOR_OUTPUT_MAX_LENGTH];
-} monitor_output_message_t;
+	uint32_t records;     // Records output
+	uint32_t dropped;     // Records lost, the ring of the core was full
+	uint32_t bad_records; // Records whose arguments did not match their format
+	uint32_t batches;     // Writes to the serial port
+	uint32_t max_batch;   // Most records written in one batch
+} monitor_stats_t;
+
+/**
+ * @brief A log or trace command line being received, from the serial console or a log port client
+ *
+ */
+typedef struct {
+	char line[48]; // The characters received so far
+	size_t length; // Characters in line
+} monitor_command_t;
+
+void task_monitor_get_stats(monitor_stats_t *stats);
+uint8_t log_set_level(log_module_e module, uint8_t level);
+bool log_command(const char *line);
+bool trace_command(const char *line);
+void monitor_command_input(monitor_command_t *command, const char *data, size_t length);
 
 /**
  * @brief The task that schedules monitor output messages
@@ -12,12 +12,18 @@
 #include <Arduino.h>
 #include <WiFi.h>
 #include <lwip/sockets.h>
+#include <esp_vfs_eventfd.h>
 
+#include "hex_codec.h"
+#include "link_control.h"
+#include "packet_trace.h"
 #include "protocol.h"
+#include "rsp_cache.h"
 #include "serial_control.h"
 #include "task_client.h"
 #include "task_server.h"
 #include "task_spi_comms.h"
+#include "spi_buffer_pool.h"
 
 #include "debug.h"
 
@@ -25,10 +31,51 @@
 
 #include "custom_assert.h"
 
-QueueHandle_t server_queue;
-
 constexpr uint32_t server_queue_length = 32;
 
+/**
+ * @brief Most servers the network task handles
+ *
+ */
+constexpr size_t network_max_servers = 5;
+
+/**
+ * @brief select() timeout while a client read or a client state waits for a free pool buffer
+ *
+ */
+constexpr uint32_t network_buffer_retry_ms = 1;
+
+/**
+ * @brief State of a server kept by the network task
+ *
+ * The packets of a gathered send that the client socket did not take in
+ * full stay here until it becomes writable, later packets for the server
+ * wait in its queue behind them.
+ */
+typedef struct {
+	server_task_params_t *params;                      // The server
+	int server_fd;                                     // Listening socket, -1 while the servers are shut down
+	bool input_stalled;                                // The last read found no room on the SPI path
+	int64_t stall_start;                               // When the input stalled, esp_timer_get_time() time
+	uint8_t *pending_messages[NETWORK_SEND_BATCH_MAX]; // Packets being sent to the client
+	struct iovec pending_data[NETWORK_SEND_BATCH_MAX]; // Data of each packet still to be sent
+	size_t pending_first;                              // First packet not yet sent in full
+	size_t pending_count;                              // Packets being sent, 0 if none
+	int8_t state_pending;                              // Client state still to be sent to ctxLink, -1 if none
+} network_server_state_t;
+
+static network_server_state_t network_servers[network_max_servers];
+static size_t network_server_count = 0;
+static network_send_stats_t send_stats = {0};
+static network_input_stats_t input_stats = {0};
+
+/**
+ * @brief Wake-up descriptor of the network task, -1 until the task has started
+ *
+ */
+static int network_wake_fd = -1;
+static volatile bool network_wake_pending = false;
+
 /**
  * @brief Configure the server
  *
@@ -49,128 +96,575 @@ bool configure_server(in_port_t *port, int *server_fd, struct sockaddr_in *serve
 
 	// Bind socket to address
 	if (bind(*server_fd, (struct sockaddr *)server_addr, sizeof(*server_addr)) < 0) {
-		MON_PRINTF("Socket bind failed -> %d\r\n", errno);
+		LOG_ERROR(NET, "Socket bind failed -> %d", errno);
 		return false;
 	}
 
 	// Listen for incoming connections
 	if (listen(*server_fd, 5) < 0) { // TODO: Test for single client operation, set to 1 or 0?
-		MON_PRINTF("Socket listen failed -> %d\r\n", errno);
+		LOG_ERROR(NET, "Socket listen failed -> %d", errno);
 		return false;
 	}
 	return true;
 }
 
 /**
- * @brief Task to handle the GDB Wi-Fi server
+ * @brief Wake the network task, e.g. after queuing a packet for a server
  *
- * @param pvParameters
+ * The descriptor is only written once until the network task has seen it.
  */
-void task_wifi_server(void *pvParameters)
+void network_wake(void)
 {
-	server_task_params_t *server_params = (server_task_params_t *)pvParameters;
-	int server_fd, client_fd;
-	struct sockaddr_in server_addr, client_addr;
-	bool client_connected = false;
+	if (network_wake_fd < 0 || network_wake_pending) {
+		return;
+	}
+	network_wake_pending = true;
+	uint64_t increment = 1;
+	if (write(network_wake_fd, &increment, sizeof(increment)) != sizeof(increment)) {
+		network_wake_pending = false;
+	}
+}
 
-	server_queue = xQueueCreate(server_queue_length,
-		sizeof(uint8_t *));                     // Create the queue for the GDB server task
-	server_params->server_queue = server_queue; // Save the queue to the server task parameters
-	socklen_t addr_len = sizeof(client_addr);
+/**
+ * @brief Queue a packet for a server and wake the network task
+ *
+ * @param server_params The server
+ * @param message       The packet
+ * @param wait_ticks    Longest wait for space in the queue
+ * @return true if the packet was queued, the caller still owns it otherwise
+ */
+bool server_queue_send(server_task_params_t *server_params, uint8_t *message, TickType_t wait_ticks)
+{
+	if (server_params->server_queue == NULL || xQueueSend(server_params->server_queue, &message, wait_ticks) != pdTRUE) {
+		return false;
+	}
+	network_wake();
+	return true;
+}
 
-	in_port_t port = (in_port_t)server_params->port; // Recover the port number for this task
-	//
-	if (!configure_server(&port, &server_fd, &server_addr)) {
-		MON_PRINTF("Failed to configure %s server\r\n", server_params->server_name);
+/**
+ * @brief Get a copy of the client input stall statistics
+ *
+ * @param stats Pointer to the structure to be filled
+ *
+ * A stall still going on is counted up to the time of the copy.
+ */
+void network_get_input_stats(network_input_stats_t *stats)
+{
+	*stats = input_stats;
+	int64_t now = esp_timer_get_time();
+	for (size_t index = 0; index < network_server_count; index++) {
+		const network_server_state_t *server = &network_servers[index];
+		if (server->input_stalled) {
+			stats->stalled_now++;
+			stats->stall_us += (uint64_t)(now - server->stall_start);
+		}
+	}
+}
+
+/**
+ * @brief Record the start or end of a client input stall
+ *
+ */
+static void network_input_stall(network_server_state_t *server, bool stalled)
+{
+	if (stalled == server->input_stalled) {
+		return;
+	}
+	int64_t now = esp_timer_get_time();
+	if (stalled) {
+		server->stall_start = now;
+		input_stats.stalls++;
+	} else {
+		uint32_t stall_us = (uint32_t)(now - server->stall_start);
+		input_stats.stall_us += stall_us;
+		if (stall_us > input_stats.max_stall_us) {
+			input_stats.max_stall_us = stall_us;
+		}
 	}
+	server->input_stalled = stalled;
+}
 
-	MON_PRINTF("%s server task started\r\n", server_params->server_name);
+/**
+ * @brief Check if a server's client is served on the ESP32 alone, its input is not passed to ctxLink
+ *
+ */
+static bool network_is_local(const server_task_params_t *server_params)
+{
+	return server_params->stream != NULL && server_params->stream->receive != NULL;
+}
+
+/**
+ * @brief Check if a stream server's socket did not take all of the last send
+ *
+ */
+static bool network_stream_blocked(const server_task_params_t *server_params)
+{
+	return server_params->stream != NULL && server_params->stream->send_blocked();
+}
+
+/**
+ * @brief Tell ctxLink the client state, or keep it to be sent on a later pass if the SPI path is full
+ *
+ * @param state 0x01 connected, 0x00 disconnected. A state still waiting is
+ *              replaced, ctxLink only needs the latest.
+ */
+static void network_client_state(network_server_state_t *server, uint8_t state)
+{
+	server->state_pending = send_client_state_to_ctxlink(server->params, state) ? -1 : (int8_t)state;
+}
+
+/**
+ * @brief Accept a client on a server's listening socket
+ *
+ */
+static void network_accept(network_server_state_t *server)
+{
+	server_task_params_t *server_params = server->params;
+	struct sockaddr_in client_addr;
+	socklen_t addr_len = sizeof(client_addr);
+	int client_fd = accept(server->server_fd, (struct sockaddr *)&client_addr, &addr_len);
+	if (client_fd < 0) {
+		LOG_ERROR(NET, "Socket accept failed -> %d", errno);
+		return;
+	}
+	LOG_INFO(NET, "%s client connected", server_params->server_name);
 	//
-	// Main server loop
+	// Disable Nagle's algorithm for the client socket to reduce latency, the
+	// network task must never block on one client
 	//
+	int tcp_nodelay = 1;
+	setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &tcp_nodelay, sizeof(tcp_nodelay));
+	fcntl(client_fd, F_SETFL, fcntl(client_fd, F_GETFL, 0) | O_NONBLOCK);
+	server_params->client_fd = client_fd;
+	server->input_stalled = false;
+	if (server_params->rsp_framer != NULL) {
+		rsp_framer_reset(server_params->rsp_framer);
+		rsp_cache_cancel();
+	}
+	server_params->client_connected = true;
+	if (server_params->stream != NULL) {
+		server_params->stream->session_start(server_params->server_queue);
+	}
+	//
+	// Inform ctxLink the client connected
+	//
+	if (!network_is_local(server_params)) {
+		network_client_state(server, 0x01);
+	}
+}
+
+/**
+ * @brief Close a server's client socket and drop the data still waiting for it
+ *
+ * @param inform_ctxlink Send the client disconnected status to ctxLink
+ */
+static void network_close_client(network_server_state_t *server, bool inform_ctxlink)
+{
+	server_task_params_t *server_params = server->params;
+	if (server_params->client_fd < 0) {
+		return;
+	}
+	close(server_params->client_fd);
+	server_params->client_fd = -1;
+	server_params->client_connected = false;
+	network_input_stall(server, false);
+	for (size_t index = server->pending_first; index < server->pending_count; index++) {
+		spi_buffer_release(server->pending_messages[index]);
+	}
+	server->pending_first = 0;
+	server->pending_count = 0;
+	if (server_params->stream != NULL) {
+		server_params->stream->session_end();
+	}
+	if (inform_ctxlink && !network_is_local(server_params)) {
+		network_client_state(server, 0x00);
+	}
+}
+
+/**
+ * @brief Handle a command from the Wi-Fi task
+ *
+ */
+static void network_command(network_server_state_t *server, protocol_packet_command_s *command_packet)
+{
+	server_task_params_t *server_params = server->params;
+	if (command_packet->command == PROTOCOL_PACKET_TYPE_CMD_SHUTDOWN_GDB_SERVER) {
+		LOG_INFO(NET, "Close Client/Server Sockets");
+		network_close_client(server, false);
+		if (server->server_fd >= 0) {
+			close(server->server_fd);
+			server->server_fd = -1;
+		}
+	} else if (command_packet->command == PROTOCOL_PACKET_TYPE_CMD_START_GDB_SERVER) {
+		if (server->server_fd < 0) {
+			in_port_t port = (in_port_t)server_params->port;
+			struct sockaddr_in server_addr;
+			if (!configure_server(&port, &server->server_fd, &server_addr)) {
+				close(server->server_fd);
+				server->server_fd = -1;
+			}
+		}
+		LOG_INFO(NET, "Reconfigured Server");
+	} else {
+		LOG_WARN(NET, "Unknown command received");
+	}
+}
+
+/**
+ * @brief Get a copy of the client send statistics
+ *
+ * @param stats Pointer to the structure to be filled
+ */
+void network_get_send_stats(network_send_stats_t *stats)
+{
+	*stats = send_stats;
+}
+
+/**
+ * @brief Check if a packet is data for the client, from ctxLink or from the ESP32 itself
+ *
+ */
+static bool network_is_client_data(const uint8_t *message)
+{
+	uint8_t packet_type = message[PACKET_HEADER_SOURCE_ID];
+	return packet_type == PROTOCOL_PACKET_TYPE_TO_CLIENT || packet_type == SERVER_PACKET_TYPE_TO_CLIENT_RAW ||
+		packet_type == SERVER_PACKET_TYPE_TO_CLIENT_HEX;
+}
+
+/**
+ * @brief Find the data of a packet to send to the client
+ *
+ * @param data Set to the data
+ * @return false if the packet cannot be sent
+ *
+ * With LINK_CAP_RSP_OFFLOAD the payloads from ctxLink for the GDB client
+ * are wrapped into RSP packets here, binary memory data is converted to
+ * hex first. Replies to the static queries are offered to the RSP cache.
+ */
+static bool network_client_data(network_server_state_t *server, uint8_t *message, struct iovec *data)
+{
+	size_t packet_size;
+	protocol_packet_type_e packet_type;
+	uint8_t *packet_data;
+	protocol_split(message, &packet_size, &packet_type, &packet_data);
+	rsp_framer_t *framer = server->params->rsp_framer;
+	if ((uint8_t)packet_type == SERVER_PACKET_TYPE_TO_CLIENT_HEX) {
+		//
+		// A memory read in binary, the digits take twice the room and must still leave room to wrap them
+		//
+		if (framer == NULL || 2 * packet_size > RSP_OFFLOAD_MAX_PAYLOAD) {
+			LOG_WARN(NET, "Binary memory data too long to convert, dropped");
+			return false;
+		}
+		hex_encode(packet_data, packet_data, packet_size);
+		framer->stats.binary_reads++;
+		framer->stats.binary_bytes += packet_size;
+		packet_size *= 2;
+		message[SPI_PACKET_HEADER_LENGTH_HI] = (uint8_t)(packet_size >> 8);
+		message[SPI_PACKET_HEADER_LENGTH_LO] = (uint8_t)packet_size;
+		packet_type = (protocol_packet_type_e)PROTOCOL_PACKET_TYPE_TO_CLIENT;
+	}
+	if ((uint8_t)packet_type == PROTOCOL_PACKET_TYPE_TO_CLIENT && framer != NULL &&
+		link_control_has(LINK_CAP_RSP_OFFLOAD)) {
+		packet_data = rsp_framer_wrap(framer, message, &packet_size);
+		if (packet_data == NULL) {
+			LOG_WARN(NET, "RSP payload too long to wrap, dropped");
+			return false;
+		}
+		rsp_cache_reply(packet_data + 1, packet_size - 4); // The payload, between '$' and '#'
+	}
+	data->iov_base = packet_data;
+	data->iov_len = packet_size;
+	return true;
+}
+
+/**
+ * @brief Start a gathered send with a packet for the client and every packet queued behind it
+ *
+ * Only packets already in the queue are taken, so a lone packet goes out
+ * without delay.
+ */
+static void network_gather(network_server_state_t *server, uint8_t *message)
+{
+	server_task_params_t *server_params = server->params;
+	size_t count = 0;
 	while (true) {
-		// Accept incoming connections
-		MON_PRINTF("%s server waiting for client on port %d.\r\n", server_params->server_name, port);
-		while (true) {
-			client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &addr_len);
-			if (client_fd < 0) {
-				MON_PRINTF("Socket accept failed -> %d\r\n", errno);
-				return; // TODO Deal with error, cannot return!
+		if (network_client_data(server, message, &server->pending_data[count])) {
+			server->pending_messages[count++] = message;
+		} else {
+			spi_buffer_release(message);
+		}
+		if (count == NETWORK_SEND_BATCH_MAX || xQueuePeek(server_params->server_queue, &message, 0) != pdTRUE ||
+			!network_is_client_data(message)) {
+			break; // Commands and wake-ups are handled in order, after this send
+		}
+		xQueueReceive(server_params->server_queue, &message, 0);
+	}
+	if (count == 0) {
+		return;
+	}
+	server->pending_first = 0;
+	server->pending_count = count;
+	send_stats.packets += count;
+	send_stats.batches++;
+	send_stats.segments_saved += count - 1;
+	if (count > send_stats.max_batch) {
+		send_stats.max_batch = count;
+	}
+}
+
+/**
+ * @brief Send the packets queued for a server's client, as far as the socket takes them
+ *
+ * @return false if the client socket is full, call again once it is writable
+ */
+static bool network_service_output(network_server_state_t *server)
+{
+	server_task_params_t *server_params = server->params;
+	while (true) {
+		//
+		// Finish the packets or SWO data already started
+		//
+		if (server->pending_count != 0) {
+			struct msghdr message_header = {0};
+			message_header.msg_iov = &server->pending_data[server->pending_first];
+			message_header.msg_iovlen = server->pending_count - server->pending_first;
+			ssize_t bytes_sent = sendmsg(server_params->client_fd, &message_header, 0);
+			if (bytes_sent < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					return false;
+				}
+				LOG_WARN(NET, "Socket send failed -> %d", errno);
+				network_close_client(server, true);
+				return true;
 			}
-			MON_NL("Client connected");
-			client_connected = true;
 			//
-			// Disable Nagle's algorithm for the client socket to reduce latency
+			// Release the packets sent in full, the socket may have taken part of the last one
 			//
-			int tcp_nodelay = fcntl(client_fd, F_GETFL, 0);
-			tcp_nodelay = 1;
-			setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &tcp_nodelay, sizeof(tcp_nodelay));
-			server_params->client_fd = client_fd; // Save the client file descriptor for the client task
+			size_t remaining = (size_t)bytes_sent;
+			while (server->pending_first < server->pending_count) {
+				struct iovec *data = &server->pending_data[server->pending_first];
+				if (remaining < data->iov_len) {
+					data->iov_base = (uint8_t *)data->iov_base + remaining;
+					data->iov_len -= remaining;
+					break;
+				}
+				remaining -= data->iov_len;
+				packet_trace(PACKET_TRACE_CLIENT_SENT, server->pending_messages[server->pending_first], data->iov_len);
+				spi_buffer_release(server->pending_messages[server->pending_first]);
+				server->pending_first++;
+			}
+			if (server->pending_first != server->pending_count) {
+				continue;
+			}
+			server->pending_first = 0;
+			server->pending_count = 0;
+		}
+		if (network_stream_blocked(server_params)) {
+			if (!server_params->stream->send(server_params->client_fd)) {
+				network_close_client(server, true);
+				return true;
+			}
+			if (server_params->stream->send_blocked()) {
+				return false;
+			}
+		}
+		//
+		// Take the next packet for this server
+		//
+		uint8_t *message;
+		if (xQueueReceive(server_params->server_queue, &message, 0) != pdTRUE) {
+			return true;
+		}
+		size_t packet_size;
+		protocol_packet_type_e packet_type;
+		uint8_t *packet_data;
+		CUSTOM_ASSERT(message[0] == 0xDE);
+		protocol_split(message, &packet_size, &packet_type, &packet_data);
+
+		switch ((uint8_t)packet_type) {
+		case PROTOCOL_PACKET_TYPE_TO_CLIENT:
+		case SERVER_PACKET_TYPE_TO_CLIENT_RAW:
+		case SERVER_PACKET_TYPE_TO_CLIENT_HEX: {
+			if (server_params->client_fd < 0) {
+				break;
+			}
+			network_gather(server, message);
+			continue; // The buffers are released once their data has been sent
+		}
+
+		case SERVER_PACKET_TYPE_RSP_RETRANSMIT: {
 			//
-			// Start a task to handle this new client
+			// GDB NAKed the last packet, it is sent again on its own
 			//
-			xTaskCreate(task_client, "ClientTask", 4096, (void *)server_params, 5, NULL);
+			size_t length = 0;
+			const uint8_t *packet = NULL;
+			if (server_params->rsp_framer != NULL) {
+				packet = rsp_framer_retransmit(server_params->rsp_framer, &length);
+			}
+			if (server_params->client_fd < 0 || length == 0) {
+				break;
+			}
+			server->pending_messages[0] = message;
+			server->pending_data[0].iov_base = (void *)packet;
+			server->pending_data[0].iov_len = length;
+			server->pending_first = 0;
+			server->pending_count = 1;
+			continue;
+		}
+
+		case SERVER_PACKET_TYPE_STREAM_READY: {
 			//
-			//  Server data handling loop
+			// Stream data does not come in the packet, it waits in the stream
 			//
-			while (client_connected) {
-				BaseType_t result;
-				uint8_t *message;
-				//
-				// Check for packets from SPI task
-				//
-				result = xQueueReceive(server_queue, &message, portMAX_DELAY);
-				if (result == pdTRUE) {
-					size_t bytes_sent;
-					size_t packet_size;
-					protocol_packet_type_e packet_type;
-					uint8_t *packet_data;
-					CUSTOM_ASSERT(message[0] == 0xDE);
-					protocol_split(message, &packet_size, &packet_type, &packet_data);
-
-					switch (packet_type) {
-					case PROTOCOL_PACKET_TYPE_TO_CLIENT: {
-						MON_NL("Packet to client");
-						while (packet_size > 0) {
-							bytes_sent = send(client_fd, packet_data, packet_size, 0);
-							if (bytes_sent < 0) {
-								MON_PRINTF("Socket send failed -> %d\r\n", errno);
-								break;
-							}
-							packet_size -= bytes_sent;
-							packet_data += bytes_sent;
-						}
-						break;
-					}
-
-					case PROTOCOL_PACKET_TYPE_COMMAND: {
-						protocol_packet_command_s *command_packet = (protocol_packet_command_s *)packet_data;
-						if (command_packet->command == PROTOCOL_PACKET_TYPE_CMD_SHUTDOWN_GDB_SERVER) {
-							MON_NL("Close Client/Server Sockets");
-							close(client_fd);
-							client_fd = -1;
-							close(server_fd);
-							server_fd = -1;
-						} else if (command_packet->command == PROTOCOL_PACKET_TYPE_CMD_START_GDB_SERVER) {
-							configure_server(&port, &server_fd, &server_addr);
-							MON_NL("Reconfigured Server");
-						} else if (command_packet->command == PROTOCOL_PACKET_TYPE_CMD_CLIENT_CLOSED) {
-							MON_NL("Client closed connection");
-							close(client_fd);
-							client_fd = -1;
-							client_connected = false;
-						} else {
-							MON_NL("Unknown command received");
-						}
-						break;
-					}
-
-					default:
-						MON_NL("Unknown packet type received");
-						break;
-					}
+			if (server_params->client_fd >= 0 && server_params->stream != NULL &&
+				!server_params->stream->send(server_params->client_fd)) {
+				LOG_WARN(NET, "%s client send failed", server_params->server_name);
+				network_close_client(server, true);
+			}
+			break;
+		}
+
+		case PROTOCOL_PACKET_TYPE_COMMAND: {
+			network_command(server, (protocol_packet_command_s *)packet_data);
+			break;
+		}
+
+		default:
+			LOG_WARN(NET, "Unknown packet type received");
+			break;
+		}
+		//
+		// The packet has been consumed, return its buffer to the pool
+		//
+		spi_buffer_release(message);
+	}
+}
+
+/**
+ * @brief Task to handle the Wi-Fi servers, GDB, the UART/SWO bridges and the log and trace ports
+ *
+ * @param pvParameters Pointer to the network_task_params_t of the servers
+ *
+ * Every server has its own input queue, the SPI task routes the packets
+ * for a server to it using the queue in the server parameters and wakes
+ * this task. One select() waits for new clients, client input, client
+ * sockets that can take more data and the wake-up.
+ */
+void task_network(void *pvParameters)
+{
+	network_task_params_t *network_params = (network_task_params_t *)pvParameters;
+	esp_vfs_eventfd_config_t eventfd_config = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+	esp_vfs_eventfd_register(&eventfd_config);
+	int wake_fd = eventfd(0, 0);
+	if (wake_fd < 0) {
+		LOG_ERROR(NET, "Network wake-up eventfd failed -> %d", errno);
+	}
+
+	network_server_count = network_params->server_count;
+	CUSTOM_ASSERT(network_server_count <= network_max_servers);
+	for (size_t index = 0; index < network_server_count; index++) {
+		network_server_state_t *server = &network_servers[index];
+		server_task_params_t *server_params = network_params->servers[index];
+		server->params = server_params;
+		server->pending_first = 0;
+		server->pending_count = 0;
+		server->state_pending = -1;
+		server_params->client_fd = -1;
+		server_params->server_queue = xQueueCreate(server_queue_length, sizeof(uint8_t *));
+		in_port_t port = (in_port_t)server_params->port;
+		struct sockaddr_in server_addr;
+		if (!configure_server(&port, &server->server_fd, &server_addr)) {
+			LOG_ERROR(NET, "Failed to configure %s server", server_params->server_name);
+			close(server->server_fd);
+			server->server_fd = -1;
+		} else {
+			LOG_INFO(NET, "%s server waiting for client on port %d.", server_params->server_name, port);
+		}
+	}
+	network_wake_fd = wake_fd;
+	LOG_INFO(NET, "Network task started");
+	//
+	// Main network loop
+	//
+	while (true) {
+		fd_set read_fds;
+		fd_set write_fds;
+		FD_ZERO(&read_fds);
+		FD_ZERO(&write_fds);
+		int max_fd = wake_fd;
+		bool input_stalled = false;
+		bool state_pending = false;
+		if (wake_fd >= 0) {
+			FD_SET(wake_fd, &read_fds);
+		}
+		for (size_t index = 0; index < network_server_count; index++) {
+			network_server_state_t *server = &network_servers[index];
+			int client_fd = server->params->client_fd;
+			if (server->state_pending >= 0) {
+				state_pending = true;
+			}
+			if (client_fd >= 0) {
+				if (server->input_stalled) {
+					input_stalled = true;
+				} else {
+					FD_SET(client_fd, &read_fds);
+				}
+				if (server->pending_count != 0 || network_stream_blocked(server->params)) {
+					FD_SET(client_fd, &write_fds);
+				}
+				if (client_fd > max_fd) {
+					max_fd = client_fd;
+				}
+			} else if (server->server_fd >= 0) {
+				FD_SET(server->server_fd, &read_fds);
+				if (server->server_fd > max_fd) {
+					max_fd = server->server_fd;
+				}
+			}
+		}
+		//
+		// Without a wake-up descriptor, poll the server queues every tick. Stalled
+		// input and client states waiting for a buffer are retried sooner.
+		//
+		bool retry = input_stalled || state_pending;
+		struct timeval timeout = {0, 0};
+		timeout.tv_usec = (retry ? network_buffer_retry_ms : portTICK_PERIOD_MS) * 1000;
+		bool wait_forever = wake_fd >= 0 && !retry;
+		if (select(max_fd + 1, &read_fds, &write_fds, NULL, wait_forever ? NULL : &timeout) < 0) {
+			LOG_ERROR(NET, "Network select failed -> %d", errno);
+			vTaskDelay(1);
+			continue;
+		}
+		if (wake_fd >= 0 && FD_ISSET(wake_fd, &read_fds)) {
+			uint64_t wake_count;
+			read(wake_fd, &wake_count, sizeof(wake_count));
+			network_wake_pending = false; // Cleared before the queues are drained, see network_wake()
+		}
+		for (size_t index = 0; index < network_server_count; index++) {
+			network_server_state_t *server = &network_servers[index];
+			server_task_params_t *server_params = server->params;
+			if (server->state_pending >= 0) {
+				network_client_state(server, (uint8_t)server->state_pending);
+			}
+			if (server_params->client_fd < 0) {
+				if (server->server_fd >= 0 && FD_ISSET(server->server_fd, &read_fds)) {
+					network_accept(server);
+				}
+			} else if (network_is_local(server_params)) {
+				if (FD_ISSET(server_params->client_fd, &read_fds) &&
+					!server_params->stream->receive(server_params->client_fd)) {
+					network_close_client(server, false);
+				}
+			} else if (server->input_stalled || FD_ISSET(server_params->client_fd, &read_fds)) {
+				client_receive_e result = client_receive(server_params);
+				network_input_stall(server, result == CLIENT_RECEIVE_NO_BUFFER);
+				if (result == CLIENT_RECEIVE_CLOSED) {
+					network_close_client(server, true);
 				}
 			}
+			network_service_output(server);
 		}
 	}
 }
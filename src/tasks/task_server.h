@@ -13,16 +13,60 @@
 #define TASK_SERVER_H
 
 #include "protocol.h"
-
-extern QueueHandle_t server_queue;
+#include "rsp_framer.h"
 
 /**
  * @brief Define the server ports
  * 
  */
-#define GDB_SERVER_PORT  2159
-#define UART_SERVER_PORT 2160
-#define SWO_SERVER_PORT  2161
+#define GDB_SERVER_PORT   2159
+#define UART_SERVER_PORT  2160
+#define SWO_SERVER_PORT   2161
+#define LOG_SERVER_PORT   2162
+#define TRACE_SERVER_PORT 2163
+
+/**
+ * @brief Packet types for the UART and SWO bridge servers
+ *
+ * The GDB server uses the types from protocol.h, the bridges use types from
+ * the top of the range as the link control packets do. Each direction has
+ * its own type so the SPI task can tell packets to be sent from packets
+ * received. The SWO stream only flows from ctxLink, anything an SWO client
+ * sends is passed on and ignored by ctxLink.
+ */
+constexpr uint8_t SERVER_PACKET_TYPE_TO_UART = 0xE0;        // ctxLink -> ESP32, target UART output
+constexpr uint8_t SERVER_PACKET_TYPE_FROM_UART = 0xE1;      // ESP32 -> ctxLink, UART client input
+constexpr uint8_t SERVER_PACKET_TYPE_TO_SWO = 0xE2;         // ctxLink -> ESP32, SWO trace data
+constexpr uint8_t SERVER_PACKET_TYPE_FROM_SWO = 0xE3;       // ESP32 -> ctxLink, SWO client input
+constexpr uint8_t SERVER_PACKET_TYPE_STREAM_READY = 0xE4;   // Queued to a stream server, data is waiting in its stream
+constexpr uint8_t SERVER_PACKET_TYPE_TO_CLIENT_RAW = 0xE5;  // Queued by the ESP32 itself, sent to the client as it is
+constexpr uint8_t SERVER_PACKET_TYPE_RSP_RETRANSMIT = 0xE6; // Queued to the GDB server, resend the last RSP packet
+constexpr uint8_t SERVER_PACKET_TYPE_TO_CLIENT_HEX = 0xE7;  // Binary memory data for the client, sent as hex digits
+
+/**
+ * @brief Client status types for the bridge servers, reported like PROTOCOL_PACKET_STATUS_TYPE_GDB_CLIENT
+ *
+ */
+constexpr uint8_t SERVER_STATUS_TYPE_UART_CLIENT = 0xE0;
+constexpr uint8_t SERVER_STATUS_TYPE_SWO_CLIENT = 0xE1;
+constexpr uint8_t SERVER_STATUS_TYPE_LOG_CLIENT = 0xE2;   // Never reported, ctxLink is not told of log clients
+constexpr uint8_t SERVER_STATUS_TYPE_TRACE_CLIENT = 0xE3; // Never reported, as for the log clients
+
+/**
+ * @brief A server whose client data comes from a byte stream on the ESP32, not as packets in its queue
+ *
+ * The stream wakes its server with a SERVER_PACKET_TYPE_STREAM_READY packet
+ * and the network task calls send() to drain it. A stream with a receive
+ * function serves its client on the ESP32 alone, the client input is
+ * handled there and ctxLink is not told of the client.
+ */
+typedef struct {
+	void (*session_start)(QueueHandle_t server_queue); // A client connected, wake the server on its queue
+	void (*session_end)(void);                         // The client disconnected
+	bool (*send)(int client_fd);                       // Send the waiting data, false if the socket failed
+	bool (*send_blocked)(void);                        // The socket did not take all of the last send
+	bool (*receive)(int client_fd);                    // Handle the client input, false if the client closed
+} server_stream_t;
 
 /**
  * @brief Structure for the server task configuration
@@ -33,12 +77,66 @@ typedef struct {
 	char server_name[32];                      // Name of the server
 	uint32_t port;                             // Port number for the server
 	int client_fd;                             // File descriptor for the client socket
-	QueueHandle_t server_queue;                // Handle for the server task input queue
-	TaskHandle_t server_task_handle;           // Handle for the server task
+	QueueHandle_t server_queue;                // Packets for the server, created by the network task
 	protocol_packet_type_e source_type;        // Source type of the server, GDB, UART, or SWO
+	volatile bool client_connected;            // Set while a client is connected, packets for the server are dropped otherwise
+	rsp_framer_t *rsp_framer;                  // Forwards the client input as whole RSP packets, NULL to forward each read
+	const server_stream_t *stream;             // Source of the client data, NULL for packets from the server queue
 } server_task_params_t;
 
-void task_wifi_server(void *pvParameters);
+/**
+ * @brief The servers handled by the network task
+ *
+ * One task waits in select() on every listening and client socket and on
+ * a wake-up descriptor signalled when a packet is queued for a server.
+ */
+typedef struct {
+	server_task_params_t *const *servers; // The servers, each listening on its own port
+	size_t server_count;                  // Number of servers
+} network_task_params_t;
+
+/**
+ * @brief Most packets for one client gathered into a single send
+ *
+ * The network task sends every packet already queued for a client with one
+ * sendmsg() call, so a burst of small responses leaves in as few TCP
+ * segments as possible. A lone packet is sent at once, nothing waits for a
+ * batch to fill. May be overridden from the build flags, 1 sends each
+ * packet on its own.
+ */
+#ifndef NETWORK_SEND_BATCH_MAX
+#define NETWORK_SEND_BATCH_MAX 8
+#endif
+
+/**
+ * @brief Statistics of the packets sent to the clients
+ *
+ */
+typedef struct {
+	uint32_t packets;        // Packets sent to clients
+	uint32_t batches;        // Gathered sends that carried them
+	uint32_t segments_saved; // Packets sent with an earlier packet rather than in their own segment
+	uint32_t max_batch;      // Most packets in one gathered send
+} network_send_stats_t;
+
+/**
+ * @brief Client input stall statistics since start up
+ *
+ * A client's socket is not read while the SPI path has no room for its
+ * data, the time it waits is counted here.
+ */
+typedef struct {
+	uint32_t stalls;       // Times a client's input was stopped
+	uint32_t stalled_now;  // Clients stopped at the time of the copy
+	uint64_t stall_us;     // Total time client input was stopped, in microseconds
+	uint32_t max_stall_us; // Longest single stall, in microseconds
+} network_input_stats_t;
+
+void task_network(void *pvParameters);
+void network_get_send_stats(network_send_stats_t *stats);
+void network_get_input_stats(network_input_stats_t *stats);
+void network_wake(void);
+bool server_queue_send(server_task_params_t *server_params, uint8_t *message, TickType_t wait_ticks);
 constexpr uint8_t MAGIC_HI = 0xbe;
 constexpr uint8_t MAGIC_LO = 0xef;
 #endif
\ No newline at end of file
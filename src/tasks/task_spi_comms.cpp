@@ -20,32 +20,34 @@
 #include "protocol.h"
 #include "tasks/task_server.h"
 #include "tasks/task_wifi.h"
+#include "spi_buffer_pool.h"
+#include "link_control.h"
+#include "link_segment.h"
+#include "log_stream.h"
+#include "packet_trace.h"
+#include "rsp_cache.h"
+#include "swo_stream.h"
 
 #include "debug.h"
 
-#define SPI_BUFFER_COUNT 8
-
-static bool tx_inflight = false;
-
-/**
- * @brief Pool of buffers for use by the SPI interface
- *
- * Note: The buffers are aligned to 4 bytes to ensure that they are suitable for use with the SPI interface. This
- *          is noted in the ESP32 SPI documentation
- */
-uint8_t spi_buffers[SPI_BUFFER_COUNT][SPI_BUFFER_SIZE] __attribute__((aligned(4)));
-
 /**
  * @brief This is the depth of the SPI task input messaging queue
  *
+ * Every entry holds a pool buffer except the static transaction completed
+ * packet, of which there is at most one per frame in flight, and only when
+ * the TX window was full. With room for every buffer and a spare the queue
+ * is never full and client data, which is read without waiting, is never
+ * dropped here.
  */
-constexpr uint32_t spi_comms_input_queue_length = 10;
+constexpr uint32_t spi_comms_input_queue_length = SPI_BUFFER_COUNT + 2;
 
 /**
  * @brief This is the depth of the SPI task output messaging queue
  *
+ * Every entry holds a pool buffer, so with one entry per buffer the queue
+ * can never be full.
  */
-constexpr uint32_t spi_comms_output_queue_length = 4;
+constexpr uint32_t spi_comms_output_queue_length = SPI_BUFFER_COUNT;
 
 /**
  * @brief The SPI task message queue
@@ -62,45 +64,472 @@ QueueHandle_t spi_comms_input_queue;
  */
 QueueHandle_t spi_comms_output_queue;
 
-portMUX_TYPE my_lock = portMUX_INITIALIZER_UNLOCKED;
+/**
+ * @brief Packets-per-frame statistics for the TX batching stage
+ *
+ */
+static spi_comms_batch_stats_t batch_stats = {0};
+
+/**
+ * @brief Packets for a server that were dropped, no client or the server queue was full
+ *
+ */
+static uint32_t server_route_drops = 0;
+
+/**
+ * @brief Longest wait for room in the GDB server queue before the packet is parked
+ *
+ */
+constexpr TickType_t spi_comms_server_wait = 1;
+
+/**
+ * @brief Packets for a server whose queue was full, in the order they arrived
+ *
+ * Every packet routed to a server is a pool buffer, so there is always room
+ * for it here and none is dropped. The SPI task moves them to the server
+ * queue as it empties, meanwhile it goes on serving the other servers.
+ */
+typedef struct {
+	server_task_params_t *server;
+	uint8_t *packets[SPI_BUFFER_COUNT];
+	size_t first;
+	size_t count;
+	uint32_t parked; // Packets that found the server queue full
+} spi_comms_overflow_t;
+
+static spi_comms_overflow_t gdb_overflow = {&gdb_server_params};
+
+/**
+ * @brief Record the number of packets sent in a frame
+ *
+ * @param packet_count Number of packets in the frame
+ */
+static void spi_comms_batch_record(uint32_t packet_count)
+{
+	batch_stats.frames++;
+	batch_stats.packets += packet_count;
+	if (packet_count > batch_stats.max_packets_per_frame) {
+		batch_stats.max_packets_per_frame = packet_count;
+	}
+	size_t bucket = 0;
+	while (bucket < SPI_COMMS_BATCH_HISTOGRAM_SIZE - 1 && packet_count > (1u << bucket)) {
+		bucket++;
+	}
+	batch_stats.histogram[bucket]++;
+}
+
+/**
+ * @brief Get a copy of the packets-per-frame statistics
+ *
+ * @param stats Pointer to the structure to be filled
+ */
+void spi_comms_get_batch_stats(spi_comms_batch_stats_t *stats)
+{
+	*stats = batch_stats;
+}
+
+/**
+ * @brief Hand a frame to the SPI driver, using a credit with LINK_CAP_CREDIT
+ *
+ */
+static void spi_comms_save_frame(uint8_t *frame, size_t frame_length)
+{
+	link_control_tx_credit_used();
+	spi_save_tx_transaction_buffer(frame, frame_length);
+}
+
+/**
+ * @brief Send the next fragment of the packet being segmented
+ *
+ * @return false if the pool is empty, the fragment is retried from the task loop
+ */
+static bool spi_comms_send_fragment(void)
+{
+	size_t fragment_length;
+	uint8_t *fragment = link_segment_tx_next(link_control_frame_limit(), &fragment_length);
+	if (fragment == NULL) {
+		return false;
+	}
+	spi_comms_batch_record(1);
+	spi_comms_save_frame(fragment, fragment_length);
+	return true;
+}
+
+/**
+ * @brief Send the next frame to ctxLink, the caller checked there is room for it
+ *
+ * @return false if nothing more can be sent now
+ *
+ * Takes the packet at the head of the output queue. If batching has been
+ * negotiated, the following packets are appended to the same buffer for as
+ * long as they fit in a frame, and their buffers are returned to the pool.
+ *
+ * A packet too large for a frame is sent as fragments, one per frame, before
+ * anything else in the queue.
+ */
+static bool spi_comms_send_frame(void)
+{
+	uint8_t *frame;
+	uint8_t *next_packet;
+
+	if (link_segment_tx_pending()) {
+		return spi_comms_send_fragment();
+	}
+	if (xQueueReceive(spi_comms_output_queue, &frame, 0) != pdTRUE) {
+		return false;
+	}
+	size_t frame_length = link_packet_length(frame);
+	uint32_t packet_count = 1;
+	size_t frame_limit = link_control_frame_limit();
+
+	if (frame_length > frame_limit) {
+		if (link_control_has(LINK_CAP_SEGMENTATION)) {
+			link_segment_tx_start(frame);
+			return spi_comms_send_fragment();
+		}
+		LOG_WARN(SPI, "SPI TX: %d byte packet does not fit a frame, dropped", (int)frame_length);
+		spi_buffer_release(frame);
+		return true;
+	}
+	if (link_control_has(LINK_CAP_BATCHING)) {
+		while (xQueuePeek(spi_comms_output_queue, &next_packet, 0) == pdTRUE) {
+			size_t packet_length = link_packet_length(next_packet);
+			if (frame_length + packet_length > frame_limit) {
+				break;
+			}
+			xQueueReceive(spi_comms_output_queue, &next_packet, 0);
+			memcpy(frame + frame_length, next_packet, packet_length);
+			frame_length += packet_length;
+			packet_count++;
+			spi_buffer_release(next_packet);
+		}
+		if (frame_length + SPI_PACKET_HEADER_SIZE <= SPI_BUFFER_SIZE) {
+			memset(frame + frame_length, 0, SPI_PACKET_HEADER_SIZE);
+		}
+	}
+	spi_comms_batch_record(packet_count);
+	spi_comms_save_frame(frame, frame_length);
+	return true;
+}
+
+/**
+ * @brief Send frames to ctxLink while the SPI driver window and ctxLink's credit allow
+ *
+ * With LINK_CAP_CREDIT several frames wait in the SPI driver and ctxLink
+ * clocks them back to back, otherwise one frame is sent at a time. The SPI
+ * ISR only wakes the task for a frame completed when the window was full,
+ * returned credit arrives as a link control packet.
+ */
+static void spi_comms_service_tx(void)
+{
+	while ((link_segment_tx_pending() || uxQueueMessagesWaiting(spi_comms_output_queue) != 0) && spi_tx_ready() &&
+		link_control_tx_credit_available() && spi_comms_send_frame()) {
+	}
+}
+
+/**
+ * @brief Define the period between statistics reports
+ *
+ */
+constexpr TickType_t spi_comms_stats_period = pdMS_TO_TICKS(60000);
+
+/**
+ * @brief Output the data path statistics to the monitor
+ *
+ */
+static void spi_comms_report_statistics(void)
+{
+	spi_buffer_pool_report();
+	LOG_INFO(SPI, "Heap: %u bytes free, minimum %u", (unsigned)esp_get_free_heap_size(),
+		(unsigned)esp_get_minimum_free_heap_size());
+	LOG_INFO(SPI, "SPI TX: %u packets in %u frames, max %u per frame", (unsigned)batch_stats.packets,
+		(unsigned)batch_stats.frames, (unsigned)batch_stats.max_packets_per_frame);
+	LOG_INFO(SPI, "  per frame 1:%u 2:%u 3-4:%u 5-8:%u 9+:%u", (unsigned)batch_stats.histogram[0],
+		(unsigned)batch_stats.histogram[1], (unsigned)batch_stats.histogram[2], (unsigned)batch_stats.histogram[3],
+		(unsigned)batch_stats.histogram[4]);
+	spi_link_stats_t link_stats;
+	spi_get_link_stats(&link_stats);
+	LOG_INFO(SPI, "SPI link: %u transactions, %u duplex, %u empty, %u re-armed for a frame",
+		(unsigned)link_stats.transactions, (unsigned)link_stats.duplex_transactions,
+		(unsigned)link_stats.empty_transactions, (unsigned)link_stats.tx_requeues);
+	LOG_INFO(SPI, "  TX frames %u, RX packets %u, dropped %u, truncated %u", (unsigned)link_stats.tx_frames,
+		(unsigned)link_stats.rx_packets, (unsigned)link_stats.rx_dropped, (unsigned)link_stats.rx_truncated);
+	LOG_INFO(SPI, "  TX window: %u task wake-ups, max %u frames waiting", (unsigned)link_stats.tx_notifications,
+		(unsigned)link_stats.tx_window_max);
+	if (link_control_has(LINK_CAP_CREDIT)) {
+		link_credit_stats_t credit_stats;
+		link_control_get_credit_stats(&credit_stats);
+		LOG_INFO(SPI, "  Credit: %u of %u, %u returned in %u grants, %u stalls", (unsigned)credit_stats.credits,
+			(unsigned)credit_stats.window, (unsigned)credit_stats.returned, (unsigned)credit_stats.grants,
+			(unsigned)credit_stats.stalls);
+	}
+	if (link_stats.ss_setup_samples != 0) {
+		LOG_INFO(SPI, "  SS to setup: %u pre-armed of %u, avg %u us, max %u us", (unsigned)link_stats.ss_setup_prearmed,
+			(unsigned)link_stats.ss_setup_samples,
+			(unsigned)(link_stats.ss_setup_total_us / link_stats.ss_setup_samples),
+			(unsigned)link_stats.ss_setup_max_us);
+	}
+	LOG_INFO(SPI, "Servers: %u packets dropped, no client or queue full, %u GDB packets parked",
+		(unsigned)server_route_drops, (unsigned)gdb_overflow.parked);
+	link_segment_stats_t segment_stats;
+	link_segment_get_stats(&segment_stats);
+	if (segment_stats.fragments_sent != 0 || segment_stats.fragments_received != 0) {
+		LOG_INFO(SPI, "Segmentation: %u packets in %u fragments sent, %u buffer waits",
+			(unsigned)segment_stats.messages_segmented, (unsigned)segment_stats.fragments_sent,
+			(unsigned)segment_stats.fragment_buffer_waits);
+		LOG_INFO(SPI, "  %u packets from %u fragments received, %u dropped",
+			(unsigned)segment_stats.messages_reassembled, (unsigned)segment_stats.fragments_received,
+			(unsigned)segment_stats.reassembly_errors);
+	}
+	if (gdb_server_params.rsp_framer != NULL) {
+		rsp_framer_stats_t framer_stats;
+		rsp_framer_get_stats(gdb_server_params.rsp_framer, &framer_stats);
+		LOG_INFO(SPI, "GDB framing: %u reads in %u packets, %u RSP packets, %u held, %u interrupts, %u oversize",
+			(unsigned)framer_stats.reads, (unsigned)framer_stats.packets_sent, (unsigned)framer_stats.rsp_packets,
+			(unsigned)framer_stats.held_reads, (unsigned)framer_stats.interrupts,
+			(unsigned)framer_stats.oversize_passes);
+		if (link_control_has(LINK_CAP_RSP_OFFLOAD)) {
+			LOG_INFO(SPI, "  RSP offload: %u acks sent, %u received, %u bad checksums, %u resent, %u dropped, "
+					   "%u deferred",
+				(unsigned)framer_stats.acks_sent, (unsigned)framer_stats.acks_received,
+				(unsigned)framer_stats.checksum_errors, (unsigned)framer_stats.retransmits,
+				(unsigned)framer_stats.dropped, (unsigned)framer_stats.deferred);
+		}
+		if (link_control_has(LINK_CAP_BINARY_MEMORY)) {
+			LOG_INFO(SPI, "  Binary memory: %u reads, %u writes, %u link bytes saved",
+				(unsigned)framer_stats.binary_reads, (unsigned)framer_stats.binary_writes,
+				(unsigned)framer_stats.binary_bytes);
+		}
+		if (link_control_has(LINK_CAP_RSP_CACHE)) {
+			rsp_cache_stats_t cache_stats;
+			rsp_cache_get_stats(&cache_stats);
+			LOG_INFO(SPI, "  RSP cache: %u hits, %u misses, %u replies in %u of %u bytes, %u full, %u invalidated",
+				(unsigned)cache_stats.hits, (unsigned)cache_stats.misses, (unsigned)cache_stats.entries,
+				(unsigned)cache_stats.store_used, (unsigned)cache_stats.store_size, (unsigned)cache_stats.full,
+				(unsigned)cache_stats.invalidations);
+		}
+	}
+	network_send_stats_t send_stats;
+	network_get_send_stats(&send_stats);
+	if (send_stats.packets != 0) {
+		LOG_INFO(SPI, "TCP TX: %u packets in %u sends, %u segments saved, max %u per send",
+			(unsigned)send_stats.packets, (unsigned)send_stats.batches, (unsigned)send_stats.segments_saved,
+			(unsigned)send_stats.max_batch);
+	}
+	network_input_stats_t input_stats;
+	network_get_input_stats(&input_stats);
+	if (input_stats.stalls != 0) {
+		LOG_INFO(SPI, "TCP RX: %u stalls waiting for the SPI path, %u ms in total, max %u us, %u stalled now",
+			(unsigned)input_stats.stalls, (unsigned)(input_stats.stall_us / 1000), (unsigned)input_stats.max_stall_us,
+			(unsigned)input_stats.stalled_now);
+	}
+	packet_trace_stats_t trace_stats;
+	packet_trace_get_stats(&trace_stats);
+	if (trace_stats.capacity != 0) {
+		LOG_INFO(SPI, "Packet trace: %s, %u of %u events, %u missed, %u sent to clients",
+			trace_stats.running ? "running" : "stopped", (unsigned)trace_stats.recorded, (unsigned)trace_stats.capacity,
+			(unsigned)trace_stats.missed, (unsigned)trace_stats.exports);
+	}
+	swo_stream_stats_t swo_stats;
+	swo_stream_get_stats(&swo_stats);
+	if (swo_stats.bytes_received != 0) {
+		LOG_INFO(SPI, "SWO: %u bytes received, %u sent, %u overwritten in %u overruns, %u of %u ring used",
+			(unsigned)swo_stats.bytes_received, (unsigned)swo_stats.bytes_sent, (unsigned)swo_stats.overrun_bytes,
+			(unsigned)swo_stats.overruns, (unsigned)swo_stats.high_water_mark, (unsigned)swo_stats.ring_size);
+	}
+#ifdef SERIAL_ON
+	monitor_stats_t monitor_stats;
+	task_monitor_get_stats(&monitor_stats);
+	LOG_INFO(SPI, "Monitor: %u records output in %u writes, max %u per write, %u dropped, %u malformed",
+		(unsigned)monitor_stats.records, (unsigned)monitor_stats.batches, (unsigned)monitor_stats.max_batch,
+		(unsigned)monitor_stats.dropped, (unsigned)monitor_stats.bad_records);
+	log_stream_stats_t log_stats;
+	log_stream_get_stats(&log_stats);
+	if (log_stats.backlog_size != 0) {
+		LOG_INFO(SPI, "Log port: %llu bytes written, %llu sent to %u clients, %u lost, %u byte backlog",
+			(unsigned long long)log_stats.bytes_written, (unsigned long long)log_stats.bytes_sent,
+			(unsigned)log_stats.sessions, (unsigned)log_stats.bytes_lost, (unsigned)log_stats.backlog_size);
+	}
+#endif
+}
 
 /**
- * @brief Get the next SPI buffer
+ * @brief Move the parked packets of a server to its queue, as far as there is room
  *
- * @return uint8_t The index of the next buffer
+ * @param overflow The server's parked packets
  *
- * This function returns the index of the next buffer to be used for SPI communications.
- * The buffers are used in a round-robin fashion.
+ * If the client has gone the packets are dropped, as they would have been
+ * had they arrived now.
  */
-uint8_t get_next_spi_buffer_index(void)
+static void spi_comms_overflow_drain(spi_comms_overflow_t *overflow)
 {
-	static uint8_t buffer_index = 0;
-	portENTER_CRITICAL(&my_lock);
-	uint8_t next_buffer = buffer_index;
-	buffer_index = (buffer_index + 1) % SPI_BUFFER_COUNT;
-	portEXIT_CRITICAL(&my_lock);
-	return next_buffer;
+	while (overflow->count != 0) {
+		uint8_t *message = overflow->packets[overflow->first];
+		if (overflow->server->client_connected) {
+			if (!server_queue_send(overflow->server, message, 0)) {
+				return;
+			}
+		} else {
+			spi_buffer_release(message);
+			server_route_drops++;
+		}
+		overflow->first = (overflow->first + 1) % SPI_BUFFER_COUNT;
+		overflow->count--;
+	}
 }
 
 /**
- * @brief Get the next spi buffer
+ * @brief Pass a packet from ctxLink to a server
  *
- * @return A pointer to the buffer
+ * @param server      The server parameters, these hold the server's own queue
+ * @param message     The packet, its buffer is passed on or returned to the pool
+ * @param client_type The packet type the server routes to its client
+ * @param overflow    Where the packet waits if the server queue is full, NULL to drop it
  */
-uint8_t *get_next_spi_buffer(void)
+static void spi_comms_route_to_server(
+	server_task_params_t *server, uint8_t *message, uint8_t client_type, spi_comms_overflow_t *overflow)
 {
-	return spi_buffers[get_next_spi_buffer_index()];
+	*(message + PACKET_HEADER_SOURCE_ID) = client_type;
+	if (server->server_queue == NULL || !server->client_connected) {
+		spi_buffer_release(message); // No client to send it to, drop the packet
+		server_route_drops++;
+		return;
+	}
+	spi_buffer_tag(message, SPI_BUFFER_OWNER_SERVER, SPI_BUFFER_STATE_QUEUED);
+	packet_trace(PACKET_TRACE_SERVER_QUEUED, message, link_packet_length(message));
+	if (overflow == NULL) {
+		if (!server_queue_send(server, message, 0)) {
+			spi_buffer_release(message);
+			server_route_drops++;
+		}
+		return;
+	}
+	//
+	// Packets already parked go first, otherwise wait a little for room before parking
+	//
+	spi_comms_overflow_drain(overflow);
+	if (overflow->count == 0 && server_queue_send(server, message, spi_comms_server_wait)) {
+		return;
+	}
+	overflow->packets[(overflow->first + overflow->count) % SPI_BUFFER_COUNT] = message;
+	overflow->count++;
+	overflow->parked++;
 }
 
 /**
- * @brief Get the SPI buffer at the specified index
+ * @brief Route a packet from the other tasks or the SPI driver
  *
- * @param index The index of the buffer to be returned
- * @return uint8_t* Pointer to the buffer
+ * @param message The packet, its buffer is passed on or returned to the pool
  */
-uint8_t *get_spi_buffer(uint8_t index)
+static void spi_comms_process_message(uint8_t *message)
 {
-	return spi_buffers[index];
+	size_t data_length;
+	protocol_packet_type_e packet_type;
+	uint8_t *packet_data;
+	protocol_split(message, &data_length, &packet_type, &packet_data);
+	switch ((uint8_t)packet_type) {
+	case PROTOCOL_PACKET_TYPE_EMPTY: {
+		LOG_DEBUG(SPI, "TX done?");
+		spi_buffer_release(message);
+		break;
+	}
+	case PROTOCOL_PACKET_TYPE_TO_GDB: {
+		//
+		// GDB data is never dropped while a client is connected, it is parked if the server is behind
+		//
+		spi_comms_route_to_server(&gdb_server_params, message, PROTOCOL_PACKET_TYPE_TO_CLIENT, &gdb_overflow);
+		break;
+	}
+
+	case LINK_PACKET_TYPE_GDB_MEMORY_DATA: {
+		//
+		// Memory read with LINK_CAP_BINARY_MEMORY, the GDB server sends it as hex
+		//
+		spi_comms_route_to_server(&gdb_server_params, message, SERVER_PACKET_TYPE_TO_CLIENT_HEX, &gdb_overflow);
+		break;
+	}
+
+	case SERVER_PACKET_TYPE_TO_UART: {
+		//
+		// The bridge streams must not stall the GDB traffic, drop data the client cannot keep up with
+		//
+		spi_comms_route_to_server(&uart_server_params, message, PROTOCOL_PACKET_TYPE_TO_CLIENT, NULL);
+		break;
+	}
+
+	case SERVER_PACKET_TYPE_TO_SWO: {
+		//
+		// SWO data is copied to the stream ring, the buffer goes straight back to the pool
+		//
+		size_t swo_length;
+		protocol_packet_type_e swo_type;
+		uint8_t *swo_data;
+		protocol_split(message, &swo_length, &swo_type, &swo_data);
+		swo_stream_write(swo_data, swo_length);
+		spi_buffer_release(message);
+		break;
+	}
+
+	case PROTOCOL_PACKET_TYPE_SET_NETWORK_INFO: {
+		//
+		// Send the packet to the Wi-Fi task
+		//
+		spi_buffer_tag(message, SPI_BUFFER_OWNER_WIFI, SPI_BUFFER_STATE_QUEUED);
+		xQueueSend(wifi_comms_queue, &message, portMAX_DELAY); // Send the message to the Wi-Fi task
+		break;
+	}
+	//
+	// The following cases fall-through to common code
+	// to send the received message to ctxLink
+	//
+	case PROTOCOL_PACKET_TYPE_NETWORK_INFO:
+	case PROTOCOL_PACKET_TYPE_FROM_GDB:
+	case LINK_PACKET_TYPE_GDB_INTERRUPT:
+	case LINK_PACKET_TYPE_GDB_MEMORY_WRITE:
+	case SERVER_PACKET_TYPE_FROM_UART:
+	case SERVER_PACKET_TYPE_FROM_SWO:
+	case PROTOCOL_PACKET_TYPE_STATUS:
+	case LINK_PACKET_TYPE_CONTROL_TO_CTXLINK: {
+		spi_buffer_tag(message, SPI_BUFFER_OWNER_SPI_COMMS, SPI_BUFFER_STATE_QUEUED);
+		xQueueSend(spi_comms_output_queue, &message, 0); // Queue the packet for the batching stage
+		spi_comms_service_tx();
+		TOGGLE_PIN(PINB);
+		break;
+	}
+
+	case LINK_PACKET_TYPE_FRAGMENT_FROM_CTXLINK: {
+		//
+		// Route the packet once all of its fragments have arrived
+		//
+		uint8_t *reassembled = link_segment_rx_fragment(message);
+		if (reassembled != NULL) {
+			spi_comms_process_message(reassembled);
+		}
+		break;
+	}
+
+	case LINK_PACKET_TYPE_CONTROL_FROM_CTXLINK: {
+		link_control_process(packet_data, data_length);
+		spi_buffer_release(message);
+		spi_comms_service_tx(); // Credit may have been returned
+		break;
+	}
+
+	case PROTOCOL_TRANSACTION_COMPLETED: {
+		LOG_DEBUG(SPI, "Transaction completed");
+		//
+		// Check if there are transactions queued for sending to ctxLink
+		//
+		spi_comms_service_tx();
+		spi_buffer_release(message);
+		break;
+	}
+	default: {
+		LOG_WARN(SPI, "Unknown packet type -> %d", packet_type);
+		spi_buffer_release(message);
+		break;
+	}
+	}
 }
 
 /**
@@ -127,74 +556,33 @@ void task_spi_comms(void *pvParameters)
 	// TODO is this a good place for this?
 	//
 	system_setup_done = true;
+	//
+	// Offer the optional link features before any other traffic. The offer is
+	// only repeated when ctxLink reports a restart, see LINK_CONTROL_RESET.
+	//
+	link_control_send_hello();
+	TickType_t last_stats_report = xTaskGetTickCount();
 
 	while (true) {
-		// Wait for a message from the other tasks or spi driver
-		xQueueReceive(spi_comms_input_queue, &message, portMAX_DELAY);
-		//
-		// Process the message
-		//
-		size_t data_length;
-		size_t packet_size;
-		protocol_packet_type_e packet_type;
-		uint8_t *packet_data;
-		packet_size = protocol_split(message, &data_length, &packet_type, &packet_data);
-		switch (packet_type) {
-		case PROTOCOL_PACKET_TYPE_EMPTY: {
-			MON_NL("TX done?");
-			break;
-		}
-		case PROTOCOL_PACKET_TYPE_TO_GDB: {
-			//
-			// Send the packet to the server task
-			//
-			//
-			// Change the message type so that the server routes it correctly.
-			//
-			// The server parameters ensure the message is routed to the right
-			// server task.
-			//
-			*(message + PACKET_HEADER_SOURCE_ID) = PROTOCOL_PACKET_TYPE_TO_CLIENT;
-			//
-			// TODO Need to check if there is a client attached to GDB server
-			//
-
-			xQueueSend(
-				gdb_server_params.server_queue, &message, portMAX_DELAY); // Send the message to the gdb server task
-			break;
-		}
-
-		case PROTOCOL_PACKET_TYPE_SET_NETWORK_INFO: {
-			//
-			// Send the packet to the Wi-Fi task
-			//
-			xQueueSend(wifi_comms_queue, &message, portMAX_DELAY); // Send the message to the Wi-Fi task
-			break;
-		}
 		//
-		// The following cases fall-through to common code
-		// to send the received message to ctxLink
+		// Report the statistics periodically, even while the link is busy
 		//
-		case PROTOCOL_PACKET_TYPE_NETWORK_INFO:
-		case PROTOCOL_PACKET_TYPE_FROM_GDB:
-		case PROTOCOL_PACKET_TYPE_STATUS: {
-			spi_save_tx_transaction_buffer(message); // Save the transaction buffer for SPI driver
-			TOGGLE_PIN(PINB);
-			break;
-		}
-
-		case PROTOCOL_TRANSACTION_COMPLETED: {
-			MON_NL("Transaction completed");
-			//
-			// Check if there are transactions queued for sending to ctxLink
-			//
-			spi_save_tx_transaction_buffer(NULL); // NULL means no new data.
-			break;
-		}
-		default: {
-			MON_PRINTF("Unknown packet type -> %d", packet_type);
-			break;
+		if (xTaskGetTickCount() - last_stats_report >= spi_comms_stats_period) {
+			last_stats_report = xTaskGetTickCount();
+			spi_comms_report_statistics();
 		}
+		//
+		// Wait for a message from the other tasks or spi driver. While a segmented
+		// packet waits for a free buffer, or GDB packets for room in the server
+		// queue, retry every tick.
+		//
+		spi_comms_overflow_drain(&gdb_overflow);
+		TickType_t wait_ticks = (link_segment_tx_pending() || gdb_overflow.count != 0) ? 1 : spi_comms_stats_period;
+		if (xQueueReceive(spi_comms_input_queue, &message, wait_ticks) != pdTRUE) {
+			spi_comms_service_tx();
+			continue;
 		}
+		spi_buffer_tag(message, SPI_BUFFER_OWNER_SPI_COMMS, SPI_BUFFER_STATE_FILLING);
+		spi_comms_process_message(message);
 	}
 }
\ No newline at end of file
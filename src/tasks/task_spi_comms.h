@@ -16,11 +16,29 @@
 
 #include <Arduino.h>
 
+#include "spi_buffer_pool.h"
+
 extern QueueHandle_t spi_comms_input_queue;
 extern QueueHandle_t spi_comms_output_queue;
 
-#define SPI_BUFFER_SIZE 2048
+/**
+ * @brief Number of buckets in the packets-per-frame histogram
+ *
+ * Bucket n counts frames carrying up to 2^n packets, the last bucket counts the rest.
+ */
+#define SPI_COMMS_BATCH_HISTOGRAM_SIZE 5
+
+/**
+ * @brief Packets-per-frame statistics for frames sent to ctxLink
+ *
+ */
+typedef struct {
+	uint32_t frames;                                     // Frames sent
+	uint32_t packets;                                    // Packets carried by those frames
+	uint32_t max_packets_per_frame;                      // Most packets seen in one frame
+	uint32_t histogram[SPI_COMMS_BATCH_HISTOGRAM_SIZE]; // 1, 2, 3-4, 5-8, 9+ packets per frame
+} spi_comms_batch_stats_t;
 
 void task_spi_comms(void *pvParameters);
-uint8_t *get_next_spi_buffer(void);
+void spi_comms_get_batch_stats(spi_comms_batch_stats_t *stats);
 #endif // TASK_SPI_COMMS_H
\ No newline at end of file
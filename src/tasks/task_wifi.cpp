@@ -17,8 +17,12 @@
 #include "protocol.h"
 
 #include "task_spi_comms.h"
+#include "spi_buffer_pool.h"
 #include "task_wifi.h"
 #include "tasks/task_server.h"
+#include "log_stream.h"
+#include "packet_trace.h"
+#include "swo_stream.h"
 
 #include "ctxlink.h"
 
@@ -53,27 +57,79 @@ static network_connection_info_s network_info;
 constexpr uint32_t wifi_comms_queue_length = 4;
 
 /**
- * @brief Instantiate the GDB server parameters
+ * @brief Instantiate the server parameters
  *
- * These are passed to a server instance and also used by the SPI
+ * These are passed to the network task and also used by the SPI
  * task to endure messages are routed correctly
  *
  */
+static rsp_framer_t gdb_rsp_framer;
 server_task_params_t gdb_server_params = {
 	PROTOCOL_PACKET_STATUS_TYPE_GDB_CLIENT,
 	"GDB",
 	GDB_SERVER_PORT,
 	0,
 	NULL, // Server queue
-	NULL, // Server task handle
 	PROTOCOL_PACKET_TYPE_FROM_GDB,
+	false,           // Client connected
+	&gdb_rsp_framer, // Whole RSP packets to ctxLink
+};
+
+server_task_params_t uart_server_params = {
+	(protocol_packet_status_type_e)SERVER_STATUS_TYPE_UART_CLIENT,
+	"UART",
+	UART_SERVER_PORT,
+	0,
+	NULL, // Server queue
+	(protocol_packet_type_e)SERVER_PACKET_TYPE_FROM_UART,
+	false, // Client connected
+	NULL,  // No RSP framing
+};
+
+server_task_params_t swo_server_params = {
+	(protocol_packet_status_type_e)SERVER_STATUS_TYPE_SWO_CLIENT,
+	"SWO",
+	SWO_SERVER_PORT,
+	0,
+	NULL, // Server queue
+	(protocol_packet_type_e)SERVER_PACKET_TYPE_FROM_SWO,
+	false,              // Client connected
+	NULL,               // No RSP framing
+	&swo_stream_server, // SWO data from the SWO stream
+};
+
+server_task_params_t log_server_params = {
+	(protocol_packet_status_type_e)SERVER_STATUS_TYPE_LOG_CLIENT,
+	"Log",
+	LOG_SERVER_PORT,
+	0,
+	NULL,                      // Server queue
+	(protocol_packet_type_e)0, // The client input stays on the ESP32
+	false,                     // Client connected
+	NULL,                      // No RSP framing
+	&log_stream_server,        // Monitor output from the log stream
+};
+
+server_task_params_t trace_server_params = {
+	(protocol_packet_status_type_e)SERVER_STATUS_TYPE_TRACE_CLIENT,
+	"Trace",
+	TRACE_SERVER_PORT,
+	0,
+	NULL,                      // Server queue
+	(protocol_packet_type_e)0, // The client input stays on the ESP32
+	false,                     // Client connected
+	NULL,                      // No RSP framing
+	&packet_trace_server,      // The packet trace capture as JSON
 };
 
 /**
- * @brief Handle for the GDB Server task
+ * @brief The servers started once Wi-Fi connects, they all run at the same time in the network task
  *
  */
-TaskHandle_t gdb_task_handle = NULL;
+static server_task_params_t *const wifi_servers[] = {
+	&gdb_server_params, &uart_server_params, &swo_server_params, &log_server_params, &trace_server_params};
+static network_task_params_t wifi_network_params = {wifi_servers, sizeof(wifi_servers) / sizeof(wifi_servers[0])};
+static TaskHandle_t network_task_handle = NULL;
 
 /**
  * @brief The Wi-Fi task message queue
@@ -84,42 +140,63 @@ TaskHandle_t gdb_task_handle = NULL;
 QueueHandle_t wifi_comms_queue;
 
 /**
- * @brief Send a command to the server task to shut down the server
+ * @brief Send a command to every server of the network task, e.g. to shut down the servers
  *
  */
 void wifi_send_server_command(protocol_command_type_e command)
 {
-	if (gdb_task_handle != NULL && server_queue != NULL) {
+	for (server_task_params_t *server : wifi_servers) {
+		if (network_task_handle == NULL || server->server_queue == NULL) {
+			continue;
+		}
 		protocol_packet_command_s cmd_packet = {0};
 		cmd_packet.type = PROTOCOL_PACKET_TYPE_CMD;
 		cmd_packet.command = command;
 
-		uint8_t *message = get_next_spi_buffer();
+		uint8_t *message = spi_buffer_acquire(SPI_BUFFER_OWNER_WIFI, portMAX_DELAY);
 		memcpy(message, &cmd_packet, sizeof(cmd_packet));
 		package_data(message, sizeof(cmd_packet), PROTOCOL_PACKET_TYPE_COMMAND);
-		xQueueSend(server_queue, &message, 0); // Send command packet pointer to GDB server task
+		spi_buffer_tag(message, SPI_BUFFER_OWNER_SERVER, SPI_BUFFER_STATE_QUEUED);
+		if (!server_queue_send(server, message, 0)) { // Send command packet pointer to the network task
+			spi_buffer_release(message);
+		}
+	}
+}
+
+/**
+ * @brief Start the network task, it runs every server
+ *
+ */
+static void wifi_start_servers(void)
+{
+	if (network_task_handle == NULL) {
+		LOG_INFO(WIFI, "Starting Network Task");
+		xTaskCreate(task_network, "Network", 4096, (void *)&wifi_network_params, 5, &network_task_handle);
 	}
 }
 
 void wifi_disconnect(void)
 {
 	if (wifi_tools.is_connected) {
-		MON_NL("Disconnecting Wi-Fi");
+		LOG_INFO(WIFI, "Disconnecting Wi-Fi");
 		WiFi.disconnect();
 		ulTaskNotifyTake(pdTRUE, portMAX_DELAY); // Wait completed disconnect
-		MON_NL("#2");
+		LOG_DEBUG(WIFI, "#2");
 	}
 } // deinitWiFi() end
 
 void wifi_get_net_info(void)
 {
-	uint8_t *message = get_next_spi_buffer();
-	MON_NL("Sending network info");
+	uint8_t *message = spi_buffer_acquire(SPI_BUFFER_OWNER_WIFI, portMAX_DELAY);
+	LOG_DEBUG(WIFI, "Sending network info");
 	memcpy(message, &network_info, sizeof(network_connection_info_s));
 	package_data(message, sizeof(network_connection_info_s), PROTOCOL_PACKET_TYPE_NETWORK_INFO);
 	//
 	// Send to ctxLink via SPI task
-	xQueueSend(spi_comms_input_queue, &message, 0);
+	spi_buffer_tag(message, SPI_BUFFER_OWNER_SPI_COMMS, SPI_BUFFER_STATE_QUEUED);
+	if (xQueueSend(spi_comms_input_queue, &message, 0) != pdTRUE) {
+		spi_buffer_release(message);
+	}
 }
 
 /**
@@ -155,8 +232,8 @@ void task_wifi(void *pvParameters)
 	memset(ssid, 0, MAX_SSID_LENGTH);
 	memset(password, 0, MAX_PASS_PHRASE_LENGTH);
 	size_t settings_count = preferences_get_wifi_parameters(ssid, password);
-	MON_PRINTF("SSID: %s\r\n", (char *)ssid);
-	MON_PRINTF("Passphrase: %s\r\n", (char *)password);
+	LOG_DEBUG(WIFI, "SSID: %s", (char *)ssid);
+	LOG_DEBUG(WIFI, "Passphrase: %s", (char *)password);
 	wifi_startup(ssid, password);
 	//
 	// Task working loop
@@ -176,9 +253,9 @@ void task_wifi(void *pvParameters)
 			// Process the received packet
 			//
 			network_connection_info_s *conn_info = (network_connection_info_s *)packet_data;
-			MON_NL("Network info received");
-			MON_PRINTF("SSID: %s\r\n", conn_info->network_ssid);
-			MON_PRINTF("Passphrase: %s\r\n", conn_info->pass_phrase);
+			LOG_INFO(WIFI, "Network info received");
+			LOG_DEBUG(WIFI, "SSID: %s", conn_info->network_ssid);
+			LOG_DEBUG(WIFI, "Passphrase: %s", conn_info->pass_phrase);
 			//
 			// Check if the Wi-Fi is already connected
 			//
@@ -187,14 +264,14 @@ void task_wifi(void *pvParameters)
 				// Check if the network information has changed
 				//
 				if (strcmp(ssid, conn_info->network_ssid) != 0 || strcmp(password, conn_info->pass_phrase) != 0) {
-					MON_NL("Wi-Fi credentials changed, reconnecting...");
+					LOG_INFO(WIFI, "Wi-Fi credentials changed, reconnecting...");
 					memset(&network_info, 0, sizeof(network_connection_info_s));
 					strncpy(ssid, conn_info->network_ssid, MAX_SSID_LENGTH);
 					strncpy(password, conn_info->pass_phrase, MAX_PASS_PHRASE_LENGTH);
 					wifi_disconnect();
 					wifi_startup(ssid, password);
 				} else {
-					MON_NL("Wi-Fi credentials unchanged");
+					LOG_INFO(WIFI, "Wi-Fi credentials unchanged");
 					wifi_get_net_info();
 				}
 			} else {
@@ -202,6 +279,10 @@ void task_wifi(void *pvParameters)
 				strncpy(password, conn_info->pass_phrase, MAX_PASS_PHRASE_LENGTH);
 				wifi_startup(ssid, password);
 			}
+			//
+			// The network information has been consumed, return the buffer to the pool
+			//
+			spi_buffer_release(message);
 		}
 		if (wifi_tools.is_connected) {
 			//
@@ -211,13 +292,13 @@ void task_wifi(void *pvParameters)
 				wifi_connect_processed = true;
 				wifi_disconnect_processed = false;
 				//
-				MON_NL("Wi-Fi Connected");
+				LOG_INFO(WIFI, "Wi-Fi Connected");
 				//
 				// Update the current network information structure
 				//
 				memset(&network_info, 0, sizeof(network_connection_info_s));
-				MON_PRINTF("Wi-Fi connected to SSID: %s\r\n", ssid);
-				MON_PRINTF("Wi-Fi IP address: %s\r\n", WiFi.localIP().toString().c_str());
+				LOG_INFO(WIFI, "Wi-Fi connected to SSID: %s", ssid);
+				LOG_INFO(WIFI, "Wi-Fi IP address: %s", WiFi.localIP().toString().c_str());
 				strncpy(network_info.network_ssid, ssid, MAX_SSID_LENGTH);
 				network_info.type = PROTOCOL_PACKET_STATUS_TYPE_NETWORK_CLIENT;
 				network_info.connected = 0x01; // 0x01 = connected, 0x00 = disconnected
@@ -233,20 +314,16 @@ void task_wifi(void *pvParameters)
 				network_info.mac_address[5] = (uint8_t)(WiFi.macAddress()[5]);
 				network_info.rssi = (int8_t)(WiFi.RSSI());
 				//
-				uint8_t *message = get_next_spi_buffer();
+				uint8_t *message = spi_buffer_acquire(SPI_BUFFER_OWNER_WIFI, portMAX_DELAY);
 				memcpy(message, &network_info, sizeof(network_connection_info_s));
 				package_data(message, sizeof(network_connection_info_s), PROTOCOL_PACKET_TYPE_NETWORK_INFO);
 				//
-				// Start the GDB server task.
+				// Start the network task that serves the GDB, UART, SWO, log and trace servers.
 				//
-				if (gdb_task_handle == NULL) {
-					//
-					// Start the GDB Server Task
-					//
-					MON_NL("Starting GDB Server Task");
-					xTaskCreate(task_wifi_server, "GDB Server", 4096, (void *)&gdb_server_params, 1, &gdb_task_handle);
+				if (network_task_handle == NULL) {
+					wifi_start_servers();
 				} else {
-					MON_NL("Restart GDB Server");
+					LOG_INFO(WIFI, "Restart Servers");
 					wifi_send_server_command(PROTOCOL_PACKET_TYPE_CMD_START_GDB_SERVER);
 				}
 				//
@@ -257,8 +334,11 @@ void task_wifi(void *pvParameters)
 				//
 				control_esp32_ready(true);
 				vTaskDelay(pdMS_TO_TICKS(1000));
-				xQueueSend(spi_comms_input_queue, &message,
-					0); // Send network information to SPI task
+				spi_buffer_tag(message, SPI_BUFFER_OWNER_SPI_COMMS, SPI_BUFFER_STATE_QUEUED);
+				if (xQueueSend(spi_comms_input_queue, &message,
+						0) != pdTRUE) { // Send network information to SPI task
+					spi_buffer_release(message);
+				}
 			}
 		} else {
 			wifi_tools.reconnect();
@@ -270,7 +350,7 @@ void task_wifi(void *pvParameters)
 				wifi_disconnect_processed = true;
 				wifi_connect_processed = false;
 				//
-				MON_NL("Wi-Fi Disconnected");
+				LOG_INFO(WIFI, "Wi-Fi Disconnected");
 				wifi_send_server_command(PROTOCOL_PACKET_TYPE_CMD_SHUTDOWN_GDB_SERVER);
 			}
 		}
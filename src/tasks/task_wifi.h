@@ -16,6 +16,10 @@
 
 void task_wifi(void *pvParameters);
 extern server_task_params_t gdb_server_params;
+extern server_task_params_t uart_server_params;
+extern server_task_params_t swo_server_params;
+extern server_task_params_t log_server_params;
+extern server_task_params_t trace_server_params;
 extern QueueHandle_t wifi_comms_queue;
 extern TaskHandle_t wifi_task_handle;
 #endif
\ No newline at end of file